@@ -4,29 +4,29 @@
 #include <vector>
 #include <string>
 
-// CSVf[^o֐
+// CSVデータを書き出す関数
 void writeCSV(const std::string& filename, const std::vector<std::vector<std::string>>& data) {
-    // t@CJ
+    // ファイルを開く
     std::ofstream outputFile(filename);
 
-    // t@CJmF
+    // ファイルが正しく開けたか確認
     if (!outputFile.is_open()) {
-        std::cerr << "t@CJƂł܂ł: " << filename << std::endl;
+        std::cerr << "ファイルを開くことができませんでした: " << filename << std::endl;
         return;
     }
 
-    // f[^CSV`ŏ
+    // データをCSV形式で書き込む
     for (const auto& row : data) {
         for (size_t i = 0; i < row.size(); ++i) {
             outputFile << row[i];
-            // Ō̗vfłȂꍇ̓J}ǉ
+            // 最後の要素でない場合はカンマを追加
             if (i < row.size() - 1) {
                 outputFile << ",";
             }
         }
-        outputFile << "\n"; // s
+        outputFile << "\n"; // 改行
     }
 
-    // t@C
+    // ファイルを閉じる
     outputFile.close();
 }
@@ -4,129 +4,267 @@
 #include <string>
 #include "../shapes/MeshObject.h"
 #include "../core/deviceManage.h"
+#include "../profiler.h"
 #include <map>
 
 
 
+// シーン内のメッシュと、結合した頂点配列でのそのメッシュの先頭の番号
+struct FbxMeshEntry {
+	FbxMesh* mesh;
+	int pointOffset;
+	int triangleOffset;
+};
+
+std::vector<FbxMeshEntry> GetMeshList(fbxsdk::FbxScene* scene) {
+	std::vector<FbxMeshEntry> meshes;
+	int pointOffset = 0;
+	int triangleOffset = 0;
+	for (int i = 0; i < scene->GetSrcObjectCount<FbxMesh>(); i++)
+	{
+		FbxMesh* mesh = scene->GetSrcObject<FbxMesh>(i);
+		if (!mesh->GetNode()) continue;
+		meshes.push_back({ mesh, pointOffset, triangleOffset });
+		pointOffset += mesh->GetControlPointsCount();
+		triangleOffset += mesh->GetPolygonCount();
+	}
+	return meshes;
+}
+
+// 頂点の変換行列（ボーンの行列を重みで足したものなど）の逆転置で法線を変換する
+// 逆転置は3x3部分の余因子行列を行列式で割ったものなので、正規化するなら余因子行列を掛けるだけでよい
+// MultNormalizeと同じく行ベクトルに右から掛ける行列なので、i行目がx, y, zの基底の移り先
+vec3 skinNormal(const FbxMatrix& m, const vec3& n)
+{
+	vec3 c0 = vec3(m.Get(0, 0), m.Get(0, 1), m.Get(0, 2));
+	vec3 c1 = vec3(m.Get(1, 0), m.Get(1, 1), m.Get(1, 2));
+	vec3 c2 = vec3(m.Get(2, 0), m.Get(2, 1), m.Get(2, 2));
+	vec3 c12 = cross(c1, c2);
+	vec3 out = n.x() * c12 + n.y() * cross(c2, c0) + n.z() * cross(c0, c1);
+	// 行列式が負（裏返る変換）なら向きを戻す
+	if (dot(c0, c12) < 0.0f) out = -out;
+	float length = out.length();
+	return length > 0.0f ? out / length : n;
+}
+
+// メッシュのノードのグローバル変換とジオメトリの変換（ノードの子に伝わらない変換）を合わせたもの
+// 時刻を省略すると読み込み時の姿勢
+FbxAMatrix GetMeshGlobalTransform(FbxNode* node, FbxTime time = FBXSDK_TIME_INFINITE) {
+	FbxAMatrix geometry(node->GetGeometricTranslation(FbxNode::eSourcePivot),
+		node->GetGeometricRotation(FbxNode::eSourcePivot), node->GetGeometricScaling(FbxNode::eSourcePivot));
+	return node->EvaluateGlobalTransform(time) * geometry;
+}
+
+bool HasSkin(FbxMesh* mesh) {
+	return mesh->GetDeformerCount(fbxsdk::FbxDeformer::EDeformerType::eSkin) > 0;
+}
+
+// マテリアルの拡散反射の色。Lambertでなければ今までの赤
+vec3 GetMaterialColor(FbxSurfaceMaterial* material) {
+	if (material && material->GetClassId().Is(FbxSurfaceLambert::ClassId)) {
+		FbxSurfaceLambert* lambert = (FbxSurfaceLambert*)material;
+		FbxDouble3 diffuse = lambert->Diffuse.Get();
+		double factor = lambert->DiffuseFactor.Get();
+		return vec3(diffuse[0] * factor, diffuse[1] * factor, diffuse[2] * factor);
+	}
+	return vec3(0.65, 0.05, 0.05);
+}
+
+// 全てのメッシュの頂点と三角形を1つの配列にまとめ、三角形ごとにマテリアルの番号を付ける
+// 同じマテリアルを使うメッシュは同じ番号になる
+// 頂点と法線はメッシュごとの読み込み時のグローバル変換（GetMeshGlobalTransform）を掛けて、同じ空間に置く
 bool GetMeshData(fbxsdk::FbxManager* manager, fbxsdk::FbxScene* scene, FBXObject* fbxData) {
-	// Op|Sւ̃Ro[g
+	// 三角ポリゴンへのコンバート
 	FbxGeometryConverter geometryConverter(manager);
 	if (!geometryConverter.Triangulate(scene, true))
 	{
-		printf("غݎ擾s\n");
+		printf("ﾎﾟﾘｺﾞﾝ取得失敗\n");
 		return false;
 	}
-	// bV擾
-	auto mesh = scene->GetSrcObject<FbxMesh>();
-	if (!mesh)
+	// メッシュ取得
+	std::vector<FbxMeshEntry> meshes = GetMeshList(scene);
+	if (meshes.empty())
 	{
-		printf("bV擾s\n");
+		printf("メッシュ取得失敗\n");
 		return false;
 	}
 
-	int nPoints = mesh->GetControlPointsCount();
-	int nTriangles = mesh->GetPolygonCount();
+	int nPoints = meshes.back().pointOffset + meshes.back().mesh->GetControlPointsCount();
+	int nTriangles = meshes.back().triangleOffset + meshes.back().mesh->GetPolygonCount();
 	fbxData->mesh->nPoints = nPoints;
 	fbxData->mesh->nTriangles = nTriangles;
+	fbxData->mesh->nMeshes = (int)meshes.size();
 
-	printf("f[^擾\n");
+	printf("データ数取得完了（メッシュ数%d）\n", (int)meshes.size());
 
 	fbxData->mesh->points = (vec3*)malloc(nPoints * sizeof(vec3));
 	fbxData->mesh->idxVertex = (vec3*)malloc(nTriangles * sizeof(vec3));
 	fbxData->mesh->normals = (vec3*)malloc(nTriangles * sizeof(vec3));
-
-	// _W̃Xg𐶐
-	for (int i = 0; i < nPoints; i++)
+	fbxData->mesh->cornerNormals = (vec3*)malloc(nTriangles * 3 * sizeof(vec3));
+	fbxData->mesh->materialIds = (int*)malloc(nTriangles * sizeof(int));
+	fbxData->mesh->uvs = (vec3*)malloc(nTriangles * 3 * sizeof(vec3));
+
+	std::map<FbxSurfaceMaterial*, int> materialIndex;
+	std::vector<vec3> materialColors;
+	bool hasUV = false;
+	for (const FbxMeshEntry& entry : meshes)
 	{
-		// _WǂݍŐݒ
-		auto point = mesh->GetControlPointAt(i);
+		FbxMesh* mesh = entry.mesh;
+		FbxNode* node = mesh->GetNode();
+		const FbxAMatrix bindTransform = GetMeshGlobalTransform(node);
+		const FbxMatrix bindMatrix(bindTransform);
 
-		vec3 vertex = vec3(point[0], point[1], point[2]);
-		fbxData->mesh->points[i] = vertex;
+		// 頂点座標情報のリストを生成
+		for (int i = 0; i < mesh->GetControlPointsCount(); i++)
+		{
+			// 頂点座標を読み込んで設定
+			auto point = bindTransform.MultT(mesh->GetControlPointAt(i));
+			fbxData->mesh->points[entry.pointOffset + i] = vec3(point[0], point[1], point[2]);
+		}
+
+		// メッシュ内のマテリアルの番号を全体の番号に変換する
+		// 全体の番号は三角形が初めて使ったときに付けるので、使われないマテリアルは登録しない（-1のまま）
+		// マテリアルのないメッシュは既定の色（nullptr）
+		std::vector<FbxSurfaceMaterial*> localMaterials(node->GetMaterialCount());
+		for (int i = 0; i < node->GetMaterialCount(); i++) localMaterials[i] = node->GetMaterial(i);
+		if (localMaterials.empty()) localMaterials.push_back(nullptr);
+		std::vector<int> localToGlobal(localMaterials.size(), -1);
+		FbxGeometryElementMaterial* materialElement = mesh->GetElementMaterial();
+
+		FbxStringList uvSetNames;
+		mesh->GetUVSetNames(uvSetNames);
+		const char* uvSet = uvSetNames.GetCount() > 0 ? uvSetNames[0].Buffer() : nullptr;
+		if (uvSet) hasUV = true;
+
+		// 頂点毎の情報を取得する
+		// 3角形ﾎﾟﾘｺﾞﾝに限定する
+		for (int polIndex = 0; polIndex < mesh->GetPolygonCount(); polIndex++) // ポリゴン毎のループ
+		{
+			int triangle = entry.triangleOffset + polIndex;
+			// インデックス座標
+			int corners[3];
+			for (int k = 0; k < 3; k++) corners[k] = entry.pointOffset + mesh->GetPolygonVertex(polIndex, k);
+			fbxData->mesh->idxVertex[triangle] = vec3(corners[0], corners[1], corners[2]);
+			//法線
+			for (int k = 0; k < 3; k++)
+			{
+				FbxVector4 normalVec4;
+				mesh->GetPolygonVertexNormal(polIndex, k, normalVec4);
+				vec3 normal = skinNormal(bindMatrix, vec3(normalVec4[0], normalVec4[1], normalVec4[2]));
+				if (k == 0) fbxData->mesh->normals[triangle] = normal;
+				fbxData->mesh->cornerNormals[triangle * 3 + k] = normal;
+			}
+			// マテリアル
+			int local = 0;
+			if (materialElement && materialElement->GetMappingMode() == FbxGeometryElement::eByPolygon) {
+				local = materialElement->GetIndexArray().GetAt(polIndex);
+			}
+			else if (materialElement) {
+				local = materialElement->GetIndexArray().GetCount() > 0 ? materialElement->GetIndexArray().GetAt(0) : 0;
+			}
+			if (local < 0 || local >= (int)localToGlobal.size()) local = 0;
+			if (localToGlobal[local] < 0) {
+				FbxSurfaceMaterial* material = localMaterials[local];
+				auto found = materialIndex.find(material);
+				if (found == materialIndex.end()) {
+					found = materialIndex.insert(std::make_pair(material, (int)materialColors.size())).first;
+					materialColors.push_back(GetMaterialColor(material));
+				}
+				localToGlobal[local] = found->second;
+			}
+			fbxData->mesh->materialIds[triangle] = localToGlobal[local];
+			// UV
+			for (int k = 0; k < 3; k++)
+			{
+				FbxVector2 uv(0, 0);
+				bool unmapped;
+				if (uvSet) mesh->GetPolygonVertexUV(polIndex, k, uvSet, uv, unmapped);
+				fbxData->mesh->uvs[triangle * 3 + k] = vec3(uv[0], uv[1], 0);
+			}
+		}
 	}
-	printf("_擾\n");
 
-	// _̏擾
-	// 3p`غ݂Ɍ肷
-	for (int polIndex = 0; polIndex < nTriangles; polIndex++) // |S̃[v
-	{
-		// CfbNXW
-		int one = mesh->GetPolygonVertex(polIndex, 0);
-		int two = mesh->GetPolygonVertex(polIndex, 1);
-		int three = mesh->GetPolygonVertex(polIndex, 2);
-		fbxData->mesh->idxVertex[polIndex] = vec3(one, two, three);
-		//@
-		FbxVector4 normalVec4;
-		mesh->GetPolygonVertexNormal(polIndex, 0, normalVec4);
-		fbxData->mesh->normals[polIndex] = vec3(normalVec4[0], normalVec4[1], normalVec4[2]);
+	// UVがなければ三角形の重心座標をそのまま使う
+	if (!hasUV) {
+		free(fbxData->mesh->uvs);
+		fbxData->mesh->uvs = nullptr;
 	}
-	printf("غݎ擾\n");
+
+	fbxData->mesh->nMaterials = (int)materialColors.size();
+	fbxData->mesh->materialColors = (vec3*)malloc(materialColors.size() * sizeof(vec3));
+	memcpy(fbxData->mesh->materialColors, materialColors.data(), materialColors.size() * sizeof(vec3));
+	printf("ﾎﾟﾘｺﾞﾝ取得完了（マテリアル数%d）\n", fbxData->mesh->nMaterials);
 	return true;
 }
 
+// スキンを持つ全てのメッシュのクラスタ（ボーン）を1つのリストにまとめる
+// 重みの頂点番号は結合した頂点配列での番号にする
 void GetBoneData(fbxsdk::FbxImporter* importer, fbxsdk::FbxScene* scene, FBXObject* fbxData) {
-	auto mesh = scene->GetSrcObject<FbxMesh>();
-	fbxsdk::FbxSkin* pSkin = static_cast<fbxsdk::FbxSkin*>(mesh->GetDeformer(0));
+	std::vector<FbxMeshEntry> meshes = GetMeshList(scene);
 
-	if (mesh->GetDeformer(0)->GetDeformerType() != fbxsdk::FbxDeformer::EDeformerType::eSkin) {
-		printf("ftH[}[̎ނقȂ܂\n");
+	int ClusterCount = 0;
+	for (const FbxMeshEntry& entry : meshes)
+	{
+		if (!HasSkin(entry.mesh)) continue;
+		ClusterCount += ((fbxsdk::FbxSkin*)entry.mesh->GetDeformer(0, fbxsdk::FbxDeformer::EDeformerType::eSkin))->GetClusterCount();
+	}
+	if (ClusterCount == 0) {
+		printf("スキンを持つメッシュがありません\n");
 		return;
 	}
 
-	int ClusterCount = pSkin->GetClusterCount();
-
-	printf("{[%d\n", ClusterCount);
+	printf("ボーン数%d\n", ClusterCount);
 	fbxData->boneCount = ClusterCount;
 	fbxData->boneList = (Bone*)malloc(ClusterCount * sizeof(Bone));
 
-	for (int i = 0; i < ClusterCount; i++)
+	int boneIndex = 0;
+	for (const FbxMeshEntry& entry : meshes)
 	{
-		fbxsdk::FbxCluster* pCluster = pSkin->GetCluster(i);
-		//{[̃ftHg̃O[oW擾
-		FbxNode* node = pCluster->GetLink();
-		fbxsdk::FbxAMatrix amat = node->EvaluateGlobalTransform();
-		vec3 defaultTransform = vec3(amat.GetT()[0], amat.GetT()[1], amat.GetT()[2]);
-		vec3 defaultRotation = vec3(amat.GetR()[0], amat.GetR()[1], amat.GetR()[2]);
-
-		fbxData->boneList[i] = Bone(node->GetName(), defaultTransform, defaultRotation,
-			defaultTransform, defaultRotation, pCluster->GetControlPointIndicesCount());
-		fbxData->boneList[i].weightIndices = (int*)malloc(pCluster->GetControlPointIndicesCount() * sizeof(int));
-		fbxData->boneList[i].weights = (double*)malloc(pCluster->GetControlPointIndicesCount() * sizeof(double));
-
-		for (int weightIndex = 0; weightIndex < pCluster->GetControlPointIndicesCount(); weightIndex++)
+		if (!HasSkin(entry.mesh)) continue;
+		fbxsdk::FbxSkin* pSkin = (fbxsdk::FbxSkin*)entry.mesh->GetDeformer(0, fbxsdk::FbxDeformer::EDeformerType::eSkin);
+		for (int i = 0; i < pSkin->GetClusterCount(); i++, boneIndex++)
 		{
-			fbxData->boneList[i].weightIndices[weightIndex] = pCluster->GetControlPointIndices()[weightIndex];
-			fbxData->boneList[i].weights[weightIndex] = pCluster->GetControlPointWeights()[weightIndex];
+			fbxsdk::FbxCluster* pCluster = pSkin->GetCluster(i);
+			//ボーンのデフォルトのグローバル座標を取得
+			FbxNode* node = pCluster->GetLink();
+			fbxsdk::FbxAMatrix amat = node->EvaluateGlobalTransform();
+			vec3 defaultTransform = vec3(amat.GetT()[0], amat.GetT()[1], amat.GetT()[2]);
+			vec3 defaultRotation = vec3(amat.GetR()[0], amat.GetR()[1], amat.GetR()[2]);
+
+			Bone& bone = fbxData->boneList[boneIndex];
+			bone = Bone(node->GetName(), defaultTransform, defaultRotation,
+				defaultTransform, defaultRotation, pCluster->GetControlPointIndicesCount());
+			bone.weightIndices = (int*)malloc(pCluster->GetControlPointIndicesCount() * sizeof(int));
+			bone.weights = (double*)malloc(pCluster->GetControlPointIndicesCount() * sizeof(double));
+
+			for (int weightIndex = 0; weightIndex < pCluster->GetControlPointIndicesCount(); weightIndex++)
+			{
+				bone.weightIndices[weightIndex] = entry.pointOffset + pCluster->GetControlPointIndices()[weightIndex];
+				bone.weights[weightIndex] = pCluster->GetControlPointWeights()[weightIndex];
+			}
 		}
 	}
 
 }
 
 void GetAnimationData(fbxsdk::FbxImporter* importer, fbxsdk::FbxScene* scene, FBXObject* fbxData, int& endFrame) {
-	//Aj[V擾
+	//アニメーション情報取得
 	int animStackCount = importer->GetAnimStackCount();
 	FbxTakeInfo* pFbxTakeInfo = importer->GetTakeInfo(0);
 	FbxLongLong start = pFbxTakeInfo->mLocalTimeSpan.GetStart().Get();
 	FbxLongLong stop = pFbxTakeInfo->mLocalTimeSpan.GetStop().Get();
 	FbxLongLong oneFrameValue = FbxTime::GetOneFrameValue(FbxTime::eFrames60);
 	int framecount = (stop - start) / oneFrameValue;
-	printf("Aj[V̍vt[%d\n", framecount);
+	printf("アニメーションの合計フレーム数%d\n", framecount);
 	endFrame = framecount - 1;
 
-	auto mesh = scene->GetSrcObject<FbxMesh>();
-	fbxsdk::FbxSkin* pSkin = static_cast<fbxsdk::FbxSkin*>(mesh->GetDeformer(0));
-
-	if (mesh->GetDeformer(0)->GetDeformerType() != fbxsdk::FbxDeformer::EDeformerType::eSkin) {
-		printf("ftH[}[̎ނقȂ܂\n");
-		return;
-	}
-
+	std::vector<FbxMeshEntry> meshes = GetMeshList(scene);
 
 	fbxData->fbxAnimationData->frameCount = framecount;
 	fbxData->fbxAnimationData->animation = (BonePoseData*)malloc(sizeof(BonePoseData) * framecount);
 	for (int frameIndex = 0; frameIndex < framecount; frameIndex++)
 	{
-		//m
+		//メモリ確保
 		BonePoseData pose = BonePoseData();
 		pose.boneCount = fbxData->boneCount;
 		pose.nowTransforom = (vec3*)malloc(sizeof(vec3) * fbxData->boneCount);
@@ -134,7 +272,7 @@ void GetAnimationData(fbxsdk::FbxImporter* importer, fbxsdk::FbxScene* scene, FB
 		pose.clusterDeformation = new FbxMatrix[fbxData->mesh->nPoints];
 		memset(pose.clusterDeformation, 0, sizeof(FbxMatrix) * fbxData->mesh->nPoints);
 
-		//[gm[ḧʒu擾
+		//ルートノードの位置を取得
 		FbxNode* rootNode = scene->GetRootNode();
 		FbxMatrix globalPosition = scene->GetRootNode()->EvaluateGlobalTransform(frameIndex * oneFrameValue);
 		FbxVector4 t0 = rootNode->GetGeometricTranslation(FbxNode::eSourcePivot);
@@ -142,71 +280,88 @@ void GetAnimationData(fbxsdk::FbxImporter* importer, fbxsdk::FbxScene* scene, FB
 		FbxVector4 s0 = rootNode->GetGeometricScaling(FbxNode::eSourcePivot);
 		FbxAMatrix geometryOffset = FbxAMatrix(t0, r0, s0);
 
-		for (int bi = 0; bi < fbxData->boneCount; bi++)
+		int bi = 0;
+		for (const FbxMeshEntry& entry : meshes)
 		{
-			fbxsdk::FbxCluster* pCluster = pSkin->GetCluster(bi);
-			FbxMatrix vertexTransformMatrix;
-			FbxAMatrix referenceGlobalInitPosition;
-			FbxAMatrix clusterGlobalInitPosition;
-			FbxMatrix clusterGlobalCurrentPosition;
-			FbxMatrix clusterRelativeInitPosition;
-			FbxMatrix clusterRelativeCurrentPositionInverse;
-			pCluster->GetTransformMatrix(referenceGlobalInitPosition);
-			referenceGlobalInitPosition *= geometryOffset;
-			pCluster->GetTransformLinkMatrix(clusterGlobalInitPosition);
-			clusterGlobalCurrentPosition = pCluster->GetLink()->EvaluateGlobalTransform(frameIndex * oneFrameValue);
-			clusterRelativeInitPosition = clusterGlobalInitPosition.Inverse() * referenceGlobalInitPosition;
-			clusterRelativeCurrentPositionInverse = globalPosition.Inverse() * clusterGlobalCurrentPosition;
-			vertexTransformMatrix = clusterRelativeCurrentPositionInverse * clusterRelativeInitPosition;
-			// sɊe_̉ex(d)|ĂꂼɉZ
-			for (int cnt = 0; cnt < pCluster->GetControlPointIndicesCount(); cnt++) {
-				int index = pCluster->GetControlPointIndices()[cnt];
-				double weight = pCluster->GetControlPointWeights()[cnt];
-				FbxMatrix influence = vertexTransformMatrix * weight;
-				pose.clusterDeformation[index] += influence;
+			FbxMesh* mesh = entry.mesh;
+			// 頂点は読み込み時のグローバル変換を掛けてあるので、メッシュの空間に戻してから変換する
+			const FbxMatrix bindInverse(GetMeshGlobalTransform(mesh->GetNode()).Inverse());
+			if (!HasSkin(mesh)) {
+				// スキンのないメッシュはノードの変換だけで動かす
+				FbxMatrix meshTransform = globalPosition.Inverse() * FbxMatrix(GetMeshGlobalTransform(mesh->GetNode(), frameIndex * oneFrameValue)) * bindInverse;
+				for (int i = 0; i < mesh->GetControlPointsCount(); i++) pose.clusterDeformation[entry.pointOffset + i] = meshTransform;
+				continue;
 			}
+			fbxsdk::FbxSkin* pSkin = (fbxsdk::FbxSkin*)mesh->GetDeformer(0, fbxsdk::FbxDeformer::EDeformerType::eSkin);
+			for (int ci = 0; ci < pSkin->GetClusterCount(); ci++, bi++)
+			{
+				fbxsdk::FbxCluster* pCluster = pSkin->GetCluster(ci);
+				FbxMatrix vertexTransformMatrix;
+				FbxAMatrix referenceGlobalInitPosition;
+				FbxAMatrix clusterGlobalInitPosition;
+				FbxMatrix clusterGlobalCurrentPosition;
+				FbxMatrix clusterRelativeInitPosition;
+				FbxMatrix clusterRelativeCurrentPositionInverse;
+				pCluster->GetTransformMatrix(referenceGlobalInitPosition);
+				referenceGlobalInitPosition *= geometryOffset;
+				pCluster->GetTransformLinkMatrix(clusterGlobalInitPosition);
+				clusterGlobalCurrentPosition = pCluster->GetLink()->EvaluateGlobalTransform(frameIndex * oneFrameValue);
+				clusterRelativeInitPosition = clusterGlobalInitPosition.Inverse() * referenceGlobalInitPosition;
+				clusterRelativeCurrentPositionInverse = globalPosition.Inverse() * clusterGlobalCurrentPosition;
+				vertexTransformMatrix = clusterRelativeCurrentPositionInverse * clusterRelativeInitPosition * bindInverse;
+				// 行列に各頂点毎の影響度(重み)を掛けてそれぞれに加算
+				for (int cnt = 0; cnt < pCluster->GetControlPointIndicesCount(); cnt++) {
+					int index = entry.pointOffset + pCluster->GetControlPointIndices()[cnt];
+					double weight = pCluster->GetControlPointWeights()[cnt];
+					FbxMatrix influence = vertexTransformMatrix * weight;
+					pose.clusterDeformation[index] += influence;
+				}
+
+				//BoneBVH用のトランスフォーム取得
+				FbxNode* node = pCluster->GetLink();
+				fbxsdk::FbxAMatrix amat = node->EvaluateGlobalTransform(frameIndex * oneFrameValue);
+				pose.nowTransforom[bi] = vec3(amat.GetT()[0],amat.GetT()[1],amat.GetT()[2]);
+				pose.nowRatation[bi] = vec3(amat.GetR()[0], amat.GetR()[1], amat.GetR()[2]);
 
-			//BoneBVHp̃gXtH[擾
-			FbxNode* node = pCluster->GetLink();
-			fbxsdk::FbxAMatrix amat = node->EvaluateGlobalTransform(frameIndex * oneFrameValue);
-			pose.nowTransforom[bi] = vec3(amat.GetT()[0],amat.GetT()[1],amat.GetT()[2]);
-			pose.nowRatation[bi] = vec3(amat.GetR()[0], amat.GetR()[1], amat.GetR()[2]);
-
+			}
 		}
 
 		fbxData->fbxAnimationData->animation[frameIndex] = pose;
 
 
 
-		printf("%dt[ړǂݍ݊\n", frameIndex);
+		printf("%dフレーム目読み込み完了\n", frameIndex);
 	}
 }
 
 bool CreateFBXData(const std::string& filePath, FBXObject* fbxData, int& endFrame)
 {
+	PROFILE_SCOPE("load");
 	auto manager = FbxManager::Create();
 
-	// C|[^[
+	// インポーター初期化
 	auto importer = FbxImporter::Create(manager, "");
 	if (!importer->Initialize(filePath.c_str(), -1, manager->GetIOSettings()))
 	{
-		printf("C|[^[s\n");
+		printf("インポーター初期化失敗\n");
+		manager->Destroy();
 		return false;
 	}
 
-	// V[쐬
+	// シーン作成
 	auto scene = FbxScene::Create(manager, "");
 	importer->Import(scene);
 
 	if (!GetMeshData(manager, scene, fbxData)) {
-		printf("bV̎擾Ɏs\n");
+		printf("メッシュ情報の取得に失敗\n");
+		manager->Destroy();
 		return false;
 	}
 
 	GetBoneData(importer, scene, fbxData);
 	GetAnimationData(importer, scene, fbxData, endFrame);
 
-	// }l[W[AV[̔j
+	// マネージャー、シーンの破棄
 	importer->Destroy();
 	scene->Destroy();
 	manager->Destroy();
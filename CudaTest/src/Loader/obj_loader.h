@@ -175,7 +175,7 @@ int BuildObjMesh(Hitable** world, Hitable** obj_list, Camera** camera, curandSta
     checkCudaErrors(cudaGetLastError());
     checkCudaErrors(cudaDeviceSynchronize());
 
-    printf("V[쐬\n");
+    printf("シーン作成完了\n");
 
     return obj_cnt;
 }*/
\ No newline at end of file
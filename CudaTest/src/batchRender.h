@@ -0,0 +1,307 @@
+#pragma once
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "core/render.h"
+
+// ジョブファイルの1ジョブ分の設定
+// 省略した項目は最初の[job]より前に書いた値、それもなければ以下の既定値になる
+struct RenderJob {
+    std::string name = "job";
+    std::string scene = "./objects/low_walking.fbx";
+    AccelType accel = ACCEL_BVH;
+    ShadeMode shadeMode = SHADE_LAMBERT;
+    int nx = 1024;
+    int ny = 512;
+    int samples = 4;
+    int max_depth = 8;
+    int beginFrame = 0;
+    int endFrame = -1;  //-1ならアニメーションの最後まで
+    int rotationBudget = 0;  //bvhのリフィットで1フレームに木を回転する最大回数
+    float shutter = 0;  //正なら次のフレームまでのこの割合の間の動きでぼかす（モーションブラー）
+    vec3 lookfrom = vec3(0, 100, 1000);
+    vec3 lookat = vec3(0, 150, 0);
+    float vfov = 40;
+    float aperture = 0;
+    float focus_dist = 10;
+    std::string imagePath = "images/moveTest/picture_";
+};
+
+const char* AccelName(AccelType accel)
+{
+    switch (accel) {
+    case ACCEL_LIST: return "list";
+    case ACCEL_BVH: return "bvh";
+    case ACCEL_BONEBVH: return "bonebvh";
+    }
+    return "";
+}
+
+const char* ShadeName(ShadeMode mode)
+{
+    switch (mode) {
+    case SHADE_LAMBERT: return "lambert";
+    case SHADE_PATH: return "path";
+    case SHADE_NORMAL: return "normal";
+    case SHADE_AO: return "ao";
+    }
+    return "";
+}
+
+bool SetJobValue(RenderJob& job, const std::string& key, const std::string& value)
+{
+    std::istringstream in(value);
+    if (key == "name") job.name = value;
+    else if (key == "scene") job.scene = value;
+    else if (key == "output") job.imagePath = value;
+    else if (key == "width") in >> job.nx;
+    else if (key == "height") in >> job.ny;
+    else if (key == "spp") in >> job.samples;
+    else if (key == "max_depth") in >> job.max_depth;
+    else if (key == "begin_frame") in >> job.beginFrame;
+    else if (key == "end_frame") in >> job.endFrame;
+    else if (key == "rotation_budget") in >> job.rotationBudget;
+    else if (key == "shutter") in >> job.shutter;
+    else if (key == "camera_from") in >> job.lookfrom;
+    else if (key == "camera_at") in >> job.lookat;
+    else if (key == "vfov") in >> job.vfov;
+    else if (key == "aperture") in >> job.aperture;
+    else if (key == "focus_dist") in >> job.focus_dist;
+    else if (key == "accel") {
+        if (value == "list") job.accel = ACCEL_LIST;
+        else if (value == "bvh") job.accel = ACCEL_BVH;
+        else if (value == "bonebvh") job.accel = ACCEL_BONEBVH;
+        else return false;
+    }
+    else if (key == "shade") {
+        if (value == "lambert") job.shadeMode = SHADE_LAMBERT;
+        else if (value == "path") job.shadeMode = SHADE_PATH;
+        else if (value == "normal") job.shadeMode = SHADE_NORMAL;
+        else if (value == "ao") job.shadeMode = SHADE_AO;
+        else return false;
+    }
+    else return false;
+    return !in.fail();
+}
+
+// ジョブファイルを読み込む
+// "key = value" の行で設定し、"[job]" の行ごとに新しいジョブを始める。"#" 以降はコメント
+// csv（全ジョブの計測結果の出力先）は最初の[job]より前に書く
+bool ParseJobFile(const std::string& filename, std::vector<RenderJob>& jobs, std::string& csvPath)
+{
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "ジョブファイルを開けません: " << filename << std::endl;
+        return false;
+    }
+
+    RenderJob defaults;
+    RenderJob* current = &defaults;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+        line.erase(0, line.find_first_not_of(" \t\r"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty()) continue;
+
+        if (line == "[job]") {
+            jobs.push_back(defaults);
+            jobs.back().name = "job" + std::to_string(jobs.size() - 1);
+            current = &jobs.back();
+            continue;
+        }
+
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            printf("%s:%d: 無効な行です\n", filename.c_str(), lineNumber);
+            return false;
+        }
+        std::string key = line.substr(0, eq);
+        std::string value = line.substr(eq + 1);
+        key.erase(key.find_last_not_of(" \t") + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+
+        if (key == "csv") {
+            csvPath = value;
+        }
+        else if (!SetJobValue(*current, key, value)) {
+            printf("%s:%d: 無効な設定です: %s\n", filename.c_str(), lineNumber, line.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// 1プロセスで複数のジョブを順に実行する
+// 読み込んだシーン、構築したBVH、乱数、画素などのバッファはジョブをまたいで使い回す
+class BatchRenderer {
+public:
+    BatchRenderer(dim3 threadsPerBlock) : threads(threadsPerBlock)
+    {
+        checkCudaErrors(cudaMallocManaged((void**)&camera, sizeof(Camera*)));
+        init_camera(camera, 1024, 512, &resources);
+    }
+    BatchRenderer(const BatchRenderer&) = delete;
+    BatchRenderer& operator=(const BatchRenderer&) = delete;
+    ~BatchRenderer()
+    {
+        resources.freeMemory();
+        for (auto& scene : scenes)
+        {
+            delete scene.second.skinningBuffers;
+            delete scene.second.fbxData;
+        }
+    }
+
+    // ジョブを実行し、フレームごとの計測結果をdataに追加する
+    // シーンを読み込めなければstatusがload_failedの行を1つだけ追加し、falseを返す（次のジョブはそのまま続けられる）
+    bool RunJob(const RenderJob& job, std::vector<std::vector<std::string>>& data)
+    {
+        printf("job %s: %s %s %dx%d spp=%d\n", job.name.c_str(), job.scene.c_str(), AccelName(job.accel), job.nx, job.ny, job.samples);
+        dim3 blocks(job.nx / threads.x + 1, job.ny / threads.y + 1);
+        SetCurandState(job.nx, job.ny, blocks);
+
+        SceneCache* loaded = GetScene(job.scene);
+        if (!loaded) {
+            printf("job %s: シーンを読み込めないので飛ばします\n", job.name.c_str());
+            data.push_back({ job.name, job.scene, AccelName(job.accel), ShadeName(job.shadeMode), std::to_string(job.nx), std::to_string(job.ny),
+                std::to_string(job.samples), std::to_string(job.max_depth), "", "", "", "", "load_failed" });
+            return false;
+        }
+        SceneCache& scene = *loaded;
+        double buildTime = 0.0;
+        Hitable** world = GetWorld(scene, job.accel, buildTime);
+
+        SetShadeMode(job.shadeMode);
+        set_camera(camera, job.nx, job.ny, job.lookfrom, job.lookat, job.focus_dist, job.aperture, job.vfov);
+
+        int endFrame = job.endFrame < 0 || job.endFrame > scene.lastFrame ? scene.lastFrame : job.endFrame;
+        std::vector<std::vector<std::string>> frames;
+        renderAnimation(job.accel, job.nx, job.ny, job.samples, job.max_depth, job.beginFrame, endFrame,
+            world, camera, scene.fbxData, blocks, threads, curandStates.get(),
+            &frameBuffers, scene.skinningBuffers, job.imagePath, frames, job.rotationBudget, job.shutter);
+
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            // frames[i]は frame, rendering, update, build
+            data.push_back({ job.name, job.scene, AccelName(job.accel), ShadeName(job.shadeMode), std::to_string(job.nx), std::to_string(job.ny),
+                std::to_string(job.samples), std::to_string(job.max_depth),
+                frames[i][0], frames[i][1], frames[i][2], i == 0 ? std::to_string(buildTime) : "", "ok" });
+        }
+        return true;
+    }
+
+    static std::vector<std::string> CSVHeader()
+    {
+        return { "job", "scene", "accel", "shade", "width", "height", "spp", "max_depth", "frame", "rendering", "update", "build", "status" };
+    }
+
+private:
+    struct SceneCache {
+        FBXObject* fbxData;
+        HitableList** meshList;
+        BVHNode** bvh;
+        HitableList** boneBVH;
+        SkinningBuffers* skinningBuffers;
+        int lastFrame;
+    };
+
+    // 必要な画素数より少なければ乱数を確保し直す
+    void SetCurandState(int nx, int ny, dim3 blocks)
+    {
+        if (curandStates.size() >= (size_t)nx * ny) return;
+        curandStates.Allocate(nx * ny);
+        random_init << <blocks, threads >> > (nx, ny, curandStates.get());
+        checkCudaErrors(cudaGetLastError());
+        checkCudaErrors(cudaDeviceSynchronize());
+    }
+
+    // 読み込めなければnullptr（失敗したシーンは覚えておき、同じパスのジョブでは読み直さない）
+    SceneCache* GetScene(const std::string& path)
+    {
+        auto found = scenes.find(path);
+        if (found != scenes.end()) return &found->second;
+        if (failedScenes.count(path)) return nullptr;
+
+        SceneCache scene;
+        scene.fbxData = new FBXObject();
+        if (!CreateFBXData(path, scene.fbxData, scene.lastFrame)) {
+            printf("シーンの読み込みに失敗: %s\n", path.c_str());
+            delete scene.fbxData;
+            failedScenes.insert(path);
+            return nullptr;
+        }
+        checkCudaErrors(cudaMallocManaged((void**)&scene.meshList, sizeof(HitableList*)));
+        init_MeshList(scene.meshList, &resources);
+        create_FBXMesh(scene.meshList, scene.fbxData);
+        scene.bvh = nullptr;
+        scene.boneBVH = nullptr;
+        scene.skinningBuffers = new SkinningBuffers(scene.fbxData);
+        printf("シーン作成完了\n");
+        return &scenes.emplace(path, scene).first->second;
+    }
+
+    // 加速構造がなければ読み込み時の姿勢で構築する
+    Hitable** GetWorld(SceneCache& scene, AccelType accel, double& buildTime)
+    {
+        if (accel == ACCEL_LIST) return (Hitable**)scene.meshList;
+
+        if (accel == ACCEL_BVH && scene.bvh == nullptr) {
+            resetFBXObjPose(scene.fbxData, scene.fbxData->d_triangleData.get(), scene.skinningBuffers);
+            checkCudaErrors(cudaMalloc((void**)&scene.bvh, sizeof(BVHNode*)));
+            create_BVHfromList(scene.bvh, scene.meshList, curandStates.get(), &resources);
+            buildTime = Profiler::Get().GetLastTime("build");
+            printf("BVH作成完了\n");
+        }
+        if (accel == ACCEL_BONEBVH && scene.boneBVH == nullptr) {
+            resetFBXObjPose(scene.fbxData, scene.fbxData->d_triangleData.get(), scene.skinningBuffers);
+            checkCudaErrors(cudaMalloc((void**)&scene.boneBVH, sizeof(HitableList*)));
+            createBoneBVH(scene.boneBVH, scene.fbxData, curandStates.get(), &resources);
+            buildTime = Profiler::Get().GetLastTime("build");
+            printf("BVH作成完了\n");
+        }
+        return accel == ACCEL_BVH ? (Hitable**)scene.bvh : (Hitable**)scene.boneBVH;
+    }
+
+    dim3 threads;
+    ResourceList resources;
+    Camera** camera;
+    DeviceBuffer<curandState> curandStates;
+    FrameBuffers frameBuffers;
+    std::map<std::string, SceneCache> scenes;
+    std::set<std::string> failedScenes;
+};
+
+
+// ジョブファイルの全ジョブを実行し、計測結果を1つのCSVにまとめて書き出す
+int RunJobFile(const std::string& filename)
+{
+    std::vector<RenderJob> jobs;
+    std::string csvPath = "jobs.csv";
+    if (!ParseJobFile(filename, jobs, csvPath)) return 1;
+    printf("%zu個のジョブを実行\n", jobs.size());
+
+    std::vector<std::vector<std::string>> data;
+    data.push_back(BatchRenderer::CSVHeader());
+    {
+        BatchRenderer renderer(dim3(16, 16));
+        for (const RenderJob& job : jobs)
+        {
+            renderer.RunJob(job, data);
+            // 途中で止めても結果が残るようにジョブごとに書き出す
+            writeCSV(csvPath, data);
+        }
+    }
+
+    Profiler::Get().WriteCSV("profile.csv");
+    Profiler::Get().WriteChromeTrace("trace.json");
+    printf("csv書き出し完了\n");
+    return 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+#include <string>
+#include "../core/growableArray.h"
+#include "../Loader/CSVWriter.h"
+#include "../swatch.h"
+
+// 以前のappend()の実装（毎回一時配列に退避して確保し直す）
+// 比較用にそのまま残している
+void LegacyAppend(void**& list, int& list_size, void* data)
+{
+    void** tmp = (void**)malloc(sizeof(void*) * list_size);
+
+    for (int i = 0; i < list_size; i++)
+    {
+        tmp[i] = list[i];
+    }
+
+    free(list);
+
+    list_size++;
+
+    list = (void**)malloc(sizeof(void*) * list_size);
+
+    for (int i = 0; i < list_size - 1; i++)
+    {
+        list[i] = tmp[i];
+    }
+    list[list_size - 1] = data;
+
+    free(tmp);
+}
+
+// 要素数を変えながらappendの時間を計測し、CSVに書き出す
+// 以前の実装はO(n^2)なので、legacyLimitより多い要素数では計測しない
+void RunAppendBenchmark(const std::string& csvPath, int maxCount = 1000000, int legacyLimit = 100000)
+{
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "count", "legacy", "growable" });
+
+    for (int count = 1000; count <= maxCount; count *= 10)
+    {
+        std::string legacyTime = "";
+        if (count <= legacyLimit)
+        {
+            void** list = nullptr;
+            int list_size = 0;
+            sw.Reset();
+            sw.Start();
+            for (int i = 0; i < count; i++)
+            {
+                LegacyAppend(list, list_size, (void*)(size_t)i);
+            }
+            sw.Stop();
+            free(list);
+            legacyTime = std::to_string(sw.GetTime());
+        }
+
+        GrowableArray<void*> array;
+        sw.Reset();
+        sw.Start();
+        for (int i = 0; i < count; i++)
+        {
+            array.append((void*)(size_t)i);
+        }
+        sw.Stop();
+        array.freeMemory();
+        std::string growableTime = std::to_string(sw.GetTime());
+
+        printf("append %d: legacy %s, growable %s\n", count, legacyTime.c_str(), growableTime.c_str());
+        data.push_back({ std::to_string(count), legacyTime, growableTime });
+    }
+
+    writeCSV(csvPath, data);
+}
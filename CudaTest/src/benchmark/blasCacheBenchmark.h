@@ -0,0 +1,89 @@
+#pragma once
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../createScene.h"
+#include "../flat/flatCrowd.h"
+#include "../Loader/CSVWriter.h"
+#include "../swatch.h"
+
+// phaseCount種類のフレームのずれで歩くinstanceCount体の群衆で、ずれごとに毎フレームスキニングする場合と、
+// フレームごとのメッシュをキャッシュする場合の更新時間・キャッシュのヒット率を比べる
+// キャッシュの予算はメッシュphaseCount個分・クリップの半分のフレーム数分・クリップの全フレーム分
+// クリップを2周して、フレームごとの値と全体のヒット率を記録する
+void RunBLASCacheBenchmark(const std::string& csvPath, const std::string& fbxPath = "./objects/low_walking.fbx",
+    int instanceCount = 1000, int phaseCount = 16)
+{
+    FBXObject fbxData;
+    int endFrame = 0;
+    if (!CreateFBXData(fbxPath, &fbxData, endFrame)) {
+        printf("%s: 読み込み失敗\n", fbxPath.c_str());
+        return;
+    }
+    const MeshData* meshData = fbxData.mesh;
+    const int animationFrames = fbxData.fbxAnimationData->frameCount;
+    if (animationFrames == 0) return;
+    const int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    auto pose = [&](int frame, vec3* points) { calcPose(frame, &fbxData, points); };
+
+    // メッシュ1つ分の大きさ
+    size_t meshBytes;
+    {
+        FlatScene scene;
+        scene.AddTriangleMesh(meshData->points, meshData->idxVertex, meshData->nTriangles, 0);
+        meshBytes = scene.primitives.size() * (sizeof(FlatPrimitive) + sizeof(int)) + scene.nodes.size() * sizeof(FlatBVHNode);
+    }
+
+    vec3 pmin(FLT_MAX), pmax(-FLT_MAX);
+    for (int i = 0; i < meshData->nPoints; i++)
+    {
+        pmin = minVec3(pmin, meshData->points[i]);
+        pmax = maxVec3(pmax, meshData->points[i]);
+    }
+    const float spacing = 1.5f * std::max(pmax.x() - pmin.x(), pmax.z() - pmin.z());
+    const int columns = (int)std::ceil(std::sqrt((double)instanceCount));
+
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "cache_meshes", "budget_bytes", "frame", "update_time", "hits", "misses", "evictions", "cache_bytes" });
+    const int cacheSizes[4] = { 0, phaseCount, animationFrames / 2, animationFrames };
+    for (int cacheSize : cacheSizes)
+    {
+        FlatScene scene;
+        int material = scene.AddMaterial(vec3(0.65, 0.05, 0.05));
+        FlatBLASCache cache(meshBytes * cacheSize);
+        FlatCrowd crowd(meshData->points, meshData->nPoints, meshData->idxVertex, meshData->nTriangles, animationFrames, material,
+            cacheSize > 0 ? &cache : nullptr);
+        for (int i = 0; i < instanceCount; i++)
+        {
+            vec3 position((i % columns) * spacing, 0.0f, (i / columns) * spacing);
+            crowd.AddInstance(scene, Mat34::FromTRS(position, vec3(0.0f, float((i * 37) % 360), 0.0f), vec3(1)),
+                (i % phaseCount) * animationFrames / phaseCount);
+        }
+        cache.BeginFrame();
+        crowd.SetFrame(scene, 0, pose, threadCount);
+        scene.BuildTopLevel();
+
+        double totalTime = 0.0;
+        int totalHits = 0, totalMisses = 0;
+        for (int frame = 1; frame <= 2 * animationFrames; frame++)
+        {
+            cache.ResetStats();
+            cache.BeginFrame();
+            sw.Reset();
+            sw.Start();
+            crowd.SetFrame(scene, frame % animationFrames, pose, threadCount);
+            sw.Stop();
+            totalTime += sw.GetTime();
+            totalHits += cache.hits;
+            totalMisses += cache.misses;
+            data.push_back({ std::to_string(cacheSize), std::to_string(cache.budgetBytes), std::to_string(frame), std::to_string(sw.GetTime()),
+                std::to_string(cache.hits), std::to_string(cache.misses), std::to_string(cache.evictions), std::to_string(cache.bytes) });
+        }
+        const double hitRate = totalHits + totalMisses > 0 ? double(totalHits) / (totalHits + totalMisses) : 0.0;
+        printf("cache %d meshes (%zu bytes): update %.4f s/frame, hit rate %.3f, %zu meshes in scene\n",
+            cacheSize, cache.bytes, totalTime / (2 * animationFrames), hitRate, scene.meshes.size());
+    }
+    writeCSV(csvPath, data);
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <random>
+#include "../core/wideAABB.h"
+#include "../core/deviceResource.h"
+#include "../Loader/CSVWriter.h"
+#include "../swatch.h"
+
+// 以前のAABB::hit（軸ごとに2回割り算し、t_maxがt_min以下になったら打ち切る）
+// 比較用にそのまま残している
+__host__ __device__ inline bool LegacyAABBHit(const AABB& box, const Ray& r, float t_min, float t_max)
+{
+    for (int a = 0; a < 3; a++) {
+        float t0 = ffmin((box._min[a] - r.origin()[a]) / r.direction()[a],
+            (box._max[a] - r.origin()[a]) / r.direction()[a]);
+        float t1 = ffmax((box._min[a] - r.origin()[a]) / r.direction()[a],
+            (box._max[a] - r.origin()[a]) / r.direction()[a]);
+        t_min = ffmax(t0, t_min);
+        t_max = ffmin(t1, t_max);
+        if (t_max <= t_min) return false;
+    }
+    return true;
+}
+
+enum BoxBenchmarkMode { BOX_LEGACY, BOX_INVDIR, BOX_WIDE2, BOX_WIDE4, BOX_WIDE8 };
+
+template<int N>
+__host__ __device__ inline int CountWideBoxHits(const AABBxN<N>* groups, int groupCount, const InvRay& r)
+{
+    int hits = 0;
+    float t_enter[N];
+    for (int g = 0; g < groupCount; g++) {
+        unsigned mask = IntersectAABBxN<N>(groups[g], r, 0.001f, FLT_MAX, t_enter);
+        for (; mask; mask &= mask - 1) hits++;
+    }
+    return hits;
+}
+
+// 1本の光線と全ての箱を判定し、当たった数を返す
+// 箱は同じものをAABBの配列とN個ずつのSoAの配列で持っている
+__host__ __device__ inline int CountBoxHits(const Ray& r, int mode, const AABB* boxes, int boxCount,
+    const AABBxN<2>* boxes2, const AABBxN<4>* boxes4, const AABBxN<8>* boxes8)
+{
+    int hits = 0;
+    const InvRay inv_r(r);
+    switch (mode) {
+    case BOX_LEGACY:
+        for (int i = 0; i < boxCount; i++) hits += LegacyAABBHit(boxes[i], r, 0.001f, FLT_MAX);
+        break;
+    case BOX_INVDIR:
+        for (int i = 0; i < boxCount; i++) hits += boxes[i].hit(inv_r, 0.001f, FLT_MAX);
+        break;
+    case BOX_WIDE2:
+        hits = CountWideBoxHits<2>(boxes2, boxCount / 2, inv_r);
+        break;
+    case BOX_WIDE4:
+        hits = CountWideBoxHits<4>(boxes4, boxCount / 4, inv_r);
+        break;
+    case BOX_WIDE8:
+        hits = CountWideBoxHits<8>(boxes8, boxCount / 8, inv_r);
+        break;
+    }
+    return hits;
+}
+
+__global__ void count_box_hits(const Ray* rays, int rayCount, int mode, const AABB* boxes, int boxCount,
+    const AABBxN<2>* boxes2, const AABBxN<4>* boxes4, const AABBxN<8>* boxes8, int* hitCount)
+{
+    int i = threadIdx.x + blockIdx.x * blockDim.x;
+    if (i >= rayCount) return;
+    atomicAdd(hitCount, CountBoxHits(rays[i], mode, boxes, boxCount, boxes2, boxes4, boxes8));
+}
+
+template<int N>
+std::vector<AABBxN<N>> MakeWideBoxes(const std::vector<AABB>& boxes)
+{
+    std::vector<AABBxN<N>> groups(boxes.size() / N);
+    for (size_t i = 0; i < boxes.size(); i++) groups[i / N].Set(i % N, boxes[i]);
+    return groups;
+}
+
+// 箱の判定の速度（判定回数/秒）を、以前の割り算の判定・方向の逆数を使う判定・2/4/8個まとめた判定で比べる
+// CPUでは4個と8個の判定がSIMDになる
+void RunBoxBenchmark(const std::string& csvPath, int rayCount = 4096, int boxCount = 1024)
+{
+    boxCount = boxCount / 8 * 8;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    std::vector<AABB> boxes(boxCount);
+    for (int i = 0; i < boxCount; i++)
+    {
+        vec3 center(uniform(rng) * 50, uniform(rng) * 50, uniform(rng) * 50);
+        vec3 half(fabsf(uniform(rng)) * 5 + 0.1f, fabsf(uniform(rng)) * 5 + 0.1f, fabsf(uniform(rng)) * 5 + 0.1f);
+        boxes[i] = AABB(center - half, center + half);
+    }
+    std::vector<AABBxN<2>> boxes2 = MakeWideBoxes<2>(boxes);
+    std::vector<AABBxN<4>> boxes4 = MakeWideBoxes<4>(boxes);
+    std::vector<AABBxN<8>> boxes8 = MakeWideBoxes<8>(boxes);
+
+    // 箱の集まりの外から中心付近に向けた光線
+    std::vector<Ray> rays(rayCount);
+    for (int i = 0; i < rayCount; i++)
+    {
+        vec3 org = 100.0f * unit_vector(vec3(uniform(rng), uniform(rng), uniform(rng)));
+        vec3 target(uniform(rng) * 30, uniform(rng) * 30, uniform(rng) * 30);
+        rays[i] = Ray(org, target - org, 0.0f);
+    }
+
+    DeviceBuffer<Ray> d_rays(rayCount);
+    DeviceBuffer<AABB> d_boxes(boxCount);
+    DeviceBuffer<AABBxN<2>> d_boxes2(boxes2.size());
+    DeviceBuffer<AABBxN<4>> d_boxes4(boxes4.size());
+    DeviceBuffer<AABBxN<8>> d_boxes8(boxes8.size());
+    d_rays.Upload(rays.data(), rays.size());
+    d_boxes.Upload(boxes.data(), boxes.size());
+    d_boxes2.Upload(boxes2.data(), boxes2.size());
+    d_boxes4.Upload(boxes4.data(), boxes4.size());
+    d_boxes8.Upload(boxes8.data(), boxes8.size());
+    DeviceBuffer<int> counter(1);
+
+    const char* names[5] = { "legacy", "invdir", "wide2", "wide4", "wide8" };
+    const double tests = (double)rayCount * boxCount;
+    const int blockSize = 128;
+    const int gridSize = (rayCount + blockSize - 1) / blockSize;
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "backend", "method", "tests", "time", "tests_per_sec", "hits" });
+    // 最初の起動の時間が計測に入らないようにする
+    count_box_hits << <gridSize, blockSize >> > (d_rays.get(), rayCount, BOX_INVDIR, d_boxes.get(), boxCount,
+        d_boxes2.get(), d_boxes4.get(), d_boxes8.get(), counter.get());
+    checkCudaErrors(cudaDeviceSynchronize());
+    for (int mode = BOX_LEGACY; mode <= BOX_WIDE8; mode++)
+    {
+        checkCudaErrors(cudaMemset(counter.get(), 0, sizeof(int)));
+        sw.Reset();
+        sw.Start();
+        count_box_hits << <gridSize, blockSize >> > (d_rays.get(), rayCount, mode, d_boxes.get(), boxCount,
+            d_boxes2.get(), d_boxes4.get(), d_boxes8.get(), counter.get());
+        checkCudaErrors(cudaGetLastError());
+        checkCudaErrors(cudaDeviceSynchronize());
+        sw.Stop();
+        int hits;
+        checkCudaErrors(cudaMemcpy(&hits, counter.get(), sizeof(int), cudaMemcpyDeviceToHost));
+        printf("gpu %s: %.1f Mtests/s, hits %d\n", names[mode], tests / sw.GetTime() / 1e6, hits);
+        data.push_back({ "gpu", names[mode], std::to_string((long long)tests), std::to_string(sw.GetTime()),
+            std::to_string(tests / sw.GetTime()), std::to_string(hits) });
+
+        sw.Reset();
+        sw.Start();
+        hits = 0;
+        for (int i = 0; i < rayCount; i++)
+        {
+            hits += CountBoxHits(rays[i], mode, boxes.data(), boxCount, boxes2.data(), boxes4.data(), boxes8.data());
+        }
+        sw.Stop();
+        printf("cpu %s: %.1f Mtests/s, hits %d\n", names[mode], tests / sw.GetTime() / 1e6, hits);
+        data.push_back({ "cpu", names[mode], std::to_string((long long)tests), std::to_string(sw.GetTime()),
+            std::to_string(tests / sw.GetTime()), std::to_string(hits) });
+    }
+    writeCSV(csvPath, data);
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <vector>
+#include "../createScene.h"
+#include "../flat/flatClipBVH.h"
+#include "../Loader/CSVWriter.h"
+#include "flatSceneBenchmark.h"
+#include "wideBVHBenchmark.h"
+#include "../swatch.h"
+
+// クリップの全フレームの姿勢を先に計算し、フレームごとのBVHの更新時間・SAHコスト・描画時間を比べる
+// median/sah: 0フレーム目の姿勢で構築してリフィット
+// clip_refit: 標本のフレームの平均SAHで構築してリフィット、clip_table: 同じ木でノードの箱を表から写す
+void RunClipBVHBenchmark(const std::string& csvPath, const std::string& fbxPath = "./objects/low_walking.fbx",
+    int nx = 1024, int ny = 512, int sampleCount = 8, int repeat = 10)
+{
+    FBXObject fbxData;
+    int endFrame = 0;
+    if (!CreateFBXData(fbxPath, &fbxData, endFrame)) {
+        printf("%s: 読み込み失敗\n", fbxPath.c_str());
+        return;
+    }
+    const MeshData* meshData = fbxData.mesh;
+    const int frameCount = fbxData.fbxAnimationData->frameCount;
+    if (frameCount == 0) return;
+    std::vector<std::vector<vec3>> framePoints(frameCount, std::vector<vec3>(meshData->nPoints));
+    for (int frame = 0; frame < frameCount; frame++)
+    {
+        vec3* newPos = framePoints[frame].data();
+        calcPose(frame, &fbxData, newPos);
+    }
+
+    const int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    const double rays = (double)nx * ny;
+    const dim3 threads(8, 8);
+    const dim3 blocks((nx + threads.x - 1) / threads.x, (ny + threads.y - 1) / threads.y);
+    DeviceBuffer<int> counter(1);
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "method", "frame", "build_time", "table_bytes", "update_time", "sah_cost", "upload_time", "gpu_time", "cpu_time", "hits" });
+
+    const char* names[4] = { "median", "sah", "clip_refit", "clip_table" };
+    for (int method = 0; method < 4; method++)
+    {
+        FlatScene scene;
+        FlatClipBVH clip;
+        int material = scene.AddMaterial(vec3(0.65, 0.05, 0.05));
+        sw.Reset();
+        sw.Start();
+        int mesh;
+        if (method < 2) {
+            scene.splitMode = method == 0 ? FLAT_SPLIT_MEDIAN : FLAT_SPLIT_SAH;
+            mesh = scene.AddTriangleMesh(framePoints[0].data(), meshData->idxVertex, meshData->nTriangles, material);
+        }
+        else {
+            mesh = clip.Build(scene, framePoints, meshData->idxVertex, meshData->nTriangles, material, sampleCount, method == 3);
+        }
+        sw.Stop();
+        const double buildTime = sw.GetTime();
+        scene.AddInstance(mesh);
+        const FlatCamera camera = FrameMeshCamera(scene, mesh, nx, ny);
+        printf("%s %s: build %.3f s, table %zu bytes\n", fbxPath.c_str(), names[method], buildTime, clip.BoundsBytes());
+
+        for (int frame = 0; frame < frameCount; frame++)
+        {
+            sw.Reset();
+            sw.Start();
+            if (method < 3) scene.UpdateTriangleMesh(mesh, framePoints[frame].data(), meshData->idxVertex);
+            else clip.SetFrame(scene, frame, framePoints[frame].data(), meshData->idxVertex);
+            sw.Stop();
+            const double updateTime = sw.GetTime();
+            const float sah = scene.SAHCost(mesh);
+
+            sw.Reset();
+            sw.Start();
+            const FlatSceneView deviceView = scene.Upload();
+            sw.Stop();
+            const double uploadTime = sw.GetTime();
+
+            checkCudaErrors(cudaMemset(counter.get(), 0, sizeof(int)));
+            sw.Reset();
+            sw.Start();
+            for (int i = 0; i < repeat; i++)
+            {
+                trace_primary_flat << <blocks, threads >> > (deviceView, camera, nx, ny, counter.get());
+            }
+            checkCudaErrors(cudaGetLastError());
+            checkCudaErrors(cudaDeviceSynchronize());
+            sw.Stop();
+            const double gpuTime = sw.GetTime() / repeat;
+
+            sw.Reset();
+            sw.Start();
+            int hits = TracePrimaryFlatCPU(scene.HostView(), camera, nx, ny, threadCount);
+            sw.Stop();
+            const double cpuTime = sw.GetTime();
+
+            printf("frame %d %s: update %.4f ms, SAH %.2f, gpu %.2f Mrays/s, cpu %.2f Mrays/s\n", frame, names[method],
+                updateTime * 1e3, sah, rays / gpuTime / 1e6, rays / cpuTime / 1e6);
+            data.push_back({ names[method], std::to_string(frame), frame == 0 ? std::to_string(buildTime) : "",
+                std::to_string(clip.BoundsBytes()), std::to_string(updateTime), std::to_string(sah), std::to_string(uploadTime),
+                std::to_string(gpuTime), std::to_string(cpuTime), std::to_string(hits) });
+        }
+    }
+    writeCSV(csvPath, data);
+}
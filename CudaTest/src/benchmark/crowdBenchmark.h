@@ -0,0 +1,115 @@
+#pragma once
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../createScene.h"
+#include "../flat/flatCrowd.h"
+#include "../Loader/CSVWriter.h"
+#include "flatSceneBenchmark.h"
+#include "../swatch.h"
+
+// 群衆全体が映るように前の上から見るカメラ
+FlatCamera FrameCrowdCamera(const FlatScene& scene, int nx, int ny)
+{
+    const FlatBVHNode& root = scene.topNodes[0];
+    vec3 bmin(root.bmin[0], root.bmin[1], root.bmin[2]);
+    vec3 bmax(root.bmax[0], root.bmax[1], root.bmax[2]);
+    vec3 center = 0.5f * (bmin + bmax);
+    float radius = 0.5f * (bmax - bmin).length();
+    return FlatCamera::LookAt(center + 1.2f * radius * unit_vector(vec3(0.0f, 0.5f, 1.0f)), center,
+        vec3(0, 1, 0), 40, float(nx) / float(ny), 1.0f);
+}
+
+// 同じキャラクターのinstanceCount体の群衆を格子状に並べ、CPUで描画する
+// フレームのずれはphaseCount種類で、ずれごとに1つのメッシュをスキニングしてリフィットする
+// 各フレームの更新時間（スキニング・リフィット・トップレベルのリフィット）と一次光線の時間を記録する
+// 0フレーム目だけ、トップレベルのBVHを使わずにインスタンスを順に調べる場合の時間も記録する
+void RunCrowdBenchmark(const std::string& csvPath, const std::string& fbxPath = "./objects/low_walking.fbx",
+    int instanceCount = 1000, int phaseCount = 16, int nx = 1024, int ny = 512, int frameCount = 30)
+{
+    FBXObject fbxData;
+    int endFrame = 0;
+    if (!CreateFBXData(fbxPath, &fbxData, endFrame)) {
+        printf("%s: 読み込み失敗\n", fbxPath.c_str());
+        return;
+    }
+    const MeshData* meshData = fbxData.mesh;
+    const int animationFrames = fbxData.fbxAnimationData->frameCount;
+    if (animationFrames == 0) return;
+    const int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    StopWatch sw;
+
+    // キャラクターの幅の1.5倍の間隔で並べ、向きとフレームのずれを変える
+    vec3 pmin(FLT_MAX), pmax(-FLT_MAX);
+    for (int i = 0; i < meshData->nPoints; i++)
+    {
+        pmin = minVec3(pmin, meshData->points[i]);
+        pmax = maxVec3(pmax, meshData->points[i]);
+    }
+    const float spacing = 1.5f * std::max(pmax.x() - pmin.x(), pmax.z() - pmin.z());
+    const int columns = (int)std::ceil(std::sqrt((double)instanceCount));
+    const int rows = (instanceCount + columns - 1) / columns;
+
+    FlatScene scene;
+    int material = scene.AddMaterial(vec3(0.65, 0.05, 0.05));
+    FlatCrowd crowd(meshData->points, meshData->nPoints, meshData->idxVertex, meshData->nTriangles, animationFrames, material);
+    sw.Reset();
+    sw.Start();
+    for (int i = 0; i < instanceCount; i++)
+    {
+        vec3 position((i % columns - 0.5f * (columns - 1)) * spacing, 0.0f, (i / columns - 0.5f * (rows - 1)) * spacing);
+        vec3 rotation(0.0f, float((i * 37) % 360), 0.0f);
+        crowd.AddInstance(scene, Mat34::FromTRS(position, rotation, vec3(1)), (i % phaseCount) * animationFrames / phaseCount);
+    }
+    scene.BuildTopLevel();
+    sw.Stop();
+    const double buildTime = sw.GetTime();
+
+    // メッシュの量はずれの種類の数で決まり、インスタンスごとには変換とトップレベルのノードだけが増える
+    const size_t geometryBytes = scene.primitives.size() * sizeof(FlatPrimitive) + scene.nodes.size() * sizeof(FlatBVHNode)
+        + scene.meshes.size() * sizeof(FlatMesh) + scene.sourceIndex.size() * sizeof(int);
+    const size_t instanceBytes = scene.instances.size() * sizeof(FlatInstance) + scene.transforms.size() * sizeof(FlatTransform)
+        + scene.topNodes.size() * sizeof(FlatBVHNode);
+    const size_t copiedBytes = geometryBytes / crowd.PoseCount() * instanceCount;
+    printf("%d instances, %d meshes: build %.3f s, geometry %zu bytes, instances %zu bytes (%zu bytes if every instance had its own mesh)\n",
+        instanceCount, crowd.PoseCount(), buildTime, geometryBytes, instanceBytes, copiedBytes);
+
+    const FlatCamera camera = FrameCrowdCamera(scene, nx, ny);
+    const double rays = (double)nx * ny;
+    auto pose = [&](int frame, vec3* points) { calcPose(frame, &fbxData, points); };
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "frame", "instances", "meshes", "geometry_bytes", "instance_bytes", "update_time", "trace_time", "list_trace_time", "hits" });
+    for (int frame = 0; frame < frameCount; frame++)
+    {
+        sw.Reset();
+        sw.Start();
+        crowd.SetFrame(scene, frame % animationFrames, pose, threadCount);
+        sw.Stop();
+        const double updateTime = sw.GetTime();
+
+        const FlatSceneView view = scene.HostView();
+        sw.Reset();
+        sw.Start();
+        int hits = TracePrimaryFlatCPU(view, camera, nx, ny, threadCount);
+        sw.Stop();
+        const double traceTime = sw.GetTime();
+
+        double listTime = 0.0;
+        if (frame == 0) {
+            FlatSceneView listView = view;
+            listView.topNodeCount = 0;
+            sw.Reset();
+            sw.Start();
+            TracePrimaryFlatCPU(listView, camera, nx, ny, threadCount);
+            sw.Stop();
+            listTime = sw.GetTime();
+        }
+
+        printf("frame %d: update %.4f s, trace %.2f Mrays/s, hits %d\n", frame, updateTime, rays / traceTime / 1e6, hits);
+        data.push_back({ std::to_string(frame), std::to_string(instanceCount), std::to_string(crowd.PoseCount()),
+            std::to_string(geometryBytes), std::to_string(instanceBytes), std::to_string(updateTime), std::to_string(traceTime),
+            frame == 0 ? std::to_string(listTime) : "", std::to_string(hits) });
+    }
+    writeCSV(csvPath, data);
+}
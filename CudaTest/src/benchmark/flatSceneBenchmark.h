@@ -0,0 +1,105 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <vector>
+#include "../createScene.h"
+#include "../flat/flatSceneBuilder.h"
+#include "../flat/flatRender.h"
+#include "../Loader/CSVWriter.h"
+#include "../swatch.h"
+
+__global__ void trace_primary_hitable(Hitable** world, FlatCamera camera, int nx, int ny, int* hitCount)
+{
+    int x = threadIdx.x + blockIdx.x * blockDim.x;
+    int y = threadIdx.y + blockIdx.y * blockDim.y;
+    if ((x >= nx) || (y >= ny)) return;
+    Ray r = camera.get_ray((x + 0.5f) / float(nx), (y + 0.5f) / float(ny));
+    HitRecord rec;
+    if ((*world)->hit(r, 0.001, FLT_MAX, rec, 0)) atomicAdd(hitCount, 1);
+}
+
+__global__ void trace_primary_flat(FlatSceneView scene, FlatCamera camera, int nx, int ny, int* hitCount)
+{
+    int x = threadIdx.x + blockIdx.x * blockDim.x;
+    int y = threadIdx.y + blockIdx.y * blockDim.y;
+    if ((x >= nx) || (y >= ny)) return;
+    Ray r = camera.get_ray((x + 0.5f) / float(nx), (y + 0.5f) / float(ny));
+    FlatHit hit;
+    if (FlatIntersect(scene, r, 0.001f, FLT_MAX, hit)) atomicAdd(hitCount, 1);
+}
+
+int TracePrimaryFlatCPU(const FlatSceneView& scene, const FlatCamera& camera, int nx, int ny, int threadCount)
+{
+    std::atomic<int> hits(0);
+    ParallelTasks(ny, threadCount, [&](int y) {
+        int rowHits = 0;
+        for (int x = 0; x < nx; x++)
+        {
+            Ray r = camera.get_ray((x + 0.5f) / float(nx), (y + 0.5f) / float(ny));
+            FlatHit hit;
+            if (FlatIntersect(scene, r, 0.001f, FLT_MAX, hit)) rowHits++;
+        }
+        hits += rowHits;
+    });
+    return hits;
+}
+
+// 一次光線の光線数/秒を、仮想関数のBVH(GPU)・フラットなシーン(GPU)・フラットなシーン(CPU)で比べる
+// worldはfbxDataの読み込み時の姿勢で構築したBVH。カメラはinit_cameraと同じ位置
+void RunFlatSceneBenchmark(const std::string& csvPath, Hitable** world, const FBXObject* fbxData,
+    int nx, int ny, dim3 blocks, dim3 threads, int repeat = 10)
+{
+    FlatCamera camera = FlatCamera::LookAt(vec3(0, 100, 1000), vec3(0, 150, 0), vec3(0, 1, 0), 40, float(nx) / float(ny), 10.0);
+
+    FlatScene flatScene;
+    StopWatch sw;
+    sw.Reset();
+    sw.Start();
+    int material = flatScene.AddMaterial(vec3(0.65, 0.05, 0.05));
+    int mesh = flatScene.AddTriangleMesh(fbxData->mesh->points, fbxData->mesh->idxVertex, fbxData->mesh->nTriangles, material);
+    flatScene.AddInstance(mesh);
+    sw.Stop();
+    printf("flat scene build %f s, %zu nodes\n", sw.GetTime(), flatScene.nodes.size());
+    FlatSceneView deviceView = flatScene.Upload();
+    FlatSceneView hostView = flatScene.HostView();
+
+    DeviceBuffer<int> counter(1);
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "backend", "scene", "threads", "rays", "time", "rays_per_sec", "hits" });
+    const double rays = (double)nx * ny;
+
+    for (int mode = 0; mode < 2; mode++)
+    {
+        checkCudaErrors(cudaMemset(counter.get(), 0, sizeof(int)));
+        sw.Reset();
+        sw.Start();
+        for (int i = 0; i < repeat; i++)
+        {
+            if (mode == 0) trace_primary_hitable << <blocks, threads >> > (world, camera, nx, ny, counter.get());
+            else trace_primary_flat << <blocks, threads >> > (deviceView, camera, nx, ny, counter.get());
+        }
+        checkCudaErrors(cudaGetLastError());
+        checkCudaErrors(cudaDeviceSynchronize());
+        sw.Stop();
+        int hits;
+        checkCudaErrors(cudaMemcpy(&hits, counter.get(), sizeof(int), cudaMemcpyDeviceToHost));
+        const char* name = mode == 0 ? "hitable" : "flat";
+        printf("gpu %s: %.2f Mrays/s\n", name, rays * repeat / sw.GetTime() / 1e6);
+        data.push_back({ "gpu", name, "", std::to_string((long long)rays * repeat), std::to_string(sw.GetTime()),
+            std::to_string(rays * repeat / sw.GetTime()), std::to_string(hits / repeat) });
+    }
+
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int threadCount = 1; ; threadCount = std::min(threadCount * 2, maxThreads))
+    {
+        sw.Reset();
+        sw.Start();
+        int hits = TracePrimaryFlatCPU(hostView, camera, nx, ny, threadCount);
+        sw.Stop();
+        printf("cpu flat (%d threads): %.2f Mrays/s\n", threadCount, rays / sw.GetTime() / 1e6);
+        data.push_back({ "cpu", "flat", std::to_string(threadCount), std::to_string((long long)rays), std::to_string(sw.GetTime()),
+            std::to_string(rays / sw.GetTime()), std::to_string(hits) });
+        if (threadCount == maxThreads) break;
+    }
+    writeCSV(csvPath, data);
+}
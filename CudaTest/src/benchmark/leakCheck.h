@@ -0,0 +1,58 @@
+#pragma once
+#include <string>
+#include "../createScene.h"
+
+// シーンの読み込みと解放をiterations回繰り返し、
+// 確保中のリソース数・デバイス上のHitable数・デバイスメモリの空き容量が元に戻るか確認する
+bool RunSceneLeakCheck(const std::string& fbxPath, int iterations = 100)
+{
+    // BVHの構築に使う乱数
+    DeviceBuffer<curandState> curand_state(1);
+    random_init << <1, 1 >> > (1, 1, curand_state.get());
+    checkCudaErrors(cudaGetLastError());
+    checkCudaErrors(cudaDeviceSynchronize());
+
+    const int baseResources = ResourceTracker::Get().LiveCount();
+    const size_t baseBytes = ResourceTracker::Get().LiveBytes();
+    const int baseHitables = GetLiveHitableCount();
+    size_t baseFreeMemory, totalMemory;
+    checkCudaErrors(cudaMemGetInfo(&baseFreeMemory, &totalMemory));
+
+    for (int i = 0; i < iterations; i++)
+    {
+        ResourceList resources;
+        FBXObject* fbxData = new FBXObject();
+        int endFrame;
+        if (!CreateFBXData(fbxPath, fbxData, endFrame)) {
+            delete fbxData;
+            return false;
+        }
+
+        HitableList** meshList;
+        checkCudaErrors(cudaMallocManaged((void**)&meshList, sizeof(HitableList*)));
+        init_MeshList(meshList, &resources);
+        create_FBXMesh(meshList, fbxData);
+
+        BVHNode** bvh;
+        checkCudaErrors(cudaMalloc((void**)&bvh, sizeof(BVHNode*)));
+        create_BVHfromList(bvh, meshList, curand_state.get(), &resources);
+
+        resources.freeMemory();
+        delete fbxData;
+
+        printf("leak check %d: resources %d, hitables %d\n", i,
+            ResourceTracker::Get().LiveCount() - baseResources, GetLiveHitableCount() - baseHitables);
+    }
+
+    size_t freeMemory;
+    checkCudaErrors(cudaMemGetInfo(&freeMemory, &totalMemory));
+
+    bool ok = ResourceTracker::Get().LiveCount() == baseResources
+        && ResourceTracker::Get().LiveBytes() == baseBytes
+        && GetLiveHitableCount() == baseHitables
+        && freeMemory >= baseFreeMemory;
+    ResourceTracker::Get().Report();
+    printf("leak check %s: %d iterations, device memory diff %lld bytes\n", ok ? "passed" : "failed",
+        iterations, (long long)baseFreeMemory - (long long)freeMemory);
+    return ok;
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <cmath>
+#include <string>
+#include <vector>
+#include "../core/render.h"
+#include "../Loader/CSVWriter.h"
+#include "../swatch.h"
+
+// 変形によるモーションブラーで1フレームを描画する場合と、シャッターの間のsubFrames個の姿勢で
+// 止まった画像を描画して平均する場合の、更新・描画の時間と画像の差（RMSE）を比べる
+// 画素あたりの光線の数は同じにする（サブフレームごとにsamples / subFrames）
+void RunMotionBlurBenchmark(const std::string& csvPath, const std::string& fbxPath = "./objects/low_walking.fbx",
+    int nx = 1024, int ny = 512, int samples = 16, int subFrames = 8, float shutter = 0.5f, int endFrame = -1)
+{
+    ResourceList resources;
+    FBXObject fbxData;
+    int lastFrame;
+    if (!CreateFBXData(fbxPath, &fbxData, lastFrame)) {
+        printf("%s: 読み込み失敗\n", fbxPath.c_str());
+        return;
+    }
+    if (endFrame < 0 || endFrame > lastFrame) endFrame = lastFrame;
+    HitableList** meshList;
+    checkCudaErrors(cudaMallocManaged((void**)&meshList, sizeof(HitableList*)));
+    init_MeshList(meshList, &resources);
+    create_FBXMesh(meshList, &fbxData);
+    SkinningBuffers skinningBuffers(&fbxData);
+    Triangle** triangles = fbxData.d_triangleData.get();
+
+    const dim3 threads(16, 16);
+    const dim3 blocks(nx / threads.x + 1, ny / threads.y + 1);
+    DeviceBuffer<curandState> curandStates(nx * ny);
+    random_init << <blocks, threads >> > (nx, ny, curandStates.get());
+    checkCudaErrors(cudaGetLastError());
+    checkCudaErrors(cudaDeviceSynchronize());
+
+    Camera** camera;
+    checkCudaErrors(cudaMallocManaged((void**)&camera, sizeof(Camera*)));
+    init_camera(camera, nx, ny, &resources);
+    set_camera(camera, nx, ny, vec3(0, 100, 1000), vec3(0, 150, 0), 10.0, 0.0, 40);
+    SetShadeMode(SHADE_LAMBERT);
+
+    resetFBXObjPose(&fbxData, triangles, &skinningBuffers);
+    BVHNode** bvh;
+    checkCudaErrors(cudaMalloc((void**)&bvh, sizeof(BVHNode*)));
+    create_BVHfromList(bvh, meshList, curandStates.get(), &resources);
+
+    FrameBuffers frameBuffers(nx, ny);
+    vec3* colorBuffer = frameBuffers.colorBuffer.data();
+    vec3* d_colorBuffer = frameBuffers.d_colorBuffer.get();
+    const int pixels = nx * ny;
+    const int subSamples = std::max(1, samples / subFrames);
+    std::vector<vec3> motionImage(pixels), averageImage(pixels);
+    std::vector<vec3> openPos(fbxData.mesh->nPoints), closePos(fbxData.mesh->nPoints);
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "frame", "method", "spp", "update_time", "render_time", "total_time", "rmse" });
+
+    for (int frame = 0; frame <= endFrame; frame++)
+    {
+        // モーションブラー：両端の頂点と箱を持たせて1回描画する
+        SetCameraShutter(camera, 0.0f, 1.0f);
+        sw.Reset();
+        sw.Start();
+        updateFBXObjMotion(frame, shutter, &fbxData, triangles, &skinningBuffers);
+        Update_MotionBVH(bvh);
+        sw.Stop();
+        const double motionUpdate = sw.GetTime();
+        sw.Reset();
+        sw.Start();
+        RenderFrame(d_colorBuffer, colorBuffer, (Hitable**)bvh, camera, curandStates.get(), nx, ny, samples, 8, frame, blocks, threads);
+        sw.Stop();
+        const double motionRender = sw.GetTime();
+        std::copy(colorBuffer, colorBuffer + pixels, motionImage.begin());
+
+        // サブフレーム：シャッターの間を等分した時刻の姿勢で止まった画像を描画して平均する
+        SetCameraShutter(camera, 0.0f, 0.0f);
+        sw.Reset();
+        sw.Start();
+        vec3* open = openPos.data();
+        vec3* close = closePos.data();
+        calcPose(frame, &fbxData, open);
+        calcPose(std::min(frame + 1, fbxData.fbxAnimationData->frameCount - 1), &fbxData, close);
+        sw.Stop();
+        double subUpdate = sw.GetTime(), subRender = 0.0;
+        std::fill(averageImage.begin(), averageImage.end(), vec3(0));
+        for (int s = 0; s < subFrames; s++)
+        {
+            const float time = shutter * (s + 0.5f) / subFrames;
+            sw.Reset();
+            sw.Start();
+            for (int pi = 0; pi < fbxData.mesh->nPoints; pi++)
+            {
+                skinningBuffers.h_pointPos[pi] = lerp(time, openPos[pi], closePos[pi]);
+            }
+            uploadFBXObjPose(&fbxData, triangles, &skinningBuffers);
+            Update_BVH(bvh);
+            sw.Stop();
+            subUpdate += sw.GetTime();
+            sw.Reset();
+            sw.Start();
+            RenderFrame(d_colorBuffer, colorBuffer, (Hitable**)bvh, camera, curandStates.get(), nx, ny, subSamples, 8, frame, blocks, threads);
+            for (int i = 0; i < pixels; i++) averageImage[i] += colorBuffer[i] / float(subFrames);
+            sw.Stop();
+            subRender += sw.GetTime();
+        }
+
+        double squaredError = 0.0;
+        for (int i = 0; i < pixels; i++) squaredError += (motionImage[i] - averageImage[i]).squared_length() / 3.0;
+        const double rmse = std::sqrt(squaredError / pixels);
+
+        printf("frame %d: motion blur %.4f s (update %.4f s), %d sub-frames %.4f s (update %.4f s), RMSE %.4f\n",
+            frame, motionUpdate + motionRender, motionUpdate, subFrames, subUpdate + subRender, subUpdate, rmse);
+        data.push_back({ std::to_string(frame), "motion_blur", std::to_string(samples), std::to_string(motionUpdate),
+            std::to_string(motionRender), std::to_string(motionUpdate + motionRender), "" });
+        data.push_back({ std::to_string(frame), "sub_frames_" + std::to_string(subFrames), std::to_string(subSamples * subFrames),
+            std::to_string(subUpdate), std::to_string(subRender), std::to_string(subUpdate + subRender), std::to_string(rmse) });
+    }
+    resources.freeMemory();
+    writeCSV(csvPath, data);
+}
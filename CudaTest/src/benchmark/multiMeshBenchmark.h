@@ -0,0 +1,81 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "../createScene.h"
+#include "../flat/flatSceneBuilder.h"
+#include "../Loader/CSVWriter.h"
+#include "../swatch.h"
+
+// FBXの全てのメッシュを1つにまとめて読み込み、読み込み時間・メッシュ数・三角形数・マテリアル数と、
+// まとめた三角形に1つのBVHを作る時間（BVHNodeとフラットなBVH）・三角形あたりのメモリを記録する
+// 三角形あたりのメモリはMeshData（頂点番号・法線・マテリアル番号・UV・頂点ごとの法線）とフラットなシーン（プリミティブ・ノード）
+void RunMultiMeshBenchmark(const std::string& csvPath, const std::vector<std::string>& fbxPaths = {
+    "./objects/HipHopDancing.fbx", "./objects/bunny2.fbx", "./objects/high_Walking2.fbx", "./objects/high_Walking3.fbx",
+    "./objects/human_light.fbx", "./objects/low_standUp.fbx", "./objects/low_walking.fbx", "./objects/small_bunny.fbx" })
+{
+    DeviceBuffer<curandState> curand_state(1);
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "model", "meshes", "triangles", "points", "materials", "import_time", "device_build_time", "flat_build_time",
+        "mesh_bytes_per_triangle", "flat_bytes_per_triangle" });
+
+    for (const std::string& fbxPath : fbxPaths)
+    {
+        FBXObject fbxData;
+        int endFrame;
+        sw.Reset();
+        sw.Start();
+        if (!CreateFBXData(fbxPath, &fbxData, endFrame)) {
+            printf("%s: 読み込み失敗\n", fbxPath.c_str());
+            continue;
+        }
+        sw.Stop();
+        const double importTime = sw.GetTime();
+        const MeshData* meshData = fbxData.mesh;
+
+        // 全てのメッシュの三角形を1つのリストにまとめてBVHNodeを作る
+        ResourceList resources;
+        HitableList** meshList;
+        checkCudaErrors(cudaMallocManaged((void**)&meshList, sizeof(HitableList*)));
+        init_MeshList(meshList, &resources);
+        random_init << <1, 1 >> > (1, 1, curand_state.get());
+        checkCudaErrors(cudaGetLastError());
+        BVHNode** bvh;
+        checkCudaErrors(cudaMalloc((void**)&bvh, sizeof(BVHNode*)));
+        sw.Reset();
+        sw.Start();
+        create_FBXMesh(meshList, &fbxData);
+        create_BVHfromList(bvh, meshList, curand_state.get(), &resources);
+        sw.Stop();
+        const double deviceTime = sw.GetTime();
+
+        // フラットなBVHもマテリアル番号付きで1つにまとめて作る
+        FlatScene scene;
+        int material = 0;
+        for (int i = 0; i < meshData->nMaterials; i++)
+        {
+            int m = scene.AddMaterial(meshData->materialColors[i]);
+            if (i == 0) material = m;
+        }
+        sw.Reset();
+        sw.Start();
+        scene.AddTriangleMesh(meshData->points, meshData->idxVertex, meshData->nTriangles, material, meshData->materialIds);
+        sw.Stop();
+        const double flatTime = sw.GetTime();
+
+        // 頂点番号・法線・マテリアル番号・3頂点分のUVと法線と、頂点座標を三角形数で割ったもの
+        const double meshBytes = double(2 * sizeof(vec3) + sizeof(int) + (meshData->uvs ? 3 * sizeof(vec3) : 0)
+            + (meshData->cornerNormals ? 3 * sizeof(vec3) : 0))
+            + double(meshData->nPoints * sizeof(vec3)) / meshData->nTriangles;
+        const double flatBytes = double(scene.primitives.size() * (sizeof(FlatPrimitive) + sizeof(int)) + scene.nodes.size() * sizeof(FlatBVHNode))
+            / meshData->nTriangles;
+
+        printf("%s: meshes %d, triangles %d, materials %d, import %.4f s, device build %.4f s, flat build %.4f s, %.1f + %.1f bytes/triangle\n",
+            fbxPath.c_str(), meshData->nMeshes, meshData->nTriangles, meshData->nMaterials, importTime, deviceTime, flatTime, meshBytes, flatBytes);
+        data.push_back({ fbxPath, std::to_string(meshData->nMeshes), std::to_string(meshData->nTriangles), std::to_string(meshData->nPoints),
+            std::to_string(meshData->nMaterials), std::to_string(importTime), std::to_string(deviceTime), std::to_string(flatTime),
+            std::to_string(meshBytes), std::to_string(flatBytes) });
+        resources.freeMemory();
+    }
+    writeCSV(csvPath, data);
+}
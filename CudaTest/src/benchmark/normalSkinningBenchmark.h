@@ -0,0 +1,74 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "../createScene.h"
+#include "../Loader/CSVWriter.h"
+#include "../swatch.h"
+
+// 高ポリゴンのモデルで、頂点の法線もスキニングすることで増える1フレームあたりの時間を測る
+// 頂点の計算だけ（CPU）と、転送・三角形の更新まで含めた時間（updateFBXObj）を、法線あり・なしで比べる
+void RunNormalSkinningBenchmark(const std::string& csvPath, const std::vector<std::string>& fbxPaths = {
+    "./objects/high_Walking2.fbx", "./objects/high_Walking3.fbx", "./objects/HipHopDancing.fbx" }, int endFrame = -1)
+{
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "model", "frame", "points", "triangles", "pose_time", "pose_normal_time", "update_time", "update_normal_time" });
+
+    for (const std::string& fbxPath : fbxPaths)
+    {
+        ResourceList resources;
+        FBXObject fbxData;
+        int lastFrame;
+        if (!CreateFBXData(fbxPath, &fbxData, lastFrame)) {
+            printf("%s: 読み込み失敗\n", fbxPath.c_str());
+            continue;
+        }
+        const int frames = endFrame < 0 || endFrame > lastFrame ? lastFrame : endFrame;
+        HitableList** meshList;
+        checkCudaErrors(cudaMallocManaged((void**)&meshList, sizeof(HitableList*)));
+        init_MeshList(meshList, &resources);
+        create_FBXMesh(meshList, &fbxData);
+        SkinningBuffers skinningBuffers(&fbxData);
+        const bool hasNormals = skinningBuffers.skinNormals;
+        if (!hasNormals) printf("%s: 頂点の法線がありません\n", fbxPath.c_str());
+
+        const int nPoints = fbxData.mesh->nPoints;
+        std::vector<vec3> points(nPoints), normals(fbxData.mesh->nTriangles * 3);
+        double totals[4] = { 0, 0, 0, 0 };
+        for (int frame = 0; frame <= frames; frame++)
+        {
+            double times[4];
+            vec3* p = points.data();
+            sw.Reset();
+            sw.Start();
+            calcPose(frame, &fbxData, p);
+            sw.Stop();
+            times[0] = sw.GetTime();
+            sw.Reset();
+            sw.Start();
+            calcPose(frame, &fbxData, p, hasNormals ? normals.data() : nullptr);
+            sw.Stop();
+            times[1] = sw.GetTime();
+
+            for (int withNormals = 0; withNormals < 2; withNormals++)
+            {
+                skinningBuffers.skinNormals = hasNormals && withNormals == 1;
+                sw.Reset();
+                sw.Start();
+                updateFBXObj(frame, &fbxData, fbxData.d_triangleData.get(), &skinningBuffers);
+                sw.Stop();
+                times[2 + withNormals] = sw.GetTime();
+            }
+            skinningBuffers.skinNormals = hasNormals;
+
+            for (int i = 0; i < 4; i++) totals[i] += times[i];
+            data.push_back({ fbxPath, std::to_string(frame), std::to_string(nPoints), std::to_string(fbxData.mesh->nTriangles),
+                std::to_string(times[0]), std::to_string(times[1]), std::to_string(times[2]), std::to_string(times[3]) });
+        }
+        const int count = frames + 1;
+        printf("%s: %d points, pose %.4f -> %.4f s/frame, update %.4f -> %.4f s/frame\n", fbxPath.c_str(), nPoints,
+            totals[0] / count, totals[1] / count, totals[2] / count, totals[3] / count);
+        resources.freeMemory();
+    }
+    writeCSV(csvPath, data);
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "../createScene.h"
+#include "../swatch.h"
+
+// 画素の中心を通る一次光線の交差点から、法線側の半球にランダムな方向の光線を作る（AOの光線と同じ）
+__global__ void make_occlusion_rays(Ray* rays, int* rayCount, Hitable** world, Camera** camera, curandState* state,
+    int nx, int ny, int frameIndex)
+{
+    int x = threadIdx.x + blockIdx.x * blockDim.x;
+    int y = threadIdx.y + blockIdx.y * blockDim.y;
+    if ((x >= nx) || (y >= ny)) return;
+    int pixel_index = y * nx + x;
+
+    Ray r = (*camera)->get_ray((x + 0.5f) / float(nx), (y + 0.5f) / float(ny), &(state[pixel_index]));
+    HitRecord rec;
+    if (!(*world)->hit(r, 0.001, FLT_MAX, rec, frameIndex)) return;
+
+    vec3 n = unit_vector(rec.normal);
+    if (dot(n, r.direction()) > 0) n = -n;
+    vec3 d = n + unit_vector(random_in_unit_sphere(&(state[pixel_index])));
+    if (d.squared_length() < 1e-6f) d = n;
+    rays[atomicAdd(rayCount, 1)] = Ray(rec.p, unit_vector(d), r.time());
+}
+
+__global__ void trace_closest(const Ray* rays, int rayCount, Hitable** world, float t_max, int* hitCount, int frameIndex)
+{
+    int i = blockDim.x * blockIdx.x + threadIdx.x;
+    if (i >= rayCount) return;
+    HitRecord rec;
+    if ((*world)->hit(rays[i], 0.001, t_max, rec, frameIndex)) atomicAdd(hitCount, 1);
+}
+
+__global__ void trace_occluded(const Ray* rays, int rayCount, Hitable** world, float t_max, int* hitCount, int frameIndex)
+{
+    int i = blockDim.x * blockIdx.x + threadIdx.x;
+    if (i >= rayCount) return;
+    if ((*world)->occluded(rays[i], 0.001, t_max, frameIndex)) atomicAdd(hitCount, 1);
+}
+
+// 同じ光線の集合を最も近い交差(hit)と遮蔽の有無(occluded)で調べ、光線数/秒をCSVに書き出す
+// 距離はAOの長さと無限遠（影）の2通り
+void RunOcclusionBenchmark(const std::string& csvPath, Hitable** world, Camera** camera, curandState* curand_state,
+    int nx, int ny, dim3 blocks, dim3 threads, int repeat = 10, int frameIndex = 0)
+{
+    DeviceBuffer<Ray> rays(nx * ny);
+    DeviceBuffer<int> counter(1);
+    checkCudaErrors(cudaMemset(counter.get(), 0, sizeof(int)));
+    make_occlusion_rays << <blocks, threads >> > (rays.get(), counter.get(), world, camera, curand_state, nx, ny, frameIndex);
+    checkCudaErrors(cudaGetLastError());
+    checkCudaErrors(cudaDeviceSynchronize());
+    int rayCount;
+    checkCudaErrors(cudaMemcpy(&rayCount, counter.get(), sizeof(int), cudaMemcpyDeviceToHost));
+    if (rayCount == 0) {
+        printf("occlusion benchmark: no rays\n");
+        return;
+    }
+
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "query", "max_distance", "rays", "time", "rays_per_sec", "hits" });
+    const float distances[2] = { 50.0f, FLT_MAX };
+    const int blockSize = 256;
+    const int gridSize = (rayCount + blockSize - 1) / blockSize;
+    for (float t_max : distances)
+    {
+        for (int query = 0; query < 2; query++)
+        {
+            checkCudaErrors(cudaMemset(counter.get(), 0, sizeof(int)));
+            sw.Reset();
+            sw.Start();
+            for (int i = 0; i < repeat; i++)
+            {
+                if (query == 0) trace_closest << <gridSize, blockSize >> > (rays.get(), rayCount, world, t_max, counter.get(), frameIndex);
+                else trace_occluded << <gridSize, blockSize >> > (rays.get(), rayCount, world, t_max, counter.get(), frameIndex);
+            }
+            checkCudaErrors(cudaGetLastError());
+            checkCudaErrors(cudaDeviceSynchronize());
+            sw.Stop();
+
+            int hits;
+            checkCudaErrors(cudaMemcpy(&hits, counter.get(), sizeof(int), cudaMemcpyDeviceToHost));
+            double total = (double)rayCount * repeat;
+            const char* name = query == 0 ? "closest" : "occluded";
+            std::string distance = t_max == FLT_MAX ? "inf" : std::to_string(t_max);
+            printf("%s (%s): %.2f Mrays/s, hits %d / %d\n", name, distance.c_str(), total / sw.GetTime() / 1e6, hits / repeat, rayCount);
+            data.push_back({ name, distance, std::to_string(rayCount), std::to_string(sw.GetTime()),
+                std::to_string(total / sw.GetTime()), std::to_string(hits / repeat) });
+        }
+    }
+    writeCSV(csvPath, data);
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../flat/flatPacket.h"
+#include "../Loader/CSVWriter.h"
+#include "wideBVHBenchmark.h"
+#include "../swatch.h"
+
+// 一次光線を4x2画素のパケットで飛ばし、当たった数を返す。1本ずつに戻ったパケットの数をfallbackに書く
+int TracePacketBenchmarkRays(const FlatSceneView& scene, const FlatCamera& camera, int nx, int ny, int threadCount, int& fallback)
+{
+    const int TILE_X = 4, TILE_Y = PACKET_SIZE / TILE_X;
+    std::atomic<int> hits(0);
+    std::atomic<int> fallbackCount(0);
+    ParallelTasks((ny + TILE_Y - 1) / TILE_Y, threadCount, [&](int tileRow) {
+        int rowHits = 0;
+        int rowFallback = 0;
+        for (int tx = 0; tx < nx; tx += TILE_X)
+        {
+            Ray rays[PACKET_SIZE];
+            int count = 0;
+            for (int dy = 0; dy < TILE_Y; dy++) {
+                for (int dx = 0; dx < TILE_X; dx++) {
+                    int x = tx + dx, y = tileRow * TILE_Y + dy;
+                    if (x >= nx || y >= ny) continue;
+                    rays[count++] = camera.get_ray((x + 0.5f) / float(nx), (y + 0.5f) / float(ny));
+                }
+            }
+            FlatHit hit[PACKET_SIZE];
+            bool hitFlags[PACKET_SIZE];
+            if (!FlatPacketIntersect(scene, rays, count, 0.001f, hit, hitFlags)) rowFallback++;
+            for (int i = 0; i < count; i++) rowHits += hitFlags[i];
+        }
+        hits += rowHits;
+        fallbackCount += rowFallback;
+    });
+    fallback = fallbackCount;
+    return hits;
+}
+
+// CPUでの一次光線の光線数/秒と、影の光線も含めた描画の画素数/秒を、1本ずつとパケットで比べる
+// 描画は両方の画像が一致するかも調べる
+void RunPacketBenchmark(const std::string& csvPath, const std::string& modelPath = "./objects/small_bunny.obj",
+    int nx = 1024, int ny = 512)
+{
+    BenchmarkMesh mesh;
+    if (!LoadWideBenchmarkModel(modelPath, mesh)) {
+        printf("%s: 読み込み失敗\n", modelPath.c_str());
+        return;
+    }
+    FlatScene scene;
+    int material = scene.AddMaterial(vec3(0.65, 0.05, 0.05));
+    int meshIndex = scene.AddTriangleMesh(mesh.points.data(), mesh.idxVertex.data(), mesh.size(), material);
+    scene.AddInstance(meshIndex);
+    const FlatSceneView view = scene.HostView();
+    const FlatCamera camera = FrameMeshCamera(scene, meshIndex, nx, ny);
+
+    const int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    const int packetCount = (nx + 3) / 4 * ((ny + 1) / 2);
+    const double rays = (double)nx * ny;
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "model", "triangles", "test", "method", "threads", "rays", "time", "rays_per_sec", "hits", "fallback_packets", "packets" });
+
+    for (int packet = 0; packet < 2; packet++)
+    {
+        int hits = 0;
+        int fallback = 0;
+        sw.Reset();
+        sw.Start();
+        if (packet) {
+            hits = TracePacketBenchmarkRays(view, camera, nx, ny, threadCount, fallback);
+        }
+        else {
+            hits = TraceWideBenchmarkRays(camera, nx, ny, threadCount,
+                [&](const Ray& r, FlatHit& hit) { return FlatIntersect(view, r, 0.001f, FLT_MAX, hit); });
+        }
+        sw.Stop();
+        const char* method = packet ? "packet" : "single";
+        printf("primary %s: %.2f Mrays/s, hits %d, fallback %d\n", method, rays / sw.GetTime() / 1e6, hits, fallback);
+        data.push_back({ modelPath, std::to_string(mesh.size()), "primary", method, std::to_string(threadCount),
+            std::to_string((long long)rays), std::to_string(sw.GetTime()), std::to_string(rays / sw.GetTime()),
+            std::to_string(hits), std::to_string(fallback), std::to_string(packet ? packetCount : 0) });
+    }
+
+    // 影の光線を含めた描画。光線の数は画素ごとに違うので画素数で割る
+    std::vector<vec3> singleImage(nx * ny);
+    std::vector<vec3> packetImage(nx * ny);
+    for (int packet = 0; packet < 2; packet++)
+    {
+        sw.Reset();
+        sw.Start();
+        if (packet) RenderFlatCPUPacket(packetImage.data(), view, camera, nx, ny, threadCount);
+        else RenderFlatCPU(singleImage.data(), view, camera, nx, ny, threadCount);
+        sw.Stop();
+        const char* method = packet ? "packet" : "single";
+        printf("render %s: %.2f Mpixels/s\n", method, rays / sw.GetTime() / 1e6);
+        data.push_back({ modelPath, std::to_string(mesh.size()), "render", method, std::to_string(threadCount),
+            std::to_string((long long)rays), std::to_string(sw.GetTime()), std::to_string(rays / sw.GetTime()),
+            "", "", "" });
+    }
+    int different = 0;
+    for (int i = 0; i < nx * ny; i++)
+    {
+        if ((singleImage[i] - packetImage[i]).length() > 1e-5f) different++;
+    }
+    printf("画素の差: %d\n", different);
+    writeCSV(csvPath, data);
+}
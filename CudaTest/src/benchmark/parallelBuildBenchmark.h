@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <vector>
+#include "../flat/flatSceneBuilder.h"
+#include "../Loader/CSVWriter.h"
+#include "wideBVHBenchmark.h"
+#include "../swatch.h"
+
+// ホストでのBVHの構築時間をスレッド数1からmaxThreadsまで測る（分割の方法ごと）
+// 構築したシーンは配列ごとに1回でデバイスに転送し、その時間も記録する
+void RunParallelBuildBenchmark(const std::string& csvPath, int maxThreads = 0, int repeat = 3,
+    const std::vector<std::string>& models = {
+        "./objects/small_bunny.obj",
+        "./objects/bunny2.fbx",
+        "./objects/high_Walking2.fbx",
+        "./objects/HipHopDancing.fbx" })
+{
+    if (maxThreads <= 0) maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "model", "triangles", "split", "threads", "nodes", "references", "build_time", "speedup", "upload_time" });
+
+    for (const std::string& path : models)
+    {
+        BenchmarkMesh mesh;
+        if (!LoadWideBenchmarkModel(path, mesh)) {
+            printf("%s: 読み込み失敗\n", path.c_str());
+            continue;
+        }
+
+        const char* names[3] = { "median", "sah", "sbvh" };
+        for (int mode = FLAT_SPLIT_MEDIAN; mode <= FLAT_SPLIT_SBVH; mode++)
+        {
+            double singleThreadTime = 0.0;
+            for (int threads = 1; threads <= maxThreads; threads++)
+            {
+                // 最も速かった回の時間を使う
+                double buildTime = FLT_MAX, uploadTime = 0.0;
+                size_t nodeCount = 0, referenceCount = 0;
+                for (int i = 0; i < repeat; i++)
+                {
+                    FlatScene scene;
+                    scene.splitMode = mode;
+                    scene.buildThreads = threads;
+                    int material = scene.AddMaterial(vec3(0.65, 0.05, 0.05));
+                    sw.Reset();
+                    sw.Start();
+                    int meshIndex = scene.AddTriangleMesh(mesh.points.data(), mesh.idxVertex.data(), mesh.size(), material);
+                    sw.Stop();
+                    buildTime = std::min(buildTime, sw.GetTime());
+                    scene.AddInstance(meshIndex);
+                    nodeCount = scene.nodes.size();
+                    referenceCount = scene.primitives.size();
+
+                    sw.Reset();
+                    sw.Start();
+                    scene.Upload();
+                    checkCudaErrors(cudaDeviceSynchronize());
+                    sw.Stop();
+                    uploadTime = sw.GetTime();
+                }
+                if (threads == 1) singleThreadTime = buildTime;
+                printf("%s %s %d threads: build %.4f s (x%.2f), upload %.4f s, nodes %zu\n", path.c_str(), names[mode], threads,
+                    buildTime, singleThreadTime / buildTime, uploadTime, nodeCount);
+                data.push_back({ path, std::to_string(mesh.size()), names[mode], std::to_string(threads), std::to_string(nodeCount),
+                    std::to_string(referenceCount), std::to_string(buildTime), std::to_string(singleThreadTime / buildTime),
+                    std::to_string(uploadTime) });
+            }
+        }
+    }
+    writeCSV(csvPath, data);
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <vector>
+#include "../flat/flatQuantizedBVH.h"
+#include "../Loader/CSVWriter.h"
+#include "wideBVHBenchmark.h"
+#include "../swatch.h"
+
+template<int N>
+__global__ void trace_primary_wide(FlatSceneView scene, FlatWideView<N> wide, FlatCamera camera, int nx, int ny, int* hitCount)
+{
+    int x = threadIdx.x + blockIdx.x * blockDim.x;
+    int y = threadIdx.y + blockIdx.y * blockDim.y;
+    if ((x >= nx) || (y >= ny)) return;
+    Ray r = camera.get_ray((x + 0.5f) / float(nx), (y + 0.5f) / float(ny));
+    FlatHit hit;
+    if (FlatWideIntersect<N>(scene, wide, r, 0.001f, FLT_MAX, hit)) atomicAdd(hitCount, 1);
+}
+
+template<int N>
+__global__ void trace_primary_quantized(FlatSceneView scene, FlatQuantizedView<N> bvh, FlatCamera camera, int nx, int ny, int* hitCount)
+{
+    int x = threadIdx.x + blockIdx.x * blockDim.x;
+    int y = threadIdx.y + blockIdx.y * blockDim.y;
+    if ((x >= nx) || (y >= ny)) return;
+    Ray r = camera.get_ray((x + 0.5f) / float(nx), (y + 0.5f) / float(ny));
+    FlatHit hit;
+    if (FlatQuantizedIntersect<N>(scene, bvh, r, 0.001f, FLT_MAX, hit)) atomicAdd(hitCount, 1);
+}
+
+// 量子化したノードと元のノードで、ノードの大きさと一次光線の光線数/秒をGPUとCPUで比べる
+void RunQuantizedBVHBenchmark(const std::string& csvPath, int nx = 1024, int ny = 512, int repeat = 10,
+    const std::vector<std::string>& models = {
+        "./objects/bunny2.fbx",
+        "./objects/high_Walking2.fbx",
+        "./objects/high_Walking3.fbx",
+        "./objects/HipHopDancing.fbx" })
+{
+    const int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    const double rays = (double)nx * ny;
+    const dim3 threads(8, 8);
+    const dim3 blocks((nx + threads.x - 1) / threads.x, (ny + threads.y - 1) / threads.y);
+    DeviceBuffer<int> counter(1);
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "model", "triangles", "backend", "structure", "nodes", "bytes_per_node", "bytes", "rays", "time", "rays_per_sec", "hits" });
+
+    for (const std::string& path : models)
+    {
+        BenchmarkMesh mesh;
+        if (!LoadWideBenchmarkModel(path, mesh)) {
+            printf("%s: 読み込み失敗\n", path.c_str());
+            continue;
+        }
+        FlatScene scene;
+        int material = scene.AddMaterial(vec3(0.65, 0.05, 0.05));
+        int meshIndex = scene.AddTriangleMesh(mesh.points.data(), mesh.idxVertex.data(), mesh.size(), material);
+        scene.AddInstance(meshIndex);
+        FlatWideBVH<4> bvh4;
+        FlatWideBVH<8> bvh8;
+        bvh4.Build(scene);
+        bvh8.Build(scene);
+        FlatQuantizedBVH<4> quantized4;
+        FlatQuantizedBVH<8> quantized8;
+        if (!quantized4.Build(bvh4) || !quantized8.Build(bvh8)) continue;
+        const FlatCamera camera = FrameMeshCamera(scene, meshIndex, nx, ny);
+
+        const FlatSceneView hostView = scene.HostView();
+        const FlatSceneView deviceView = scene.Upload();
+        const FlatWideView<4> host4 = bvh4.HostView(), device4 = bvh4.Upload();
+        const FlatWideView<8> host8 = bvh8.HostView(), device8 = bvh8.Upload();
+        const FlatQuantizedView<4> hostQ4 = quantized4.HostView(), deviceQ4 = quantized4.Upload();
+        const FlatQuantizedView<8> hostQ8 = quantized8.HostView(), deviceQ8 = quantized8.Upload();
+
+        const char* names[4] = { "bvh4", "bvh4_quantized", "bvh8", "bvh8_quantized" };
+        const size_t nodeCounts[4] = { bvh4.nodes.size(), quantized4.nodes.size(), bvh8.nodes.size(), quantized8.nodes.size() };
+        const size_t nodeSizes[4] = { sizeof(FlatWideNode<4>), sizeof(FlatQuantizedNode<4>), sizeof(FlatWideNode<8>), sizeof(FlatQuantizedNode<8>) };
+        for (int structure = 0; structure < 4; structure++)
+        {
+            const std::string bytes = std::to_string(nodeCounts[structure] * nodeSizes[structure]);
+
+            checkCudaErrors(cudaMemset(counter.get(), 0, sizeof(int)));
+            sw.Reset();
+            sw.Start();
+            for (int i = 0; i < repeat; i++)
+            {
+                if (structure == 0) trace_primary_wide<4> << <blocks, threads >> > (deviceView, device4, camera, nx, ny, counter.get());
+                else if (structure == 1) trace_primary_quantized<4> << <blocks, threads >> > (deviceView, deviceQ4, camera, nx, ny, counter.get());
+                else if (structure == 2) trace_primary_wide<8> << <blocks, threads >> > (deviceView, device8, camera, nx, ny, counter.get());
+                else trace_primary_quantized<8> << <blocks, threads >> > (deviceView, deviceQ8, camera, nx, ny, counter.get());
+            }
+            checkCudaErrors(cudaGetLastError());
+            checkCudaErrors(cudaDeviceSynchronize());
+            sw.Stop();
+            int hits;
+            checkCudaErrors(cudaMemcpy(&hits, counter.get(), sizeof(int), cudaMemcpyDeviceToHost));
+            printf("%s gpu %s (%zu bytes/node): %.2f Mrays/s\n", path.c_str(), names[structure], nodeSizes[structure],
+                rays * repeat / sw.GetTime() / 1e6);
+            data.push_back({ path, std::to_string(mesh.size()), "gpu", names[structure], std::to_string(nodeCounts[structure]),
+                std::to_string(nodeSizes[structure]), bytes, std::to_string((long long)rays * repeat), std::to_string(sw.GetTime()),
+                std::to_string(rays * repeat / sw.GetTime()), std::to_string(hits / repeat) });
+
+            sw.Reset();
+            sw.Start();
+            if (structure == 0) {
+                hits = TraceWideBenchmarkRays(camera, nx, ny, threadCount,
+                    [&](const Ray& r, FlatHit& hit) { return FlatWideIntersect<4>(hostView, host4, r, 0.001f, FLT_MAX, hit); });
+            }
+            else if (structure == 1) {
+                hits = TraceWideBenchmarkRays(camera, nx, ny, threadCount,
+                    [&](const Ray& r, FlatHit& hit) { return FlatQuantizedIntersect<4>(hostView, hostQ4, r, 0.001f, FLT_MAX, hit); });
+            }
+            else if (structure == 2) {
+                hits = TraceWideBenchmarkRays(camera, nx, ny, threadCount,
+                    [&](const Ray& r, FlatHit& hit) { return FlatWideIntersect<8>(hostView, host8, r, 0.001f, FLT_MAX, hit); });
+            }
+            else {
+                hits = TraceWideBenchmarkRays(camera, nx, ny, threadCount,
+                    [&](const Ray& r, FlatHit& hit) { return FlatQuantizedIntersect<8>(hostView, hostQ8, r, 0.001f, FLT_MAX, hit); });
+            }
+            sw.Stop();
+            printf("%s cpu %s: %.2f Mrays/s, hits %d\n", path.c_str(), names[structure], rays / sw.GetTime() / 1e6, hits);
+            data.push_back({ path, std::to_string(mesh.size()), "cpu", names[structure], std::to_string(nodeCounts[structure]),
+                std::to_string(nodeSizes[structure]), bytes, std::to_string((long long)rays), std::to_string(sw.GetTime()),
+                std::to_string(rays / sw.GetTime()), std::to_string(hits) });
+        }
+    }
+    writeCSV(csvPath, data);
+}
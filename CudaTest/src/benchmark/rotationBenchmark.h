@@ -0,0 +1,80 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "../createScene.h"
+#include "../Loader/CSVWriter.h"
+#include "flatSceneBenchmark.h"
+#include "../swatch.h"
+
+// アニメーションの各フレームでBVHNodeをリフィットだけする場合と、リフィットしながら回転する場合で
+// SAHコスト・リフィットの時間・一次光線の時間を比べる（どちらも読み込み時の姿勢で同じ木を構築してから始める）
+void RunRotationBenchmark(const std::string& csvPath, const std::string& fbxPath = "./objects/HipHopDancing.fbx",
+    int rotationBudget = 4096, int nx = 1024, int ny = 512, int endFrame = -1)
+{
+    DeviceBuffer<curandState> curand_state(1);
+    ResourceList resources;
+    FBXObject fbxData;
+    int lastFrame;
+    if (!CreateFBXData(fbxPath, &fbxData, lastFrame)) {
+        printf("%s: 読み込み失敗\n", fbxPath.c_str());
+        return;
+    }
+    if (endFrame < 0 || endFrame > lastFrame) endFrame = lastFrame;
+    HitableList** meshList;
+    checkCudaErrors(cudaMallocManaged((void**)&meshList, sizeof(HitableList*)));
+    init_MeshList(meshList, &resources);
+    create_FBXMesh(meshList, &fbxData);
+    SkinningBuffers skinningBuffers(&fbxData);
+
+    const FlatCamera camera = FlatCamera::LookAt(vec3(0, 100, 1000), vec3(0, 150, 0), vec3(0, 1, 0), 40, float(nx) / float(ny), 10.0);
+    const dim3 threads(8, 8);
+    const dim3 blocks((nx + threads.x - 1) / threads.x, (ny + threads.y - 1) / threads.y);
+    DeviceBuffer<int> counter(1);
+    DeviceBuffer<int> rotationCounter(1);
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "frame", "method", "refit_time", "rotations", "sah_cost", "trace_time", "hits" });
+
+    for (int method = 0; method < 2; method++)
+    {
+        const int budget = method == 0 ? 0 : rotationBudget;
+        const char* name = method == 0 ? "refit" : "refit_rotation";
+
+        // 同じ乱数で構築して、どちらも同じ木から始める
+        ResourceList bvhResources;
+        random_init << <1, 1 >> > (1, 1, curand_state.get());
+        checkCudaErrors(cudaGetLastError());
+        resetFBXObjPose(&fbxData, fbxData.d_triangleData.get(), &skinningBuffers);
+        BVHNode** bvh;
+        checkCudaErrors(cudaMalloc((void**)&bvh, sizeof(BVHNode*)));
+        create_BVHfromList(bvh, meshList, curand_state.get(), &bvhResources);
+
+        for (int frame = 0; frame <= endFrame; frame++)
+        {
+            updateFBXObj(frame, &fbxData, fbxData.d_triangleData.get(), &skinningBuffers);
+            sw.Reset();
+            sw.Start();
+            int rotations = Update_BVH(bvh, budget, &rotationCounter);
+            sw.Stop();
+            const double refitTime = sw.GetTime();
+            const float sah = BVHSAHCost(bvh);
+
+            checkCudaErrors(cudaMemset(counter.get(), 0, sizeof(int)));
+            sw.Reset();
+            sw.Start();
+            trace_primary_hitable << <blocks, threads >> > ((Hitable**)bvh, camera, nx, ny, counter.get());
+            checkCudaErrors(cudaGetLastError());
+            checkCudaErrors(cudaDeviceSynchronize());
+            sw.Stop();
+            int hits;
+            checkCudaErrors(cudaMemcpy(&hits, counter.get(), sizeof(int), cudaMemcpyDeviceToHost));
+
+            printf("frame %d %s: SAH %.2f, rotations %d, refit %.4f s, trace %.4f s\n", frame, name, sah, rotations, refitTime, sw.GetTime());
+            data.push_back({ std::to_string(frame), name, std::to_string(refitTime), std::to_string(rotations), std::to_string(sah),
+                std::to_string(sw.GetTime()), std::to_string(hits) });
+        }
+        bvhResources.freeMemory();
+    }
+    resources.freeMemory();
+    writeCSV(csvPath, data);
+}
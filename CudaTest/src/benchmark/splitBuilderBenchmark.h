@@ -0,0 +1,103 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <vector>
+#include "../flat/flatWideBVH.h"
+#include "../Loader/CSVWriter.h"
+#include "flatSceneBenchmark.h"
+#include "wideBVHBenchmark.h"
+#include "../swatch.h"
+
+// 中央値分割・SAHのオブジェクト分割・空間分割あり（SBVH）でBVHを構築し、
+// 構築時間・ノード数・プリミティブの参照数・SAHコスト・子の箱の重なりと、一次光線の光線数/秒をGPUとCPUで比べる
+void RunSplitBuilderBenchmark(const std::string& csvPath, int nx = 1024, int ny = 512, int repeat = 10,
+    const std::vector<std::string>& models = {
+        "./objects/small_bunny.obj",
+        "./objects/bunny2.fbx",
+        "./objects/high_Walking2.fbx",
+        "./objects/HipHopDancing.fbx" })
+{
+    const int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    const double rays = (double)nx * ny;
+    const dim3 threads(8, 8);
+    const dim3 blocks((nx + threads.x - 1) / threads.x, (ny + threads.y - 1) / threads.y);
+    DeviceBuffer<int> counter(1);
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "model", "triangles", "split", "build_time", "nodes", "references", "sah_cost", "overlap",
+        "backend", "rays", "time", "rays_per_sec", "hits" });
+
+    for (const std::string& path : models)
+    {
+        BenchmarkMesh mesh;
+        if (!LoadWideBenchmarkModel(path, mesh)) {
+            printf("%s: 読み込み失敗\n", path.c_str());
+            continue;
+        }
+
+        const char* names[3] = { "median", "sah", "sbvh" };
+        for (int mode = FLAT_SPLIT_MEDIAN; mode <= FLAT_SPLIT_SBVH; mode++)
+        {
+            FlatScene scene;
+            scene.splitMode = mode;
+            int material = scene.AddMaterial(vec3(0.65, 0.05, 0.05));
+            sw.Reset();
+            sw.Start();
+            int meshIndex = scene.AddTriangleMesh(mesh.points.data(), mesh.idxVertex.data(), mesh.size(), material);
+            sw.Stop();
+            const double buildTime = sw.GetTime();
+            scene.AddInstance(meshIndex);
+            FlatWideBVH<8> bvh8;
+            bvh8.Build(scene);
+            const FlatCamera camera = FrameMeshCamera(scene, meshIndex, nx, ny);
+            const FlatSceneView hostView = scene.HostView();
+            const FlatSceneView deviceView = scene.Upload();
+            const FlatWideView<8> host8 = bvh8.HostView();
+
+            const float sah = scene.SAHCost(meshIndex);
+            const float overlap = scene.ChildOverlap(meshIndex);
+            printf("%s %s: build %.3f s, nodes %zu, references %zu, SAH %.2f, overlap %.3f\n", path.c_str(), names[mode],
+                buildTime, scene.nodes.size(), scene.primitives.size(), sah, overlap);
+            const std::vector<std::string> common = { path, std::to_string(mesh.size()), names[mode], std::to_string(buildTime),
+                std::to_string(scene.nodes.size()), std::to_string(scene.primitives.size()), std::to_string(sah), std::to_string(overlap) };
+            auto addRow = [&](const char* backend, double count, double time, int hits) {
+                std::vector<std::string> row = common;
+                row.push_back(backend);
+                row.push_back(std::to_string((long long)count));
+                row.push_back(std::to_string(time));
+                row.push_back(std::to_string(count / time));
+                row.push_back(std::to_string(hits));
+                data.push_back(row);
+                printf("%s %s %s: %.2f Mrays/s, hits %d\n", path.c_str(), names[mode], backend, count / time / 1e6, hits);
+            };
+
+            checkCudaErrors(cudaMemset(counter.get(), 0, sizeof(int)));
+            sw.Reset();
+            sw.Start();
+            for (int i = 0; i < repeat; i++)
+            {
+                trace_primary_flat << <blocks, threads >> > (deviceView, camera, nx, ny, counter.get());
+            }
+            checkCudaErrors(cudaGetLastError());
+            checkCudaErrors(cudaDeviceSynchronize());
+            sw.Stop();
+            int hits;
+            checkCudaErrors(cudaMemcpy(&hits, counter.get(), sizeof(int), cudaMemcpyDeviceToHost));
+            addRow("gpu", rays * repeat, sw.GetTime(), hits / repeat);
+
+            sw.Reset();
+            sw.Start();
+            hits = TracePrimaryFlatCPU(hostView, camera, nx, ny, threadCount);
+            sw.Stop();
+            addRow("cpu", rays, sw.GetTime(), hits);
+
+            sw.Reset();
+            sw.Start();
+            hits = TraceWideBenchmarkRays(camera, nx, ny, threadCount,
+                [&](const Ray& r, FlatHit& hit) { return FlatWideIntersect<8>(hostView, host8, r, 0.001f, FLT_MAX, hit); });
+            sw.Stop();
+            addRow("cpu_bvh8", rays, sw.GetTime(), hits);
+        }
+    }
+    writeCSV(csvPath, data);
+}
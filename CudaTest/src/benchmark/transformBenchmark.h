@@ -0,0 +1,101 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <random>
+#include "../createScene.h"
+#include "../Loader/CSVWriter.h"
+#include "../swatch.h"
+
+// 以前のTransform::TransformRay（拡大縮小・rotate()による回転・平行移動を光線ごとに計算する）
+// 比較用にそのまま残している
+__host__ __device__ inline Ray LegacyTransformRay(const Ray& r, const vec3& position, const vec3& rotation, const vec3& scale)
+{
+    vec3 dir = r.direction() / scale;
+    Ray scaled_r(r.origin(), unit_vector(dir), r.time() * dir.length());
+    Ray rotate_r(rotate(scaled_r.origin(), rotation), rotate(scaled_r.direction(), rotation), scaled_r.time());
+    return Ray(rotate_r.origin() - position, rotate_r.direction(), rotate_r.time());
+}
+
+enum TransformBenchmarkMode { TRANSFORM_LEGACY, TRANSFORM_CACHED, TRANSFORM_IDENTITY };
+
+// 光線と法線を1回ずつ変換する（Hitable::hitで交差したときと同じ処理量）
+// 最適化で消されないように結果を足し合わせる
+__host__ __device__ inline float TransformOnce(const Transform& transform, const Ray& r, int mode)
+{
+    Ray t;
+    vec3 n;
+    if (mode == TRANSFORM_LEGACY) {
+        t = LegacyTransformRay(r, transform.Position(), transform.Rotation(), transform.Scale());
+        n = rotate(r.direction(), transform.Rotation());
+    }
+    else {
+        t = transform.TransformRay(r);
+        n = transform.TransformNormal(r.direction());
+    }
+    return t.origin().x() + t.direction().y() + n.z();
+}
+
+__global__ void transform_rays(const Ray* rays, int rayCount, Transform transform, int mode, float* sums)
+{
+    int i = threadIdx.x + blockIdx.x * blockDim.x;
+    if (i >= rayCount) return;
+    sums[i] = TransformOnce(transform, rays[i], mode);
+}
+
+// 光線の変換の速度（光線/秒）を、以前の毎回sin/cosを計算する方法、行列をキャッシュする方法、単位変換で比べる
+void RunTransformBenchmark(const std::string& csvPath, int rayCount = 1 << 20, int repeat = 20)
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    std::vector<Ray> rays(rayCount);
+    for (int i = 0; i < rayCount; i++)
+    {
+        vec3 org(uniform(rng) * 100, uniform(rng) * 100, uniform(rng) * 100);
+        vec3 dir(uniform(rng), uniform(rng), uniform(rng));
+        rays[i] = Ray(org, dir, 0.0f);
+    }
+    DeviceBuffer<Ray> d_rays(rayCount);
+    d_rays.Upload(rays.data(), rayCount);
+    DeviceBuffer<float> d_sums(rayCount);
+
+    const Transform rotated(vec3(10, 20, 30), vec3(15, 30, 45), vec3(1, 2, 1));
+    const Transform identity;
+    const char* names[3] = { "legacy", "cached", "identity" };
+    const int blockSize = 256;
+    const int gridSize = (rayCount + blockSize - 1) / blockSize;
+
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "backend", "method", "rays", "time", "rays_per_sec", "checksum" });
+    for (int mode = TRANSFORM_LEGACY; mode <= TRANSFORM_IDENTITY; mode++)
+    {
+        const Transform& transform = mode == TRANSFORM_IDENTITY ? identity : rotated;
+        double total = (double)rayCount * repeat;
+
+        sw.Reset();
+        sw.Start();
+        for (int i = 0; i < repeat; i++)
+        {
+            transform_rays << <gridSize, blockSize >> > (d_rays.get(), rayCount, transform, mode, d_sums.get());
+        }
+        checkCudaErrors(cudaGetLastError());
+        checkCudaErrors(cudaDeviceSynchronize());
+        sw.Stop();
+        printf("gpu %s: %.2f Mrays/s\n", names[mode], total / sw.GetTime() / 1e6);
+        data.push_back({ "gpu", names[mode], std::to_string((long long)total), std::to_string(sw.GetTime()),
+            std::to_string(total / sw.GetTime()), "" });
+
+        float checksum = 0;
+        sw.Reset();
+        sw.Start();
+        for (int i = 0; i < repeat; i++)
+        {
+            for (int j = 0; j < rayCount; j++) checksum += TransformOnce(transform, rays[j], mode);
+        }
+        sw.Stop();
+        printf("cpu %s: %.2f Mrays/s\n", names[mode], total / sw.GetTime() / 1e6);
+        data.push_back({ "cpu", names[mode], std::to_string((long long)total), std::to_string(sw.GetTime()),
+            std::to_string(total / sw.GetTime()), std::to_string(checksum) });
+    }
+    writeCSV(csvPath, data);
+}
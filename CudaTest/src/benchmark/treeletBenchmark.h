@@ -0,0 +1,106 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <vector>
+#include "../createScene.h"
+#include "../flat/flatTreelet.h"
+#include "../Loader/CSVWriter.h"
+#include "flatSceneBenchmark.h"
+#include "wideBVHBenchmark.h"
+#include "../swatch.h"
+
+// アニメーションのフレームごとにリフィットだけする場合と、リフィットの後にtreeletを組み替える場合で、
+// SAHコスト・組み替えにかかった時間・一次光線の描画時間（GPU・CPU）を比べる
+// 0フレーム目の行は構築直後（組み替えの有無）の値
+void RunTreeletBenchmark(const std::string& csvPath, const std::string& fbxPath = "./objects/HipHopDancing.fbx",
+    int nx = 1024, int ny = 512, int frameCount = 60, int passes = 1, int repeat = 10)
+{
+    FBXObject fbxData;
+    int endFrame = 0;
+    if (!CreateFBXData(fbxPath, &fbxData, endFrame)) {
+        printf("%s: 読み込み失敗\n", fbxPath.c_str());
+        return;
+    }
+    frameCount = std::min(frameCount, fbxData.fbxAnimationData->frameCount);
+    const MeshData* meshData = fbxData.mesh;
+    const int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    const FlatTreeletOptimizer optimizer(threadCount, passes);
+    const double rays = (double)nx * ny;
+    const dim3 threads(8, 8);
+    const dim3 blocks((nx + threads.x - 1) / threads.x, (ny + threads.y - 1) / threads.y);
+    DeviceBuffer<int> counter(1);
+    StopWatch sw;
+
+    // 0: リフィットのみ、1: リフィットと組み替え
+    FlatScene scenes[2];
+    int meshes[2];
+    double buildTimes[2];
+    for (int mode = 0; mode < 2; mode++)
+    {
+        sw.Reset();
+        sw.Start();
+        int material = scenes[mode].AddMaterial(vec3(0.65, 0.05, 0.05));
+        meshes[mode] = scenes[mode].AddTriangleMesh(meshData->points, meshData->idxVertex, meshData->nTriangles, material);
+        scenes[mode].AddInstance(meshes[mode]);
+        sw.Stop();
+        buildTimes[mode] = sw.GetTime();
+    }
+    const FlatCamera camera = FrameMeshCamera(scenes[0], meshes[0], nx, ny);
+
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "frame", "method", "refit_time", "optimize_time", "treelets", "sah_cost", "gpu_time", "cpu_time", "hits" });
+    std::vector<vec3> points(meshData->nPoints);
+    for (int frame = 0; frame <= frameCount; frame++)
+    {
+        for (int mode = 0; mode < 2; mode++)
+        {
+            FlatScene& scene = scenes[mode];
+            double refitTime = frame == 0 ? buildTimes[mode] : 0.0;
+            if (frame > 0) {
+                vec3* newPos = points.data();
+                calcPose(frame - 1, &fbxData, newPos);
+                sw.Reset();
+                sw.Start();
+                scene.UpdateTriangleMesh(meshes[mode], points.data(), meshData->idxVertex);
+                sw.Stop();
+                refitTime = sw.GetTime();
+            }
+            int treelets = 0;
+            double optimizeTime = 0.0;
+            if (mode == 1) {
+                sw.Reset();
+                sw.Start();
+                treelets = optimizer.Optimize(scene, meshes[mode]);
+                sw.Stop();
+                optimizeTime = sw.GetTime();
+            }
+            const float sah = scene.SAHCost(meshes[mode]);
+
+            const FlatSceneView deviceView = scene.Upload();
+            checkCudaErrors(cudaMemset(counter.get(), 0, sizeof(int)));
+            sw.Reset();
+            sw.Start();
+            for (int i = 0; i < repeat; i++)
+            {
+                trace_primary_flat << <blocks, threads >> > (deviceView, camera, nx, ny, counter.get());
+            }
+            checkCudaErrors(cudaGetLastError());
+            checkCudaErrors(cudaDeviceSynchronize());
+            sw.Stop();
+            const double gpuTime = sw.GetTime() / repeat;
+
+            sw.Reset();
+            sw.Start();
+            int hits = TracePrimaryFlatCPU(scene.HostView(), camera, nx, ny, threadCount);
+            sw.Stop();
+            const double cpuTime = sw.GetTime();
+
+            const char* name = mode == 0 ? "refit" : "refit_treelet";
+            printf("frame %d %s: SAH %.2f, optimize %.4f s (%d treelets), gpu %.2f Mrays/s, cpu %.2f Mrays/s\n", frame, name, sah,
+                optimizeTime, treelets, rays / gpuTime / 1e6, rays / cpuTime / 1e6);
+            data.push_back({ std::to_string(frame), name, std::to_string(refitTime), std::to_string(optimizeTime), std::to_string(treelets),
+                std::to_string(sah), std::to_string(gpuTime), std::to_string(cpuTime), std::to_string(hits) });
+        }
+    }
+    writeCSV(csvPath, data);
+}
@@ -0,0 +1,199 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <map>
+#include <random>
+#include <float.h>
+#include "../shapes/triangleIntersect.h"
+#include "../Loader/obj_loader.h"
+#include "../Loader/CSVWriter.h"
+#include "../swatch.h"
+
+// 以前のcollision_detectionの交差判定（毎回辺を計算するMoller-Trumbore、tの範囲は見ない）
+// 比較用にそのまま残している（法線による事前の棄却は除く）
+bool LegacyIntersectTriangle(const vec3& org, const vec3& dir,
+    const vec3& v0, const vec3& v1, const vec3& v2, float& t)
+{
+    const float EPSILON = 0.000001;
+    vec3 edge1 = v1 - v0;
+    vec3 edge2 = v2 - v0;
+    vec3 h = cross(dir, edge2);
+    float a = dot(edge1, h);
+    if (a > -EPSILON && a < EPSILON)
+        return false;
+
+    float f = 1.0 / a;
+    vec3 s = org - v0;
+    float u = f * dot(s, h);
+    if (u < 0.0 || u > 1.0)
+        return false;
+
+    vec3 q = cross(s, edge1);
+    float v = f * dot(dir, q);
+    if (v < 0.0 || u + v > 1.0)
+        return false;
+
+    t = f * dot(edge2, q);
+    return true;
+}
+
+struct BenchmarkMesh {
+    std::vector<vec3> points;
+    std::vector<vec3> idxVertex;// 0始まりの頂点番号
+
+    vec3 Vertex(int tri, int i) const { return points[int(idxVertex[tri][i])]; }
+    int size() const { return (int)idxVertex.size(); }
+};
+
+bool LoadBenchmarkMesh(const std::string& objPath, BenchmarkMesh& mesh)
+{
+    // parseObjByNameは確保済みの配列に書き込むので、先に数を数えておく
+    std::ifstream objFile(objPath);
+    if (!objFile.is_open()) {
+        std::cerr << "Can't open the file " << objPath << std::endl;
+        return false;
+    }
+    int np = 0, nt = 0;
+    std::string line;
+    while (std::getline(objFile, line))
+    {
+        if (line.compare(0, 2, "v ") == 0) np++;
+        else if (line.compare(0, 2, "f ") == 0) nt++;
+    }
+    mesh.points.resize(np);
+    mesh.idxVertex.resize(nt);
+    parseObjByName(objPath, mesh.points.data(), mesh.idxVertex.data(), np, nt);
+    for (int i = 0; i < nt; i++)
+    {
+        mesh.idxVertex[i] -= vec3(1);
+    }
+    return nt > 0;
+}
+
+// 全三角形と総当たりで最も近い交差を求める
+// 新しい判定ではt_maxを縮めながら、以前の判定では交差後にtを比べる（HitableListと同じ使い方）
+int CountClosestHits(const BenchmarkMesh& mesh, const std::vector<vec3>& origins, const std::vector<vec3>& dirs, bool legacy)
+{
+    int hits = 0;
+    for (size_t ri = 0; ri < origins.size(); ri++)
+    {
+        float closest = FLT_MAX;
+        bool hit = false;
+        WatertightRay ray(origins[ri], dirs[ri]);
+        for (int ti = 0; ti < mesh.size(); ti++)
+        {
+            float t, u, v;
+            if (legacy) {
+                if (LegacyIntersectTriangle(origins[ri], dirs[ri], mesh.Vertex(ti, 0), mesh.Vertex(ti, 1), mesh.Vertex(ti, 2), t) && t < closest) {
+                    closest = t;
+                    hit = true;
+                }
+            }
+            else if (IntersectTriangle(ray, mesh.Vertex(ti, 0), mesh.Vertex(ti, 1), mesh.Vertex(ti, 2), 0.001f, closest, false, t, u, v)) {
+                closest = t;
+                hit = true;
+            }
+        }
+        if (hit) hits++;
+    }
+    return hits;
+}
+
+// 2つの三角形が共有する辺の上の点に向けてレイを飛ばし、どちらにも当たらなかった数を数える
+int CountEdgeMisses(const BenchmarkMesh& mesh, bool legacy, int& edgeRays)
+{
+    std::map<std::pair<int, int>, std::vector<int>> edges;
+    for (int ti = 0; ti < mesh.size(); ti++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            int a = int(mesh.idxVertex[ti][i]);
+            int b = int(mesh.idxVertex[ti][(i + 1) % 3]);
+            edges[std::make_pair(std::min(a, b), std::max(a, b))].push_back(ti);
+        }
+    }
+
+    const float params[3] = { 0.25f, 0.5f, 0.75f };
+    int misses = 0;
+    edgeRays = 0;
+    for (const auto& edge : edges)
+    {
+        if (edge.second.size() != 2) continue;
+        int t0 = edge.second[0], t1 = edge.second[1];
+        vec3 n0 = cross(mesh.Vertex(t0, 1) - mesh.Vertex(t0, 0), mesh.Vertex(t0, 2) - mesh.Vertex(t0, 0));
+        vec3 n1 = cross(mesh.Vertex(t1, 1) - mesh.Vertex(t1, 0), mesh.Vertex(t1, 2) - mesh.Vertex(t1, 0));
+        vec3 n = unit_vector(unit_vector(n0) + unit_vector(n1));
+        vec3 a = mesh.points[edge.first.first];
+        vec3 b = mesh.points[edge.first.second];
+        for (float s : params)
+        {
+            vec3 p = a + s * (b - a);
+            vec3 org = p + n;
+            vec3 dir = p - org;
+            bool hit = false;
+            WatertightRay ray(org, dir);
+            for (int ti : edge.second)
+            {
+                float t, u, v;
+                if (legacy) hit |= LegacyIntersectTriangle(org, dir, mesh.Vertex(ti, 0), mesh.Vertex(ti, 1), mesh.Vertex(ti, 2), t);
+                else hit |= IntersectTriangle(ray, mesh.Vertex(ti, 0), mesh.Vertex(ti, 1), mesh.Vertex(ti, 2), 0.0f, FLT_MAX, false, t, u, v);
+            }
+            edgeRays++;
+            if (!hit) misses++;
+        }
+    }
+    return misses;
+}
+
+// バニーのメッシュに対する三角形の交差判定の速度（判定回数/秒）と、共有辺でのすり抜けの数をCSVに書き出す
+void RunTriangleBenchmark(const std::string& csvPath, const std::string& objPath = "./objects/small_bunny.obj", int rayCount = 10000)
+{
+    BenchmarkMesh mesh;
+    if (!LoadBenchmarkMesh(objPath, mesh)) return;
+
+    // バウンディングスフィアの外から、メッシュのAABB内の点に向けたレイ
+    vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+    for (const vec3& p : mesh.points)
+    {
+        bmin = minVec3(bmin, p);
+        bmax = maxVec3(bmax, p);
+    }
+    vec3 center = 0.5f * (bmin + bmax);
+    float radius = (bmax - bmin).length();
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<vec3> origins(rayCount), dirs(rayCount);
+    for (int i = 0; i < rayCount; i++)
+    {
+        vec3 onSphere;
+        do {
+            onSphere = vec3(uniform(rng), uniform(rng), uniform(rng)) * 2.0f - vec3(1);
+        } while (onSphere.squared_length() > 1.0f || onSphere.squared_length() < 1e-4f);
+        origins[i] = center + radius * unit_vector(onSphere);
+        vec3 target = bmin + vec3(uniform(rng), uniform(rng), uniform(rng)) * (bmax - bmin);
+        dirs[i] = target - origins[i];
+    }
+
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "method", "triangles", "rays", "tests", "time", "tests_per_sec", "hits", "edge_rays", "edge_misses" });
+    const char* names[2] = { "legacy", "watertight" };
+    for (int m = 0; m < 2; m++)
+    {
+        bool legacy = m == 0;
+        sw.Reset();
+        sw.Start();
+        int hits = CountClosestHits(mesh, origins, dirs, legacy);
+        sw.Stop();
+
+        double tests = (double)rayCount * mesh.size();
+        int edgeRays;
+        int edgeMisses = CountEdgeMisses(mesh, legacy, edgeRays);
+        printf("%s: %.1f Mtests/s, hits %d / %d, edge misses %d / %d\n", names[m],
+            tests / sw.GetTime() / 1e6, hits, rayCount, edgeMisses, edgeRays);
+        data.push_back({ names[m], std::to_string(mesh.size()), std::to_string(rayCount), std::to_string((long long)tests),
+            std::to_string(sw.GetTime()), std::to_string(tests / sw.GetTime()), std::to_string(hits),
+            std::to_string(edgeRays), std::to_string(edgeMisses) });
+    }
+    writeCSV(csvPath, data);
+}
@@ -0,0 +1,183 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <vector>
+#include <random>
+#include "../flat/flatTriangleBlock.h"
+#include "../Loader/CSVWriter.h"
+#include "wideBVHBenchmark.h"
+#include "../swatch.h"
+
+// プリミティブの配列の三角形を先頭から順にW個ずつブロックに詰める
+template<int W>
+std::vector<FlatTriangleBlock<W>> PackTriangleBlocks(const std::vector<FlatPrimitive>& primitives)
+{
+    std::vector<FlatTriangleBlock<W>> blocks((primitives.size() + W - 1) / W);
+    for (size_t i = 0; i < blocks.size() * W; i++)
+    {
+        FlatTriangleBlock<W>& block = blocks[i / W];
+        bool used = i < primitives.size();
+        block.primitive[i % W] = used ? (int)i : -1;
+        for (int a = 0; a < 3; a++)
+        {
+            block.v[0][a][i % W] = used ? primitives[i].triangle.v0[a] : 0.0f;
+            block.v[1][a][i % W] = used ? primitives[i].triangle.v1[a] : 0.0f;
+            block.v[2][a][i % W] = used ? primitives[i].triangle.v2[a] : 0.0f;
+        }
+    }
+    return blocks;
+}
+
+// 全ての三角形と総当たりで最も近い交差を求め、当たった光線の数を返す（W = 1ならプリミティブを1つずつ）
+template<int W>
+int CountClosestBlockHits(const std::vector<FlatPrimitive>& primitives, const std::vector<FlatTriangleBlock<W>>& blocks,
+    const std::vector<Ray>& rays)
+{
+    int hits = 0;
+    for (const Ray& r : rays)
+    {
+        WatertightRay wray(r.origin(), r.direction());
+        float closest = FLT_MAX;
+        bool hit = false;
+        float t, u, v;
+        if (W == 1) {
+            for (const FlatPrimitive& prim : primitives)
+            {
+                if (IntersectPrimitive(prim, r, wray, 0.001f, closest, t, u, v)) {
+                    closest = t;
+                    hit = true;
+                }
+            }
+        }
+        else {
+            for (const FlatTriangleBlock<W>& block : blocks)
+            {
+                if (IntersectTriangleBlock<W>(block, wray, 0.001f, closest, t, u, v) >= 0) {
+                    closest = t;
+                    hit = true;
+                }
+            }
+        }
+        if (hit) hits++;
+    }
+    return hits;
+}
+
+// 葉の三角形を1つずつ判定する場合と、4個・8個のブロックでまとめて判定する場合を比べる
+// 三角形の判定回数/秒（総当たり）と、4分木・8分木のBVHでの一次光線の光線数/秒をCPUで測る
+// ブロックの場合は葉の大きさをコストの見積もりで決める（最大でブロック2つ分）
+void RunTriangleLeafBenchmark(const std::string& csvPath, int nx = 640, int ny = 480, int rayCount = 1000,
+    const std::vector<std::string>& models = {
+        "./objects/small_bunny.obj",
+        "./objects/bunny2.fbx",
+        "./objects/high_Walking2.fbx",
+        "./objects/HipHopDancing.fbx" })
+{
+    const int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    const double rays = (double)nx * ny;
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "model", "triangles", "test", "method", "max_leaf_size", "nodes", "count", "time", "per_sec", "hits" });
+
+    for (const std::string& path : models)
+    {
+        BenchmarkMesh mesh;
+        if (!LoadWideBenchmarkModel(path, mesh)) {
+            printf("%s: 読み込み失敗\n", path.c_str());
+            continue;
+        }
+
+        // 三角形の判定回数/秒。バウンディングスフィアの外からメッシュの中心付近に向けた光線
+        {
+            FlatScene scene;
+            int material = scene.AddMaterial(vec3(0.65, 0.05, 0.05));
+            int meshIndex = scene.AddTriangleMesh(mesh.points.data(), mesh.idxVertex.data(), mesh.size(), material);
+            const FlatCamera camera = FrameMeshCamera(scene, meshIndex, nx, ny);
+            std::mt19937 rng(1);
+            std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+            std::vector<Ray> testRays(rayCount);
+            for (int i = 0; i < rayCount; i++)
+            {
+                testRays[i] = camera.get_ray(uniform(rng), uniform(rng));
+            }
+            std::vector<FlatTriangleBlock<4>> blocks4 = PackTriangleBlocks<4>(scene.primitives);
+            std::vector<FlatTriangleBlock<8>> blocks8 = PackTriangleBlocks<8>(scene.primitives);
+            std::vector<FlatTriangleBlock<1>> noBlocks;
+            const double tests = (double)rayCount * mesh.size();
+            const char* names[3] = { "primitive", "block4", "block8" };
+            for (int method = 0; method < 3; method++)
+            {
+                sw.Reset();
+                sw.Start();
+                int hits = method == 0 ? CountClosestBlockHits<1>(scene.primitives, noBlocks, testRays)
+                    : method == 1 ? CountClosestBlockHits<4>(scene.primitives, blocks4, testRays)
+                    : CountClosestBlockHits<8>(scene.primitives, blocks8, testRays);
+                sw.Stop();
+                printf("%s triangle %s: %.1f Mtests/s, hits %d\n", path.c_str(), names[method], tests / sw.GetTime() / 1e6, hits);
+                data.push_back({ path, std::to_string(mesh.size()), "triangle", names[method], "", "",
+                    std::to_string((long long)tests), std::to_string(sw.GetTime()), std::to_string(tests / sw.GetTime()),
+                    std::to_string(hits) });
+            }
+        }
+
+        // 一次光線の光線数/秒。葉の配置ごとにBVHを作り直す
+        for (int config = 0; config < 4; config++)
+        {
+            const bool wide8 = config >= 2;
+            const bool blocks = config % 2 == 1;
+            const int width = wide8 ? 8 : 4;
+            FlatScene scene;
+            scene.leafWidth = blocks ? width : 1;
+            scene.maxLeafSize = blocks ? 2 * width : 2;
+            int material = scene.AddMaterial(vec3(0.65, 0.05, 0.05));
+            int meshIndex = scene.AddTriangleMesh(mesh.points.data(), mesh.idxVertex.data(), mesh.size(), material);
+            scene.AddInstance(meshIndex);
+            const FlatSceneView view = scene.HostView();
+            const FlatCamera camera = FrameMeshCamera(scene, meshIndex, nx, ny);
+
+            FlatWideBVH<4> bvh4;
+            FlatWideBVH<8> bvh8;
+            FlatTriangleBlocks<4> leaves4;
+            FlatTriangleBlocks<8> leaves8;
+            if (wide8) {
+                bvh8.Build(scene);
+                leaves8.Build(scene);
+            }
+            else {
+                bvh4.Build(scene);
+                leaves4.Build(scene);
+            }
+            const FlatWideView<4> view4 = bvh4.HostView();
+            const FlatWideView<8> view8 = bvh8.HostView();
+            const FlatTriangleLeaf<4> leaf4 = leaves4.HostLeaf();
+            const FlatTriangleLeaf<8> leaf8 = leaves8.HostLeaf();
+
+            int hits = 0;
+            sw.Reset();
+            sw.Start();
+            if (config == 0) {
+                hits = TraceWideBenchmarkRays(camera, nx, ny, threadCount,
+                    [&](const Ray& r, FlatHit& hit) { return FlatWideIntersect<4>(view, view4, r, 0.001f, FLT_MAX, hit); });
+            }
+            else if (config == 1) {
+                hits = TraceWideBenchmarkRays(camera, nx, ny, threadCount,
+                    [&](const Ray& r, FlatHit& hit) { return FlatWideIntersect<4>(view, view4, r, 0.001f, FLT_MAX, hit, leaf4); });
+            }
+            else if (config == 2) {
+                hits = TraceWideBenchmarkRays(camera, nx, ny, threadCount,
+                    [&](const Ray& r, FlatHit& hit) { return FlatWideIntersect<8>(view, view8, r, 0.001f, FLT_MAX, hit); });
+            }
+            else {
+                hits = TraceWideBenchmarkRays(camera, nx, ny, threadCount,
+                    [&](const Ray& r, FlatHit& hit) { return FlatWideIntersect<8>(view, view8, r, 0.001f, FLT_MAX, hit, leaf8); });
+            }
+            sw.Stop();
+            const char* names[4] = { "bvh4_primitive", "bvh4_block4", "bvh8_primitive", "bvh8_block8" };
+            printf("%s rays %s: %.2f Mrays/s, hits %d\n", path.c_str(), names[config], rays / sw.GetTime() / 1e6, hits);
+            data.push_back({ path, std::to_string(mesh.size()), "rays", names[config], std::to_string(scene.maxLeafSize),
+                std::to_string(scene.nodes.size()), std::to_string((long long)rays), std::to_string(sw.GetTime()),
+                std::to_string(rays / sw.GetTime()), std::to_string(hits) });
+        }
+    }
+    writeCSV(csvPath, data);
+}
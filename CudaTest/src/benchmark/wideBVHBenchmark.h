@@ -0,0 +1,141 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <vector>
+#include "../createScene.h"
+#include "../flat/flatWideBVH.h"
+#include "../flat/flatRender.h"
+#include "../Loader/CSVWriter.h"
+#include "triangleBenchmark.h"
+#include "../swatch.h"
+
+// objはLoadBenchmarkMeshで、fbxは読み込み時の姿勢のメッシュを読む
+bool LoadWideBenchmarkModel(const std::string& path, BenchmarkMesh& mesh)
+{
+    if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".obj") == 0) {
+        return LoadBenchmarkMesh(path, mesh);
+    }
+    FBXObject fbxData;
+    int endFrame = 0;
+    if (!CreateFBXData(path, &fbxData, endFrame)) return false;
+    mesh.points.assign(fbxData.mesh->points, fbxData.mesh->points + fbxData.mesh->nPoints);
+    mesh.idxVertex.assign(fbxData.mesh->idxVertex, fbxData.mesh->idxVertex + fbxData.mesh->nTriangles);
+    return mesh.size() > 0;
+}
+
+// メッシュ全体が映るように斜め前から見るカメラ
+FlatCamera FrameMeshCamera(const FlatScene& scene, int mesh, int nx, int ny)
+{
+    const FlatBVHNode& root = scene.nodes[scene.meshes[mesh].rootNode];
+    vec3 bmin(root.bmin[0], root.bmin[1], root.bmin[2]);
+    vec3 bmax(root.bmax[0], root.bmax[1], root.bmax[2]);
+    vec3 center = 0.5f * (bmin + bmax);
+    float radius = 0.5f * (bmax - bmin).length();
+    return FlatCamera::LookAt(center + 3.0f * radius * unit_vector(vec3(0.3f, 0.3f, 1.0f)), center,
+        vec3(0, 1, 0), 40, float(nx) / float(ny), 1.0f);
+}
+
+// 一次光線をthreadCount個のスレッドで飛ばし、当たった数を返す
+template<class Intersect>
+int TraceWideBenchmarkRays(const FlatCamera& camera, int nx, int ny, int threadCount, const Intersect& intersect)
+{
+    std::atomic<int> hits(0);
+    ParallelTasks(ny, threadCount, [&](int y) {
+        int rowHits = 0;
+        for (int x = 0; x < nx; x++)
+        {
+            Ray r = camera.get_ray((x + 0.5f) / float(nx), (y + 0.5f) / float(ny));
+            FlatHit hit;
+            if (intersect(r, hit)) rowHits++;
+        }
+        hits += rowHits;
+    });
+    return hits;
+}
+
+// 2分木とそれを畳んだ4分木・8分木のBVHで、CPUでの一次光線の光線数/秒を比べる
+// モデルごとに全体が映るようにカメラを置く
+void RunWideBVHBenchmark(const std::string& csvPath, int nx = 640, int ny = 480,
+    const std::vector<std::string>& models = {
+        "./objects/small_bunny.obj",
+        "./objects/cbox_smallbox.obj",
+        "./objects/small_bunny.fbx",
+        "./objects/bunny2.fbx",
+        "./objects/low_walking.fbx",
+        "./objects/low_standUp.fbx",
+        "./objects/human_light.fbx",
+        "./objects/high_Walking2.fbx",
+        "./objects/high_Walking3.fbx",
+        "./objects/HipHopDancing.fbx" })
+{
+    const int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    const double rays = (double)nx * ny;
+    StopWatch sw;
+    std::vector<std::vector<std::string>> data;
+    data.push_back({ "model", "triangles", "structure", "nodes", "build", "threads", "rays", "time", "rays_per_sec", "hits" });
+
+    for (const std::string& path : models)
+    {
+        BenchmarkMesh mesh;
+        if (!LoadWideBenchmarkModel(path, mesh)) {
+            printf("%s: 読み込み失敗\n", path.c_str());
+            continue;
+        }
+
+        FlatScene scene;
+        sw.Reset();
+        sw.Start();
+        int material = scene.AddMaterial(vec3(0.65, 0.05, 0.05));
+        int meshIndex = scene.AddTriangleMesh(mesh.points.data(), mesh.idxVertex.data(), mesh.size(), material);
+        scene.AddInstance(meshIndex);
+        sw.Stop();
+        double binaryBuild = sw.GetTime();
+
+        FlatWideBVH<4> bvh4;
+        sw.Reset();
+        sw.Start();
+        bvh4.Build(scene);
+        sw.Stop();
+        double build4 = sw.GetTime();
+
+        FlatWideBVH<8> bvh8;
+        sw.Reset();
+        sw.Start();
+        bvh8.Build(scene);
+        sw.Stop();
+        double build8 = sw.GetTime();
+
+        FlatCamera camera = FrameMeshCamera(scene, meshIndex, nx, ny);
+
+        const FlatSceneView view = scene.HostView();
+        const FlatWideView<4> view4 = bvh4.HostView();
+        const FlatWideView<8> view8 = bvh8.HostView();
+        for (int structure = 0; structure < 3; structure++)
+        {
+            const char* names[3] = { "binary", "bvh4", "bvh8" };
+            const size_t nodeCounts[3] = { scene.nodes.size(), bvh4.nodes.size(), bvh8.nodes.size() };
+            const double builds[3] = { binaryBuild, binaryBuild + build4, binaryBuild + build8 };
+            int hits = 0;
+            sw.Reset();
+            sw.Start();
+            if (structure == 0) {
+                hits = TraceWideBenchmarkRays(camera, nx, ny, threadCount,
+                    [&](const Ray& r, FlatHit& hit) { return FlatIntersect(view, r, 0.001f, FLT_MAX, hit); });
+            }
+            else if (structure == 1) {
+                hits = TraceWideBenchmarkRays(camera, nx, ny, threadCount,
+                    [&](const Ray& r, FlatHit& hit) { return FlatWideIntersect<4>(view, view4, r, 0.001f, FLT_MAX, hit); });
+            }
+            else {
+                hits = TraceWideBenchmarkRays(camera, nx, ny, threadCount,
+                    [&](const Ray& r, FlatHit& hit) { return FlatWideIntersect<8>(view, view8, r, 0.001f, FLT_MAX, hit); });
+            }
+            sw.Stop();
+            printf("%s %s: %.2f Mrays/s, hits %d\n", path.c_str(), names[structure], rays / sw.GetTime() / 1e6, hits);
+            data.push_back({ path, std::to_string(mesh.size()), names[structure], std::to_string(nodeCounts[structure]),
+                std::to_string(builds[structure]), std::to_string(threadCount), std::to_string((long long)rays),
+                std::to_string(sw.GetTime()), std::to_string(rays / sw.GetTime()), std::to_string(hits) });
+        }
+    }
+    writeCSV(csvPath, data);
+}
@@ -4,8 +4,8 @@
 #include <float.h>
 
 // avoid too much sanity check
-__device__ inline float ffmin(float a, float b) { return a < b ? a : b; }
-__device__ inline float ffmax(float a, float b) { return a > b ? a : b; }
+__host__ __device__ inline float ffmin(float a, float b) { return a < b ? a : b; }
+__host__ __device__ inline float ffmax(float a, float b) { return a > b ? a : b; }
 
 
 /* axis-aligned bounding boxes */
@@ -13,43 +13,72 @@ __device__ inline float ffmax(float a, float b) { return a > b ? a : b; }
 class AABB {
 public:
 
-    __device__ AABB() {
-        float minNum = FLT_MIN;
-        float maxNum = FLT_MAX;
-        _min = vec3(maxNum, maxNum, maxNum);
-        _max = vec3(minNum, minNum, minNum);
+    // 空の箱。どの箱と合わせてもその箱になる
+    __host__ __device__ AABB() {
+        _min = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+        _max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
     }
 
     // bbox of a point
-    __device__ AABB(const vec3& p) : _min(p), _max(p) {}
+    __host__ __device__ AABB(const vec3& p) : _min(p), _max(p) {}
 
     // regular constructor
     // TODO: add sanity check
-    __device__ AABB(const vec3& p1, const vec3& p2) : _min(p1), _max(p2) {}
+    __host__ __device__ AABB(const vec3& p1, const vec3& p2) : _min(p1), _max(p2) {}
 
-    __device__ bool hit(const Ray& r,
+    __host__ __device__ bool hit(const Ray& r,
         float t_min,
         float t_max) const {
+        float t_enter;
+        return hit(InvRay(r), t_min, t_max, t_enter);
+    }
+
+    // 交差する場合はt_enterに箱に入る距離（t_min以上）を返す
+    __host__ __device__ bool hit(const Ray& r,
+        float t_min,
+        float t_max,
+        float& t_enter) const {
+        return hit(InvRay(r), t_min, t_max, t_enter);
+    }
+
+    // スラブ法。符号で近い面と遠い面を選ぶので、軸ごとのmin/maxと分岐がない
+    // 0*infでNaNになった軸はffmin/ffmaxで無視される（面の上を通る光線）
+    __host__ __device__ bool hit(const InvRay& r,
+        float t_min,
+        float t_max,
+        float& t_enter) const {
         for (int a = 0; a < 3; a++) {
-            float t0 = ffmin((_min[a] - r.origin()[a]) / r.direction()[a],
-                (_max[a] - r.origin()[a]) / r.direction()[a]);
-            float t1 = ffmax((_min[a] - r.origin()[a]) / r.direction()[a],
-                (_max[a] - r.origin()[a]) / r.direction()[a]);
+            float t0 = ((r.sign[a] ? _max : _min)[a] - r.org[a]) * r.invDir[a];
+            float t1 = ((r.sign[a] ? _min : _max)[a] - r.org[a]) * r.invDir[a];
             t_min = ffmax(t0, t_min);
             t_max = ffmin(t1, t_max);
-            if (t_max <= t_min) return false;
         }
-        return true;
+        t_enter = t_min;
+        return t_min <= t_max;
+    }
+
+    __host__ __device__ bool hit(const InvRay& r,
+        float t_min,
+        float t_max) const {
+        float t_enter;
+        return hit(r, t_min, t_max, t_enter);
     }
 
     // TODO: get one corner of the aabb 
-    __device__ vec3 getCorner(int corner) const { return vec3(0, 0, 0); }
+    __host__ __device__ vec3 getCorner(int corner) const { return vec3(0, 0, 0); }
 
     // TODO: get union of two aabb
-    __device__ AABB getUnion(const AABB& aabb) const { return AABB(); }
+    __host__ __device__ AABB getUnion(const AABB& aabb) const { return AABB(); }
 
-    __device__ vec3 min() const { return _min; }
-    __device__ vec3 max() const { return _max; }
+    __host__ __device__ vec3 min() const { return _min; }
+    __host__ __device__ vec3 max() const { return _max; }
+
+    // 表面積の半分（SAHで比べるだけなので2倍しない）
+    __host__ __device__ float area() const
+    {
+        vec3 d = _max - _min;
+        return d.x() * d.y() + d.y() * d.z() + d.z() * d.x();
+    }
 
     vec3 _min, _max;
 };
@@ -72,3 +101,9 @@ __device__ AABB moveAABB(AABB box,vec3 pos)
     vec3 big = box.max() + pos;
     return AABB(small, big);
 }
+
+// 2つの箱を線形補間する。頂点が線形に動くなら、途中の時刻の箱はこの箱に含まれる
+__host__ __device__ inline AABB lerpAABB(float t, const AABB& box0, const AABB& box1)
+{
+    return AABB(lerp(t, box0.min(), box1.min()), lerp(t, box0.max(), box1.max()));
+}
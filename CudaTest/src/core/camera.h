@@ -37,10 +37,12 @@ public:
         vertical = 2.0f * half_height * focus_dist * y;
     }
 
+    // シャッターが開いている間（time0 < time1）なら光線の時刻をその間から選ぶ
     __device__ Ray get_ray(float s, float t, curandState* state) {
         vec3 rd = lens_radius * random_in_unit_disk(state);
         vec3 offset = x * rd.x() + y * rd.y();
-        return Ray(origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset, 0.0f);
+        float time = time1 > time0 ? time0 + curand_uniform(state) * (time1 - time0) : time0;
+        return Ray(origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset, time);
     }
 
     vec3 lower_left_corner;
@@ -50,9 +52,12 @@ public:
     vec3 x, y, z;
 
     float lens_radius;
+    float time0 = 0.0f;
+    float time1 = 0.0f;
 };
 
 
+// シャッターの開閉の時刻を指定したカメラ
 class MotionCamera : public Camera {
 public:
     __device__ MotionCamera(vec3 lookfrom,
@@ -69,21 +74,4 @@ public:
         time0 = t0;
         time1 = t1;
     }
-
-    __device__ Ray get_ray(float s, float t, curandState* state) {
-        vec3 rd = lens_radius * random_in_unit_disk(state);
-        vec3 offset = x * rd.x() + y * rd.y();
-        float time = time0 + curand_uniform(state) * (time1 - time0);
-        return Ray(origin + offset, lower_left_corner + s * horizontal + t * vertical - origin - offset, time);
-    }
-
-    vec3 lower_left_corner;
-    vec3 horizontal;
-    vec3 vertical;
-    vec3 origin;
-    vec3 x, y, z;
-
-    float lens_radius;
-    float time0;
-    float time1;
 };
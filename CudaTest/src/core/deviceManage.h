@@ -1,20 +1,6 @@
 #pragma once
 
-#define checkCudaErrors(val) check_cuda((val), #val, __FILE__, __LINE__)
-
-#define CHECK(call) {const cudaError_t error = call;  if (error != cudaSuccess)  { printf("Error: %s:%d, ", __FILE__, __LINE__); printf("code:%d, reason: %s\n", error, cudaGetErrorString(error)); exit(1); } }
-
-void check_cuda(cudaError_t result,
-    char const* const func,
-    const char* const file,
-    int const line) {
-    if (result) {
-        std::cerr << "CUDA error = " << static_cast<unsigned int>(result) << " at " <<
-            file << ":" << line << " '" << func << "' \n";
-        cudaDeviceReset();
-        exit(99);
-    }
-}
+#include "deviceResource.h"
 
 
 __global__ void destroy(Camera** camera) {
@@ -34,74 +20,79 @@ __global__ void destroy(TransformList** transformPointer) {
     delete* transformPointer;
 
 }
+__global__ void destroy(BVHNode** bvh) {
 
+    delete* bvh;
 
+}
 
-class CudaPointerList
-{
-public:
-    CudaPointerList() { list = new void* (); list_size = 0; }
-    CudaPointerList(void** l, int n) { list = l; list_size = n; }
-    void append(void** data)
+// メッシュのリストは三角形を所有しているので、三角形も合わせて破棄する
+__global__ void destroy_mesh(HitableList** mesh) {
+
+    // add_mesh_withNormalでマテリアルごとに三角形が共有しているので、重複を除いて破棄する
+    GrowableArray<Material*> mats;
+    for (int i = 0; i < (*mesh)->list_size; i++)
+    {
+        Triangle* tri = (Triangle*)(*mesh)->list[i];
+        Material* mat = tri->material;
+        delete tri;
+        if (mats.list_size > 0 && mats[mats.list_size - 1] == mat) continue;
+        bool found = false;
+        for (int j = 0; j < mats.list_size && !found; j++) found = mats[j] == mat;
+        if (!found) mats.append(mat);
+    }
+    for (int i = 0; i < mats.list_size; i++)
     {
-        void** tmp = (void**)malloc(sizeof(void*) * list_size);
+        delete mats[i];
+    }
+    mats.freeMemory();
+    delete* mesh;
+
+}
+
+// ボーンごとのBVHのリスト。三角形はメッシュ側が所有している
+__global__ void destroy_boneBVH(HitableList** list) {
+
+    for (int i = 0; i < (*list)->list_size; i++)
+    {
+        delete (*list)->list[i];
+    }
+    delete* list;
 
-        for (int i = 0; i < list_size; i++)
-        {
-            tmp[i] = list[i];
-        }
+}
 
-        free(list);
+template <typename T>
+void LaunchDestroy(T** slot)
+{
+    destroy << <1, 1 >> > (slot);
+}
 
-        list_size++;
+void LaunchDestroyMesh(HitableList** slot)
+{
+    destroy_mesh << <1, 1 >> > (slot);
+}
 
-        list = (void**)malloc(sizeof(void*) * list_size);
+void LaunchDestroyBoneBVH(HitableList** slot)
+{
+    destroy_boneBVH << <1, 1 >> > (slot);
+}
 
-        for (int i = 0; i < list_size - 1; i++)
-        {
-            list[i] = tmp[i];
-        }
-        list[list_size - 1] = data;
+// デバイスヒープ上のオブジェクトを型ごとの破棄処理と合わせて登録する
+template <typename T>
+T** TrackDeviceObject(ResourceList* resources, T** slot, const char* name,
+    typename DeviceObject<T>::DestroyLauncher launcher = LaunchDestroy<T>)
+{
+    resources->Add(new DeviceObject<T>(slot, launcher, name));
+    return slot;
+}
 
-        free(tmp);
-    }
-    void freeMemory()
-    {
-        for (int i = 0; i < list_size; i++)
-        {
-            //printf("free %d\n", i);
-
-            if (typeid(list[i]) == typeid(HitableList**)) 
-            {
-                destroy << <1, 1 >> > ((HitableList**)list[i]);
-                CHECK(cudaDeviceSynchronize());
-                checkCudaErrors(cudaGetLastError());
-            }
-            if (typeid(list[i]) == typeid(TransformList**))
-            {
-                destroy << <1, 1 >> > ((TransformList**)list[i]);
-                CHECK(cudaDeviceSynchronize());
-                checkCudaErrors(cudaGetLastError());
-            }
-
-            if (typeid(list[i]) == typeid(Camera**))
-            {
-                destroy << <1, 1 >> > ((Camera**)list[i]);
-                CHECK(cudaDeviceSynchronize());
-                checkCudaErrors(cudaGetLastError());
-            }
-
-            checkCudaErrors(cudaFree(list[i]));
-            CHECK(cudaDeviceSynchronize());
-            checkCudaErrors(cudaGetLastError());
-
-        }
-        free(list);
-        list_size = 0;
-    }
-    void** list;
-    int list_size;
-};
+// デバイスヒープ上で生存しているHitableの数
+int GetLiveHitableCount()
+{
+    int count = 0;
+    checkCudaErrors(cudaMemcpyFromSymbol(&count, liveHitableCount, sizeof(int)));
+    return count;
+}
 
 
 void ChangeHeapSize(size_t heapSize) {
@@ -127,12 +118,12 @@ __global__ void random_init(int nx,
     curand_init(0, pixel_index, 0, &state[pixel_index]);
 }
 
-void SetCurandState(curandState* curand_state,int nx,int ny,dim3 blocks,dim3 threads, CudaPointerList* pointerList) {
-    // fƂɗ
+void SetCurandState(curandState* curand_state,int nx,int ny,dim3 blocks,dim3 threads, ResourceList* resources) {
+    // 画素ごとに乱数を初期化
     random_init << <blocks, threads >> > (nx, ny, curand_state);
     checkCudaErrors(cudaGetLastError());
     checkCudaErrors(cudaDeviceSynchronize());
-    pointerList->append((void**)curand_state);
+    resources->Add(new DeviceBuffer<curandState>(curand_state, nx * ny, "curandState"));
 }
 
 __global__ void destroy(HitableList** world,
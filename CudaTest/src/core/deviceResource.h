@@ -0,0 +1,313 @@
+#pragma once
+
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <string>
+#include "cuda_runtime.h"
+#include "growableArray.h"
+
+#define checkCudaErrors(val) check_cuda((val), #val, __FILE__, __LINE__)
+
+#define CHECK(call) {const cudaError_t error = call;  if (error != cudaSuccess)  { printf("Error: %s:%d, ", __FILE__, __LINE__); printf("code:%d, reason: %s\n", error, cudaGetErrorString(error)); exit(1); } }
+
+void check_cuda(cudaError_t result,
+    char const* const func,
+    const char* const file,
+    int const line) {
+    if (result) {
+        std::cerr << "CUDA error = " << static_cast<unsigned int>(result) << " at " <<
+            file << ":" << line << " '" << func << "' \n";
+        cudaDeviceReset();
+        exit(99);
+    }
+}
+
+
+// 確保中のリソースを種類ごとに数える
+// シーンの読み込みと解放を繰り返したときにメモリが増え続けていないかの確認に使う
+class ResourceTracker
+{
+public:
+    struct Entry {
+        int count = 0;
+        size_t bytes = 0;
+    };
+
+    static ResourceTracker& Get()
+    {
+        static ResourceTracker tracker;
+        return tracker;
+    }
+
+    void Add(const char* name, size_t bytes)
+    {
+        Entry& e = entries[name];
+        e.count++;
+        e.bytes += bytes;
+    }
+
+    void Remove(const char* name, size_t bytes)
+    {
+        Entry& e = entries[name];
+        e.count--;
+        e.bytes -= bytes;
+    }
+
+    int LiveCount() const
+    {
+        int count = 0;
+        for (const auto& e : entries) count += e.second.count;
+        return count;
+    }
+
+    size_t LiveBytes() const
+    {
+        size_t bytes = 0;
+        for (const auto& e : entries) bytes += e.second.bytes;
+        return bytes;
+    }
+
+    void Report() const
+    {
+        printf("---- live resources ----\n");
+        for (const auto& e : entries) {
+            if (e.second.count == 0) continue;
+            printf("%-24s %6d %12zu bytes\n", e.first.c_str(), e.second.count, e.second.bytes);
+        }
+        printf("total %d resources, %zu bytes\n", LiveCount(), LiveBytes());
+    }
+
+private:
+    std::map<std::string, Entry> entries;
+};
+
+
+// 解放処理を型ごとに持つリソースの基底クラス
+// デバイス側のオブジェクトを破棄するカーネルの起動と、メモリの解放を分けておき
+// ResourceListでまとめて解放できるようにする
+class DeviceResource
+{
+public:
+    virtual ~DeviceResource() {}
+    // デバイスヒープ上のオブジェクトを破棄するカーネルを起動する（同期はしない）
+    virtual void LaunchDestroy() {}
+    // cudaMallocなどで確保したメモリを解放する
+    virtual void Free() = 0;
+
+    void Release()
+    {
+        LaunchDestroy();
+        CHECK(cudaDeviceSynchronize());
+        checkCudaErrors(cudaGetLastError());
+        Free();
+    }
+};
+
+
+// cudaMalloc / cudaMallocManagedで確保した配列の所有ハンドル
+template <typename T>
+class DeviceBuffer : public DeviceResource
+{
+public:
+    DeviceBuffer() : ptr(nullptr), count(0) {}
+    DeviceBuffer(size_t n, bool managed = false) : ptr(nullptr), count(0) { Allocate(n, managed); }
+    // 確保済みのポインタの所有権を引き取る
+    DeviceBuffer(T* p, size_t n, const char* resourceName) : ptr(p), count(n), name(resourceName)
+    {
+        ResourceTracker::Get().Add(name, sizeof(T) * count);
+    }
+    DeviceBuffer(const DeviceBuffer&) = delete;
+    DeviceBuffer& operator=(const DeviceBuffer&) = delete;
+    DeviceBuffer(DeviceBuffer&& other) noexcept : ptr(other.ptr), count(other.count), name(other.name)
+    {
+        other.ptr = nullptr;
+        other.count = 0;
+    }
+    DeviceBuffer& operator=(DeviceBuffer&& other) noexcept
+    {
+        if (this != &other) {
+            Free();
+            ptr = other.ptr;
+            count = other.count;
+            name = other.name;
+            other.ptr = nullptr;
+            other.count = 0;
+        }
+        return *this;
+    }
+    ~DeviceBuffer() { Free(); }
+
+    void Allocate(size_t n, bool managed = false)
+    {
+        Free();
+        if (n == 0) return;
+        if (managed) {
+            checkCudaErrors(cudaMallocManaged((void**)&ptr, sizeof(T) * n));
+            name = "ManagedBuffer";
+        }
+        else {
+            checkCudaErrors(cudaMalloc((void**)&ptr, sizeof(T) * n));
+            name = "DeviceBuffer";
+        }
+        count = n;
+        ResourceTracker::Get().Add(name, sizeof(T) * count);
+    }
+
+    void Upload(const T* host, size_t n)
+    {
+        if (n == 0) return;
+        if (count < n) Allocate(n);
+        checkCudaErrors(cudaMemcpy(ptr, host, sizeof(T) * n, cudaMemcpyHostToDevice));
+    }
+
+    // hostはPinnedBufferで確保しておくと転送がCPUと並行して行われる
+    void UploadAsync(const T* host, size_t n, cudaStream_t stream)
+    {
+        checkCudaErrors(cudaMemcpyAsync(ptr, host, sizeof(T) * n, cudaMemcpyHostToDevice, stream));
+    }
+
+    virtual void Free()
+    {
+        if (ptr == nullptr) return;
+        checkCudaErrors(cudaFree(ptr));
+        ResourceTracker::Get().Remove(name, sizeof(T) * count);
+        ptr = nullptr;
+        count = 0;
+    }
+
+    T* get() const { return ptr; }
+    size_t size() const { return count; }
+
+private:
+    T* ptr;
+    size_t count;
+    const char* name = "DeviceBuffer";
+};
+
+
+// cudaMallocHostで確保したページロック（ピン留め）されたホスト配列の所有ハンドル
+// 非同期転送の転送元として使う
+template <typename T>
+class PinnedBuffer : public DeviceResource
+{
+public:
+    PinnedBuffer() : ptr(nullptr), count(0) {}
+    PinnedBuffer(size_t n) : ptr(nullptr), count(0) { Allocate(n); }
+    PinnedBuffer(const PinnedBuffer&) = delete;
+    PinnedBuffer& operator=(const PinnedBuffer&) = delete;
+    ~PinnedBuffer() { Free(); }
+
+    void Allocate(size_t n)
+    {
+        Free();
+        if (n == 0) return;
+        checkCudaErrors(cudaMallocHost((void**)&ptr, sizeof(T) * n));
+        count = n;
+        ResourceTracker::Get().Add("PinnedBuffer", sizeof(T) * count);
+    }
+
+    virtual void Free()
+    {
+        if (ptr == nullptr) return;
+        checkCudaErrors(cudaFreeHost(ptr));
+        ResourceTracker::Get().Remove("PinnedBuffer", sizeof(T) * count);
+        ptr = nullptr;
+        count = 0;
+    }
+
+    T* get() const { return ptr; }
+    T& operator[](size_t i) { return ptr[i]; }
+    size_t size() const { return count; }
+
+private:
+    T* ptr;
+    size_t count;
+};
+
+
+// デバイスヒープ上に作ったオブジェクトを指すポインタ(T**)の所有ハンドル
+// 解放時にdestroyLauncherでオブジェクトを破棄してから、ポインタの置き場所を解放する
+template <typename T>
+class DeviceObject : public DeviceResource
+{
+public:
+    typedef void (*DestroyLauncher)(T** slot);
+
+    DeviceObject(T** s, DestroyLauncher launcher, const char* resourceName) : slot(s), destroyLauncher(launcher), name(resourceName)
+    {
+        ResourceTracker::Get().Add(name, sizeof(T*));
+    }
+    DeviceObject(const DeviceObject&) = delete;
+    DeviceObject& operator=(const DeviceObject&) = delete;
+    ~DeviceObject()
+    {
+        if (slot != nullptr) Release();
+    }
+
+    virtual void LaunchDestroy()
+    {
+        if (slot == nullptr || destroyLauncher == nullptr) return;
+        destroyLauncher(slot);
+        checkCudaErrors(cudaGetLastError());
+        destroyLauncher = nullptr;
+    }
+
+    virtual void Free()
+    {
+        if (slot == nullptr) return;
+        checkCudaErrors(cudaFree(slot));
+        ResourceTracker::Get().Remove(name, sizeof(T*));
+        slot = nullptr;
+    }
+
+    T** get() const { return slot; }
+
+private:
+    T** slot;
+    DestroyLauncher destroyLauncher;
+    const char* name;
+};
+
+
+// あとでまとめて破棄するリソースのリスト
+// 破棄用のカーネルを登録と逆順にすべて起動し、一度だけ同期してからメモリを解放する
+class ResourceList
+{
+public:
+    ResourceList() {}
+    ResourceList(const ResourceList&) = delete;
+    ResourceList& operator=(const ResourceList&) = delete;
+    ~ResourceList() { freeMemory(); }
+
+    template <typename R>
+    R* Add(R* resource)
+    {
+        resources.append(resource);
+        return resource;
+    }
+
+    void freeMemory()
+    {
+        if (resources.size() == 0) return;
+
+        for (int i = resources.size() - 1; i >= 0; i--)
+        {
+            resources[i]->LaunchDestroy();
+        }
+        CHECK(cudaDeviceSynchronize());
+        checkCudaErrors(cudaGetLastError());
+
+        for (int i = resources.size() - 1; i >= 0; i--)
+        {
+            resources[i]->Free();
+            delete resources[i];
+        }
+        resources.freeMemory();
+    }
+
+    int size() const { return resources.size(); }
+
+private:
+    GrowableArray<DeviceResource*> resources;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+// 容量を倍々に拡張する可変長配列
+// ホスト・デバイスの両方で使用できる（デバイス側ではデバイスヒープから確保される）
+// 要素はmemcpyで移動するので、ポインタなどのトリビアルにコピーできる型のみを格納する
+template <typename T>
+class GrowableArray {
+public:
+    __host__ __device__ GrowableArray() : list(nullptr), list_size(0), capacity(0) {}
+    // mallocで確保済みの配列の所有権を引き取る
+    __host__ __device__ GrowableArray(T* l, int n) : list(l), list_size(n), capacity(n) {}
+    // 要素数nで確保する（中身は未初期化）
+    __host__ __device__ GrowableArray(int n) : list(nullptr), list_size(0), capacity(0) { resize(n); }
+
+    // 容量をn以上にする。要素数は変わらない
+    __host__ __device__ void reserve(int n)
+    {
+        if (n <= capacity) return;
+
+        T* newList = (T*)malloc(sizeof(T) * n);
+        if (list_size > 0) {
+            memcpy(newList, list, sizeof(T) * list_size);
+        }
+        free(list);
+
+        list = newList;
+        capacity = n;
+    }
+
+    // 末尾に追加する。容量が足りなければ倍に拡張するので償却O(1)
+    __host__ __device__ void append(const T& data)
+    {
+        if (list_size == capacity) {
+            reserve(capacity < 4 ? 4 : capacity * 2);
+        }
+        list[list_size++] = data;
+    }
+
+    // 要素数をnにする。先頭からmin(n, list_size)個の要素は保持される
+    __host__ __device__ void resize(int n)
+    {
+        reserve(n);
+        list_size = n;
+    }
+
+    // 配列の所有権を呼び出し側に渡して空になる。返された配列はfree()で解放する
+    __host__ __device__ T* release()
+    {
+        T* l = list;
+        list = nullptr;
+        list_size = 0;
+        capacity = 0;
+        return l;
+    }
+
+    __host__ __device__ void freeMemory()
+    {
+        free(list);
+        list = nullptr;
+        list_size = 0;
+        capacity = 0;
+    }
+
+    __host__ __device__ int size() const { return list_size; }
+    __host__ __device__ T& operator[](int i) { return list[i]; }
+    __host__ __device__ const T& operator[](int i) const { return list[i]; }
+
+    T* list;
+    int list_size;
+    int capacity;
+};
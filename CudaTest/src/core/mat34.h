@@ -0,0 +1,117 @@
+#pragma once
+
+#include "vec3.h"
+
+// 3x4のアフィン変換行列（左3x3が回転・拡大縮小、右端の列が平行移動）
+// ホスト・デバイスの両方で使用できる
+struct Mat34 {
+    float m[3][4];
+
+    __host__ __device__ static Mat34 Identity()
+    {
+        Mat34 r;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                r.m[i][j] = i == j ? 1.0f : 0.0f;
+            }
+        }
+        return r;
+    }
+
+    // 拡大縮小、回転（rotate()と同じオイラー角、度）、平行移動の順に適用する行列
+    __host__ __device__ static Mat34 FromTRS(const vec3& position, const vec3& rotation, const vec3& scale)
+    {
+        float radiansX = (M_PI / 180.) * rotation.x();
+        float sin_X = sin(radiansX);
+        float cos_X = cos(radiansX);
+        float radiansY = (M_PI / 180.) * rotation.y();
+        float sin_Y = sin(radiansY);
+        float cos_Y = cos(radiansY);
+        float radiansZ = -(M_PI / 180.) * rotation.z();
+        float sin_Z = sin(radiansZ);
+        float cos_Z = cos(radiansZ);
+
+        vec3 rows[3] = {
+            vec3(cos_Y * cos_Z, -cos_Y * sin_Z, sin_Y),
+            vec3(sin_X * sin_Y * cos_Z + cos_X * sin_Z, -sin_X * sin_Y * sin_Z + cos_X * cos_Z, -sin_X * cos_Y),
+            vec3(-cos_X * sin_Y * cos_Z + sin_X * sin_Z, cos_X * sin_Y * sin_Z + sin_X * cos_Z, cos_X * cos_Y) };
+
+        Mat34 r;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                r.m[i][j] = rows[i][j] * scale[j];
+            }
+            r.m[i][3] = position[i];
+        }
+        return r;
+    }
+
+    __host__ __device__ vec3 TransformPoint(const vec3& p) const
+    {
+        return vec3(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+            m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+            m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+    }
+
+    __host__ __device__ vec3 TransformVector(const vec3& v) const
+    {
+        return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+            m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+            m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+
+    // 左3x3の転置をかける。逆行列に対して呼ぶと法線の変換になる
+    __host__ __device__ vec3 TransposeTransformVector(const vec3& v) const
+    {
+        return vec3(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+            m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+            m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+    }
+
+    __host__ __device__ Mat34 operator*(const Mat34& b) const
+    {
+        Mat34 r;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                r.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j];
+            }
+            r.m[i][3] += m[i][3];
+        }
+        return r;
+    }
+
+    __host__ __device__ Mat34 Inverse() const
+    {
+        float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+        float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+        float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+        float det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+        float invDet = det != 0.0f ? 1.0f / det : 0.0f;
+
+        Mat34 r;
+        r.m[0][0] = c00 * invDet;
+        r.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet;
+        r.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+        r.m[1][0] = c01 * invDet;
+        r.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+        r.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet;
+        r.m[2][0] = c02 * invDet;
+        r.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet;
+        r.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+        for (int i = 0; i < 3; i++) {
+            r.m[i][3] = -(r.m[i][0] * m[0][3] + r.m[i][1] * m[1][3] + r.m[i][2] * m[2][3]);
+        }
+        return r;
+    }
+
+    __host__ __device__ bool IsIdentity(float epsilon = 1e-6f) const
+    {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                float d = m[i][j] - (i == j ? 1.0f : 0.0f);
+                if (d > epsilon || d < -epsilon) return false;
+            }
+        }
+        return true;
+    }
+};
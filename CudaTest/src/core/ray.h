@@ -6,18 +6,33 @@
 
 class Ray {
 public:
-    __device__ Ray() : _origin(vec3(0.f)), _direction(vec3(0.f)), _time(0.f) {}
+    __host__ __device__ Ray() : _origin(vec3(0.f)), _direction(vec3(0.f)), _time(0.f) {}
 
-    __device__ Ray(const vec3& o, const vec3& d, float t = 0.f) : _origin(o), _direction(d), _time(t) {}
+    __host__ __device__ Ray(const vec3& o, const vec3& d, float t = 0.f) : _origin(o), _direction(d), _time(t) {}
 
-    __device__ float time() const { return _time; }
-    __device__ vec3 origin() const { return _origin; }
-    __device__ vec3 direction() const { return _direction; }
+    __host__ __device__ float time() const { return _time; }
+    __host__ __device__ vec3 origin() const { return _origin; }
+    __host__ __device__ vec3 direction() const { return _direction; }
 
     // t is parameter, not time t
-    __device__ vec3 point_at_t(float t) const { return _origin + t * _direction; }
+    __host__ __device__ vec3 point_at_t(float t) const { return _origin + t * _direction; }
 
     float _time;
     vec3 _origin;
     vec3 _direction;
-};
\ No newline at end of file
+};
+
+// AABBの判定用に、方向の逆数と各軸の符号を前もって計算した光線
+// 1回の走査の間は同じものを使い回し、箱ごとの割り算をなくす
+struct InvRay {
+    vec3 org;
+    vec3 invDir;    // 成分が0なら±inf
+    int sign[3];    // 方向が負の軸は1（近い面がmax側になる）
+
+    __host__ __device__ InvRay(const Ray& r) : org(r.origin())
+    {
+        vec3 d = r.direction();
+        invDir = vec3(1.0f / d[0], 1.0f / d[1], 1.0f / d[2]);
+        for (int a = 0; a < 3; a++) sign[a] = invDir[a] < 0.0f;
+    }
+};
@@ -27,13 +27,14 @@
 
 #define NOMINMAX
 #include "../swatch.h"
+#include "../profiler.h"
 
 
 
 struct RGBColor {
 public:
 
-    unsigned char r, g, b, a; //, , , 
+    unsigned char r, g, b, a; //赤, 緑, 青, 透過
     __host__ __device__ RGBColor() {}
     __host__ __device__ RGBColor(const unsigned char r_, const unsigned char g_, const unsigned char b_, const unsigned char a_) :r(r_), g(g_), b(b_), a(a_) {}
 };
@@ -50,6 +51,7 @@ __device__ vec3 shade(const Ray& r,
     int depth,
     curandState* state, int frameIndex) {
     HitRecord rec;
+    COUNT_RAY();
     if ((*world)->hit(r, 0.001, FLT_MAX, rec, frameIndex)) {
         Ray scattered;
         vec3 attenuation;
@@ -66,12 +68,13 @@ __device__ vec3 shade(const Ray& r,
     }
 }
 
-//o[gVF[hł̃eXg
+//ランバートシェードでのテスト
 __device__ vec3 LambertShade(const Ray& r,
     Hitable** world,
     int depth,
     curandState* state, int frameIndex) {
     HitRecord rec;
+    COUNT_RAY();
     if ((*world)->hit(r, 0.001, FLT_MAX, rec, frameIndex)) {
         Ray scattered;
         vec3 attenuation;
@@ -86,12 +89,13 @@ __device__ vec3 LambertShade(const Ray& r,
     }
 }
 
-// @̃eXg
+// 法線のテスト
 __device__ vec3 shade_normal(const Ray& r,
     Hitable** world,
     int depth,
     curandState* state, int frameIndex) {
     HitRecord rec;
+    COUNT_RAY();
     if ((*world)->hit(r, 0.001, FLT_MAX, rec, frameIndex)) {
         Ray scattered;
         vec3 attenuation;
@@ -102,6 +106,66 @@ __device__ vec3 shade_normal(const Ray& r,
     }
 }
 
+// 平行光源による直接光とアンビエントオクルージョン
+// 影とAOの光線は交差の有無だけが必要なのでoccludedで調べる
+__device__ vec3 DirectLightAOShade(const Ray& r,
+    Hitable** world,
+    int aoSamples,
+    curandState* state, int frameIndex) {
+    const vec3 lightDirection = unit_vector(vec3(1, 2, 1));
+    const vec3 lightColor(0.8f, 0.8f, 0.75f);
+    const float aoDistance = 50.0f;
+    HitRecord rec;
+    COUNT_RAY();
+    if ((*world)->hit(r, 0.001, FLT_MAX, rec, frameIndex)) {
+        Ray scattered;
+        vec3 albedo;
+        vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+        rec.mat_ptr->scatter(r, rec, albedo, scattered, state);
+        // 光線の来た側を向いた法線
+        vec3 n = unit_vector(rec.normal);
+        if (dot(n, r.direction()) > 0) n = -n;
+
+        vec3 color = emitted;
+        float cosine = dot(n, lightDirection);
+        if (cosine > 0) {
+            COUNT_RAY();
+            if (!(*world)->occluded(Ray(rec.p, lightDirection, r.time()), 0.001, FLT_MAX, frameIndex)) {
+                color += albedo * lightColor * cosine;
+            }
+        }
+
+        // 法線側の半球にコサイン分布で光線を飛ばし、aoDistance以内で遮られなかった割合を環境光にかける
+        int visible = 0;
+        for (int i = 0; i < aoSamples; i++) {
+            vec3 d = n + unit_vector(random_in_unit_sphere(state));
+            if (d.squared_length() < 1e-6f) d = n;
+            COUNT_RAY();
+            if (!(*world)->occluded(Ray(rec.p, unit_vector(d), r.time()), 0.001, aoDistance, frameIndex)) visible++;
+        }
+        return color + albedo * backgroundSky(n) * 0.5f * (float(visible) / float(aoSamples));
+    }
+    else {
+        return backgroundSky(r.direction());
+    }
+}
+
+// 描画の方法
+enum ShadeMode {
+    SHADE_LAMBERT,  //ランバートシェード
+    SHADE_PATH,     //パストレース
+    SHADE_NORMAL,   //法線
+    SHADE_AO,       //直接光とアンビエントオクルージョン
+};
+
+__device__ int shadeMode = SHADE_LAMBERT;
+
+void SetShadeMode(ShadeMode mode)
+{
+    int m = mode;
+    checkCudaErrors(cudaMemcpyToSymbol(shadeMode, &m, sizeof(int)));
+}
+
 __global__ void render(vec3* colorBuffer, Hitable** world,Camera** camera,curandState* state,
     int nx,int ny,int samples,int max_depth,int frameIndex) {
     int x = threadIdx.x + blockIdx.x * blockDim.x;
@@ -115,10 +179,21 @@ __global__ void render(vec3* colorBuffer, Hitable** world,Camera** camera,curand
     for (int i = 0; i < ns; i++) {
         float u = float(x + curand_uniform(&(state[pixel_index]))) / float(nx);
         float v = float(y + curand_uniform(&(state[pixel_index]))) / float(ny);
-        Ray r = (*camera)->get_ray(u, v, state);
-        //col += shade(r, world, max_depth, &(state[pixel_index]), frameIndex);
-        col += LambertShade(r, world, max_depth, &(state[pixel_index]),frameIndex);
-        //col += shade_normal(r, world, 0, &(state[pixel_index]),frameIndex);
+        Ray r = (*camera)->get_ray(u, v, &(state[pixel_index]));
+        switch (shadeMode) {
+        case SHADE_PATH:
+            col += shade(r, world, max_depth, &(state[pixel_index]), frameIndex);
+            break;
+        case SHADE_NORMAL:
+            col += shade_normal(r, world, 0, &(state[pixel_index]), frameIndex);
+            break;
+        case SHADE_AO:
+            col += DirectLightAOShade(r, world, 4, &(state[pixel_index]), frameIndex);
+            break;
+        default:
+            col += LambertShade(r, world, max_depth, &(state[pixel_index]), frameIndex);
+            break;
+        }
     }
     col /= float(ns);
     col[0] = sqrt(col[0]);
@@ -132,8 +207,9 @@ __global__ void SetTransform(Transform transform, TransformList** transformPoint
     *((*transformPointer)->list[i]) = transform;
 }
 
-void WritePng(int nx,int ny,int frameIndex,const vec3* colorBuffer)
+void WritePng(int nx,int ny,int frameIndex,const vec3* colorBuffer, const std::string& imagePath = "images/moveTest/picture_")
 {
+    PROFILE_SCOPE("png");
     RGBColor* rgb = new RGBColor[nx * ny];
     for (int i = 0; i < ny; i++) {
         for (int j = 0; j < nx; j++) {
@@ -145,143 +221,159 @@ void WritePng(int nx,int ny,int frameIndex,const vec3* colorBuffer)
         }
     }
 
-    char* folderPath = "images/moveTest/picture_";
-    char* pathname = new char[strlen(folderPath) + sizeof(frameIndex) + strlen(".png") + 1];
-    strcpy(pathname, folderPath);
-    sprintf(pathname + strlen(folderPath), "%d", frameIndex);
-    strcat(pathname, ".png");
-    stbi_write_png(pathname, nx, ny, sizeof(RGBColor), rgb, 0);
+    std::string pathname = imagePath + std::to_string(frameIndex) + ".png";
+    stbi_write_png(pathname.c_str(), nx, ny, sizeof(RGBColor), rgb, 0);
 
-    printf("%dt[:摜o\n", frameIndex);
-    delete[] pathname;
+    printf("%dフレーム目:画像書き出し\n", frameIndex);
+    delete[] rgb;
 }
 
-void renderListAnimation(int nx, int ny, int samples, int max_depth, int beginFrame, int endFrame,
-    Hitable** world, Camera** camera, FBXObject* obj,
-    dim3 blocks, dim3 threads, curandState* curand_state) {
+// 画素のバッファ。解像度が変わるまで使い回す
+class FrameBuffers {
+public:
+    FrameBuffers() : nx(0), ny(0) {}
+    FrameBuffers(int w, int h) : nx(0), ny(0) { Resize(w, h); }
 
-    // f̃m
-    const int num_pixel = nx * ny;
-    vec3* colorBuffer = (vec3*)malloc(nx * ny * sizeof(vec3));
-    for (int i = 0; i < nx * ny; i++)
+    void Resize(int w, int h)
     {
-        colorBuffer[i] = vec3(0);
+        if (w == nx && h == ny) return;
+        nx = w;
+        ny = h;
+        colorBuffer.assign(nx * ny, vec3(0));
+        if (d_colorBuffer.size() < colorBuffer.size()) {
+            d_colorBuffer.Allocate(colorBuffer.size());
+        }
     }
-    vec3* d_colorBuffer;
-    cudaMalloc(&d_colorBuffer, nx * ny * sizeof(vec3));
-    cudaMemcpy(d_colorBuffer, colorBuffer, nx * ny * sizeof(vec3), cudaMemcpyHostToDevice);
-    // _O
-    for (int frameIndex = beginFrame; frameIndex <= endFrame; frameIndex++)
-    {
-        //bV̈ʒu̍XV
-        updateFBXObj(frameIndex, obj, obj->d_triangleData);
 
+    std::vector<vec3> colorBuffer;
+    DeviceBuffer<vec3> d_colorBuffer;
+    int nx, ny;
+};
+
+// 描画に使う加速構造
+enum AccelType {
+    ACCEL_LIST,     //ただのリスト
+    ACCEL_BVH,      //BVH
+    ACCEL_BONEBVH,  //ボーンによるBVH
+};
+
+// 1フレームをレンダリングしてホストに読み戻す
+void RenderFrame(vec3* d_colorBuffer, vec3* colorBuffer, Hitable** world, Camera** camera, curandState* curand_state,
+    int nx, int ny, int samples, int max_depth, int frameIndex, dim3 blocks, dim3 threads)
+{
+#ifdef TRAVERSAL_STATS
+    ResetTraversalStats();
+#endif
+    {
+        PROFILE_SCOPE("render");
+        Profiler::Get().BeginGpu("render_gpu");
         render << <blocks, threads >> > (d_colorBuffer, world, camera, curand_state, nx, ny, samples, max_depth, frameIndex);
+        Profiler::Get().EndGpu();
         CHECK(cudaDeviceSynchronize());
         checkCudaErrors(cudaGetLastError());
-        checkCudaErrors(cudaDeviceSynchronize());
-        cudaMemcpy(colorBuffer, d_colorBuffer, nx * ny * sizeof(vec3), cudaMemcpyDeviceToHost);
-        //pngo
-        WritePng(nx, ny, frameIndex, colorBuffer);
     }
-    checkCudaErrors(cudaFree(d_colorBuffer));
-    free(colorBuffer);
+    {
+        PROFILE_SCOPE("readback");
+        checkCudaErrors(cudaMemcpy(colorBuffer, d_colorBuffer, nx * ny * sizeof(vec3), cudaMemcpyDeviceToHost));
+    }
+#ifdef TRAVERSAL_STATS
+    // 光線1本あたりの平均をプロファイラのCSVに出す
+    TraversalStats stats = GetTraversalStats();
+    double rays = stats.rays > 0 ? (double)stats.rays : 1.0;
+    Profiler::Get().AddValue("nodes_per_ray", stats.nodeVisits / rays);
+    Profiler::Get().AddValue("triangles_per_ray", stats.triangleTests / rays);
+    printf("rays %llu, nodes/ray %.2f, triangles/ray %.2f\n", stats.rays, stats.nodeVisits / rays, stats.triangleTests / rays);
+#endif
 }
 
-void renderBVHAnimation(int nx, int ny, int samples, int max_depth, int beginFrame, int endFrame,
-    Hitable** world, Camera** camera, FBXObject* obj,
-    dim3 blocks, dim3 threads, curandState* curand_state, std::vector<std::vector<std::string>>& data) {
+// output.csvの1行（frame, rendering, update, build）
+// renderingは描画と読み戻し、updateは姿勢の更新とBVHの更新の合計
+std::vector<std::string> FrameTimeRow(int frameIndex)
+{
+    const Profiler& profiler = Profiler::Get();
+    double renderTime = profiler.GetFrameTime(frameIndex, "render") + profiler.GetFrameTime(frameIndex, "readback");
+    double updateTime = profiler.GetFrameTime(frameIndex, "skinning") + profiler.GetFrameTime(frameIndex, "refit");
+    return { std::to_string(frameIndex), std::to_string(renderTime), std::to_string(updateTime), "" };
+}
 
-    StopWatch sw;
-    // f̃m
-    const int num_pixel = nx * ny;
-    vec3* colorBuffer = (vec3*)malloc(nx * ny * sizeof(vec3));
-    for (int i = 0; i < nx * ny; i++)
-    {
-        colorBuffer[i] = vec3(0);
-    }
-    vec3* d_colorBuffer;
-    cudaMalloc(&d_colorBuffer, nx * ny * sizeof(vec3));
-    cudaMemcpy(d_colorBuffer, colorBuffer, nx * ny * sizeof(vec3), cudaMemcpyHostToDevice);
-    // _O
+// アニメーションの各フレームで姿勢とBVHを更新してレンダリングし、計測結果をdataに追加する
+// rotationBudgetが正ならACCEL_BVHのリフィットで1フレームにその回数まで木を回転する
+// shutterが正なら、各フレームをそのフレームから次のフレームまでのshutterの割合の間の動きでぼかす（ACCEL_LISTとACCEL_BVH）
+void renderAnimation(AccelType accel, int nx, int ny, int samples, int max_depth, int beginFrame, int endFrame,
+    Hitable** world, Camera** camera, FBXObject* obj,
+    dim3 blocks, dim3 threads, curandState* curand_state,
+    FrameBuffers* frameBuffers, SkinningBuffers* skinningBuffers, const std::string& imagePath,
+    std::vector<std::vector<std::string>>& data, int rotationBudget = 0, float shutter = 0.0f) {
+
+    frameBuffers->Resize(nx, ny);
+    vec3* colorBuffer = frameBuffers->colorBuffer.data();
+    vec3* d_colorBuffer = frameBuffers->d_colorBuffer.get();
+    // ボーンごとのBVHは箱を平行移動するだけなので、変形の両端の箱を持てない
+    const bool motionBlur = shutter > 0.0f && accel != ACCEL_BONEBVH;
+    if (shutter > 0.0f && !motionBlur) printf("bonebvhではモーションブラーを使えません\n");
+    if (motionBlur) SetCameraShutter(camera, 0.0f, 1.0f);
+    DeviceBuffer<int> rotationCounter(rotationBudget > 0 ? 1 : 0);
+    // レンダリング
     for (int frameIndex = beginFrame; frameIndex <= endFrame; frameIndex++)
     {
-        //bV̈ʒu̍XV
-        updateFBXObj(frameIndex, obj, obj->d_triangleData);
-
-        sw.Reset();
-        sw.Start();
-        //BVH̍XV
-        Update_BVH((BVHNode**)world);
-        sw.Stop();
-        std::string updateTime = std::to_string(sw.GetTime());
-        printf("BVHXV\n");
-
-        sw.Reset();
-        sw.Start();
-        render << <blocks, threads >> > (d_colorBuffer, world, camera, curand_state, nx, ny, samples, max_depth, frameIndex);
-        CHECK(cudaDeviceSynchronize());
-        checkCudaErrors(cudaGetLastError());
-        checkCudaErrors(cudaDeviceSynchronize());
-        cudaMemcpy(colorBuffer, d_colorBuffer, nx * ny * sizeof(vec3), cudaMemcpyDeviceToHost);
-        sw.Stop();
-        std::string renderTime = std::to_string(sw.GetTime());
+        Profiler::Get().BeginFrame(frameIndex);
+        //メッシュの位置の更新
+        if (motionBlur) updateFBXObjMotion(frameIndex, shutter, obj, obj->d_triangleData.get(), skinningBuffers);
+        else updateFBXObj(frameIndex, obj, obj->d_triangleData.get(), skinningBuffers);
+
+        //BVHの更新
+        if (accel == ACCEL_BVH && motionBlur) {
+            Update_MotionBVH((BVHNode**)world);
+            printf("BVH更新完了\n");
+        }
+        else if (accel == ACCEL_BVH) {
+            int rotations = Update_BVH((BVHNode**)world, rotationBudget, &rotationCounter);
+            if (rotationBudget > 0) Profiler::Get().AddValue("rotations", rotations);
+            printf("BVH更新完了\n");
+        }
+        else if (accel == ACCEL_BONEBVH) {
+            Update_BVH((HitableList**)world, obj, skinningBuffers);
+            printf("BVH更新完了\n");
+        }
+
+        RenderFrame(d_colorBuffer, colorBuffer, world, camera, curand_state, nx, ny, samples, max_depth, frameIndex, blocks, threads);
 
-        data.push_back({ std::to_string(frameIndex), renderTime, updateTime,"" });
+        //png書き出し
+        WritePng(nx, ny, frameIndex, colorBuffer, imagePath);
+        Profiler::Get().EndFrame();
 
-        //pngo
-        WritePng(nx, ny, frameIndex, colorBuffer);
+        data.push_back(FrameTimeRow(frameIndex));
     }
-    checkCudaErrors(cudaFree(d_colorBuffer));
-    free(colorBuffer);
+    if (motionBlur) SetCameraShutter(camera, 0.0f, 0.0f);
 }
 
-void renderBoneBVHAnimation(int nx,int ny,int samples,int max_depth,int beginFrame,int endFrame,
-    Hitable** world,  Camera** camera, FBXObject* obj,
+void renderListAnimation(int nx, int ny, int samples, int max_depth, int beginFrame, int endFrame,
+    Hitable** world, Camera** camera, FBXObject* obj,
+    dim3 blocks, dim3 threads, curandState* curand_state) {
+
+    FrameBuffers frameBuffers(nx, ny);
+    SkinningBuffers skinningBuffers(obj);
+    std::vector<std::vector<std::string>> data;
+    renderAnimation(ACCEL_LIST, nx, ny, samples, max_depth, beginFrame, endFrame, world, camera, obj,
+        blocks, threads, curand_state, &frameBuffers, &skinningBuffers, "images/moveTest/picture_", data);
+}
+
+void renderBVHAnimation(int nx, int ny, int samples, int max_depth, int beginFrame, int endFrame,
+    Hitable** world, Camera** camera, FBXObject* obj,
     dim3 blocks, dim3 threads, curandState* curand_state, std::vector<std::vector<std::string>>& data) {
 
-    StopWatch sw;
-    // f̃m
-    const int num_pixel = nx * ny;
-    vec3* colorBuffer = (vec3*)malloc(nx * ny * sizeof(vec3));
-    for (int i = 0; i < nx * ny; i++)
-    {
-        colorBuffer[i] = vec3(0);
-    }
-    vec3* d_colorBuffer;
-    cudaMalloc(&d_colorBuffer, nx * ny * sizeof(vec3));
-    cudaMemcpy(d_colorBuffer, colorBuffer, nx * ny * sizeof(vec3), cudaMemcpyHostToDevice);
-    // _O
-    for (int frameIndex = beginFrame; frameIndex <= endFrame; frameIndex++)
-    {
-        //bV̈ʒu̍XV
-        updateFBXObj(frameIndex, obj, obj->d_triangleData);
-        
-        sw.Reset();
-        sw.Start();
-        //BVH̍XV
-        Update_BVH((HitableList**)world, obj);
-        sw.Stop();
-        std::string updateTime = std::to_string(sw.GetTime());
-        printf("BVHXV\n");
-        
-        sw.Reset();
-        sw.Start();
-        render << <blocks, threads >> > (d_colorBuffer, world, camera, curand_state, nx, ny, samples, max_depth, frameIndex);
-        CHECK(cudaDeviceSynchronize());
-        checkCudaErrors(cudaGetLastError());
-        checkCudaErrors(cudaDeviceSynchronize());
-        cudaMemcpy(colorBuffer, d_colorBuffer, nx * ny * sizeof(vec3), cudaMemcpyDeviceToHost);
-        sw.Stop();
-        std::string renderTime = std::to_string(sw.GetTime());
-
-        data.push_back({ std::to_string(frameIndex), renderTime, updateTime,""});
-        
-        //pngo
-        WritePng(nx, ny, frameIndex, colorBuffer);
-    }
-    checkCudaErrors(cudaFree(d_colorBuffer));
-    free(colorBuffer);
+    FrameBuffers frameBuffers(nx, ny);
+    SkinningBuffers skinningBuffers(obj);
+    renderAnimation(ACCEL_BVH, nx, ny, samples, max_depth, beginFrame, endFrame, world, camera, obj,
+        blocks, threads, curand_state, &frameBuffers, &skinningBuffers, "images/moveTest/picture_", data);
 }
 
+void renderBoneBVHAnimation(int nx,int ny,int samples,int max_depth,int beginFrame,int endFrame,
+    Hitable** world,  Camera** camera, FBXObject* obj,
+    dim3 blocks, dim3 threads, curandState* curand_state, std::vector<std::vector<std::string>>& data) {
 
+    FrameBuffers frameBuffers(nx, ny);
+    SkinningBuffers skinningBuffers(obj);
+    renderAnimation(ACCEL_BONEBVH, nx, ny, samples, max_depth, beginFrame, endFrame, world, camera, obj,
+        blocks, threads, curand_state, &frameBuffers, &skinningBuffers, "images/moveTest/picture_", data);
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "aabb.h"
+
+// CPUではSSE（4個）とAVX（8個、/arch:AVX以上でビルドしたとき）でまとめて判定する
+#if !defined(__CUDA_ARCH__) && (defined(__SSE2__) || defined(_M_X64))
+#define WIDE_AABB_SSE
+#include <immintrin.h>
+#endif
+#if !defined(__CUDA_ARCH__) && defined(__AVX__)
+#define WIDE_AABB_AVX
+#endif
+
+// N個のAABBを軸ごとに並べて持つ（SoA）。幅の広いBVHのノードの子の箱に使う
+// 使わない要素は空の箱（min = FLT_MAX, max = -FLT_MAX）にしておけば当たらない
+template<int N>
+struct AABBxN {
+    float bmin[3][N];
+    float bmax[3][N];
+
+    __host__ __device__ void SetEmpty(int i)
+    {
+        for (int a = 0; a < 3; a++) {
+            bmin[a][i] = FLT_MAX;
+            bmax[a][i] = -FLT_MAX;
+        }
+    }
+
+    __host__ __device__ void Set(int i, const AABB& box)
+    {
+        for (int a = 0; a < 3; a++) {
+            bmin[a][i] = box.min()[a];
+            bmax[a][i] = box.max()[a];
+        }
+    }
+};
+
+// 1本の光線とN個の箱の判定（AABB::hitと同じ計算を要素ごとに行う）
+// 交差した箱のビットを返し、t_enterにそれぞれの箱に入る距離を書く
+template<int N>
+__host__ __device__ inline unsigned IntersectAABBxNScalar(const AABBxN<N>& boxes, const InvRay& r,
+    float t_min, float t_max, float t_enter[N])
+{
+    unsigned mask = 0;
+    for (int i = 0; i < N; i++) {
+        float tmin = t_min;
+        float tmax = t_max;
+        for (int a = 0; a < 3; a++) {
+            float t0 = ((r.sign[a] ? boxes.bmax : boxes.bmin)[a][i] - r.org[a]) * r.invDir[a];
+            float t1 = ((r.sign[a] ? boxes.bmin : boxes.bmax)[a][i] - r.org[a]) * r.invDir[a];
+            tmin = ffmax(t0, tmin);
+            tmax = ffmin(t1, tmax);
+        }
+        t_enter[i] = tmin;
+        mask |= (tmin <= tmax ? 1u : 0u) << i;
+    }
+    return mask;
+}
+
+#ifdef WIDE_AABB_SSE
+// CPUでSIMDの幅に合わない数はそのまま1個ずつ判定する
+template<int N>
+struct WideAABBHost {
+    static unsigned Intersect(const AABBxN<N>& boxes, const InvRay& r, float t_min, float t_max, float t_enter[N])
+    {
+        return IntersectAABBxNScalar<N>(boxes, r, t_min, t_max, t_enter);
+    }
+};
+
+// 近い面と遠い面の配列の先頭から4個を判定する
+// _mm_max_ps(a, b)はaがNaNのときbを返すので、NaNの軸は無視される（ffmaxと同じ）
+inline unsigned IntersectAABB4SSE(const float* const nearPlane[3], const float* const farPlane[3], const InvRay& r,
+    float t_min, float t_max, float* t_enter)
+{
+    __m128 tmin = _mm_set1_ps(t_min);
+    __m128 tmax = _mm_set1_ps(t_max);
+    for (int a = 0; a < 3; a++) {
+        __m128 org = _mm_set1_ps(r.org[a]);
+        __m128 inv = _mm_set1_ps(r.invDir[a]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearPlane[a]), org), inv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farPlane[a]), org), inv);
+        tmin = _mm_max_ps(t0, tmin);
+        tmax = _mm_min_ps(t1, tmax);
+    }
+    _mm_storeu_ps(t_enter, tmin);
+    return (unsigned)_mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+}
+
+template<>
+struct WideAABBHost<4> {
+    static unsigned Intersect(const AABBxN<4>& boxes, const InvRay& r, float t_min, float t_max, float t_enter[4])
+    {
+        const float* nearPlane[3];
+        const float* farPlane[3];
+        for (int a = 0; a < 3; a++) {
+            nearPlane[a] = r.sign[a] ? boxes.bmax[a] : boxes.bmin[a];
+            farPlane[a] = r.sign[a] ? boxes.bmin[a] : boxes.bmax[a];
+        }
+        return IntersectAABB4SSE(nearPlane, farPlane, r, t_min, t_max, t_enter);
+    }
+};
+
+template<>
+struct WideAABBHost<8> {
+    static unsigned Intersect(const AABBxN<8>& boxes, const InvRay& r, float t_min, float t_max, float t_enter[8])
+    {
+#ifdef WIDE_AABB_AVX
+        __m256 tmin = _mm256_set1_ps(t_min);
+        __m256 tmax = _mm256_set1_ps(t_max);
+        for (int a = 0; a < 3; a++) {
+            __m256 org = _mm256_set1_ps(r.org[a]);
+            __m256 inv = _mm256_set1_ps(r.invDir[a]);
+            __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(r.sign[a] ? boxes.bmax[a] : boxes.bmin[a]), org), inv);
+            __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(r.sign[a] ? boxes.bmin[a] : boxes.bmax[a]), org), inv);
+            tmin = _mm256_max_ps(t0, tmin);
+            tmax = _mm256_min_ps(t1, tmax);
+        }
+        _mm256_storeu_ps(t_enter, tmin);
+        return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+#else
+        // AVXがないときは4個ずつ2回に分ける
+        const float* nearPlane[3];
+        const float* farPlane[3];
+        for (int a = 0; a < 3; a++) {
+            nearPlane[a] = r.sign[a] ? boxes.bmax[a] : boxes.bmin[a];
+            farPlane[a] = r.sign[a] ? boxes.bmin[a] : boxes.bmax[a];
+        }
+        unsigned mask = IntersectAABB4SSE(nearPlane, farPlane, r, t_min, t_max, t_enter);
+        for (int a = 0; a < 3; a++) {
+            nearPlane[a] += 4;
+            farPlane[a] += 4;
+        }
+        return mask | (IntersectAABB4SSE(nearPlane, farPlane, r, t_min, t_max, t_enter + 4) << 4);
+#endif
+    }
+};
+#endif
+
+// GPUでは1スレッドが1本の光線なので、要素ごとのループのまま使う
+template<int N>
+__host__ __device__ inline unsigned IntersectAABBxN(const AABBxN<N>& boxes, const InvRay& r,
+    float t_min, float t_max, float t_enter[N])
+{
+#if !defined(__CUDA_ARCH__) && defined(WIDE_AABB_SSE)
+    return WideAABBHost<N>::Intersect(boxes, r, t_min, t_max, t_enter);
+#else
+    return IntersectAABBxNScalar<N>(boxes, r, t_min, t_max, t_enter);
+#endif
+}
@@ -3,6 +3,7 @@
 #include <curand.h>
 #include <curand_kernel.h>
 
+#include <algorithm>
 #include <float.h>
 #include <set>
 
@@ -16,9 +17,10 @@
 #include "material/material.h"
 #include "hitable/animationData.h"
 #include "shapes/MeshObject.h"
+#include "hitable/BoneBVH.h"
 #include "core/deviceManage.h"
 #include "Loader/FbxLoader.h"
-#include "hitable/BoneBVH.h"
+#include "profiler.h"
 
 __device__ float rand(curandState* state) {
     return float(curand_uniform(state));
@@ -38,25 +40,53 @@ __global__ void create_List(HitableList** list,int n)
 }
 
 
-//BVH̍쐬
+//BVHの作成
 __global__ void create_BVH(HitableList** list, BVHNode** bvh,curandState* state) {
     *bvh = new BVHNode((*list)->list, (*list)->list_size, 0, 1, state);
 }
 
-__global__ void UpdateBVH(BVHNode** bvh) {
+__global__ void UpdateBVH(BVHNode** bvh, int rotationBudget, int* rotations) {
     if (threadIdx.x == 0 && blockIdx.x == 0)
     {
-        (*bvh)->UpdateBVH();
+        int budget = rotationBudget;
+        (*bvh)->UpdateBVH(rotationBudget > 0 ? &budget : nullptr);
+        if (rotations) *rotations = rotationBudget - budget;
     }
 }
 
-void Update_BVH(BVHNode** d_bvhNode)
+__global__ void UpdateMotionBVH(BVHNode** bvh) {
+    if (threadIdx.x == 0 && blockIdx.x == 0)
+    {
+        (*bvh)->UpdateMotionBVH();
+    }
+}
+
+// シャッターが開くときと閉じるときの箱をリフィットする
+void Update_MotionBVH(BVHNode** d_bvhNode)
 {
-    UpdateBVH << <1, 1 >> > (d_bvhNode);
+    PROFILE_SCOPE("refit");
+    UpdateMotionBVH << <1, 1 >> > (d_bvhNode);
     CHECK(cudaDeviceSynchronize());
     checkCudaErrors(cudaGetLastError());
 }
 
+__global__ void bvh_sah_cost(BVHNode** bvh, float* cost) {
+    if (threadIdx.x == 0 && blockIdx.x == 0)
+    {
+        *cost = (*bvh)->SAHCost();
+    }
+}
+
+float BVHSAHCost(BVHNode** d_bvhNode)
+{
+    DeviceBuffer<float> cost(1);
+    bvh_sah_cost << <1, 1 >> > (d_bvhNode, cost.get());
+    checkCudaErrors(cudaGetLastError());
+    float h_cost;
+    checkCudaErrors(cudaMemcpy(&h_cost, cost.get(), sizeof(float), cudaMemcpyDeviceToHost));
+    return h_cost;
+}
+
 __global__ void UpdateBVH(HitableList** list,vec3* nowT) {
 
     for (size_t i = 0; i < (*list)->list_size; i++)
@@ -77,66 +107,184 @@ __global__ void UpdateBVH(HitableList** list, vec3* d_nowTransform, int boneCoun
 }
 
 
-void Update_BVH(HitableList** d_boneBvhNode, FBXObject* obj)
+// フレームごとの姿勢の更新で使い回すバッファ
+// レンダリングのループの前に一度だけ確保し、変化しない頂点インデックスもここで一度だけ転送する
+class SkinningBuffers {
+public:
+    SkinningBuffers(const FBXObject* obj)
+    {
+        h_pointPos.Allocate(obj->mesh->nPoints);
+        d_newPos.Allocate(obj->mesh->nPoints);
+        h_closePos.Allocate(obj->mesh->nPoints);
+        d_closePos.Allocate(obj->mesh->nPoints);
+        d_idxVertices.Upload(obj->mesh->idxVertex, obj->mesh->nTriangles);
+        if (obj->mesh->cornerNormals) {
+            h_cornerNormal.Allocate(obj->mesh->nTriangles * 3);
+            d_newNormal.Allocate(obj->mesh->nTriangles * 3);
+        }
+        skinNormals = obj->mesh->cornerNormals != nullptr;
+        h_boneTransform.Allocate(obj->boneCount);
+        d_boneTransform.Allocate(obj->boneCount);
+        checkCudaErrors(cudaStreamCreate(&stream));
+    }
+    SkinningBuffers(const SkinningBuffers&) = delete;
+    SkinningBuffers& operator=(const SkinningBuffers&) = delete;
+    ~SkinningBuffers()
+    {
+        checkCudaErrors(cudaStreamDestroy(stream));
+    }
+
+    PinnedBuffer<vec3> h_pointPos;//スキニング後の頂点座標（転送元）
+    DeviceBuffer<vec3> d_newPos;
+    PinnedBuffer<vec3> h_closePos;//モーションブラーでシャッターが閉じるときの頂点座標（転送元）
+    DeviceBuffer<vec3> d_closePos;
+    DeviceBuffer<vec3> d_idxVertices;
+    PinnedBuffer<vec3> h_cornerNormal;//スキニング後の三角形の頂点ごとの法線（転送元）
+    DeviceBuffer<vec3> d_newNormal;
+    bool skinNormals;//falseなら法線は更新しない（読み込み時の法線のまま）
+    PinnedBuffer<vec3> h_boneTransform;//ボーンの位置（転送元）
+    DeviceBuffer<vec3> d_boneTransform;
+    cudaStream_t stream;
+};
+
+
+// rotationBudgetが正なら1フレームでその回数まで木を回転する
+// 回転した回数はrotationCounter（1要素、呼び出し側でループの前に一度だけ確保する）で受け取って返す
+// rotationCounterがなくても回転はするが、回数は数えずに-1を返す
+int Update_BVH(BVHNode** d_bvhNode, int rotationBudget = 0, DeviceBuffer<int>* rotationCounter = nullptr)
+{
+    PROFILE_SCOPE("refit");
+    int* d_rotations = rotationBudget > 0 && rotationCounter ? rotationCounter->get() : nullptr;
+    UpdateBVH << <1, 1 >> > (d_bvhNode, rotationBudget, d_rotations);
+    CHECK(cudaDeviceSynchronize());
+    checkCudaErrors(cudaGetLastError());
+    if (rotationBudget <= 0) return 0;
+    if (!d_rotations) return -1;
+    int count = 0;
+    checkCudaErrors(cudaMemcpy(&count, d_rotations, sizeof(int), cudaMemcpyDeviceToHost));
+    return count;
+}
+
+
+void Update_BVH(HitableList** d_boneBvhNode, FBXObject* obj, SkinningBuffers* buffers)
 {
-    vec3* h_nowTransform = (vec3*)malloc(sizeof(vec3) * obj->boneCount);
+    PROFILE_SCOPE("refit");
+    if (obj->boneCount == 0) return;
     for (int i = 0; i < obj->boneCount; i++)
     {
-        h_nowTransform[i] = obj->boneList[i].nowTransform;
+        buffers->h_boneTransform[i] = obj->boneList[i].nowTransform;
     }
 
-    vec3* d_nowTransform;
-    cudaMalloc(&d_nowTransform, sizeof(vec3) * obj->boneCount);
-    cudaMemcpy(d_nowTransform, h_nowTransform, obj->boneCount * sizeof(vec3), cudaMemcpyHostToDevice);
-    UpdateBVH << <1, obj->boneCount >> > (d_boneBvhNode, d_nowTransform, obj->boneCount);
-    CHECK(cudaDeviceSynchronize());
+    const int threads = 256;
+    buffers->d_boneTransform.UploadAsync(buffers->h_boneTransform.get(), obj->boneCount, buffers->stream);
+    UpdateBVH << <(obj->boneCount + threads - 1) / threads, threads, 0, buffers->stream >> > (d_boneBvhNode, buffers->d_boneTransform.get(), obj->boneCount);
     checkCudaErrors(cudaGetLastError());
-    checkCudaErrors(cudaFree(d_nowTransform));
-    free(h_nowTransform);
+    CHECK(cudaStreamSynchronize(buffers->stream));
 }
 
 
-__global__ void update_pose(Triangle** tris, vec3* newPos, vec3* idxVertices, int triangleNum)
+// 三角形ごとに1スレッドで頂点を更新する。newNormal（三角形ごとに3頂点分）があれば頂点の法線も更新する
+__global__ void update_pose(Triangle** tris, vec3* newPos, vec3* newNormal, vec3* idxVertices, int triangleNum)
 {
-    if (threadIdx.x == 0 && blockIdx.x == 0)
+    int i = blockDim.x * blockIdx.x + threadIdx.x;
+    if (i < triangleNum)
+    {
+        vec3 idx = idxVertices[i];
+        vec3 v[3] = { newPos[int(idx[2])], newPos[int(idx[1])], newPos[int(idx[0])] };
+        tris[i]->SetVertices(v);
+        if (newNormal) {
+            vec3 n[3] = { newNormal[i * 3 + 2], newNormal[i * 3 + 1], newNormal[i * 3] };
+            tris[i]->SetVertexNormals(n);
+        }
+    }
+}
+
+// シャッターが開くときと閉じるときの頂点を設定する
+// 法線はシャッターが開くときのものを使う
+__global__ void update_motion_pose(Triangle** tris, vec3* openPos, vec3* closePos, vec3* openNormal, vec3* idxVertices, int triangleNum)
+{
+    int i = blockDim.x * blockIdx.x + threadIdx.x;
+    if (i < triangleNum)
     {
-        for (int i = 0; i < triangleNum; i++) {
-            vec3 idx = idxVertices[i];
-            vec3 v[3] = { newPos[int(idx[2])], newPos[int(idx[1])], newPos[int(idx[0])] };
-            tris[i]->SetVertices(v);
+        vec3 idx = idxVertices[i];
+        vec3 v0[3] = { openPos[int(idx[2])], openPos[int(idx[1])], openPos[int(idx[0])] };
+        vec3 v1[3] = { closePos[int(idx[2])], closePos[int(idx[1])], closePos[int(idx[0])] };
+        tris[i]->SetMotionVertices(v0, v1);
+        if (openNormal) {
+            vec3 n[3] = { openNormal[i * 3 + 2], openNormal[i * 3 + 1], openNormal[i * 3] };
+            tris[i]->SetVertexNormals(n);
         }
     }
 }
 
-void calcPose(int frame, const FBXObject* data, vec3*& newPos)
+// newNormalを渡すと三角形の頂点ごとの法線も、その頂点の変換行列で変換する
+void calcPose(int frame, const FBXObject* data, vec3*& newPos, vec3* newNormal = nullptr)
 {
-    // <ŏIIȒ_WvZVERTEXɕϊ>
+    const FbxMatrix* deformation = data->fbxAnimationData->animation[frame].clusterDeformation;
+    // <最終的な頂点座標を計算しVERTEXに変換>
     for (int pi = 0; pi < data->mesh->nPoints; pi++) {
         FbxVector4 oriPos = FbxVector4(data->mesh->points[pi].x(), data->mesh->points[pi].y(), data->mesh->points[pi].z(),1);
-        FbxVector4 outVertex = data->fbxAnimationData->animation[frame].clusterDeformation[pi].MultNormalize(oriPos);
+        FbxVector4 outVertex = deformation[pi].MultNormalize(oriPos);
         float x = (float)outVertex[0];
         float y = (float)outVertex[1];
         float z = (float)outVertex[2];
 
         newPos[pi] = vec3(x, y, z);
     }
+    if (!newNormal) return;
+    for (int ti = 0; ti < data->mesh->nTriangles; ti++) {
+        const vec3 idx = data->mesh->idxVertex[ti];
+        for (int k = 0; k < 3; k++) {
+            newNormal[ti * 3 + k] = skinNormal(deformation[int(idx[k])], data->mesh->cornerNormals[ti * 3 + k]);
+        }
+    }
 }
 
-void updateFBXObj(int frameIndex, FBXObject* obj, Triangle** triangleList) {
-    vec3* h_pointPos = (vec3*)malloc(sizeof(vec3) * obj->mesh->nPoints);
-    calcPose(frameIndex, obj, h_pointPos);
-    vec3* d_newPos;
-    cudaMalloc(&d_newPos, sizeof(vec3) * obj->mesh->nPoints);
-    cudaMemcpy(d_newPos, h_pointPos, obj->mesh->nPoints * sizeof(vec3), cudaMemcpyHostToDevice);
-    vec3* d_idxVertices;
-    cudaMalloc(&d_idxVertices, sizeof(vec3) * obj->mesh->nTriangles);
-    cudaMemcpy(d_idxVertices, obj->mesh->idxVertex, obj->mesh->nTriangles * sizeof(vec3), cudaMemcpyHostToDevice);
-    update_pose << <1, 1 >> > (triangleList, d_newPos, d_idxVertices, obj->mesh->nTriangles);
-    CHECK(cudaDeviceSynchronize());
+// h_pointPosの頂点座標（skinNormalsならh_cornerNormalの法線も）を転送して三角形の頂点を更新する
+void uploadFBXObjPose(FBXObject* obj, Triangle** triangleList, SkinningBuffers* buffers) {
+    buffers->d_newPos.UploadAsync(buffers->h_pointPos.get(), obj->mesh->nPoints, buffers->stream);
+    if (buffers->skinNormals) buffers->d_newNormal.UploadAsync(buffers->h_cornerNormal.get(), obj->mesh->nTriangles * 3, buffers->stream);
+    const int threads = 256;
+    update_pose << <(obj->mesh->nTriangles + threads - 1) / threads, threads, 0, buffers->stream >> > (triangleList, buffers->d_newPos.get(),
+        buffers->skinNormals ? buffers->d_newNormal.get() : nullptr, buffers->d_idxVertices.get(), obj->mesh->nTriangles);
+    checkCudaErrors(cudaGetLastError());
+    CHECK(cudaStreamSynchronize(buffers->stream));
+}
+
+void updateFBXObj(int frameIndex, FBXObject* obj, Triangle** triangleList, SkinningBuffers* buffers) {
+    PROFILE_SCOPE("skinning");
+    vec3* h_pointPos = buffers->h_pointPos.get();
+    calcPose(frameIndex, obj, h_pointPos, buffers->skinNormals ? buffers->h_cornerNormal.get() : nullptr);
+    uploadFBXObjPose(obj, triangleList, buffers);
+}
+
+// モーションブラー用に、frameIndexの姿勢でシャッターが開き、次のフレームまでのshutterの割合だけ動いて閉じるようにする
+// 次のフレームの姿勢との間は線形補間する。最後のフレームは動かない
+void updateFBXObjMotion(int frameIndex, float shutter, FBXObject* obj, Triangle** triangleList, SkinningBuffers* buffers) {
+    PROFILE_SCOPE("skinning");
+    vec3* h_pointPos = buffers->h_pointPos.get();
+    vec3* h_closePos = buffers->h_closePos.get();
+    calcPose(frameIndex, obj, h_pointPos, buffers->skinNormals ? buffers->h_cornerNormal.get() : nullptr);
+    calcPose(std::min(frameIndex + 1, obj->fbxAnimationData->frameCount - 1), obj, h_closePos);
+    for (int pi = 0; pi < obj->mesh->nPoints; pi++)
+    {
+        h_closePos[pi] = lerp(shutter, h_pointPos[pi], h_closePos[pi]);
+    }
+    buffers->d_newPos.UploadAsync(h_pointPos, obj->mesh->nPoints, buffers->stream);
+    buffers->d_closePos.UploadAsync(h_closePos, obj->mesh->nPoints, buffers->stream);
+    if (buffers->skinNormals) buffers->d_newNormal.UploadAsync(buffers->h_cornerNormal.get(), obj->mesh->nTriangles * 3, buffers->stream);
+    const int threads = 256;
+    update_motion_pose << <(obj->mesh->nTriangles + threads - 1) / threads, threads, 0, buffers->stream >> > (triangleList, buffers->d_newPos.get(), buffers->d_closePos.get(),
+        buffers->skinNormals ? buffers->d_newNormal.get() : nullptr, buffers->d_idxVertices.get(), obj->mesh->nTriangles);
     checkCudaErrors(cudaGetLastError());
-    checkCudaErrors(cudaFree(d_newPos));
-    checkCudaErrors(cudaFree(d_idxVertices));
-    free(h_pointPos);
+    CHECK(cudaStreamSynchronize(buffers->stream));
+}
+
+// メッシュを読み込んだときの姿勢に戻す（BVHの構築前に使う）
+void resetFBXObjPose(FBXObject* obj, Triangle** triangleList, SkinningBuffers* buffers) {
+    memcpy(buffers->h_pointPos.get(), obj->mesh->points, sizeof(vec3) * obj->mesh->nPoints);
+    if (buffers->skinNormals) memcpy(buffers->h_cornerNormal.get(), obj->mesh->cornerNormals, sizeof(vec3) * obj->mesh->nTriangles * 3);
+    uploadFBXObjPose(obj, triangleList, buffers);
 }
 
 __global__ void create_camera(Camera** camera, int nx, int ny,
@@ -153,36 +301,99 @@ __global__ void create_camera(Camera** camera, int nx, int ny,
     }
 }
 
-void init_camera(Camera** camera, int nx, int ny,CudaPointerList* pointerList) {
+// 既存のカメラを破棄して作り直す
+__global__ void reset_camera(Camera** camera, int nx, int ny,
+    vec3 lookfrom, vec3 lookat, float dist_to_focus, float aperture, float vfov)
+{
+    if (threadIdx.x == 0 && blockIdx.x == 0) {
+        delete* camera;
+        *camera = new Camera(lookfrom,
+            lookat,
+            vec3(0, 1, 0),
+            vfov,
+            float(nx) / float(ny),
+            aperture,
+            dist_to_focus);
+    }
+}
+
+void set_camera(Camera** camera, int nx, int ny,
+    vec3 lookfrom, vec3 lookat, float dist_to_focus, float aperture, float vfov)
+{
+    reset_camera << <1, 1 >> > (camera, nx, ny, lookfrom, lookat, dist_to_focus, aperture, vfov);
+    checkCudaErrors(cudaGetLastError());
+    checkCudaErrors(cudaDeviceSynchronize());
+}
+
+__global__ void set_camera_shutter(Camera** camera, float time0, float time1)
+{
+    if (threadIdx.x == 0 && blockIdx.x == 0) {
+        (*camera)->time0 = time0;
+        (*camera)->time1 = time1;
+    }
+}
+
+// 光線の時刻をtime0からtime1の間で選ぶようにする。同じ時刻なら止まった画像になる
+void SetCameraShutter(Camera** camera, float time0, float time1)
+{
+    set_camera_shutter << <1, 1 >> > (camera, time0, time1);
+    checkCudaErrors(cudaGetLastError());
+    checkCudaErrors(cudaDeviceSynchronize());
+}
+
+void init_camera(Camera** camera, int nx, int ny, ResourceList* resources) {
     //create_camera << <1, 1 >> > (camera, nx, ny, vec3(0, 150, 400), vec3(0, 150, 0), 10.0, 0.0, 40);//low_walk
     //create_camera << <1, 1 >> > (camera, nx, ny, vec3(0, 200, 2000), vec3(0, 200, 0), 10.0, 0.0, 40);//dragon
     //create_camera << <1, 1 >> > (camera, nx, ny, vec3(200, 250, 200), vec3(0, 200, 0), 10.0, 0.0, 60);//high_walk
     create_camera << <1, 1 >> > (camera, nx, ny, vec3(0, 100, 1000), vec3(0, 150, 0), 10.0, 0.0, 40);//cube
 
-    pointerList->append((void**)camera);
+    TrackDeviceObject(resources, camera, "Camera");
     checkCudaErrors(cudaGetLastError());
     checkCudaErrors(cudaDeviceSynchronize());
 }
 
-void init_List(HitableList** list, CudaPointerList* pointerList)
+void init_List(HitableList** list, ResourceList* resources)
 {
     create_List << <1, 1 >> > (list);
     checkCudaErrors(cudaGetLastError());
     checkCudaErrors(cudaDeviceSynchronize());
-    pointerList->append((void**)list);
+    TrackDeviceObject(resources, list, "HitableList");
 }
 
-__global__ void add_mesh_withNormal(HitableList** list, Triangle** triangles, vec3* points, vec3* normal, vec3* idxVertex, int nTriangles)
+// 三角形を所有するメッシュのリストを作成する
+void init_MeshList(HitableList** list, ResourceList* resources)
+{
+    create_List << <1, 1 >> > (list);
+    checkCudaErrors(cudaGetLastError());
+    checkCudaErrors(cudaDeviceSynchronize());
+    TrackDeviceObject(resources, list, "MeshList", LaunchDestroyMesh);
+}
+
+// マテリアルはmaterialColorsの色ごとに1つ作ってmatsに入れ、同じ番号の三角形で共有する
+// matsはホストから確保したnMaterials個の配列（デバイスのヒープを使わない）
+// cornerNormalsがあれば三角形の頂点ごとの法線で、uvsがあれば三角形の頂点ごとのUVで補間する
+__global__ void add_mesh_withNormal(HitableList** list, Triangle** triangles, vec3* points, vec3* normal, vec3* idxVertex, int nTriangles,
+    int* materialIds, vec3* materialColors, int nMaterials, Material** mats, vec3* cornerNormals, vec3* uvs)
 {
     if (threadIdx.x == 0 && blockIdx.x == 0)
     {
-        (*list) = new HitableList(nTriangles);
-        Material* mat = new Lambertian(new ConstantTexture(vec3(0.65, 0.05, 0.05)));
+        (*list)->resize(nTriangles);
+        for (int i = 0; i < nMaterials; i++) {
+            mats[i] = new Lambertian(new ConstantTexture(materialColors[i]));
+        }
         for (int i = 0; i < nTriangles; i++) {
             vec3 idx = idxVertex[i];
             vec3 v[3] = { points[int(idx[2])], points[int(idx[1])], points[int(idx[0])] };
             Transform* transform = new Transform(vec3(0), vec3(0), vec3(1));
-            Triangle* tri = new Triangle(v, normal[i], mat, false, transform, false);
+            Triangle* tri = new Triangle(v, normal[i], mats[materialIds[i]], false, transform, false);
+            if (cornerNormals) {
+                vec3 n[3] = { cornerNormals[i * 3 + 2], cornerNormals[i * 3 + 1], cornerNormals[i * 3] };
+                tri->SetVertexNormals(n);
+            }
+            if (uvs) {
+                vec3 uv[3] = { uvs[i * 3 + 2], uvs[i * 3 + 1], uvs[i * 3] };
+                tri->SetUVs(uv);
+            }
             (*list)->list[i] = tri;
             triangles[i] = tri;
         }
@@ -191,27 +402,34 @@ __global__ void add_mesh_withNormal(HitableList** list, Triangle** triangles, ve
 
 void create_FBXMesh(HitableList** list, FBXObject* data) 
 {
-    vec3* d_point;
-    cudaMalloc(&d_point, sizeof(vec3) * data->mesh->nPoints);
-    cudaMemcpy(d_point, data->mesh->points, data->mesh->nPoints * sizeof(vec3), cudaMemcpyHostToDevice);
-    vec3* d_idxVertices;
-    cudaMalloc(&d_idxVertices, sizeof(vec3) * data->mesh->nTriangles);
-    cudaMemcpy(d_idxVertices, data->mesh->idxVertex, data->mesh->nTriangles * sizeof(vec3), cudaMemcpyHostToDevice);
-    vec3* d_normals;
-    cudaMalloc(&d_normals, sizeof(vec3) * data->mesh->nTriangles);
-    cudaMemcpy(d_normals, data->mesh->normals, data->mesh->nTriangles * sizeof(vec3), cudaMemcpyHostToDevice);
-    cudaMalloc(&data->d_triangleData, sizeof(Triangle*) * data->mesh->nTriangles);
-    add_mesh_withNormal << <1, 1 >> > (list, data->d_triangleData, d_point, d_normals, d_idxVertices, data->mesh->nTriangles); //bV̈ړƍ쐬
+    PROFILE_SCOPE("mesh");
+    // 一時的なバッファは全てDeviceBufferにして、関数を抜けるときに解放する
+    DeviceBuffer<vec3> d_point;
+    d_point.Upload(data->mesh->points, data->mesh->nPoints);
+    DeviceBuffer<vec3> d_idxVertices;
+    d_idxVertices.Upload(data->mesh->idxVertex, data->mesh->nTriangles);
+    DeviceBuffer<vec3> d_normals;
+    d_normals.Upload(data->mesh->normals, data->mesh->nTriangles);
+    DeviceBuffer<int> d_materialIds;
+    d_materialIds.Upload(data->mesh->materialIds, data->mesh->nTriangles);
+    DeviceBuffer<vec3> d_materialColors;
+    d_materialColors.Upload(data->mesh->materialColors, data->mesh->nMaterials);
+    DeviceBuffer<vec3> d_cornerNormals;
+    if (data->mesh->cornerNormals) d_cornerNormals.Upload(data->mesh->cornerNormals, data->mesh->nTriangles * 3);
+    DeviceBuffer<vec3> d_uvs;
+    if (data->mesh->uvs) d_uvs.Upload(data->mesh->uvs, data->mesh->nTriangles * 3);
+    DeviceBuffer<Material*> d_mats(data->mesh->nMaterials);
+    data->d_triangleData.Allocate(data->mesh->nTriangles);
+    add_mesh_withNormal << <1, 1 >> > (list, data->d_triangleData.get(), d_point.get(), d_normals.get(), d_idxVertices.get(), data->mesh->nTriangles,
+        d_materialIds.get(), d_materialColors.get(), data->mesh->nMaterials, d_mats.get(), d_cornerNormals.get(), d_uvs.get()); //メッシュの移動と作成
     CHECK(cudaDeviceSynchronize());
     checkCudaErrors(cudaGetLastError());
-    checkCudaErrors(cudaFree(d_point));
-    checkCudaErrors(cudaFree(d_idxVertices));
-    checkCudaErrors(cudaFree(d_normals));
 }
 
-void create_BVHfromList(BVHNode** bvh,HitableList** list, curandState* curand_state, CudaPointerList* pointerList)
+void create_BVHfromList(BVHNode** bvh,HitableList** list, curandState* curand_state, ResourceList* resources)
 {
-    pointerList->append((void**)bvh);
+    PROFILE_SCOPE("build");
+    TrackDeviceObject(resources, bvh, "BVHNode");
     create_BVH << <1, 1 >> > (list, bvh, curand_state);
     CHECK(cudaDeviceSynchronize());
     checkCudaErrors(cudaGetLastError());
@@ -221,10 +439,10 @@ void create_BVHfromList(BVHNode** bvh,HitableList** list, curandState* curand_st
 __global__ void create_BoneBVH(HitableList** bvh_list, bool* d_hasTriangle, int boneIndex,
     curandState* curand_state, int hasTriangleNum, int nTriangles, vec3 defaultTransform, vec3 nowTransform, Triangle** fbxList)
 {
-    // {[̎Op`HitableList쐬
+    // ボーンの三角形のHitableListを作成
     HitableList* triangleList = new HitableList(hasTriangleNum);
     int i = 0;
-    //Op`setɊ܂܂邩A܂܂Ă烊Xgɓ
+    //三角形がsetに含まれるか判定、含まれてたらリストに入れる
     for (int triangleIndex = 0; triangleIndex < nTriangles; triangleIndex++)
     {
         if (d_hasTriangle[triangleIndex]) {
@@ -233,11 +451,11 @@ __global__ void create_BoneBVH(HitableList** bvh_list, bool* d_hasTriangle, int
         }
     }
 
-    //XgBoneBVHNode쐬
+    //リストからBoneBVHNodeを作成する
     BoneBVHNode* node = new BoneBVHNode(triangleList->list, triangleList->list_size, 0, 1, curand_state, defaultTransform, nowTransform, true);
-    //BoneBVHNodeListɒǉ
+    //BoneBVHNodeをListに追加
     (*bvh_list)->list[boneIndex] = node;
-    triangleList->freeMemory();
+    delete triangleList;
 }
 
 
@@ -245,24 +463,26 @@ __global__ void create_BoneBVH(HitableList** bvh_list, bool* d_hasTriangle, int
 
 __global__ void create_emptyBoneBVH(HitableList** list,int boneIndex)
 {
-    //XgBoneBVHNode쐬
+    //リストからBoneBVHNodeを作成する
     BoneBVHNode* node = new BoneBVHNode(true);
     (*list)->list[boneIndex] = node;
 }
 
-void createBoneBVH(HitableList** list, FBXObject* fbxData, curandState* curand_state, CudaPointerList* pointerList)
+void createBoneBVH(HitableList** list, FBXObject* fbxData, curandState* curand_state, ResourceList* resources)
 {
+    PROFILE_SCOPE("build");
     create_List << <1, 1 >> > (list, fbxData->boneCount);
     CHECK(cudaDeviceSynchronize());
     checkCudaErrors(cudaGetLastError());
+    TrackDeviceObject(resources, list, "BoneBVHList", LaunchDestroyBoneBVH);
 
     std::vector<bool> IsTriangleAdded(fbxData->mesh->nTriangles, false);
 
-    // BoneBVHNode{[쐬
+    // BoneBVHNodeをボーン分作成
     for (int boneIndex = 0; boneIndex < fbxData->boneCount; boneIndex++)
     {
         bool* h_hasTriangle = (bool*)malloc(fbxData->mesh->nTriangles * sizeof(bool));
-        //setɃ{[̒_̃CfbNXi[
+        //setにボーンの頂点のインデックスを格納
         std::set<int> boneVerticesIndexes;
 
         for (int weightIndex = 0; weightIndex < fbxData->boneList[boneIndex].weightCount; weightIndex++)
@@ -271,7 +491,7 @@ void createBoneBVH(HitableList** list, FBXObject* fbxData, curandState* curand_s
         }
 
         int hasTriangleNum = 0;
-        //Op`setɊ܂܂邩A܂܂Ă烊Xgɓ
+        //三角形がsetに含まれるか判定、含まれてたらリストに入れる
         for (int triangleIndex = 0; triangleIndex < fbxData->mesh->nTriangles; triangleIndex++)
         {
             h_hasTriangle[triangleIndex] = false;
@@ -295,7 +515,7 @@ void createBoneBVH(HitableList** list, FBXObject* fbxData, curandState* curand_s
         }
         else {
             create_BoneBVH << <1, 1 >> > (list, d_hasTriangle, boneIndex,
-                curand_state, hasTriangleNum, fbxData->mesh->nTriangles, fbxData->boneList[boneIndex].defaultTransform, fbxData->boneList[boneIndex].nowTransform, fbxData->d_triangleData);
+                curand_state, hasTriangleNum, fbxData->mesh->nTriangles, fbxData->boneList[boneIndex].defaultTransform, fbxData->boneList[boneIndex].nowTransform, fbxData->d_triangleData.get());
         }
 
         CHECK(cudaDeviceSynchronize());
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <map>
+#include <tuple>
+#include <vector>
+#include "flatSceneBuilder.h"
+
+// スキニングしてリフィットしたメッシュ（BLAS）を (キャラクター, クリップ, フレーム) ごとに取っておくキャッシュ
+// 同じフレームのインスタンスは1つのメッシュを共有し、前のフレームで作った姿勢は作り直さない
+// メッシュはFlatSceneの中に作り、使わなくなったら同じキャラクターの別の姿勢に使い回す（シーンの配列は縮まない）
+// budgetBytesを超える場合は、今のフレームで使っていないメッシュのうち最も長く使われていないものを使い回す
+// 全て使っている場合は予算を超えてメッシュを作る
+class FlatBLASCache {
+public:
+    FlatBLASCache(size_t budgetBytes) : budgetBytes(budgetBytes), bytes(0), hits(0), misses(0), evictions(0), clock(0) {}
+
+    // メッシュの形（頂点数・三角形）を登録する。idxVertexは呼び出し側が持ち続ける
+    int AddCharacter(const vec3* restPoints, int nPoints, const vec3* idxVertex, int nTriangles, int material)
+    {
+        Character character;
+        character.restPoints = restPoints;
+        character.idxVertex = idxVertex;
+        character.nPoints = nPoints;
+        character.nTriangles = nTriangles;
+        character.material = material;
+        character.meshBytes = 0;
+        characters.push_back(character);
+        return (int)characters.size() - 1;
+    }
+
+    // 描画するフレームごとに1回呼ぶ。これ以降にAcquireしたメッシュは、このフレームの間は使い回さない
+    void BeginFrame() { clock++; }
+
+    // 姿勢のメッシュの番号を返す。なければメッシュを用意し、次のUpdateで姿勢を計算する
+    int Acquire(FlatScene& scene, int character, int clip, int frame)
+    {
+        const Key key(character, clip, frame);
+        auto found = entries.find(key);
+        if (found != entries.end()) {
+            hits++;
+            slots[found->second].lastUse = clock;
+            return slots[found->second].mesh;
+        }
+        misses++;
+        int slot = FindSlot(scene, character);
+        if (slots[slot].used) entries.erase(slots[slot].key);
+        slots[slot].key = key;
+        slots[slot].used = true;
+        slots[slot].pending = true;
+        slots[slot].lastUse = clock;
+        entries[key] = slot;
+        return slots[slot].mesh;
+    }
+
+    // Acquireで用意したメッシュの姿勢を計算してリフィットする。pose(character, clip, frame, points)
+    // メッシュごとにプリミティブとノードの範囲が別なので、並列に処理する
+    template<class PoseFunc>
+    void Update(FlatScene& scene, const PoseFunc& pose, int threadCount = 1)
+    {
+        std::vector<int> pending;
+        for (int i = 0; i < (int)slots.size(); i++)
+        {
+            if (slots[i].pending) pending.push_back(i);
+        }
+        ParallelTasks((int)pending.size(), threadCount, [&](int i) {
+            Slot& slot = slots[pending[i]];
+            const Character& character = characters[std::get<0>(slot.key)];
+            std::vector<vec3> points(character.nPoints);
+            pose(std::get<0>(slot.key), std::get<1>(slot.key), std::get<2>(slot.key), points.data());
+            scene.UpdateTriangleMesh(slot.mesh, points.data(), character.idxVertex);
+            slot.pending = false;
+        });
+    }
+
+    // Acquireのうちキャッシュにあった割合
+    float HitRate() const { return hits + misses > 0 ? float(hits) / float(hits + misses) : 0.0f; }
+    void ResetStats() { hits = misses = evictions = 0; }
+
+    size_t budgetBytes;
+    size_t bytes;   // キャッシュのメッシュの三角形とノードの合計
+    int hits;
+    int misses;
+    int evictions;
+
+private:
+    typedef std::tuple<int, int, int> Key;  // キャラクター, クリップ, フレーム
+
+    struct Character {
+        const vec3* restPoints;
+        const vec3* idxVertex;
+        int nPoints;
+        int nTriangles;
+        int material;
+        size_t meshBytes;   // 最初のメッシュを作ったときに測る
+    };
+
+    struct Slot {
+        int character;
+        int mesh;
+        Key key;
+        bool used;      // keyの姿勢を持っている
+        bool pending;   // 姿勢をまだ計算していない
+        long long lastUse;
+    };
+
+    // 予算内なら新しいメッシュを作り、超えるなら同じキャラクターの最も長く使われていないメッシュを使い回す
+    int FindSlot(FlatScene& scene, int character)
+    {
+        Character& c = characters[character];
+        if (c.meshBytes == 0 || bytes + c.meshBytes <= budgetBytes) return NewSlot(scene, character);
+        int best = -1;
+        for (int i = 0; i < (int)slots.size(); i++)
+        {
+            const Slot& slot = slots[i];
+            if (slot.character != character || slot.lastUse == clock) continue;
+            if (best < 0 || slot.lastUse < slots[best].lastUse) best = i;
+        }
+        if (best < 0) return NewSlot(scene, character);
+        evictions++;
+        return best;
+    }
+
+    int NewSlot(FlatScene& scene, int character)
+    {
+        Character& c = characters[character];
+        const size_t primitiveCount = scene.primitives.size();
+        const size_t nodeCount = scene.nodes.size();
+        Slot slot;
+        slot.character = character;
+        slot.mesh = scene.AddTriangleMesh(c.restPoints, c.idxVertex, c.nTriangles, c.material);
+        slot.used = false;
+        slot.pending = false;
+        slot.lastUse = clock;
+        if (c.meshBytes == 0) {
+            c.meshBytes = (scene.primitives.size() - primitiveCount) * (sizeof(FlatPrimitive) + sizeof(int))
+                + (scene.nodes.size() - nodeCount) * sizeof(FlatBVHNode);
+        }
+        bytes += c.meshBytes;
+        slots.push_back(slot);
+        return (int)slots.size() - 1;
+    }
+
+    std::vector<Character> characters;
+    std::vector<Slot> slots;
+    std::map<Key, int> entries;  // 姿勢を持っているスロット
+    long long clock;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "flatScene.h"
+
+// ホストでのBVHの並列構築に使う関数
+// 上の階層はノードを1つずつ分割し、プリミティブの範囲を分けて並列に処理する
+// 小さくなった部分木は独立した仕事として、空いたスレッドが順に構築する
+
+// count個の仕事を、空いたスレッドが番号順に取って実行する（CPUでの描画の行の分担にも使う）
+template<class Func>
+void ParallelTasks(int count, int threadCount, const Func& func)
+{
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int i = next++; i < count; i = next++) func(i);
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < std::min(threadCount, count); i++) threads.emplace_back(worker);
+    worker();
+    for (std::thread& t : threads) t.join();
+}
+
+// [0, count)をchunkCount個の連続した範囲に分けて並列に実行する。func(chunk, begin, end)
+template<class Func>
+void ParallelChunks(int count, int chunkCount, const Func& func)
+{
+    ParallelTasks(chunkCount, chunkCount, [&](int chunk) {
+        func(chunk, (int)((long long)count * chunk / chunkCount), (int)((long long)count * (chunk + 1) / chunkCount));
+    });
+}
+
+// 並列に処理する範囲の数。少ない場合はスレッドを起こさない
+inline int FlatChunkCount(int count, int threadCount)
+{
+    const int MIN_CHUNK = 4096;
+    return std::max(1, std::min(threadCount, count / MIN_CHUNK));
+}
+
+// これより少ないプリミティブの部分木は独立した仕事にする（仕事の数がスレッド数の数倍になるように）
+inline int FlatSubtreeSize(int count, int threadCount)
+{
+    return threadCount <= 1 ? 0 : std::max(256, count / (threadCount * 8));
+}
+
+// 独立して構築する部分木。nodeは親の配列で予約したノード
+struct FlatSubtreeTask {
+    int node;
+    int begin, end;
+};
+
+// 部分木のノード（localの0番が根）を、nodes[rootIndex]と配列の末尾に移す
+// 部分木の中の子の番号と、葉のプリミティブの位置（leafOffsetを足す）を付け替える
+inline void AppendSubtree(std::vector<FlatBVHNode>& nodes, int rootIndex, const std::vector<FlatBVHNode>& local, int leafOffset)
+{
+    const int base = (int)nodes.size() - 1;
+    for (size_t i = 0; i < local.size(); i++)
+    {
+        FlatBVHNode node = local[i];
+        node.leftFirst += node.IsLeaf() ? leafOffset : base;
+        if (i == 0) nodes[rootIndex] = node;
+        else nodes.push_back(node);
+    }
+}
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "flatSceneBuilder.h"
+
+// アニメーションのクリップの全フレームの姿勢が分かっている場合のBVH
+// 等間隔に選んだフレーム（標本）の姿勢でのSAHの平均が小さくなるように木の形を決める
+// 重心のビンは標本の姿勢ごと・軸ごとに作り、左右の箱の表面積は全ての標本の姿勢で測る
+// storeBoundsならフレームごとのノードの箱を表にして、SetFrameではリフィットの代わりに表から写す
+class FlatClipBVH {
+public:
+    FlatClipBVH() : mesh(-1), frameCount(0), nodeCount(0) {}
+
+    // framePoints[frame]はそのフレームのスキニング後の頂点座標。追加したメッシュの番号を返す
+    // メッシュはシーンの末尾に追加し、0フレーム目の姿勢にしておく
+    int Build(FlatScene& scene, const std::vector<std::vector<vec3>>& framePoints, const vec3* idxVertex, int nTriangles,
+        int material, int sampleCount = 8, bool storeBounds = true)
+    {
+        frameCount = (int)framePoints.size();
+        mesh = scene.AddUnbuiltTriangleMesh(framePoints[0].data(), idxVertex, nTriangles, material);
+        FlatMesh& m = scene.meshes[mesh];
+
+        // 標本のフレームでの三角形の箱（並びはシーンのプリミティブの順）
+        sampleCount = std::max(1, std::min(sampleCount, frameCount));
+        const int count = m.primitiveCount;
+        std::vector<vec3> boxMin((size_t)sampleCount * count), boxMax((size_t)sampleCount * count);
+        for (int s = 0; s < sampleCount; s++)
+        {
+            int frame = sampleCount > 1 ? (int)((long long)s * (frameCount - 1) / (sampleCount - 1)) : 0;
+            const vec3* points = framePoints[frame].data();
+            for (int i = 0; i < count; i++)
+            {
+                vec3 idx = idxVertex[scene.sourceIndex[m.firstPrimitive + i]];
+                vec3 v0 = points[int(idx[2])], v1 = points[int(idx[1])], v2 = points[int(idx[0])];
+                boxMin[(size_t)s * count + i] = minVec3(v0, minVec3(v1, v2));
+                boxMax[(size_t)s * count + i] = maxVec3(v0, maxVec3(v1, v2));
+            }
+        }
+
+        // 根だけのメッシュに木を作る（メッシュは末尾にあるので、ノードとプリミティブは後ろを書き換えればよい）
+        ClipBuilder builder(boxMin, boxMax, count, sampleCount, scene.maxLeafSize, scene.leafWidth);
+        std::vector<int> order(count);
+        for (int i = 0; i < count; i++) order[i] = i;
+        scene.nodes.resize(m.rootNode + 1);
+        builder.Subdivide(scene.nodes, m.rootNode, order, 0, count, m.firstPrimitive, 0);
+        m.nodeCount = (int)scene.nodes.size() - m.rootNode;
+
+        std::vector<FlatPrimitive> sorted(count);
+        std::vector<int> sortedSource(count);
+        for (int i = 0; i < count; i++)
+        {
+            sorted[i] = scene.primitives[m.firstPrimitive + order[i]];
+            sortedSource[i] = scene.sourceIndex[m.firstPrimitive + order[i]];
+        }
+        std::copy(sorted.begin(), sorted.end(), scene.primitives.begin() + m.firstPrimitive);
+        std::copy(sortedSource.begin(), sortedSource.end(), scene.sourceIndex.begin() + m.firstPrimitive);
+
+        nodeCount = m.nodeCount;
+        frameBounds.clear();
+        if (storeBounds) {
+            frameBounds.resize((size_t)frameCount * nodeCount);
+            for (int frame = 0; frame < frameCount; frame++)
+            {
+                scene.UpdateTriangleMesh(mesh, framePoints[frame].data(), idxVertex);
+                for (int i = 0; i < nodeCount; i++) frameBounds[(size_t)frame * nodeCount + i] = NodeBounds(scene.nodes[m.rootNode + i]);
+            }
+        }
+        scene.UpdateTriangleMesh(mesh, framePoints[0].data(), idxVertex);
+        return mesh;
+    }
+
+    // frameの頂点で三角形を書き換え、ノードの箱を表から写す（表がなければリフィットする）
+    // 表にないフレーム（frameCount以上）は表から写さずにリフィットする
+    void SetFrame(FlatScene& scene, int frame, const vec3* points, const vec3* idxVertex) const
+    {
+        if (frameBounds.empty() || frame < 0 || frame >= frameCount) {
+            scene.UpdateTriangleMesh(mesh, points, idxVertex);
+            return;
+        }
+        scene.SetTriangleVertices(mesh, points, idxVertex);
+        FlatBVHNode* nodes = &scene.nodes[scene.meshes[mesh].rootNode];
+        const Bounds* bounds = &frameBounds[(size_t)frame * nodeCount];
+        for (int i = 0; i < nodeCount; i++)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                nodes[i].bmin[a] = bounds[i].bmin[a];
+                nodes[i].bmax[a] = bounds[i].bmax[a];
+            }
+        }
+    }
+
+    // 表の大きさ（バイト）
+    size_t BoundsBytes() const { return frameBounds.size() * sizeof(Bounds); }
+
+    int mesh;
+    int frameCount;
+
+private:
+    struct Bounds {
+        float bmin[3];
+        float bmax[3];
+    };
+
+    static Bounds NodeBounds(const FlatBVHNode& node)
+    {
+        Bounds bounds;
+        for (int a = 0; a < 3; a++) {
+            bounds.bmin[a] = node.bmin[a];
+            bounds.bmax[a] = node.bmax[a];
+        }
+        return bounds;
+    }
+
+    // 三角形の箱を標本の姿勢ごとに持ち、平均のSAHで分割する
+    class ClipBuilder {
+    public:
+        ClipBuilder(const std::vector<vec3>& boxMin, const std::vector<vec3>& boxMax, int count, int sampleCount,
+            int maxLeafSize, int leafWidth)
+            : boxMin(boxMin), boxMax(boxMax), count(count), sampleCount(sampleCount), maxLeafSize(maxLeafSize), leafWidth(leafWidth)
+        {
+        }
+
+        // order[begin, end)の三角形でnodes[nodeIndex]の部分木を作る。箱は後でリフィットする
+        // 深さFLAT_MAX_DEPTHのノードは、maxLeafSizeを超えても葉にする
+        void Subdivide(std::vector<FlatBVHNode>& nodes, int nodeIndex, std::vector<int>& order, int begin, int end, int firstPrimitive,
+            int depth) const
+        {
+            const int n = end - begin;
+            int sample = 0, axis = 0, bin = 0;
+            float cmin = 0.0f, scale = 0.0f;
+            float splitCost = n > 1 && depth < FLAT_MAX_DEPTH ? FindSplit(order, begin, end, sample, axis, bin, cmin, scale) : FLT_MAX;
+            float leafCost = FLAT_LEAF_COST * FlatLeafBlocks(n, leafWidth);
+            if (n <= 1 || depth >= FLAT_MAX_DEPTH || (n <= maxLeafSize && leafCost <= splitCost)) {
+                nodes[nodeIndex].leftFirst = firstPrimitive + begin;
+                nodes[nodeIndex].count = n;
+                return;
+            }
+
+            int mid = begin + n / 2;
+            if (splitCost < FLT_MAX) {
+                mid = (int)(std::partition(order.begin() + begin, order.begin() + end,
+                    [&](int i) { return Bin(i, sample, axis, cmin, scale) < bin; }) - order.begin());
+            }
+            if (mid == begin || mid == end) mid = begin + n / 2;
+
+            int left = (int)nodes.size();
+            nodes.push_back(FlatBVHNode());
+            nodes.push_back(FlatBVHNode());
+            nodes[nodeIndex].leftFirst = left;
+            nodes[nodeIndex].count = 0;
+            Subdivide(nodes, left, order, begin, mid, firstPrimitive, depth + 1);
+            Subdivide(nodes, left + 1, order, mid, end, firstPrimitive, depth + 1);
+        }
+
+    private:
+        static const int BINS = 16;
+
+        vec3 Centroid(int i, int s) const
+        {
+            return 0.5f * (boxMin[(size_t)s * count + i] + boxMax[(size_t)s * count + i]);
+        }
+
+        int Bin(int i, int s, int axis, float cmin, float scale) const
+        {
+            return std::min(BINS - 1, std::max(0, (int)((Centroid(i, s)[axis] - cmin) * scale)));
+        }
+
+        // 標本の姿勢sの軸axisの重心でビンに分け、全ての標本の姿勢での平均のSAHが最小の境界を探す
+        float FindSplit(const std::vector<int>& order, int begin, int end, int& bestSample, int& bestAxis, int& bestBin,
+            float& bestMin, float& bestScale) const
+        {
+            // ノードの箱の表面積（標本ごと）
+            std::vector<float> nodeArea(sampleCount);
+            for (int s = 0; s < sampleCount; s++)
+            {
+                vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+                for (int k = begin; k < end; k++)
+                {
+                    bmin = minVec3(bmin, boxMin[(size_t)s * count + order[k]]);
+                    bmax = maxVec3(bmax, boxMax[(size_t)s * count + order[k]]);
+                }
+                nodeArea[s] = std::max(SurfaceArea(bmin, bmax), 1e-20f);
+            }
+
+            float bestCost = FLT_MAX;
+            std::vector<vec3> binMin(BINS * sampleCount), binMax(BINS * sampleCount);
+            std::vector<float> leftArea(BINS), rightArea(BINS);
+            for (int s = 0; s < sampleCount; s++)
+            {
+                vec3 cmin(FLT_MAX), cmax(-FLT_MAX);
+                for (int k = begin; k < end; k++)
+                {
+                    cmin = minVec3(cmin, Centroid(order[k], s));
+                    cmax = maxVec3(cmax, Centroid(order[k], s));
+                }
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    float extent = cmax[axis] - cmin[axis];
+                    if (extent <= 0.0f) continue;
+                    const float scale = BINS / extent;
+                    int binCount[BINS] = {};
+                    std::fill(binMin.begin(), binMin.end(), vec3(FLT_MAX));
+                    std::fill(binMax.begin(), binMax.end(), vec3(-FLT_MAX));
+                    for (int k = begin; k < end; k++)
+                    {
+                        int i = order[k];
+                        int b = Bin(i, s, axis, cmin[axis], scale);
+                        binCount[b]++;
+                        for (int t = 0; t < sampleCount; t++)
+                        {
+                            binMin[b * sampleCount + t] = minVec3(binMin[b * sampleCount + t], boxMin[(size_t)t * count + i]);
+                            binMax[b * sampleCount + t] = maxVec3(binMax[b * sampleCount + t], boxMax[(size_t)t * count + i]);
+                        }
+                    }
+                    // 境界bの左右の箱の表面積を、標本ごとのノードの表面積で割って足す
+                    std::fill(leftArea.begin(), leftArea.end(), 0.0f);
+                    std::fill(rightArea.begin(), rightArea.end(), 0.0f);
+                    for (int t = 0; t < sampleCount; t++)
+                    {
+                        vec3 lmin(FLT_MAX), lmax(-FLT_MAX), rmin(FLT_MAX), rmax(-FLT_MAX);
+                        for (int b = 1; b < BINS; b++)
+                        {
+                            lmin = minVec3(lmin, binMin[(b - 1) * sampleCount + t]);
+                            lmax = maxVec3(lmax, binMax[(b - 1) * sampleCount + t]);
+                            leftArea[b] += SurfaceArea(lmin, lmax) / nodeArea[t];
+                            rmin = minVec3(rmin, binMin[(BINS - b) * sampleCount + t]);
+                            rmax = maxVec3(rmax, binMax[(BINS - b) * sampleCount + t]);
+                            rightArea[BINS - b] += SurfaceArea(rmin, rmax) / nodeArea[t];
+                        }
+                    }
+                    int leftCount = 0;
+                    for (int b = 1; b < BINS; b++)
+                    {
+                        leftCount += binCount[b - 1];
+                        int rightCount = (end - begin) - leftCount;
+                        if (leftCount == 0 || rightCount == 0) continue;
+                        float cost = FLAT_TRAVERSAL_COST + FLAT_LEAF_COST * (leftArea[b] * FlatLeafBlocks(leftCount, leafWidth)
+                            + rightArea[b] * FlatLeafBlocks(rightCount, leafWidth)) / sampleCount;
+                        if (cost < bestCost) {
+                            bestCost = cost;
+                            bestSample = s;
+                            bestAxis = axis;
+                            bestBin = b;
+                            bestMin = cmin[axis];
+                            bestScale = scale;
+                        }
+                    }
+                }
+            }
+            return bestCost;
+        }
+
+        const std::vector<vec3>& boxMin;
+        const std::vector<vec3>& boxMax;
+        int count;
+        int sampleCount;
+        int maxLeafSize;
+        int leafWidth;
+    };
+
+    int nodeCount;
+    std::vector<Bounds> frameBounds;  // frameBounds[frame * nodeCount + ノード]
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vector>
+#include "flatBLASCache.h"
+
+// 同じアニメーションをするキャラクターの群衆
+// フレームのずれ（frameOffset）が同じインスタンスは1つのメッシュ（BLAS）を共有し、インスタンスごとには変換だけを持つ
+// 三角形とBVHの量はずれの種類の数で決まり、インスタンスの数によらない
+// cacheを渡すと、ずれごとのメッシュを持たずに、フレームごとのメッシュをキャッシュから受け取ってインスタンスの参照を付け替える
+// （ずれが違っても同じフレームなら同じメッシュになり、前のフレームで作った姿勢は作り直さない）
+// インスタンスを追加した後にSetFrameを呼び、scene.BuildTopLevel()を呼ぶ
+class FlatCrowd {
+public:
+    // restPointsは読み込み時の姿勢（メッシュを作るときの頂点）。idxVertexは呼び出し側が持ち続ける
+    FlatCrowd(const vec3* restPoints, int nPoints, const vec3* idxVertex, int nTriangles, int frameCount, int material,
+        FlatBLASCache* cache = nullptr, int clip = 0) :
+        restPoints(restPoints), idxVertex(idxVertex), nPoints(nPoints), nTriangles(nTriangles), frameCount(frameCount), material(material),
+        cache(cache), clip(clip), character(cache ? cache->AddCharacter(restPoints, nPoints, idxVertex, nTriangles, material) : -1) {}
+
+    int AddInstance(FlatScene& scene, const Mat34& objectToWorld, int frameOffset)
+    {
+        Pose& pose = poses[PoseIndex(scene, frameOffset)];
+        int instance = scene.AddInstance(pose.mesh, objectToWorld);
+        pose.instances.push_back(instance);
+        return instance;
+    }
+
+    // 各メッシュを frame + frameOffset の姿勢にしてリフィットし、トップレベルの箱を更新する
+    // pose(frame, points)でframeの頂点を計算する。メッシュごとに並列に呼ぶ
+    // キャッシュを使う場合は、描画するフレームごとにcache->BeginFrame()を先に呼ぶ
+    template<class PoseFunc>
+    void SetFrame(FlatScene& scene, int frame, const PoseFunc& pose, int threadCount = 1)
+    {
+        if (cache) {
+            for (Pose& p : poses)
+            {
+                int mesh = cache->Acquire(scene, character, clip, (frame + p.frameOffset) % frameCount);
+                if (mesh == p.mesh) continue;
+                p.mesh = mesh;
+                for (int instance : p.instances) scene.instances[instance].mesh = mesh;
+            }
+            cache->Update(scene, [&](int c, int clipIndex, int poseFrame, vec3* points) { pose(poseFrame, points); }, threadCount);
+        }
+        else {
+            // メッシュごとにプリミティブとノードの範囲が別なので、並列にリフィットできる
+            ParallelTasks((int)poses.size(), threadCount, [&](int i) {
+                std::vector<vec3> points(nPoints);
+                pose((frame + poses[i].frameOffset) % frameCount, points.data());
+                scene.UpdateTriangleMesh(poses[i].mesh, points.data(), idxVertex);
+            });
+        }
+        scene.RefitTopLevel();
+    }
+
+    int PoseCount() const { return (int)poses.size(); }
+
+private:
+    struct Pose {
+        int frameOffset;
+        int mesh;
+        std::vector<int> instances;
+    };
+
+    // ずれが同じものがなければ作る
+    int PoseIndex(FlatScene& scene, int frameOffset)
+    {
+        frameOffset = ((frameOffset % frameCount) + frameCount) % frameCount;
+        for (int i = 0; i < (int)poses.size(); i++)
+        {
+            if (poses[i].frameOffset == frameOffset) return i;
+        }
+        Pose pose;
+        pose.frameOffset = frameOffset;
+        pose.mesh = cache ? cache->Acquire(scene, character, clip, frameOffset) : scene.AddTriangleMesh(restPoints, idxVertex, nTriangles, material);
+        poses.push_back(pose);
+        return (int)poses.size() - 1;
+    }
+
+    const vec3* restPoints;
+    const vec3* idxVertex;
+    int nPoints;
+    int nTriangles;
+    int frameCount;
+    int material;
+    FlatBLASCache* cache;
+    int clip;
+    int character;  // キャッシュに登録した番号
+    std::vector<Pose> poses;
+};
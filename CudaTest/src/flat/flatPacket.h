@@ -0,0 +1,360 @@
+#pragma once
+
+#include "flatRender.h"
+#include "../core/wideAABB.h"
+
+// CPUでのパケット走査
+// 隣り合う画素の一次光線や、同じ方向に向かう影の光線をPACKET_SIZE本まとめてBVHを辿る
+// ノードごとにまずパケット全体を区間演算で判定し、全ての光線が外れると確実なら個別の判定をしない
+// 方向の符号が軸ごとに揃っていないパケット（拡散反射の後など）は1本ずつの走査に戻す
+
+const int PACKET_SIZE = 8;
+
+struct FlatRayPacket {
+    float org[3][PACKET_SIZE];
+    float invDir[3][PACKET_SIZE];
+    float t_max[PACKET_SIZE];
+    unsigned active;    // 走査中の光線のビット
+    int sign[3];        // 全ての光線で共通の方向の符号
+    // 区間演算用の、全ての光線の原点と方向の逆数の範囲
+    float orgLo[3], orgHi[3];
+    float invLo[3], invHi[3];
+
+    // 光線を詰める。方向の符号が揃っていなければfalse（パケットにできない）
+    bool Set(const Ray* rays, int count, const float* tMax)
+    {
+        active = count >= 32 ? ~0u : (1u << count) - 1;
+        for (int a = 0; a < 3; a++) {
+            sign[a] = rays[0].direction()[a] < 0.0f;
+            orgLo[a] = invLo[a] = FLT_MAX;
+            orgHi[a] = invHi[a] = -FLT_MAX;
+        }
+        for (int i = 0; i < PACKET_SIZE; i++) {
+            // 使わないレーンは0番の光線で埋める（activeに含めない）
+            int src = i < count ? i : 0;
+            vec3 o = rays[src].origin();
+            vec3 d = rays[src].direction();
+            t_max[i] = tMax[src];
+            for (int a = 0; a < 3; a++) {
+                if (fabsf(d[a]) < 1e-20f || (d[a] < 0.0f) != (sign[a] != 0)) return false;
+                org[a][i] = o[a];
+                invDir[a][i] = 1.0f / d[a];
+                orgLo[a] = ffmin(orgLo[a], o[a]);
+                orgHi[a] = ffmax(orgHi[a], o[a]);
+                invLo[a] = ffmin(invLo[a], invDir[a][i]);
+                invHi[a] = ffmax(invHi[a], invDir[a][i]);
+            }
+        }
+        return true;
+    }
+
+    float MaxTMax() const
+    {
+        float t = -FLT_MAX;
+        for (int i = 0; i < PACKET_SIZE; i++) {
+            if ((active >> i) & 1) t = ffmax(t, t_max[i]);
+        }
+        return t;
+    }
+};
+
+// 区間[aLo, aHi]と区間[bLo, bHi]の積の最小値と最大値
+inline float IntervalMulMin(float aLo, float aHi, float bLo, float bHi)
+{
+    return ffmin(ffmin(aLo * bLo, aLo * bHi), ffmin(aHi * bLo, aHi * bHi));
+}
+
+inline float IntervalMulMax(float aLo, float aHi, float bLo, float bHi)
+{
+    return ffmax(ffmax(aLo * bLo, aLo * bHi), ffmax(aHi * bLo, aHi * bHi));
+}
+
+// パケット全体と箱の区間演算による判定
+// falseならパケットのどの光線も箱に当たらない。trueでも当たる光線があるとは限らない
+inline bool PacketIntervalHit(const FlatRayPacket& p, const float bmin[3], const float bmax[3], float t_min, float t_max)
+{
+    for (int a = 0; a < 3; a++) {
+        float nearPlane = p.sign[a] ? bmax[a] : bmin[a];
+        float farPlane = p.sign[a] ? bmin[a] : bmax[a];
+        t_min = ffmax(t_min, IntervalMulMin(nearPlane - p.orgHi[a], nearPlane - p.orgLo[a], p.invLo[a], p.invHi[a]));
+        t_max = ffmin(t_max, IntervalMulMax(farPlane - p.orgHi[a], farPlane - p.orgLo[a], p.invLo[a], p.invHi[a]));
+    }
+    return t_min <= t_max;
+}
+
+// パケットの光線ごとの箱の判定。当たった光線のビットを返し、t_enterにそれぞれの入る距離を書く
+// 符号はパケットで共通なので、近い面と遠い面は軸ごとに1回選ぶだけでよい
+inline unsigned PacketBoxHit(const FlatRayPacket& p, const float bmin[3], const float bmax[3], float t_min, float t_enter[PACKET_SIZE])
+{
+#ifdef WIDE_AABB_AVX
+    __m256 tmin = _mm256_set1_ps(t_min);
+    __m256 tmax = _mm256_loadu_ps(p.t_max);
+    for (int a = 0; a < 3; a++) {
+        __m256 o = _mm256_loadu_ps(p.org[a]);
+        __m256 inv = _mm256_loadu_ps(p.invDir[a]);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(p.sign[a] ? bmax[a] : bmin[a]), o), inv);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(p.sign[a] ? bmin[a] : bmax[a]), o), inv);
+        tmin = _mm256_max_ps(t0, tmin);
+        tmax = _mm256_min_ps(t1, tmax);
+    }
+    _mm256_storeu_ps(t_enter, tmin);
+    return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ)) & p.active;
+#elif defined(WIDE_AABB_SSE)
+    unsigned mask = 0;
+    for (int h = 0; h < PACKET_SIZE; h += 4) {
+        __m128 tmin = _mm_set1_ps(t_min);
+        __m128 tmax = _mm_loadu_ps(p.t_max + h);
+        for (int a = 0; a < 3; a++) {
+            __m128 o = _mm_loadu_ps(p.org[a] + h);
+            __m128 inv = _mm_loadu_ps(p.invDir[a] + h);
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(p.sign[a] ? bmax[a] : bmin[a]), o), inv);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(p.sign[a] ? bmin[a] : bmax[a]), o), inv);
+            tmin = _mm_max_ps(t0, tmin);
+            tmax = _mm_min_ps(t1, tmax);
+        }
+        _mm_storeu_ps(t_enter + h, tmin);
+        mask |= (unsigned)_mm_movemask_ps(_mm_cmple_ps(tmin, tmax)) << h;
+    }
+    return mask & p.active;
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < PACKET_SIZE; i++) {
+        float tmin = t_min;
+        float tmax = p.t_max[i];
+        for (int a = 0; a < 3; a++) {
+            float t0 = ((p.sign[a] ? bmax[a] : bmin[a]) - p.org[a][i]) * p.invDir[a][i];
+            float t1 = ((p.sign[a] ? bmin[a] : bmax[a]) - p.org[a][i]) * p.invDir[a][i];
+            tmin = ffmax(t0, tmin);
+            tmax = ffmin(t1, tmax);
+        }
+        t_enter[i] = tmin;
+        mask |= (tmin <= tmax ? 1u : 0u) << i;
+    }
+    return mask & p.active;
+#endif
+}
+
+// 1つのメッシュのBVHをパケットで辿る
+// 最も近い交差はhits、交差した光線はhitMaskに書く。anyHitなら遮られた光線をパケットから外していく
+inline void TraverseFlatPacket(const FlatSceneView& scene, const FlatMesh& mesh, FlatRayPacket& p,
+    const Ray* rays, const WatertightRay* wrays, int instance, float t_min, FlatHit* hits, unsigned& hitMask, bool anyHit)
+{
+    const int STACK_SIZE = FLAT_STACK_SIZE;
+    int stack[STACK_SIZE];
+    float stackT[STACK_SIZE];   // 積んだノードにパケットの光線が入る最小の距離
+    int sp = 0;
+
+    const FlatBVHNode* nodes = scene.nodes;
+    float t_enter[PACKET_SIZE];
+    if (!PacketIntervalHit(p, nodes[mesh.rootNode].bmin, nodes[mesh.rootNode].bmax, t_min, p.MaxTMax())) return;
+
+    int nodeIndex = mesh.rootNode;
+    while (true) {
+        const FlatBVHNode& node = nodes[nodeIndex];
+        if (node.IsLeaf()) {
+            unsigned mask = PacketBoxHit(p, node.bmin, node.bmax, t_min, t_enter);
+            for (int prim = node.leftFirst; prim < node.leftFirst + node.count && mask; prim++) {
+                for (int i = 0; i < PACKET_SIZE; i++) {
+                    if (!((mask >> i) & 1)) continue;
+                    float t, u, v;
+                    if (!IntersectPrimitive(scene.primitives[prim], rays[i], wrays[i], t_min, p.t_max[i], t, u, v)) continue;
+                    hitMask |= 1u << i;
+                    if (anyHit) {
+                        p.active &= ~(1u << i);
+                        mask &= ~(1u << i);
+                        continue;
+                    }
+                    p.t_max[i] = t;
+                    hits[i].t = t;
+                    hits[i].u = u;
+                    hits[i].v = v;
+                    hits[i].primitive = prim;
+                    hits[i].instance = instance;
+                }
+            }
+            if (!p.active) return;
+        }
+        else {
+            // パケット全体の区間演算で外れるとわかる子は、光線ごとの判定をしない
+            const float packetTMax = p.MaxTMax();
+            int children[2] = { node.leftFirst, node.leftFirst + 1 };
+            float childT[2];
+            bool childHit[2];
+            for (int c = 0; c < 2; c++) {
+                const FlatBVHNode& child = nodes[children[c]];
+                childHit[c] = false;
+                if (!PacketIntervalHit(p, child.bmin, child.bmax, t_min, packetTMax)) continue;
+                unsigned mask = PacketBoxHit(p, child.bmin, child.bmax, t_min, t_enter);
+                if (!mask) continue;
+                childHit[c] = true;
+                childT[c] = FLT_MAX;
+                for (int i = 0; i < PACKET_SIZE; i++) {
+                    if ((mask >> i) & 1) childT[c] = ffmin(childT[c], t_enter[i]);
+                }
+            }
+            if (childHit[0] && childHit[1]) {
+                int nearChild = childT[1] < childT[0] ? 1 : 0;
+                // 深さの制限を超える木では、配列の外に書かずに打ち切る
+                if (sp == STACK_SIZE) return;
+                stack[sp] = children[1 - nearChild];
+                stackT[sp] = childT[1 - nearChild];
+                sp++;
+                nodeIndex = children[nearChild];
+                continue;
+            }
+            else if (childHit[0] || childHit[1]) {
+                nodeIndex = children[childHit[0] ? 0 : 1];
+                continue;
+            }
+        }
+
+        // パケットのどの光線の交差よりも遠いノードは飛ばす
+        do {
+            if (sp == 0) return;
+            sp--;
+        } while (stackT[sp] > p.MaxTMax());
+        nodeIndex = stack[sp];
+    }
+}
+
+// count本（PACKET_SIZE以下）の光線の最も近い交差を求める。交差した光線はhitFlagsがtrue
+// 方向の符号が揃わないパケットは1本ずつFlatIntersectと同じ走査をする。パケットで辿れたらtrueを返す
+inline bool FlatPacketIntersect(const FlatSceneView& scene, const Ray* rays, int count, float t_min,
+    FlatHit* hits, bool* hitFlags)
+{
+    float tMax[PACKET_SIZE];
+    for (int i = 0; i < count; i++) {
+        hitFlags[i] = false;
+        tMax[i] = FLT_MAX;
+    }
+    bool packetUsed = true;
+    for (int inst = 0; inst < scene.instanceCount; inst++) {
+        const FlatInstance& instance = scene.instances[inst];
+        const FlatMesh& mesh = scene.meshes[instance.mesh];
+        Ray local[PACKET_SIZE];
+        for (int i = 0; i < count; i++) local[i] = FlatInstanceRay(scene, instance, rays[i]);
+
+        FlatRayPacket packet;
+        if (!packet.Set(local, count, tMax)) {
+            packetUsed = false;
+            for (int i = 0; i < count; i++) {
+                if (TraverseFlatMesh(scene, mesh, local[i], t_min, tMax[i], hits[i], false)) {
+                    hitFlags[i] = true;
+                    hits[i].instance = inst;
+                }
+            }
+            continue;
+        }
+
+        WatertightRay wrays[PACKET_SIZE];
+        for (int i = 0; i < count; i++) wrays[i] = WatertightRay(local[i].origin(), local[i].direction());
+
+        unsigned hitMask = 0;
+        TraverseFlatPacket(scene, mesh, packet, local, wrays, inst, t_min, hits, hitMask, false);
+        for (int i = 0; i < count; i++) {
+            if ((hitMask >> i) & 1) {
+                hitFlags[i] = true;
+                tMax[i] = packet.t_max[i];
+            }
+        }
+    }
+    return packetUsed;
+}
+
+// count本の光線がt_minからt_maxの間で遮られているかを調べる（影の光線用）
+inline bool FlatPacketOccluded(const FlatSceneView& scene, const Ray* rays, int count, float t_min, float t_max,
+    bool* occluded)
+{
+    float tMax[PACKET_SIZE];
+    for (int i = 0; i < count; i++) {
+        occluded[i] = false;
+        tMax[i] = t_max;
+    }
+    bool packetUsed = true;
+    for (int inst = 0; inst < scene.instanceCount; inst++) {
+        const FlatInstance& instance = scene.instances[inst];
+        const FlatMesh& mesh = scene.meshes[instance.mesh];
+        Ray local[PACKET_SIZE];
+        for (int i = 0; i < count; i++) local[i] = FlatInstanceRay(scene, instance, rays[i]);
+
+        FlatRayPacket packet;
+        if (!packet.Set(local, count, tMax)) {
+            packetUsed = false;
+            for (int i = 0; i < count; i++) {
+                FlatHit hit;
+                float t = t_max;
+                if (!occluded[i] && TraverseFlatMesh(scene, mesh, local[i], t_min, t, hit, true)) occluded[i] = true;
+            }
+            continue;
+        }
+        // 既に遮られている光線は辿らない
+        for (int i = 0; i < count; i++) {
+            if (occluded[i]) packet.active &= ~(1u << i);
+        }
+        if (!packet.active) break;
+
+        WatertightRay wrays[PACKET_SIZE];
+        for (int i = 0; i < count; i++) wrays[i] = WatertightRay(local[i].origin(), local[i].direction());
+
+        FlatHit hits[PACKET_SIZE];
+        unsigned hitMask = 0;
+        TraverseFlatPacket(scene, mesh, packet, local, wrays, inst, t_min, hits, hitMask, true);
+        for (int i = 0; i < count; i++) {
+            if ((hitMask >> i) & 1) occluded[i] = true;
+        }
+    }
+    return packetUsed;
+}
+
+// 4x2画素ずつのパケットで描画する。影の光線も交差した画素の分をパケットで辿る
+void RenderFlatCPUPacket(vec3* colorBuffer, const FlatSceneView& scene, const FlatCamera& camera, int nx, int ny, int threadCount)
+{
+    const int TILE_X = 4, TILE_Y = PACKET_SIZE / TILE_X;
+    const int tileRows = (ny + TILE_Y - 1) / TILE_Y;
+    const vec3 lightDirection = FlatLightDirection();
+    ParallelTasks(tileRows, threadCount, [&](int tileRow) {
+        for (int tx = 0; tx < nx; tx += TILE_X)
+        {
+            Ray rays[PACKET_SIZE];
+            int pixels[PACKET_SIZE];
+            int count = 0;
+            for (int dy = 0; dy < TILE_Y; dy++) {
+                for (int dx = 0; dx < TILE_X; dx++) {
+                    int x = tx + dx, y = tileRow * TILE_Y + dy;
+                    if (x >= nx || y >= ny) continue;
+                    rays[count] = camera.get_ray((x + 0.5f) / float(nx), (y + 0.5f) / float(ny));
+                    pixels[count] = y * nx + x;
+                    count++;
+                }
+            }
+
+            FlatHit hits[PACKET_SIZE];
+            bool hitFlags[PACKET_SIZE];
+            FlatPacketIntersect(scene, rays, count, 0.001f, hits, hitFlags);
+
+            // 光源側を向いている点だけ影の光線を飛ばす
+            Ray shadowRays[PACKET_SIZE];
+            int shadowSource[PACKET_SIZE];
+            vec3 normals[PACKET_SIZE];
+            int shadowCount = 0;
+            for (int i = 0; i < count; i++) {
+                if (!hitFlags[i]) continue;
+                normals[i] = FlatShadingNormal(scene, rays[i], hits[i]);
+                if (dot(normals[i], lightDirection) > 0) {
+                    shadowRays[shadowCount] = Ray(rays[i].point_at_t(hits[i].t), lightDirection, rays[i].time());
+                    shadowSource[shadowCount++] = i;
+                }
+            }
+            bool lit[PACKET_SIZE] = {};
+            if (shadowCount > 0) {
+                bool occluded[PACKET_SIZE];
+                FlatPacketOccluded(scene, shadowRays, shadowCount, 0.001f, FLT_MAX, occluded);
+                for (int k = 0; k < shadowCount; k++) lit[shadowSource[k]] = !occluded[k];
+            }
+
+            for (int i = 0; i < count; i++) {
+                colorBuffer[pixels[i]] = hitFlags[i] ? clip(FlatShadeHit(scene, hits[i], normals[i], lit[i])) : clip(FlatSky(rays[i].direction()));
+            }
+        }
+    });
+}
@@ -0,0 +1,369 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "flatWideBVH.h"
+
+// 子の箱を8ビットに量子化したN分木のBVH（N = 4, 8）
+// 子の箱は親の箱の最小の角（origin）からの、軸ごとの刻み幅2^exponentの倍数で表す
+// 量子化では最小の角を切り下げ、最大の角を切り上げるので、箱は元より小さくならない
+
+const unsigned char QUANTIZED_EMPTY = 0xff;
+const int QUANTIZED_MAX_LEAF_SIZE = 254;    // countに入る葉のプリミティブ数の上限（255は空き）
+
+// ノード。FlatWideNodeの半分以下の大きさ（4分木で60バイト、8分木で104バイト）
+template<int N>
+struct FlatQuantizedNode {
+    float origin[3];
+    signed char exponent[3];
+    unsigned char count[N];     // 葉のプリミティブ数（QUANTIZED_MAX_LEAF_SIZE以下）。0なら内部ノード、QUANTIZED_EMPTYなら空き
+    unsigned char qmin[3][N];
+    unsigned char qmax[3][N];
+    int child[N];               // 内部ノードなら子のノードの番号、葉なら最初のプリミティブの番号
+};
+
+template<int N>
+struct FlatQuantizedView {
+    const FlatQuantizedNode<N>* nodes;
+    const int* meshRoots;
+};
+
+// 2^exponent。ビットを直接組み立てる（exponentは-126から127）
+__host__ __device__ inline float QuantizedScale(int exponent)
+{
+    unsigned bits = (unsigned)(exponent + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(float));
+    return scale;
+}
+
+// 光線に合わせて選んだ軸ごとの近い面・遠い面と、面の距離を求める係数
+// 面の距離は (origin + q * scale - org) * invDir = q * (scale * invDir) + (origin - org) * invDir で求める
+struct QuantizedPlanes {
+    const unsigned char* nearPlane[3];
+    const unsigned char* farPlane[3];
+    float scale[3];
+    float offset[3];
+};
+
+template<int N>
+__host__ __device__ inline unsigned IntersectQuantizedScalar(const QuantizedPlanes& planes, float t_min, float t_max, float t_enter[N])
+{
+    float tmin[N], tmax[N];
+    for (int i = 0; i < N; i++) {
+        tmin[i] = t_min;
+        tmax[i] = t_max;
+    }
+    for (int a = 0; a < 3; a++) {
+        for (int i = 0; i < N; i++) {
+            tmin[i] = ffmax(planes.nearPlane[a][i] * planes.scale[a] + planes.offset[a], tmin[i]);
+            tmax[i] = ffmin(planes.farPlane[a][i] * planes.scale[a] + planes.offset[a], tmax[i]);
+        }
+    }
+    unsigned mask = 0;
+    for (int i = 0; i < N; i++) {
+        t_enter[i] = tmin[i];
+        mask |= (tmin[i] <= tmax[i] ? 1u : 0u) << i;
+    }
+    return mask;
+}
+
+#ifdef WIDE_AABB_SSE
+// 8ビットの4個の値をfloatにする
+inline __m128 LoadQuantized4(const unsigned char* q)
+{
+    int bits;
+    memcpy(&bits, q, sizeof(int));
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bits), zero), zero));
+}
+
+inline unsigned IntersectQuantized4SSE(const QuantizedPlanes& planes, int first, float t_min, float t_max, float* t_enter)
+{
+    __m128 tmin = _mm_set1_ps(t_min);
+    __m128 tmax = _mm_set1_ps(t_max);
+    for (int a = 0; a < 3; a++) {
+        __m128 scale = _mm_set1_ps(planes.scale[a]);
+        __m128 offset = _mm_set1_ps(planes.offset[a]);
+        __m128 t0 = _mm_add_ps(_mm_mul_ps(LoadQuantized4(planes.nearPlane[a] + first), scale), offset);
+        __m128 t1 = _mm_add_ps(_mm_mul_ps(LoadQuantized4(planes.farPlane[a] + first), scale), offset);
+        tmin = _mm_max_ps(t0, tmin);
+        tmax = _mm_min_ps(t1, tmax);
+    }
+    _mm_storeu_ps(t_enter, tmin);
+    return (unsigned)_mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+}
+
+template<int N>
+struct QuantizedHost {
+    static unsigned Intersect(const QuantizedPlanes& planes, float t_min, float t_max, float t_enter[N])
+    {
+        return IntersectQuantizedScalar<N>(planes, t_min, t_max, t_enter);
+    }
+};
+
+template<>
+struct QuantizedHost<4> {
+    static unsigned Intersect(const QuantizedPlanes& planes, float t_min, float t_max, float t_enter[4])
+    {
+        return IntersectQuantized4SSE(planes, 0, t_min, t_max, t_enter);
+    }
+};
+
+template<>
+struct QuantizedHost<8> {
+    static unsigned Intersect(const QuantizedPlanes& planes, float t_min, float t_max, float t_enter[8])
+    {
+#ifdef WIDE_AABB_AVX
+        __m256 tmin = _mm256_set1_ps(t_min);
+        __m256 tmax = _mm256_set1_ps(t_max);
+        for (int a = 0; a < 3; a++) {
+            __m256 scale = _mm256_set1_ps(planes.scale[a]);
+            __m256 offset = _mm256_set1_ps(planes.offset[a]);
+            __m256 nearPlane = _mm256_insertf128_ps(_mm256_castps128_ps256(LoadQuantized4(planes.nearPlane[a])), LoadQuantized4(planes.nearPlane[a] + 4), 1);
+            __m256 farPlane = _mm256_insertf128_ps(_mm256_castps128_ps256(LoadQuantized4(planes.farPlane[a])), LoadQuantized4(planes.farPlane[a] + 4), 1);
+            tmin = _mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(nearPlane, scale), offset), tmin);
+            tmax = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(farPlane, scale), offset), tmax);
+        }
+        _mm256_storeu_ps(t_enter, tmin);
+        return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+#else
+        return IntersectQuantized4SSE(planes, 0, t_min, t_max, t_enter)
+            | (IntersectQuantized4SSE(planes, 4, t_min, t_max, t_enter + 4) << 4);
+#endif
+    }
+};
+#endif
+
+// 1本の光線とノードのN個の子の箱の判定。交差した子のビットを返す
+template<int N>
+__host__ __device__ inline unsigned IntersectQuantizedChildren(const FlatQuantizedNode<N>& node, const InvRay& r,
+    float t_min, float t_max, float t_enter[N])
+{
+    QuantizedPlanes planes;
+    for (int a = 0; a < 3; a++) {
+        planes.nearPlane[a] = r.sign[a] ? node.qmax[a] : node.qmin[a];
+        planes.farPlane[a] = r.sign[a] ? node.qmin[a] : node.qmax[a];
+        planes.scale[a] = QuantizedScale(node.exponent[a]) * r.invDir[a];
+        planes.offset[a] = (node.origin[a] - r.org[a]) * r.invDir[a];
+    }
+#if !defined(__CUDA_ARCH__) && defined(WIDE_AABB_SSE)
+    unsigned mask = QuantizedHost<N>::Intersect(planes, t_min, t_max, t_enter);
+#else
+    unsigned mask = IntersectQuantizedScalar<N>(planes, t_min, t_max, t_enter);
+#endif
+    for (int i = 0; i < N; i++) {
+        if (node.count[i] == QUANTIZED_EMPTY) mask &= ~(1u << i);
+    }
+    return mask;
+}
+
+// 1つのメッシュの量子化したN分木を辿る。辿り方はTraverseFlatWideMeshと同じ
+template<int N>
+__host__ __device__ inline bool TraverseFlatQuantizedMesh(const FlatSceneView& scene, const FlatQuantizedView<N>& bvh, int mesh,
+    const Ray& r, float t_min, float& t_max, FlatHit& hit, bool anyHit)
+{
+    // 深さFLAT_MAX_DEPTHまでの段ごとに、まだ辿っていない子を最大N-1個ずつ積む
+    const int STACK_SIZE = FLAT_MAX_DEPTH * (N - 1) + 1;
+    int stackChild[STACK_SIZE];
+    int stackCount[STACK_SIZE];
+    float stackT[STACK_SIZE];
+    int sp = 0;
+
+    const InvRay inv_r(r);
+    const WatertightRay wray(r.origin(), r.direction());
+
+    stackChild[sp] = bvh.meshRoots[mesh];
+    stackCount[sp] = 0;
+    stackT[sp] = t_min;
+    sp++;
+
+    bool hit_anything = false;
+    while (sp > 0) {
+        sp--;
+        if (stackT[sp] > t_max) continue;
+        const int child = stackChild[sp];
+        const int count = stackCount[sp];
+
+        if (count > 0) {
+            for (int i = child; i < child + count; i++) {
+                float t, u, v;
+                if (IntersectPrimitive(scene.primitives[i], r, wray, t_min, t_max, t, u, v)) {
+                    hit_anything = true;
+                    if (anyHit) return true;
+                    t_max = t;
+                    hit.t = t;
+                    hit.u = u;
+                    hit.v = v;
+                    hit.primitive = i;
+                }
+            }
+            continue;
+        }
+
+        const FlatQuantizedNode<N>& node = bvh.nodes[child];
+        float t_enter[N];
+        unsigned mask = IntersectQuantizedChildren<N>(node, inv_r, t_min, t_max, t_enter);
+
+        int order[N];
+        int hitCount = 0;
+        for (int i = 0; i < N; i++) {
+            if (!((mask >> i) & 1)) continue;
+            int k = hitCount++;
+            while (k > 0 && t_enter[order[k - 1]] < t_enter[i]) {
+                order[k] = order[k - 1];
+                k--;
+            }
+            order[k] = i;
+        }
+        if (sp + hitCount > STACK_SIZE) return hit_anything;
+        for (int k = 0; k < hitCount; k++) {
+            int i = order[k];
+            stackChild[sp] = node.child[i];
+            stackCount[sp] = node.count[i];
+            stackT[sp] = t_enter[i];
+            sp++;
+        }
+    }
+    return hit_anything;
+}
+
+template<int N>
+__host__ __device__ inline bool FlatQuantizedIntersect(const FlatSceneView& scene, const FlatQuantizedView<N>& bvh,
+    const Ray& r, float t_min, float t_max, FlatHit& hit)
+{
+    bool hit_anything = false;
+    for (int i = 0; i < scene.instanceCount; i++) {
+        const FlatInstance& instance = scene.instances[i];
+        Ray local = FlatInstanceRay(scene, instance, r);
+        if (TraverseFlatQuantizedMesh<N>(scene, bvh, instance.mesh, local, t_min, t_max, hit, false)) {
+            hit_anything = true;
+            hit.instance = i;
+        }
+    }
+    return hit_anything;
+}
+
+template<int N>
+__host__ __device__ inline bool FlatQuantizedOccluded(const FlatSceneView& scene, const FlatQuantizedView<N>& bvh,
+    const Ray& r, float t_min, float t_max)
+{
+    FlatHit hit;
+    for (int i = 0; i < scene.instanceCount; i++) {
+        const FlatInstance& instance = scene.instances[i];
+        Ray local = FlatInstanceRay(scene, instance, r);
+        if (TraverseFlatQuantizedMesh<N>(scene, bvh, instance.mesh, local, t_min, t_max, hit, true)) return true;
+    }
+    return false;
+}
+
+
+// FlatWideBVHのノードを量子化して作る。ノードの番号はFlatWideBVHと同じ
+// 元のFlatWideBVHをリフィットした後はもう一度Buildする
+// 葉のプリミティブ数がQUANTIZED_MAX_LEAF_SIZEを超える場合は作らずにfalseを返す（FlatScene::maxLeafSizeを254以下にする）
+// 失敗したときはノードを空にするので、Built()で作れたかを確かめられる
+template<int N>
+class FlatQuantizedBVH {
+public:
+    FlatQuantizedBVH() : built(false) {}
+
+    bool Build(const FlatWideBVH<N>& wide)
+    {
+        nodes.clear();
+        meshRoots.clear();
+        built = false;
+        for (const FlatWideNode<N>& node : wide.nodes)
+        {
+            for (int i = 0; i < N; i++)
+            {
+                if (node.count[i] > QUANTIZED_MAX_LEAF_SIZE) {
+                    std::cerr << "量子化BVH: 葉のプリミティブ数" << node.count[i] << "が上限" << QUANTIZED_MAX_LEAF_SIZE << "を超えています" << std::endl;
+                    return false;
+                }
+            }
+        }
+        nodes.resize(wide.nodes.size());
+        for (size_t n = 0; n < wide.nodes.size(); n++)
+        {
+            Quantize(wide.nodes[n], nodes[n]);
+        }
+        meshRoots = wide.meshRoots;
+        built = true;
+        return true;
+    }
+
+    bool Built() const { return built; }
+
+    FlatQuantizedView<N> HostView() const
+    {
+        FlatQuantizedView<N> view;
+        view.nodes = nodes.data();
+        view.meshRoots = meshRoots.data();
+        return view;
+    }
+
+    FlatQuantizedView<N> Upload()
+    {
+        d_nodes.Upload(nodes.data(), nodes.size());
+        d_meshRoots.Upload(meshRoots.data(), meshRoots.size());
+        FlatQuantizedView<N> view;
+        view.nodes = d_nodes.get();
+        view.meshRoots = d_meshRoots.get();
+        return view;
+    }
+
+    std::vector<FlatQuantizedNode<N>> nodes;
+    std::vector<int> meshRoots;
+
+private:
+    static void Quantize(const FlatWideNode<N>& source, FlatQuantizedNode<N>& node)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            // 親の箱は使っている子の箱を合わせたもの
+            float lo = FLT_MAX, hi = -FLT_MAX;
+            for (int i = 0; i < N; i++)
+            {
+                if (source.count[i] < 0) continue;
+                lo = ffmin(lo, source.bounds.bmin[a][i]);
+                hi = ffmax(hi, source.bounds.bmax[a][i]);
+            }
+            if (lo > hi) lo = hi = 0.0f;
+
+            // 255刻みで親の箱の最大の角に届く最小の刻み幅
+            int exponent = -126;
+            if (hi > lo) exponent = std::max(-126, (int)std::ceil(std::log2((hi - lo) / 255.0f)));
+            while (exponent < 127 && lo + 255 * QuantizedScale(exponent) < hi) exponent++;
+            const float scale = QuantizedScale(exponent);
+            node.origin[a] = lo;
+            node.exponent[a] = (signed char)exponent;
+
+            for (int i = 0; i < N; i++)
+            {
+                if (source.count[i] < 0) {
+                    node.qmin[a][i] = 255;
+                    node.qmax[a][i] = 0;
+                    continue;
+                }
+                int qmin = std::min(255, std::max(0, (int)std::floor((source.bounds.bmin[a][i] - lo) / scale)));
+                int qmax = std::min(255, std::max(0, (int)std::ceil((source.bounds.bmax[a][i] - lo) / scale)));
+                // 戻したときに丸めで内側に入る場合は1刻み広げる
+                while (qmin > 0 && lo + qmin * scale > source.bounds.bmin[a][i]) qmin--;
+                while (qmax < 255 && lo + qmax * scale < source.bounds.bmax[a][i]) qmax++;
+                node.qmin[a][i] = (unsigned char)qmin;
+                node.qmax[a][i] = (unsigned char)qmax;
+            }
+        }
+        for (int i = 0; i < N; i++)
+        {
+            node.child[i] = source.child[i];
+            node.count[i] = source.count[i] < 0 ? QUANTIZED_EMPTY : (unsigned char)source.count[i];
+        }
+    }
+
+    DeviceBuffer<FlatQuantizedNode<N>> d_nodes;
+    DeviceBuffer<int> d_meshRoots;
+    bool built;
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <vector>
+#include "flatBuildTasks.h"
+
+// ホスト・デバイスの両方で使えるピンホールカメラ（Cameraと同じ画角の計算でレンズはなし）
+struct FlatCamera {
+    vec3 origin;
+    vec3 lower_left_corner;
+    vec3 horizontal;
+    vec3 vertical;
+
+    __host__ __device__ static FlatCamera LookAt(vec3 lookfrom, vec3 lookat, vec3 vup, float vfov, float aspect, float focus_dist)
+    {
+        float theta = vfov * M_PI / 180.0f;
+        float half_height = tan(theta / 2.0f);
+        float half_width = half_height * aspect;
+        vec3 z = unit_vector(lookfrom - lookat);
+        vec3 x = unit_vector(cross(vup, z));
+        vec3 y = cross(z, x);
+
+        FlatCamera camera;
+        camera.origin = lookfrom;
+        camera.lower_left_corner = lookfrom - half_width * focus_dist * x - half_height * focus_dist * y - focus_dist * z;
+        camera.horizontal = 2.0f * half_width * focus_dist * x;
+        camera.vertical = 2.0f * half_height * focus_dist * y;
+        return camera;
+    }
+
+    __host__ __device__ Ray get_ray(float s, float t) const
+    {
+        return Ray(origin, lower_left_corner + s * horizontal + t * vertical - origin, 0.0f);
+    }
+};
+
+__host__ __device__ inline vec3 FlatSky(const vec3& d)
+{
+    vec3 v = unit_vector(d);
+    float t = 0.5f * (v[1] + 1.0f);
+    return lerp(t, vec3(1), vec3(0.5f, 0.7f, 1.0f));
+}
+
+__host__ __device__ inline vec3 FlatLightDirection()
+{
+    return unit_vector(vec3(1, 2, 1));
+}
+
+// 光線の側を向いた法線
+__host__ __device__ inline vec3 FlatShadingNormal(const FlatSceneView& scene, const Ray& r, const FlatHit& hit)
+{
+    vec3 n = FlatSurfaceNormal(scene, r, hit);
+    if (dot(n, r.direction()) > 0) n = -n;
+    return n;
+}
+
+// 交差した点の色。litは平行光源が遮られずに届いているか
+__host__ __device__ inline vec3 FlatShadeHit(const FlatSceneView& scene, const FlatHit& hit, const vec3& n, bool lit)
+{
+    vec3 albedo = scene.materials[scene.primitives[hit.primitive].material];
+    vec3 color = albedo * FlatSky(n) * 0.3f;
+    if (lit) color += albedo * dot(n, FlatLightDirection()) * 0.7f;
+    return color;
+}
+
+// 一次光線だけの簡単なシェーディング（平行光源の影あり）
+__host__ __device__ inline vec3 FlatShade(const FlatSceneView& scene, const Ray& r)
+{
+    FlatHit hit;
+    if (!FlatIntersect(scene, r, 0.001f, FLT_MAX, hit)) return FlatSky(r.direction());
+
+    vec3 n = FlatShadingNormal(scene, r, hit);
+    bool lit = dot(n, FlatLightDirection()) > 0
+        && !FlatOccluded(scene, Ray(r.point_at_t(hit.t), FlatLightDirection(), r.time()), 0.001f, FLT_MAX);
+    return FlatShadeHit(scene, hit, n, lit);
+}
+
+__global__ void render_flat(vec3* colorBuffer, FlatSceneView scene, FlatCamera camera, int nx, int ny)
+{
+    int x = threadIdx.x + blockIdx.x * blockDim.x;
+    int y = threadIdx.y + blockIdx.y * blockDim.y;
+    if ((x >= nx) || (y >= ny)) return;
+    Ray r = camera.get_ray((x + 0.5f) / float(nx), (y + 0.5f) / float(ny));
+    colorBuffer[y * nx + x] = clip(FlatShade(scene, r));
+}
+
+// CPUでの描画
+void RenderFlatCPU(vec3* colorBuffer, const FlatSceneView& scene, const FlatCamera& camera, int nx, int ny, int threadCount)
+{
+    // 行ごとに空いたスレッドが分担する
+    ParallelTasks(ny, threadCount, [&](int y) {
+        for (int x = 0; x < nx; x++)
+        {
+            Ray r = camera.get_ray((x + 0.5f) / float(nx), (y + 0.5f) / float(ny));
+            colorBuffer[y * nx + x] = clip(FlatShade(scene, r));
+        }
+    });
+}
@@ -0,0 +1,363 @@
+#pragma once
+
+#include <float.h>
+#include <math.h>
+#include "../core/vec3.h"
+#include "../core/aabb.h"
+#include "../core/mat34.h"
+#include "../shapes/triangleIntersect.h"
+
+// 仮想関数を使わないシーン表現
+// プリミティブは種類のタグとunionで持ち、switchで判定を呼び分ける
+// BVHのノードは配列の要素で、Hitableではない
+// 変換は単位変換でないインスタンスだけが行列で持つ
+// 判定の関数はホスト・デバイスの両方で使用できる（CPUでの描画とGPUでの描画で共有する）
+
+enum FlatPrimitiveType {
+    FLAT_TRIANGLE = 0,
+    FLAT_SPHERE = 1,
+};
+
+struct FlatTriangle {
+    float v0[3];
+    float v1[3];
+    float v2[3];
+};
+
+struct FlatSphere {
+    float center[3];
+    float radius;
+};
+
+struct FlatPrimitive {
+    int type;       // FlatPrimitiveType
+    int material;   // マテリアルの番号
+    union {
+        FlatTriangle triangle;
+        FlatSphere sphere;
+    };
+};
+
+// 2分木のBVHを辿るスタックの大きさ。構築では葉の深さをFLAT_MAX_DEPTH以下にする
+// 辿るときは遠い子だけを積むので、積む数は深さを超えない
+const int FLAT_STACK_SIZE = 64;
+const int FLAT_MAX_DEPTH = 60;
+
+// BVHのノード（32バイト）
+// 内部ノードの子は leftFirst と leftFirst + 1 に並んでいる
+struct FlatBVHNode {
+    float bmin[3];
+    int leftFirst;  // 内部ノードなら左の子の番号、葉なら最初のプリミティブの番号
+    float bmax[3];
+    int count;      // 葉のプリミティブ数。0なら内部ノード
+
+    __host__ __device__ bool IsLeaf() const { return count > 0; }
+};
+
+// メッシュ1つ分のBVH。ノードとプリミティブの番号はシーン全体の配列での番号
+struct FlatMesh {
+    int rootNode;
+    int nodeCount;
+    int firstPrimitive;
+    int primitiveCount;
+};
+
+struct FlatTransform {
+    Mat34 objectToWorld;
+    Mat34 worldToObject;
+};
+
+struct FlatInstance {
+    int mesh;
+    int transform;  // 単位変換なら-1
+};
+
+// 判定に使う配列への参照。ホスト側の配列でもデバイス側の配列でもよい
+// topNodesはインスタンスのトップレベルのBVH（葉は1インスタンスで、leftFirstがインスタンスの番号）
+// topNodeCountが0ならインスタンスを順に調べる
+struct FlatSceneView {
+    const FlatPrimitive* primitives;
+    const FlatBVHNode* nodes;
+    const FlatMesh* meshes;
+    const FlatInstance* instances;
+    const FlatTransform* transforms;
+    const vec3* materials;  // マテリアルごとの色
+    const FlatBVHNode* topNodes;
+    int instanceCount;
+    int topNodeCount;
+};
+
+// 交差の結果。法線などは走査の後でFlatSurfaceNormalで求める
+struct FlatHit {
+    float t;
+    float u;
+    float v;
+    int primitive;
+    int instance;
+};
+
+
+// 逆数の方向と符号を使ったスラブ法（AABB::hitと同じ）。交差する場合はt_enterに箱に入る距離を返す
+__host__ __device__ inline bool FlatBoxHit(const float bmin[3], const float bmax[3],
+    const InvRay& r, float t_min, float t_max, float& t_enter)
+{
+    for (int a = 0; a < 3; a++) {
+        float t0 = ((r.sign[a] ? bmax : bmin)[a] - r.org[a]) * r.invDir[a];
+        float t1 = ((r.sign[a] ? bmin : bmax)[a] - r.org[a]) * r.invDir[a];
+        t_min = ffmax(t0, t_min);
+        t_max = ffmin(t1, t_max);
+    }
+    t_enter = t_min;
+    return t_min <= t_max;
+}
+
+__host__ __device__ inline bool IntersectSphere(const FlatSphere& sphere, const Ray& r, float t_min, float t_max, float& t)
+{
+    vec3 oc = r.origin() - vec3(sphere.center[0], sphere.center[1], sphere.center[2]);
+    float a = dot(r.direction(), r.direction());
+    float b = dot(oc, r.direction());
+    float c = dot(oc, oc) - sphere.radius * sphere.radius;
+    float discriminant = b * b - a * c;
+    if (discriminant <= 0) return false;
+    float sq = sqrtf(discriminant);
+    float tmp = (-b - sq) / a;
+    if (tmp < t_max && tmp > t_min) {
+        t = tmp;
+        return true;
+    }
+    tmp = (-b + sq) / a;
+    if (tmp < t_max && tmp > t_min) {
+        t = tmp;
+        return true;
+    }
+    return false;
+}
+
+// プリミティブの種類で判定を呼び分ける
+__host__ __device__ inline bool IntersectPrimitive(const FlatPrimitive& prim, const Ray& r, const WatertightRay& wray,
+    float t_min, float t_max, float& t, float& u, float& v)
+{
+    switch (prim.type) {
+    case FLAT_TRIANGLE: {
+        const FlatTriangle& tri = prim.triangle;
+        return IntersectTriangle(wray,
+            vec3(tri.v0[0], tri.v0[1], tri.v0[2]),
+            vec3(tri.v1[0], tri.v1[1], tri.v1[2]),
+            vec3(tri.v2[0], tri.v2[1], tri.v2[2]),
+            t_min, t_max, false, t, u, v);
+    }
+    case FLAT_SPHERE:
+        u = v = 0.0f;
+        return IntersectSphere(prim.sphere, r, t_min, t_max, t);
+    }
+    return false;
+}
+
+// 1つのメッシュのBVHを近い子から辿り、最も近い交差を求める
+// anyHitなら最初に見つかった交差で打ち切る
+__host__ __device__ inline bool TraverseFlatMesh(const FlatSceneView& scene, const FlatMesh& mesh, const Ray& r,
+    float t_min, float& t_max, FlatHit& hit, bool anyHit)
+{
+    const int STACK_SIZE = FLAT_STACK_SIZE;
+    int stack[STACK_SIZE];
+    float stackT[STACK_SIZE];
+    int sp = 0;
+
+    const InvRay inv_r(r);
+    const WatertightRay wray(r.origin(), r.direction());
+
+    float t_enter;
+    const FlatBVHNode* nodes = scene.nodes;
+    if (!FlatBoxHit(nodes[mesh.rootNode].bmin, nodes[mesh.rootNode].bmax, inv_r, t_min, t_max, t_enter)) return false;
+
+    bool hit_anything = false;
+    int nodeIndex = mesh.rootNode;
+    while (true) {
+        const FlatBVHNode& node = nodes[nodeIndex];
+        if (node.IsLeaf()) {
+            for (int i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+                float t, u, v;
+                if (IntersectPrimitive(scene.primitives[i], r, wray, t_min, t_max, t, u, v)) {
+                    hit_anything = true;
+                    if (anyHit) return true;
+                    t_max = t;
+                    hit.t = t;
+                    hit.u = u;
+                    hit.v = v;
+                    hit.primitive = i;
+                }
+            }
+        }
+        else {
+            int left = node.leftFirst;
+            int right = node.leftFirst + 1;
+            float t_left, t_right;
+            bool hit_left = FlatBoxHit(nodes[left].bmin, nodes[left].bmax, inv_r, t_min, t_max, t_left);
+            bool hit_right = FlatBoxHit(nodes[right].bmin, nodes[right].bmax, inv_r, t_min, t_max, t_right);
+            if (hit_left && hit_right) {
+                int nearNode = left, farNode = right;
+                float t_far = t_right;
+                if (t_right < t_left) {
+                    nearNode = right;
+                    farNode = left;
+                    t_far = t_left;
+                }
+                // 深さの制限を超える木では、配列の外に書かずに打ち切る
+                if (sp == STACK_SIZE) return hit_anything;
+                stack[sp] = farNode;
+                stackT[sp] = t_far;
+                sp++;
+                nodeIndex = nearNode;
+                continue;
+            }
+            else if (hit_left) {
+                nodeIndex = left;
+                continue;
+            }
+            else if (hit_right) {
+                nodeIndex = right;
+                continue;
+            }
+        }
+
+        do {
+            if (sp == 0) return hit_anything;
+            sp--;
+        } while (stackT[sp] > t_max);
+        nodeIndex = stack[sp];
+    }
+}
+
+// インスタンスの変換（あれば）を適用した光線
+__host__ __device__ inline Ray FlatInstanceRay(const FlatSceneView& scene, const FlatInstance& instance, const Ray& r)
+{
+    if (instance.transform < 0) return r;
+    const Mat34& m = scene.transforms[instance.transform].worldToObject;
+    // 方向は正規化しないので、tはワールド空間と同じ値になる
+    return Ray(m.TransformPoint(r.origin()), m.TransformVector(r.direction()), r.time());
+}
+
+// トップレベルのBVHを近い子から辿り、葉のインスタンスのメッシュのBVHを辿る
+// anyHitなら最初に見つかった交差で打ち切る
+__host__ __device__ inline bool TraverseFlatTopLevel(const FlatSceneView& scene, const Ray& r,
+    float t_min, float& t_max, FlatHit& hit, bool anyHit)
+{
+    const int STACK_SIZE = FLAT_STACK_SIZE;
+    int stack[STACK_SIZE];
+    float stackT[STACK_SIZE];
+    int sp = 0;
+
+    const InvRay inv_r(r);
+    const FlatBVHNode* nodes = scene.topNodes;
+    float t_enter;
+    if (!FlatBoxHit(nodes[0].bmin, nodes[0].bmax, inv_r, t_min, t_max, t_enter)) return false;
+
+    bool hit_anything = false;
+    int nodeIndex = 0;
+    while (true) {
+        const FlatBVHNode& node = nodes[nodeIndex];
+        if (node.IsLeaf()) {
+            const FlatInstance& instance = scene.instances[node.leftFirst];
+            Ray local = FlatInstanceRay(scene, instance, r);
+            if (TraverseFlatMesh(scene, scene.meshes[instance.mesh], local, t_min, t_max, hit, anyHit)) {
+                hit_anything = true;
+                if (anyHit) return true;
+                hit.instance = node.leftFirst;
+            }
+        }
+        else {
+            int left = node.leftFirst;
+            int right = node.leftFirst + 1;
+            float t_left, t_right;
+            bool hit_left = FlatBoxHit(nodes[left].bmin, nodes[left].bmax, inv_r, t_min, t_max, t_left);
+            bool hit_right = FlatBoxHit(nodes[right].bmin, nodes[right].bmax, inv_r, t_min, t_max, t_right);
+            if (hit_left && hit_right) {
+                int nearNode = left, farNode = right;
+                float t_far = t_right;
+                if (t_right < t_left) {
+                    nearNode = right;
+                    farNode = left;
+                    t_far = t_left;
+                }
+                // 深さの制限を超える木では、配列の外に書かずに打ち切る
+                if (sp == STACK_SIZE) return hit_anything;
+                stack[sp] = farNode;
+                stackT[sp] = t_far;
+                sp++;
+                nodeIndex = nearNode;
+                continue;
+            }
+            else if (hit_left) {
+                nodeIndex = left;
+                continue;
+            }
+            else if (hit_right) {
+                nodeIndex = right;
+                continue;
+            }
+        }
+
+        do {
+            if (sp == 0) return hit_anything;
+            sp--;
+        } while (stackT[sp] > t_max);
+        nodeIndex = stack[sp];
+    }
+}
+
+// シーン全体で最も近い交差を求める
+__host__ __device__ inline bool FlatIntersect(const FlatSceneView& scene, const Ray& r, float t_min, float t_max, FlatHit& hit)
+{
+    if (scene.topNodeCount > 0) return TraverseFlatTopLevel(scene, r, t_min, t_max, hit, false);
+    bool hit_anything = false;
+    for (int i = 0; i < scene.instanceCount; i++) {
+        const FlatInstance& instance = scene.instances[i];
+        Ray local = FlatInstanceRay(scene, instance, r);
+        if (TraverseFlatMesh(scene, scene.meshes[instance.mesh], local, t_min, t_max, hit, false)) {
+            hit_anything = true;
+            hit.instance = i;
+        }
+    }
+    return hit_anything;
+}
+
+// t_minからt_maxの間に何かがあるかだけを調べる
+__host__ __device__ inline bool FlatOccluded(const FlatSceneView& scene, const Ray& r, float t_min, float t_max)
+{
+    FlatHit hit;
+    if (scene.topNodeCount > 0) return TraverseFlatTopLevel(scene, r, t_min, t_max, hit, true);
+    for (int i = 0; i < scene.instanceCount; i++) {
+        const FlatInstance& instance = scene.instances[i];
+        Ray local = FlatInstanceRay(scene, instance, r);
+        if (TraverseFlatMesh(scene, scene.meshes[instance.mesh], local, t_min, t_max, hit, true)) return true;
+    }
+    return false;
+}
+
+// 交差した点のワールド空間での法線（正規化済み）
+__host__ __device__ inline vec3 FlatSurfaceNormal(const FlatSceneView& scene, const Ray& r, const FlatHit& hit)
+{
+    const FlatPrimitive& prim = scene.primitives[hit.primitive];
+    const FlatInstance& instance = scene.instances[hit.instance];
+    vec3 n;
+    switch (prim.type) {
+    case FLAT_TRIANGLE: {
+        const FlatTriangle& tri = prim.triangle;
+        vec3 v0(tri.v0[0], tri.v0[1], tri.v0[2]);
+        n = cross(vec3(tri.v1[0], tri.v1[1], tri.v1[2]) - v0, vec3(tri.v2[0], tri.v2[1], tri.v2[2]) - v0);
+        break;
+    }
+    case FLAT_SPHERE: {
+        Ray local = FlatInstanceRay(scene, instance, r);
+        n = local.point_at_t(hit.t) - vec3(prim.sphere.center[0], prim.sphere.center[1], prim.sphere.center[2]);
+        break;
+    }
+    default:
+        n = vec3(0, 1, 0);
+        break;
+    }
+    if (instance.transform >= 0) {
+        n = scene.transforms[instance.transform].worldToObject.TransposeTransformVector(n);
+    }
+    return unit_vector(n);
+}
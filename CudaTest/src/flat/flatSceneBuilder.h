@@ -0,0 +1,481 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "flatSplitBuilder.h"
+#include "../core/deviceResource.h"
+
+inline void SetTriangle(FlatPrimitive& prim, const vec3& v0, const vec3& v1, const vec3& v2)
+{
+    for (int a = 0; a < 3; a++) {
+        prim.triangle.v0[a] = v0[a];
+        prim.triangle.v1[a] = v1[a];
+        prim.triangle.v2[a] = v2[a];
+    }
+}
+
+// FlatSceneViewの配列をホスト側で組み立て、必要ならデバイスに転送する
+// BVHはメッシュごとにホストで構築する（splitModeで分割の方法を選ぶ。既定は重心の広がりが最大の軸で中央値分割）
+// maxLeafSize以下のノードは、葉にした場合と分割した場合のコストを表面積で見積もって決める
+// buildThreadsが2以上なら構築を並列に行う（木の形はスレッド数によらない。ノードの並び順は変わる）
+class FlatScene {
+public:
+    FlatScene() : maxLeafSize(2), leafWidth(1), splitMode(FLAT_SPLIT_MEDIAN), splitBudget(0.3f), buildThreads(1) {}
+    FlatScene(const FlatScene&) = delete;
+    FlatScene& operator=(const FlatScene&) = delete;
+
+    int AddMaterial(const vec3& albedo)
+    {
+        materials.push_back(albedo);
+        return (int)materials.size() - 1;
+    }
+
+    // FBXのメッシュと同じ頂点の順番（idx[2], idx[1], idx[0]）で三角形を作り、BVHを構築する
+    // materialIdsを渡すと、三角形のマテリアルは material + materialIds[i] になる
+    int AddTriangleMesh(const vec3* points, const vec3* idxVertex, int nTriangles, int material, const int* materialIds = nullptr)
+    {
+        int first = AddTriangles(points, idxVertex, nTriangles, material, materialIds);
+        return AddMesh(first, nTriangles);
+    }
+
+    // AddTriangleMeshと同じ三角形を追加し、BVHは作らずに全ての三角形を持つ葉1つを根にする
+    // 木は呼び出し側が根から作り直す（FlatClipBVHなど）。メッシュは末尾にあるので、ノードは根の後ろに追加すればよい
+    int AddUnbuiltTriangleMesh(const vec3* points, const vec3* idxVertex, int nTriangles, int material)
+    {
+        FlatMesh mesh;
+        mesh.firstPrimitive = AddTriangles(points, idxVertex, nTriangles, material, nullptr);
+        mesh.primitiveCount = nTriangles;
+        mesh.rootNode = (int)nodes.size();
+        mesh.nodeCount = 1;
+        nodes.push_back(FlatBVHNode());
+        MakeLeaf(nodes.back(), mesh.firstPrimitive, nTriangles);
+        meshes.push_back(mesh);
+        return (int)meshes.size() - 1;
+    }
+
+    int AddSphere(const vec3& center, float radius, int material)
+    {
+        FlatPrimitive prim;
+        prim.type = FLAT_SPHERE;
+        prim.material = material;
+        for (int a = 0; a < 3; a++) prim.sphere.center[a] = center[a];
+        prim.sphere.radius = radius;
+        primitives.push_back(prim);
+        sourceIndex.push_back(0);
+        return AddMesh((int)primitives.size() - 1, 1);
+    }
+
+    // 単位変換の場合は行列を持たない
+    int AddInstance(int mesh, const Mat34& objectToWorld = Mat34::Identity())
+    {
+        FlatInstance instance;
+        instance.mesh = mesh;
+        instance.transform = -1;
+        if (!objectToWorld.IsIdentity()) {
+            FlatTransform transform;
+            transform.objectToWorld = objectToWorld;
+            transform.worldToObject = objectToWorld.Inverse();
+            transforms.push_back(transform);
+            instance.transform = (int)transforms.size() - 1;
+        }
+        instances.push_back(instance);
+        return (int)instances.size() - 1;
+    }
+
+    // インスタンスのワールド空間の箱でトップレベルのBVHを構築する（重心の広がりが最大の軸で中央値分割し、葉は1インスタンス）
+    // インスタンスを追加した後に呼ぶ。構築しなければ判定ではインスタンスを順に調べる
+    // メッシュをリフィットした後はRefitTopLevelで箱だけ更新する
+    void BuildTopLevel()
+    {
+        topNodes.clear();
+        const int count = (int)instances.size();
+        if (count == 0) return;
+        std::vector<vec3> centroids(count);
+        std::vector<int> order(count);
+        for (int i = 0; i < count; i++)
+        {
+            vec3 bmin, bmax;
+            InstanceBounds(i, bmin, bmax);
+            centroids[i] = 0.5f * (bmin + bmax);
+            order[i] = i;
+        }
+        topNodes.push_back(FlatBVHNode());
+        SubdivideTopLevel(0, order, centroids, 0, count);
+        RefitTopLevel();
+    }
+
+    // メッシュのBVHと同じく、後ろから順に更新する
+    void RefitTopLevel()
+    {
+        for (int i = (int)topNodes.size() - 1; i >= 0; i--)
+        {
+            FlatBVHNode& node = topNodes[i];
+            vec3 bmin, bmax;
+            if (node.IsLeaf()) {
+                InstanceBounds(node.leftFirst, bmin, bmax);
+            }
+            else {
+                const FlatBVHNode& l = topNodes[node.leftFirst];
+                const FlatBVHNode& r = topNodes[node.leftFirst + 1];
+                bmin = minVec3(vec3(l.bmin[0], l.bmin[1], l.bmin[2]), vec3(r.bmin[0], r.bmin[1], r.bmin[2]));
+                bmax = maxVec3(vec3(l.bmax[0], l.bmax[1], l.bmax[2]), vec3(r.bmax[0], r.bmax[1], r.bmax[2]));
+            }
+            SetNodeBounds(node, bmin, bmax);
+        }
+    }
+
+    // インスタンスのワールド空間の箱（メッシュの根の箱の8つの角を変換して囲む）
+    void InstanceBounds(int instance, vec3& bmin, vec3& bmax) const
+    {
+        const FlatInstance& inst = instances[instance];
+        const FlatBVHNode& root = nodes[meshes[inst.mesh].rootNode];
+        bmin = vec3(root.bmin[0], root.bmin[1], root.bmin[2]);
+        bmax = vec3(root.bmax[0], root.bmax[1], root.bmax[2]);
+        if (inst.transform < 0) return;
+        const Mat34& m = transforms[inst.transform].objectToWorld;
+        vec3 wmin(FLT_MAX), wmax(-FLT_MAX);
+        for (int corner = 0; corner < 8; corner++)
+        {
+            vec3 p((corner & 1) ? root.bmax[0] : root.bmin[0], (corner & 2) ? root.bmax[1] : root.bmin[1], (corner & 4) ? root.bmax[2] : root.bmin[2]);
+            p = m.TransformPoint(p);
+            wmin = minVec3(wmin, p);
+            wmax = maxVec3(wmax, p);
+        }
+        bmin = wmin;
+        bmax = wmax;
+    }
+
+    // 変形後の頂点で三角形を書き換え、BVHをリフィットする
+    // 空間分割で切った箱は切る前の三角形の箱に戻る（重複した三角形はsourceIndexで同じ三角形を指す）
+    void UpdateTriangleMesh(int mesh, const vec3* points, const vec3* idxVertex)
+    {
+        SetTriangleVertices(mesh, points, idxVertex);
+        Refit(mesh);
+    }
+
+    // 三角形だけ書き換える（ノードの箱は呼び出し側で更新する）
+    void SetTriangleVertices(int mesh, const vec3* points, const vec3* idxVertex)
+    {
+        const FlatMesh& m = meshes[mesh];
+        for (int i = m.firstPrimitive; i < m.firstPrimitive + m.primitiveCount; i++)
+        {
+            vec3 idx = idxVertex[sourceIndex[i]];
+            SetTriangle(primitives[i], points[int(idx[2])], points[int(idx[1])], points[int(idx[0])]);
+        }
+    }
+
+    // ノードは親より子が後ろにあるので、後ろから順に更新すれば子が先に更新される
+    void Refit(int mesh)
+    {
+        const FlatMesh& m = meshes[mesh];
+        for (int i = m.rootNode + m.nodeCount - 1; i >= m.rootNode; i--)
+        {
+            FlatBVHNode& node = nodes[i];
+            vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+            if (node.IsLeaf()) {
+                for (int p = node.leftFirst; p < node.leftFirst + node.count; p++)
+                {
+                    vec3 pmin, pmax;
+                    FlatPrimitiveBounds(primitives[p], pmin, pmax);
+                    bmin = minVec3(bmin, pmin);
+                    bmax = maxVec3(bmax, pmax);
+                }
+            }
+            else {
+                for (int c = node.leftFirst; c <= node.leftFirst + 1; c++)
+                {
+                    bmin = minVec3(bmin, vec3(nodes[c].bmin[0], nodes[c].bmin[1], nodes[c].bmin[2]));
+                    bmax = maxVec3(bmax, vec3(nodes[c].bmax[0], nodes[c].bmax[1], nodes[c].bmax[2]));
+                }
+            }
+            SetNodeBounds(node, bmin, bmax);
+        }
+    }
+
+    // メッシュのBVHのSAHコスト（根の表面積に対する期待値。FLAT_TRAVERSAL_COSTとFLAT_LEAF_COSTで見積もる）
+    float SAHCost(int mesh) const
+    {
+        const FlatMesh& m = meshes[mesh];
+        const float rootArea = NodeArea(nodes[m.rootNode]);
+        if (rootArea <= 0.0f) return 0.0f;
+        float cost = 0.0f;
+        for (int i = m.rootNode; i < m.rootNode + m.nodeCount; i++)
+        {
+            const FlatBVHNode& node = nodes[i];
+            float area = NodeArea(node) / rootArea;
+            cost += node.IsLeaf() ? area * FLAT_LEAF_COST * FlatLeafBlocks(node.count, leafWidth) : area * FLAT_TRAVERSAL_COST;
+        }
+        return cost;
+    }
+
+    // 内部ノードの子の箱が重なる部分の表面積の合計（根の表面積に対する割合）
+    float ChildOverlap(int mesh) const
+    {
+        const FlatMesh& m = meshes[mesh];
+        const float rootArea = NodeArea(nodes[m.rootNode]);
+        if (rootArea <= 0.0f) return 0.0f;
+        float overlap = 0.0f;
+        for (int i = m.rootNode; i < m.rootNode + m.nodeCount; i++)
+        {
+            const FlatBVHNode& node = nodes[i];
+            if (node.IsLeaf()) continue;
+            const FlatBVHNode& l = nodes[node.leftFirst];
+            const FlatBVHNode& r = nodes[node.leftFirst + 1];
+            vec3 omin(std::max(l.bmin[0], r.bmin[0]), std::max(l.bmin[1], r.bmin[1]), std::max(l.bmin[2], r.bmin[2]));
+            vec3 omax(std::min(l.bmax[0], r.bmax[0]), std::min(l.bmax[1], r.bmax[1]), std::min(l.bmax[2], r.bmax[2]));
+            if (omin[0] <= omax[0] && omin[1] <= omax[1] && omin[2] <= omax[2]) overlap += SurfaceArea(omin, omax) / rootArea;
+        }
+        return overlap;
+    }
+
+    FlatSceneView HostView() const
+    {
+        FlatSceneView view;
+        view.primitives = primitives.data();
+        view.nodes = nodes.data();
+        view.meshes = meshes.data();
+        view.instances = instances.data();
+        view.transforms = transforms.data();
+        view.materials = materials.data();
+        view.topNodes = topNodes.data();
+        view.instanceCount = (int)instances.size();
+        view.topNodeCount = (int)topNodes.size();
+        return view;
+    }
+
+    // デバイスに転送する。リフィットした後はもう一度呼ぶ
+    FlatSceneView Upload()
+    {
+        d_primitives.Upload(primitives.data(), primitives.size());
+        d_nodes.Upload(nodes.data(), nodes.size());
+        d_meshes.Upload(meshes.data(), meshes.size());
+        d_instances.Upload(instances.data(), instances.size());
+        d_transforms.Upload(transforms.data(), transforms.size());
+        d_materials.Upload(materials.data(), materials.size());
+        d_topNodes.Upload(topNodes.data(), topNodes.size());
+
+        FlatSceneView view;
+        view.primitives = d_primitives.get();
+        view.nodes = d_nodes.get();
+        view.meshes = d_meshes.get();
+        view.instances = d_instances.get();
+        view.transforms = d_transforms.get();
+        view.materials = d_materials.get();
+        view.topNodes = d_topNodes.get();
+        view.instanceCount = (int)instances.size();
+        view.topNodeCount = (int)topNodes.size();
+        return view;
+    }
+
+    int maxLeafSize;
+    int leafWidth;  // 葉でまとめて判定するプリミティブ数（FlatTriangleBlockの幅）
+    int splitMode;  // FlatSplitMode
+    float splitBudget;  // FLAT_SPLIT_SBVHで増やしてよいプリミティブの数の割合
+    int buildThreads;  // BVHの構築に使うスレッド数
+
+    std::vector<FlatPrimitive> primitives;
+    std::vector<FlatBVHNode> nodes;
+    std::vector<FlatMesh> meshes;
+    std::vector<FlatInstance> instances;
+    std::vector<FlatTransform> transforms;
+    std::vector<vec3> materials;
+    std::vector<int> sourceIndex;   // プリミティブの元の三角形の番号（並べ替え後）
+    std::vector<FlatBVHNode> topNodes;  // インスタンスのトップレベルのBVH（BuildTopLevelで構築）
+
+private:
+    // 三角形をプリミティブの末尾に追加し、最初の番号を返す
+    int AddTriangles(const vec3* points, const vec3* idxVertex, int nTriangles, int material, const int* materialIds)
+    {
+        int first = (int)primitives.size();
+        for (int i = 0; i < nTriangles; i++)
+        {
+            FlatPrimitive prim;
+            prim.type = FLAT_TRIANGLE;
+            prim.material = materialIds ? material + materialIds[i] : material;
+            vec3 idx = idxVertex[i];
+            SetTriangle(prim, points[int(idx[2])], points[int(idx[1])], points[int(idx[0])]);
+            primitives.push_back(prim);
+            sourceIndex.push_back(i);
+        }
+        return first;
+    }
+
+    int AddMesh(int firstPrimitive, int count)
+    {
+        FlatMesh mesh;
+        mesh.rootNode = (int)nodes.size();
+        mesh.firstPrimitive = firstPrimitive;
+        mesh.primitiveCount = count;
+
+        nodes.push_back(FlatBVHNode());
+        std::vector<int> order;
+        if (splitMode == FLAT_SPLIT_MEDIAN) {
+            std::vector<vec3> centroids(count);
+            order.resize(count);
+            ParallelChunks(count, FlatChunkCount(count, buildThreads), [&](int, int begin, int end) {
+                for (int i = begin; i < end; i++)
+                {
+                    vec3 pmin, pmax;
+                    FlatPrimitiveBounds(primitives[firstPrimitive + i], pmin, pmax);
+                    centroids[i] = 0.5f * (pmin + pmax);
+                    order[i] = i;
+                }
+            });
+            std::vector<FlatSubtreeTask> tasks;
+            Subdivide(nodes, mesh.rootNode, order, centroids, 0, count, firstPrimitive, FlatSubtreeSize(count, buildThreads), &tasks);
+
+            // 部分木はorderの別々の範囲を並べ替えるので、そのまま並列に構築できる
+            std::vector<std::vector<FlatBVHNode>> subtrees(tasks.size());
+            ParallelTasks((int)tasks.size(), buildThreads, [&](int i) {
+                subtrees[i].assign(1, FlatBVHNode());
+                Subdivide(subtrees[i], 0, order, centroids, tasks[i].begin, tasks[i].end, firstPrimitive, 0, nullptr);
+            });
+            for (size_t i = 0; i < tasks.size(); i++) AppendSubtree(nodes, tasks[i].node, subtrees[i], 0);
+        }
+        else {
+            // ノードの箱は切った三角形の箱で決まるので、最後のリフィットはしない
+            FlatSplitBuilder builder(&primitives[firstPrimitive], count, splitMode == FLAT_SPLIT_SBVH,
+                maxLeafSize, leafWidth, splitBudget, buildThreads);
+            builder.Build(nodes, mesh.rootNode, firstPrimitive, order);
+        }
+
+        // 葉が連続した範囲を指すようにプリミティブを並べ替える。空間分割で重複した分だけ末尾が伸びる
+        // （メッシュは常に末尾に追加するので、後ろのプリミティブはない）
+        const int sortedCount = (int)order.size();
+        std::vector<FlatPrimitive> sorted(sortedCount);
+        std::vector<int> sortedSource(sortedCount);
+        ParallelChunks(sortedCount, FlatChunkCount(sortedCount, buildThreads), [&](int, int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                sorted[i] = primitives[firstPrimitive + order[i]];
+                sortedSource[i] = sourceIndex[firstPrimitive + order[i]];
+            }
+        });
+        primitives.resize(firstPrimitive);
+        sourceIndex.resize(firstPrimitive);
+        primitives.insert(primitives.end(), sorted.begin(), sorted.end());
+        sourceIndex.insert(sourceIndex.end(), sortedSource.begin(), sortedSource.end());
+        mesh.primitiveCount = sortedCount;
+
+        mesh.nodeCount = (int)nodes.size() - mesh.rootNode;
+        meshes.push_back(mesh);
+        if (splitMode == FLAT_SPLIT_MEDIAN) Refit((int)meshes.size() - 1);
+        return (int)meshes.size() - 1;
+    }
+
+    // tasksがあれば、subtreeSizeより小さい部分木は構築せずにtasksに回す
+    void Subdivide(std::vector<FlatBVHNode>& out, int nodeIndex, std::vector<int>& order, const std::vector<vec3>& centroids,
+        int begin, int end, int firstPrimitive, int subtreeSize, std::vector<FlatSubtreeTask>* tasks) const
+    {
+        int count = end - begin;
+        if (count <= 1) {
+            MakeLeaf(out[nodeIndex], firstPrimitive + begin, count);
+            return;
+        }
+        if (tasks && count < subtreeSize) {
+            FlatSubtreeTask task;
+            task.node = nodeIndex;
+            task.begin = begin;
+            task.end = end;
+            tasks->push_back(task);
+            return;
+        }
+
+        vec3 cmin(FLT_MAX), cmax(-FLT_MAX);
+        for (int i = begin; i < end; i++)
+        {
+            cmin = minVec3(cmin, centroids[order[i]]);
+            cmax = maxVec3(cmax, centroids[order[i]]);
+        }
+        vec3 extent = cmax - cmin;
+        int axis = extent[0] > extent[1] ? (extent[0] > extent[2] ? 0 : 2) : (extent[1] > extent[2] ? 1 : 2);
+
+        int mid = begin + count / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+            [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+
+        if (count <= maxLeafSize && PreferLeaf(order, begin, mid, end, firstPrimitive)) {
+            MakeLeaf(out[nodeIndex], firstPrimitive + begin, count);
+            return;
+        }
+
+        int left = (int)out.size();
+        out.push_back(FlatBVHNode());
+        out.push_back(FlatBVHNode());
+        out[nodeIndex].leftFirst = left;
+        out[nodeIndex].count = 0;
+        Subdivide(out, left, order, centroids, begin, mid, firstPrimitive, subtreeSize, tasks);
+        Subdivide(out, left + 1, order, centroids, mid, end, firstPrimitive, subtreeSize, tasks);
+    }
+
+    void SubdivideTopLevel(int nodeIndex, std::vector<int>& order, const std::vector<vec3>& centroids, int begin, int end)
+    {
+        if (end - begin == 1) {
+            MakeLeaf(topNodes[nodeIndex], order[begin], 1);
+            return;
+        }
+        vec3 cmin(FLT_MAX), cmax(-FLT_MAX);
+        for (int i = begin; i < end; i++)
+        {
+            cmin = minVec3(cmin, centroids[order[i]]);
+            cmax = maxVec3(cmax, centroids[order[i]]);
+        }
+        vec3 extent = cmax - cmin;
+        int axis = extent[0] > extent[1] ? (extent[0] > extent[2] ? 0 : 2) : (extent[1] > extent[2] ? 1 : 2);
+        int mid = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+            [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+
+        int left = (int)topNodes.size();
+        topNodes.push_back(FlatBVHNode());
+        topNodes.push_back(FlatBVHNode());
+        topNodes[nodeIndex].leftFirst = left;
+        topNodes[nodeIndex].count = 0;
+        SubdivideTopLevel(left, order, centroids, begin, mid);
+        SubdivideTopLevel(left + 1, order, centroids, mid, end);
+    }
+
+    static float NodeArea(const FlatBVHNode& node)
+    {
+        return SurfaceArea(vec3(node.bmin[0], node.bmin[1], node.bmin[2]), vec3(node.bmax[0], node.bmax[1], node.bmax[2]));
+    }
+
+    static void MakeLeaf(FlatBVHNode& node, int first, int count)
+    {
+        node.leftFirst = first;
+        node.count = count;
+    }
+
+    // 葉にする方が安いか。分割後の子は葉になると仮定する（SAH）
+    bool PreferLeaf(const std::vector<int>& order, int begin, int mid, int end, int firstPrimitive) const
+    {
+        vec3 lmin(FLT_MAX), lmax(-FLT_MAX), rmin(FLT_MAX), rmax(-FLT_MAX);
+        for (int i = begin; i < end; i++)
+        {
+            vec3 pmin, pmax;
+            FlatPrimitiveBounds(primitives[firstPrimitive + order[i]], pmin, pmax);
+            if (i < mid) {
+                lmin = minVec3(lmin, pmin);
+                lmax = maxVec3(lmax, pmax);
+            }
+            else {
+                rmin = minVec3(rmin, pmin);
+                rmax = maxVec3(rmax, pmax);
+            }
+        }
+        float area = SurfaceArea(minVec3(lmin, rmin), maxVec3(lmax, rmax));
+        if (area <= 0.0f) return true;
+        float leafCost = FLAT_LEAF_COST * FlatLeafBlocks(end - begin, leafWidth);
+        float splitCost = FLAT_TRAVERSAL_COST + FLAT_LEAF_COST * (SurfaceArea(lmin, lmax) * FlatLeafBlocks(mid - begin, leafWidth)
+            + SurfaceArea(rmin, rmax) * FlatLeafBlocks(end - mid, leafWidth)) / area;
+        return leafCost <= splitCost;
+    }
+
+    DeviceBuffer<FlatPrimitive> d_primitives;
+    DeviceBuffer<FlatBVHNode> d_nodes;
+    DeviceBuffer<FlatMesh> d_meshes;
+    DeviceBuffer<FlatInstance> d_instances;
+    DeviceBuffer<FlatTransform> d_transforms;
+    DeviceBuffer<vec3> d_materials;
+    DeviceBuffer<FlatBVHNode> d_topNodes;
+};
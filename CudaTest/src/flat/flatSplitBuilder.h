@@ -0,0 +1,499 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "flatBuildTasks.h"
+
+// BVHの構築に使う関数と、表面積によるコスト（SAH）で分割するBVHの構築
+
+// プリミティブのAABB
+inline void FlatPrimitiveBounds(const FlatPrimitive& prim, vec3& bmin, vec3& bmax)
+{
+    switch (prim.type) {
+    case FLAT_TRIANGLE: {
+        const FlatTriangle& tri = prim.triangle;
+        vec3 v0(tri.v0[0], tri.v0[1], tri.v0[2]);
+        vec3 v1(tri.v1[0], tri.v1[1], tri.v1[2]);
+        vec3 v2(tri.v2[0], tri.v2[1], tri.v2[2]);
+        bmin = minVec3(v0, minVec3(v1, v2));
+        bmax = maxVec3(v0, maxVec3(v1, v2));
+        break;
+    }
+    case FLAT_SPHERE: {
+        vec3 c(prim.sphere.center[0], prim.sphere.center[1], prim.sphere.center[2]);
+        bmin = c - vec3(prim.sphere.radius);
+        bmax = c + vec3(prim.sphere.radius);
+        break;
+    }
+    default:
+        bmin = vec3(FLT_MAX);
+        bmax = vec3(-FLT_MAX);
+        break;
+    }
+}
+
+inline float SurfaceArea(const vec3& bmin, const vec3& bmax)
+{
+    vec3 d = bmax - bmin;
+    return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+}
+
+inline void SetNodeBounds(FlatBVHNode& node, const vec3& bmin, const vec3& bmax)
+{
+    for (int a = 0; a < 3; a++) {
+        node.bmin[a] = bmin[a];
+        node.bmax[a] = bmax[a];
+    }
+}
+
+// SAHの係数。箱2つの判定と、葉でleafWidth個まとめた判定1回をそれぞれ1と見積もる
+const float FLAT_TRAVERSAL_COST = 1.0f;
+const float FLAT_LEAF_COST = 1.0f;
+
+// 葉でのプリミティブの判定の回数（leafWidth個ずつまとめて判定する）
+inline float FlatLeafBlocks(int count, int leafWidth)
+{
+    return float((count + leafWidth - 1) / leafWidth);
+}
+
+// これより深いノードでは空間分割をしない。空間分割では子が親の参照を全て持つことがあり、木が深くなりやすい
+const int FLAT_SPATIAL_SPLIT_MAX_DEPTH = 48;
+
+enum FlatSplitMode {
+    FLAT_SPLIT_MEDIAN = 0,  // 重心の広がりが最大の軸で中央値分割
+    FLAT_SPLIT_SAH = 1,     // 重心をビンに分けてSAHが最小の面で分割（オブジェクト分割）
+    FLAT_SPLIT_SBVH = 2,    // オブジェクト分割に加えて、三角形を面で切る空間分割も考える（SBVH）
+};
+
+// SAHで分割してBVHを構築する（Stich, Friedrich, Dietrich 2009 "Spatial Splits in Bounding Volume Hierarchies"）
+// 空間分割では面をまたぐ三角形を両側の子に入れ、それぞれの箱は三角形を面で切った部分の箱にする
+// 子の箱が大きく重なる細長い三角形（腕や脚の周りなど）で箱の重なりを減らせる
+// 同じプリミティブを複数の葉が指すので、プリミティブの数はsplitBudgetの割合まで増える
+// threadCountが2以上なら上の階層のビン分け・振り分けを範囲ごとに並列に行い、下の部分木は別々のスレッドで構築する
+// （オブジェクト分割だけなら木はスレッド数によらない。空間分割の予算はスレッド間で先着順になる）
+// 深さFLAT_MAX_DEPTHのノードは、maxLeafSizeを超えても葉にする
+class FlatSplitBuilder {
+public:
+    FlatSplitBuilder(const FlatPrimitive* primitives, int count, bool spatialSplits, int maxLeafSize, int leafWidth, float splitBudget,
+        int threadCount = 1)
+        : primitives(primitives), count(count), spatialSplits(spatialSplits), maxLeafSize(maxLeafSize), leafWidth(leafWidth),
+        maxReferences(count + (int)(count * splitBudget)), referenceCount(count), rootArea(0.0f), threadCount(threadCount)
+    {
+    }
+
+    // 根をnodes[rootIndex]に書き、子のノードはnodesの末尾に追加する
+    // orderに葉の順に並べたプリミティブの番号（0からcount - 1、重複あり）を返す。葉はfirstPrimitive + orderの位置を指す
+    void Build(std::vector<FlatBVHNode>& nodes, int rootIndex, int firstPrimitive, std::vector<int>& order)
+    {
+        std::vector<Reference> references(count);
+        for (int i = 0; i < count; i++)
+        {
+            references[i].primitive = i;
+            FlatPrimitiveBounds(primitives[i], references[i].bmin, references[i].bmax);
+        }
+        vec3 bmin, bmax;
+        Bounds(references, FlatChunkCount(count, threadCount), bmin, bmax);
+        rootArea = SurfaceArea(bmin, bmax);
+        order.clear();
+        subtreeSize = FlatSubtreeSize(count, threadCount);
+        std::vector<Subtree> subtrees;
+        Subdivide(nodes, rootIndex, references, firstPrimitive, order, 0, &subtrees);
+
+        // 部分木は大きい順に取り、葉のプリミティブは部分木ごとにまとめてorderの末尾に足す
+        std::vector<int> byCount(subtrees.size());
+        for (size_t i = 0; i < subtrees.size(); i++) byCount[i] = (int)i;
+        std::sort(byCount.begin(), byCount.end(),
+            [&](int a, int b) { return subtrees[a].references.size() > subtrees[b].references.size(); });
+        std::vector<std::vector<FlatBVHNode>> localNodes(subtrees.size());
+        std::vector<std::vector<int>> localOrder(subtrees.size());
+        ParallelTasks((int)subtrees.size(), threadCount, [&](int task) {
+            int i = byCount[task];
+            localNodes[i].assign(1, FlatBVHNode());
+            Subdivide(localNodes[i], 0, subtrees[i].references, 0, localOrder[i], subtrees[i].depth, nullptr);
+        });
+        for (size_t i = 0; i < subtrees.size(); i++)
+        {
+            AppendSubtree(nodes, subtrees[i].node, localNodes[i], firstPrimitive + (int)order.size());
+            order.insert(order.end(), localOrder[i].begin(), localOrder[i].end());
+        }
+    }
+
+private:
+    struct Reference {
+        vec3 bmin, bmax;
+        int primitive;
+    };
+
+    struct Bin {
+        vec3 bmin, bmax;
+        int count;      // オブジェクト分割ではプリミティブの数、空間分割ではこのビンで始まる参照の数
+        int exitCount;  // 空間分割でこのビンで終わる参照の数
+
+        Bin() : bmin(FLT_MAX), bmax(-FLT_MAX), count(0), exitCount(0) {}
+        void Grow(const vec3& pmin, const vec3& pmax)
+        {
+            bmin = minVec3(bmin, pmin);
+            bmax = maxVec3(bmax, pmax);
+        }
+        void Merge(const Bin& other)
+        {
+            Grow(other.bmin, other.bmax);
+            count += other.count;
+            exitCount += other.exitCount;
+        }
+    };
+
+    struct Split {
+        float cost;
+        int axis;
+        int bin;        // このビンより前が左
+        bool spatial;
+        float binMin, binScale;  // オブジェクト分割のビンの位置
+        vec3 lmin, lmax, rmin, rmax;
+    };
+
+    // 別のスレッドで構築する部分木
+    struct Subtree {
+        int node;
+        int depth;
+        std::vector<Reference> references;
+    };
+
+    static const int OBJECT_BINS = 16;
+    static const int SPATIAL_BINS = 32;
+
+    // 参照の箱（centroidsなら重心）を囲む箱。範囲ごとに求めて合わせる
+    static void Bounds(const std::vector<Reference>& references, int chunks, vec3& bmin, vec3& bmax, bool centroids = false)
+    {
+        std::vector<vec3> chunkMin(chunks, vec3(FLT_MAX)), chunkMax(chunks, vec3(-FLT_MAX));
+        ParallelChunks((int)references.size(), chunks, [&](int chunk, int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                const Reference& ref = references[i];
+                vec3 pmin = centroids ? 0.5f * (ref.bmin + ref.bmax) : ref.bmin;
+                vec3 pmax = centroids ? pmin : ref.bmax;
+                chunkMin[chunk] = minVec3(chunkMin[chunk], pmin);
+                chunkMax[chunk] = maxVec3(chunkMax[chunk], pmax);
+            }
+        });
+        bmin = vec3(FLT_MAX);
+        bmax = vec3(-FLT_MAX);
+        for (int chunk = 0; chunk < chunks; chunk++)
+        {
+            bmin = minVec3(bmin, chunkMin[chunk]);
+            bmax = maxVec3(bmax, chunkMax[chunk]);
+        }
+    }
+
+    float SplitCost(float leftArea, int leftCount, float rightArea, int rightCount, float area) const
+    {
+        return FLAT_TRAVERSAL_COST + FLAT_LEAF_COST * (leftArea * FlatLeafBlocks(leftCount, leafWidth)
+            + rightArea * FlatLeafBlocks(rightCount, leafWidth)) / area;
+    }
+
+    // subtreesがあれば上の階層として範囲を分けて並列に処理し、小さくなった部分木はsubtreesに回す
+    // depthはnodeIndexの根からの深さ
+    void Subdivide(std::vector<FlatBVHNode>& nodes, int nodeIndex, std::vector<Reference>& references,
+        int firstPrimitive, std::vector<int>& order, int depth, std::vector<Subtree>* subtrees)
+    {
+        const int n = (int)references.size();
+        if (subtrees && n < subtreeSize) {
+            subtrees->push_back(Subtree());
+            subtrees->back().node = nodeIndex;
+            subtrees->back().depth = depth;
+            subtrees->back().references.swap(references);
+            return;
+        }
+        const int chunks = subtrees ? FlatChunkCount(n, threadCount) : 1;
+
+        vec3 bmin, bmax;
+        Bounds(references, chunks, bmin, bmax);
+        SetNodeBounds(nodes[nodeIndex], bmin, bmax);
+        const float area = SurfaceArea(bmin, bmax);
+
+        Split split;
+        split.cost = FLT_MAX;
+        if (n > 1 && depth < FLAT_MAX_DEPTH) {
+            FindObjectSplit(references, area, chunks, split);
+            // 子の箱の重なりが無視できない場合だけ空間分割を探す
+            if (spatialSplits && depth < FLAT_SPATIAL_SPLIT_MAX_DEPTH && split.cost < FLT_MAX && referenceCount < maxReferences) {
+                vec3 omin = maxVec3(split.lmin, split.rmin);
+                vec3 omax = minVec3(split.lmax, split.rmax);
+                if (omin[0] <= omax[0] && omin[1] <= omax[1] && omin[2] <= omax[2]
+                    && SurfaceArea(omin, omax) > 1e-5f * rootArea) {
+                    FindSpatialSplit(references, bmin, bmax, area, chunks, split);
+                }
+            }
+        }
+
+        const float leafCost = FLAT_LEAF_COST * FlatLeafBlocks(n, leafWidth);
+        if (n <= 1 || depth >= FLAT_MAX_DEPTH || (n <= maxLeafSize && leafCost <= split.cost)) {
+            nodes[nodeIndex].leftFirst = firstPrimitive + (int)order.size();
+            nodes[nodeIndex].count = n;
+            for (const Reference& ref : references) order.push_back(ref.primitive);
+            return;
+        }
+
+        std::vector<Reference> left, right;
+        if (split.cost < FLT_MAX) Partition(references, split, bmin, bmax, chunks, left, right);
+        if (left.empty() || right.empty()) {
+            // 分割できない（重心が全て同じなど）場合は半分に分ける
+            left.assign(references.begin(), references.begin() + n / 2);
+            right.assign(references.begin() + n / 2, references.end());
+        }
+        std::vector<Reference>().swap(references);
+
+        int child = (int)nodes.size();
+        nodes.push_back(FlatBVHNode());
+        nodes.push_back(FlatBVHNode());
+        nodes[nodeIndex].leftFirst = child;
+        nodes[nodeIndex].count = 0;
+        Subdivide(nodes, child, left, firstPrimitive, order, depth + 1, subtrees);
+        Subdivide(nodes, child + 1, right, firstPrimitive, order, depth + 1, subtrees);
+    }
+
+    // 軸ごとに重心をビンに分け、ビンの境界のうちSAHが最小のものを探す
+    void FindObjectSplit(const std::vector<Reference>& references, float area, int chunks, Split& split) const
+    {
+        vec3 cmin, cmax;
+        Bounds(references, chunks, cmin, cmax, true);
+        vec3 scale;
+        for (int axis = 0; axis < 3; axis++) scale[axis] = cmax[axis] > cmin[axis] ? OBJECT_BINS / (cmax[axis] - cmin[axis]) : 0.0f;
+        std::vector<Bin> bins(chunks * 3 * OBJECT_BINS);
+        ParallelChunks((int)references.size(), chunks, [&](int chunk, int begin, int end) {
+            Bin* chunkBins = &bins[chunk * 3 * OBJECT_BINS];
+            for (int i = begin; i < end; i++)
+            {
+                const Reference& ref = references[i];
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    if (scale[axis] == 0.0f) continue;
+                    Bin& bin = chunkBins[axis * OBJECT_BINS + ObjectBin(ref, axis, cmin[axis], scale[axis])];
+                    bin.count++;
+                    bin.Grow(ref.bmin, ref.bmax);
+                }
+            }
+        });
+        for (int i = 3 * OBJECT_BINS; i < (int)bins.size(); i++) bins[i % (3 * OBJECT_BINS)].Merge(bins[i]);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (scale[axis] == 0.0f) continue;
+            Split candidate = split;
+            EvaluateBins(&bins[axis * OBJECT_BINS], OBJECT_BINS, axis, area, false, candidate);
+            if (candidate.cost < split.cost) {
+                split = candidate;
+                split.binMin = cmin[axis];
+                split.binScale = scale[axis];
+            }
+        }
+    }
+
+    static int ObjectBin(const Reference& ref, int axis, float cmin, float scale)
+    {
+        float c = 0.5f * (ref.bmin[axis] + ref.bmax[axis]);
+        return std::min(OBJECT_BINS - 1, std::max(0, (int)((c - cmin) * scale)));
+    }
+
+    // 右から箱と数を累積し、ビンの境界ごとのコストを求める
+    // 空間分割では左の数はビンで始まる参照、右の数はビンで終わる参照で数える
+    void EvaluateBins(const Bin* bins, int binCount, int axis, float area, bool spatial, Split& split) const
+    {
+        std::vector<vec3> rightMin(binCount), rightMax(binCount);
+        std::vector<int> rightCount(binCount);
+        vec3 rmin(FLT_MAX), rmax(-FLT_MAX);
+        int rcount = 0;
+        for (int b = binCount - 1; b > 0; b--)
+        {
+            rmin = minVec3(rmin, bins[b].bmin);
+            rmax = maxVec3(rmax, bins[b].bmax);
+            rcount += spatial ? bins[b].exitCount : bins[b].count;
+            rightMin[b] = rmin;
+            rightMax[b] = rmax;
+            rightCount[b] = rcount;
+        }
+        vec3 lmin(FLT_MAX), lmax(-FLT_MAX);
+        int lcount = 0;
+        for (int b = 1; b < binCount; b++)
+        {
+            lmin = minVec3(lmin, bins[b - 1].bmin);
+            lmax = maxVec3(lmax, bins[b - 1].bmax);
+            lcount += bins[b - 1].count;
+            if (lcount == 0 || rightCount[b] == 0) continue;
+            float cost = SplitCost(SurfaceArea(lmin, lmax), lcount, SurfaceArea(rightMin[b], rightMax[b]), rightCount[b], area);
+            if (cost < split.cost) {
+                split.cost = cost;
+                split.axis = axis;
+                split.bin = b;
+                split.spatial = spatial;
+                split.lmin = lmin;
+                split.lmax = lmax;
+                split.rmin = rightMin[b];
+                split.rmax = rightMax[b];
+            }
+        }
+    }
+
+    // 軸ごとに箱を等間隔のビンに分け、参照をビンの境界で切りながら入れる
+    void FindSpatialSplit(const std::vector<Reference>& references, const vec3& bmin, const vec3& bmax, float area, int chunks,
+        Split& split) const
+    {
+        std::vector<Bin> bins(chunks * 3 * SPATIAL_BINS);
+        ParallelChunks((int)references.size(), chunks, [&](int chunk, int begin, int end) {
+            Bin* chunkBins = &bins[chunk * 3 * SPATIAL_BINS];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float extent = bmax[axis] - bmin[axis];
+                if (extent <= 0.0f) continue;
+                Bin* axisBins = &chunkBins[axis * SPATIAL_BINS];
+                const float width = extent / SPATIAL_BINS;
+                for (int i = begin; i < end; i++)
+                {
+                    const Reference& ref = references[i];
+                    int first = SpatialBin(ref.bmin[axis], axis, bmin, width);
+                    int last = std::max(first, SpatialBin(ref.bmax[axis], axis, bmin, width));
+                    Reference rest = ref;
+                    for (int b = first; b < last; b++)
+                    {
+                        Reference l, r;
+                        SplitReference(rest, axis, bmin[axis] + width * (b + 1), l, r);
+                        axisBins[b].Grow(l.bmin, l.bmax);
+                        rest = r;
+                    }
+                    axisBins[last].Grow(rest.bmin, rest.bmax);
+                    axisBins[first].count++;
+                    axisBins[last].exitCount++;
+                }
+            }
+        });
+        for (int i = 3 * SPATIAL_BINS; i < (int)bins.size(); i++) bins[i % (3 * SPATIAL_BINS)].Merge(bins[i]);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (bmax[axis] - bmin[axis] <= 0.0f) continue;
+            EvaluateBins(&bins[axis * SPATIAL_BINS], SPATIAL_BINS, axis, area, true, split);
+        }
+    }
+
+    static int SpatialBin(float x, int axis, const vec3& bmin, float width)
+    {
+        return std::min(SPATIAL_BINS - 1, std::max(0, (int)((x - bmin[axis]) / width)));
+    }
+
+    float SplitPosition(const Split& split, const vec3& bmin, const vec3& bmax) const
+    {
+        return bmin[split.axis] + (bmax[split.axis] - bmin[split.axis]) / SPATIAL_BINS * split.bin;
+    }
+
+    // 範囲ごとに左右に振り分け、範囲の順につなげる（1つの範囲で振り分けた場合と同じ順番になる）
+    void Partition(const std::vector<Reference>& references, const Split& split, const vec3& bmin, const vec3& bmax, int chunks,
+        std::vector<Reference>& left, std::vector<Reference>& right)
+    {
+        std::vector<std::vector<Reference>> chunkLeft(chunks), chunkRight(chunks);
+        ParallelChunks((int)references.size(), chunks, [&](int chunk, int begin, int end) {
+            PartitionRange(references, begin, end, split, bmin, bmax, chunkLeft[chunk], chunkRight[chunk]);
+        });
+        if (chunks == 1) {
+            left.swap(chunkLeft[0]);
+            right.swap(chunkRight[0]);
+            return;
+        }
+        for (int chunk = 0; chunk < chunks; chunk++)
+        {
+            left.insert(left.end(), chunkLeft[chunk].begin(), chunkLeft[chunk].end());
+            right.insert(right.end(), chunkRight[chunk].begin(), chunkRight[chunk].end());
+        }
+    }
+
+    void PartitionRange(const std::vector<Reference>& references, int begin, int end, const Split& split, const vec3& bmin, const vec3& bmax,
+        std::vector<Reference>& left, std::vector<Reference>& right)
+    {
+        const int axis = split.axis;
+        if (!split.spatial) {
+            for (int i = begin; i < end; i++)
+            {
+                const Reference& ref = references[i];
+                (ObjectBin(ref, axis, split.binMin, split.binScale) < split.bin ? left : right).push_back(ref);
+            }
+            return;
+        }
+
+        // 面をまたぐ参照は両側に入れる。予算を超える分は、またぐ参照の箱の重心の側に入れる
+        const float position = SplitPosition(split, bmin, bmax);
+        for (int i = begin; i < end; i++)
+        {
+            const Reference& ref = references[i];
+            if (ref.bmax[axis] <= position) {
+                left.push_back(ref);
+            }
+            else if (ref.bmin[axis] >= position) {
+                right.push_back(ref);
+            }
+            else if (referenceCount++ < maxReferences) {
+                Reference l, r;
+                SplitReference(ref, axis, position, l, r);
+                left.push_back(l);
+                right.push_back(r);
+            }
+            else {
+                (0.5f * (ref.bmin[axis] + ref.bmax[axis]) < position ? left : right).push_back(ref);
+            }
+        }
+    }
+
+    // 参照を軸に垂直な面で2つに分ける。三角形は辺と面の交点で切った部分の箱にする
+    void SplitReference(const Reference& ref, int axis, float position, Reference& left, Reference& right) const
+    {
+        left.primitive = right.primitive = ref.primitive;
+        left.bmin = right.bmin = vec3(FLT_MAX);
+        left.bmax = right.bmax = vec3(-FLT_MAX);
+        const FlatPrimitive& prim = primitives[ref.primitive];
+        if (prim.type == FLAT_TRIANGLE) {
+            const FlatTriangle& tri = prim.triangle;
+            vec3 v[3] = {
+                vec3(tri.v0[0], tri.v0[1], tri.v0[2]),
+                vec3(tri.v1[0], tri.v1[1], tri.v1[2]),
+                vec3(tri.v2[0], tri.v2[1], tri.v2[2]) };
+            for (int i = 0; i < 3; i++)
+            {
+                const vec3& v0 = v[i];
+                const vec3& v1 = v[(i + 1) % 3];
+                float p0 = v0[axis], p1 = v1[axis];
+                if (p0 <= position) Grow(left, v0, v0);
+                if (p0 >= position) Grow(right, v0, v0);
+                if ((p0 < position && position < p1) || (p1 < position && position < p0)) {
+                    vec3 p = lerp(std::min(1.0f, std::max(0.0f, (position - p0) / (p1 - p0))), v0, v1);
+                    Grow(left, p, p);
+                    Grow(right, p, p);
+                }
+            }
+        }
+        else {
+            Grow(left, ref.bmin, ref.bmax);
+            Grow(right, ref.bmin, ref.bmax);
+        }
+        left.bmax[axis] = position;
+        right.bmin[axis] = position;
+        // 切る前の参照の箱からはみ出さないようにする
+        left.bmin = maxVec3(left.bmin, ref.bmin);
+        left.bmax = minVec3(left.bmax, ref.bmax);
+        right.bmin = maxVec3(right.bmin, ref.bmin);
+        right.bmax = minVec3(right.bmax, ref.bmax);
+    }
+
+    static void Grow(Reference& ref, const vec3& pmin, const vec3& pmax)
+    {
+        ref.bmin = minVec3(ref.bmin, pmin);
+        ref.bmax = maxVec3(ref.bmax, pmax);
+    }
+
+    const FlatPrimitive* primitives;
+    int count;
+    bool spatialSplits;
+    int maxLeafSize;
+    int leafWidth;
+    int maxReferences;
+    std::atomic<int> referenceCount;  // 予算を超えた後も数え続ける（比べるだけなので）
+    float rootArea;
+    int threadCount;
+    int subtreeSize;
+};
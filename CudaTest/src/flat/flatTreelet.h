@@ -0,0 +1,231 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "flatSceneBuilder.h"
+
+// 構築やリフィットの後にBVHの形を組み替えてSAHコストを下げる（Karras, Aila 2013 "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies"）
+// ノードごとに、表面積の大きいノードから広げて最大7個の葉を持つ部分木（treelet）を作り、
+// 葉の組み合わせを全て調べて内部ノードの表面積の和が最小になる形に組み替える
+// 葉になった部分木と、葉のプリミティブの範囲はそのまま使う
+// 高さが同じノードを根とするtreeletは重ならないので、高さの低い順に、同じ高さのノードを並列に処理する
+// 組み替えた後の葉の深さがFLAT_MAX_DEPTHを超える形は選ばない
+class FlatTreeletOptimizer {
+public:
+    static const int TREELET_LEAVES = 7;
+
+    FlatTreeletOptimizer(int threadCount = 1, int passes = 1) : threadCount(threadCount), passes(passes) {}
+
+    // 組み替えたtreeletの数を返す
+    // 組み替えた後は親が子より前になるようにノードを並べ直すので、FlatWideBVHなどは作り直す
+    int Optimize(FlatScene& scene, int mesh) const
+    {
+        const FlatMesh& m = scene.meshes[mesh];
+        std::vector<FlatBVHNode>& nodes = scene.nodes;
+        int restructured = 0;
+        for (int pass = 0; pass < passes; pass++)
+        {
+            // 子は親より後ろにあるので、後ろから高さを、前から深さを求める
+            // 高さは低い順に処理するときに子から求め直す。深さは上のノードから先に組み替えることはないので変わらない
+            TreeletState state;
+            state.rootNode = m.rootNode;
+            state.height.assign(m.nodeCount, 0);
+            state.depth.assign(m.nodeCount, 0);
+            int maxHeight = 0;
+            for (int i = m.nodeCount - 1; i >= 0; i--)
+            {
+                const FlatBVHNode& node = nodes[m.rootNode + i];
+                if (node.IsLeaf()) continue;
+                int left = node.leftFirst - m.rootNode;
+                state.height[i] = 1 + std::max(state.height[left], state.height[left + 1]);
+                maxHeight = std::max(maxHeight, state.height[i]);
+            }
+            for (int i = 0; i < m.nodeCount; i++)
+            {
+                const FlatBVHNode& node = nodes[m.rootNode + i];
+                if (node.IsLeaf()) continue;
+                int left = node.leftFirst - m.rootNode;
+                state.depth[left] = state.depth[left + 1] = state.depth[i] + 1;
+            }
+            // 葉が3個以上のtreeletを作れるのは高さ2以上のノード
+            std::vector<std::vector<int>> levels(maxHeight + 1);
+            for (int i = 0; i < m.nodeCount; i++)
+            {
+                if (state.height[i] >= 2) levels[state.height[i]].push_back(m.rootNode + i);
+            }
+            int passRestructured = 0;
+            for (int h = 2; h <= maxHeight; h++)
+            {
+                const std::vector<int>& level = levels[h];
+                std::vector<char> changed(level.size(), 0);
+                ParallelTasks((int)level.size(), threadCount, [&](int i) {
+                    changed[i] = OptimizeTreelet(nodes, level[i], state);
+                });
+                for (char c : changed) passRestructured += c;
+            }
+            restructured += passRestructured;
+            if (passRestructured > 0) ReorderNodes(scene, mesh);
+        }
+        return restructured;
+    }
+
+private:
+    // 1パスの間のノードの高さと深さ（メッシュの先頭のノードからの番号で引く）
+    struct TreeletState {
+        int rootNode;
+        std::vector<int> height;
+        std::vector<int> depth;
+    };
+
+    static float NodeArea(const FlatBVHNode& node)
+    {
+        return SurfaceArea(vec3(node.bmin[0], node.bmin[1], node.bmin[2]), vec3(node.bmax[0], node.bmax[1], node.bmax[2]));
+    }
+
+    // rootを根とするtreeletを組み替える。rootの番号と部分木の外のノードは変わらない
+    bool OptimizeTreelet(std::vector<FlatBVHNode>& nodes, int root, TreeletState& state) const
+    {
+        const int N = TREELET_LEAVES;
+        // 下の高さで組み替えた部分木があれば高さが変わっているので、子から求め直す
+        const int left = nodes[root].leftFirst - state.rootNode;
+        state.height[root - state.rootNode] = 1 + std::max(state.height[left], state.height[left + 1]);
+        // treeletの葉のノードの番号と、根以外の内部ノードの番号
+        int leaves[N];
+        int internals[N];
+        int leafCount = 2, internalCount = 0;
+        leaves[0] = nodes[root].leftFirst;
+        leaves[1] = nodes[root].leftFirst + 1;
+        float oldCost = NodeArea(nodes[root]);
+        while (leafCount < N)
+        {
+            int best = -1;
+            float bestArea = -1.0f;
+            for (int i = 0; i < leafCount; i++)
+            {
+                const FlatBVHNode& node = nodes[leaves[i]];
+                float area = NodeArea(node);
+                if (!node.IsLeaf() && area > bestArea) {
+                    best = i;
+                    bestArea = area;
+                }
+            }
+            if (best < 0) break;
+            int expanded = leaves[best];
+            internals[internalCount++] = expanded;
+            oldCost += bestArea;
+            leaves[best] = nodes[expanded].leftFirst;
+            leaves[leafCount++] = nodes[expanded].leftFirst + 1;
+        }
+        if (leafCount < 3) return false;
+
+        // 葉の組み合わせごとの箱と、その組み合わせの部分木の内部ノードの表面積の和の最小値
+        const int full = (1 << leafCount) - 1;
+        vec3 boxMin[1 << N], boxMax[1 << N];
+        float cost[1 << N];
+        int partition[1 << N];
+        for (int mask = 1; mask <= full; mask++)
+        {
+            int low = mask & -mask;
+            if (mask == low) {
+                int leaf = 0;
+                while ((1 << leaf) != low) leaf++;
+                const FlatBVHNode& node = nodes[leaves[leaf]];
+                boxMin[mask] = vec3(node.bmin[0], node.bmin[1], node.bmin[2]);
+                boxMax[mask] = vec3(node.bmax[0], node.bmax[1], node.bmax[2]);
+                cost[mask] = 0.0f;
+                continue;
+            }
+            boxMin[mask] = minVec3(boxMin[mask ^ low], boxMin[low]);
+            boxMax[mask] = maxVec3(boxMax[mask ^ low], boxMax[low]);
+            // 一番下のビットを含む側を左にして、同じ分け方を2回調べないようにする
+            float best = FLT_MAX;
+            for (int left = (mask - 1) & mask; left > 0; left = (left - 1) & mask)
+            {
+                if (!(left & low)) continue;
+                float c = cost[left] + cost[mask ^ left];
+                if (c < best) {
+                    best = c;
+                    partition[mask] = left;
+                }
+            }
+            cost[mask] = SurfaceArea(boxMin[mask], boxMax[mask]) + best;
+        }
+        if (cost[full] >= oldCost * (1.0f - 1e-5f)) return false;
+
+        // 組み替えた後の高さを足しても、葉の深さがFLAT_MAX_DEPTHを超えないようにする
+        int leafHeights[N];
+        for (int i = 0; i < leafCount; i++) leafHeights[i] = state.height[leaves[i] - state.rootNode];
+        if (state.depth[root - state.rootNode] + TreeletHeight(full, partition, leafHeights) > FLAT_MAX_DEPTH) return false;
+
+        // 内部ノードが持っていた子の組を使い回して書き戻す
+        FlatBVHNode leafNodes[N];
+        for (int i = 0; i < leafCount; i++) leafNodes[i] = nodes[leaves[i]];
+        int pairs[N];
+        int pairCount = 0;
+        pairs[pairCount++] = nodes[root].leftFirst;
+        for (int i = 0; i < internalCount; i++) pairs[pairCount++] = nodes[internals[i]].leftFirst;
+        int nextPair = 0;
+        Emit(nodes, root, full, leafNodes, leafHeights, boxMin, boxMax, partition, pairs, nextPair, state);
+        return true;
+    }
+
+    // 葉の組み合わせmaskを分け方partitionで組んだ部分木の高さ
+    static int TreeletHeight(int mask, const int* partition, const int* leafHeights)
+    {
+        if ((mask & (mask - 1)) == 0) {
+            int leaf = 0;
+            while ((1 << leaf) != mask) leaf++;
+            return leafHeights[leaf];
+        }
+        return 1 + std::max(TreeletHeight(partition[mask], partition, leafHeights),
+            TreeletHeight(mask ^ partition[mask], partition, leafHeights));
+    }
+
+    // 書き戻したノードの高さも更新する
+    static void Emit(std::vector<FlatBVHNode>& nodes, int index, int mask, const FlatBVHNode* leafNodes, const int* leafHeights,
+        const vec3* boxMin, const vec3* boxMax, const int* partition, const int* pairs, int& nextPair, TreeletState& state)
+    {
+        if ((mask & (mask - 1)) == 0) {
+            int leaf = 0;
+            while ((1 << leaf) != mask) leaf++;
+            nodes[index] = leafNodes[leaf];
+            state.height[index - state.rootNode] = leafHeights[leaf];
+            return;
+        }
+        int pair = pairs[nextPair++];
+        SetNodeBounds(nodes[index], boxMin[mask], boxMax[mask]);
+        nodes[index].leftFirst = pair;
+        nodes[index].count = 0;
+        Emit(nodes, pair, partition[mask], leafNodes, leafHeights, boxMin, boxMax, partition, pairs, nextPair, state);
+        Emit(nodes, pair + 1, mask ^ partition[mask], leafNodes, leafHeights, boxMin, boxMax, partition, pairs, nextPair, state);
+        state.height[index - state.rootNode] = 1 + std::max(state.height[pair - state.rootNode], state.height[pair + 1 - state.rootNode]);
+    }
+
+    // 構築時と同じく、根から深さ優先で子の組を後ろに並べる
+    static void ReorderNodes(FlatScene& scene, int mesh)
+    {
+        const FlatMesh& m = scene.meshes[mesh];
+        std::vector<FlatBVHNode> ordered;
+        ordered.reserve(m.nodeCount);
+        ordered.push_back(scene.nodes[m.rootNode]);
+        std::vector<int> stack(1, 0);
+        while (!stack.empty())
+        {
+            int index = stack.back();
+            stack.pop_back();
+            if (ordered[index].IsLeaf()) continue;
+            // 写したノードの子の番号は並べ替え前の番号
+            int oldLeft = ordered[index].leftFirst;
+            int left = (int)ordered.size();
+            ordered.push_back(scene.nodes[oldLeft]);
+            ordered.push_back(scene.nodes[oldLeft + 1]);
+            ordered[index].leftFirst = m.rootNode + left;
+            stack.push_back(left + 1);
+            stack.push_back(left);
+        }
+        std::copy(ordered.begin(), ordered.end(), scene.nodes.begin() + m.rootNode);
+    }
+
+    int threadCount;
+    int passes;
+};
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <vector>
+#include "flatWideBVH.h"
+
+// 葉の三角形をW個（W = 4, 8）ずつSoAで並べたブロック
+// 1本の光線とブロックのW個の三角形をまとめて判定する（CPUではSIMD、GPUでは展開したループ）
+// 判定はIntersectTriangleと同じ水密な判定で、同じ交差を返す
+
+template<int W>
+struct FlatTriangleBlock {
+    float v[3][3][W];   // [頂点][軸][三角形]
+    int primitive[W];   // プリミティブの番号。使わない要素（末尾）は-1
+};
+
+template<int W>
+struct FlatTriangleBlockView {
+    const FlatTriangleBlock<W>* blocks;
+    const int* firstBlock;  // 葉の最初のプリミティブの番号から、その葉の最初のブロックの番号（三角形の葉でなければ-1）
+};
+
+template<int W>
+__host__ __device__ inline vec3 BlockVertex(const FlatTriangleBlock<W>& block, int k, int i)
+{
+    return vec3(block.v[k][0][i], block.v[k][1][i], block.v[k][2][i]);
+}
+
+// 1つずつ判定し、最も近い交差の要素の番号を返す（なければ-1）
+template<int W>
+__host__ __device__ inline int IntersectTriangleBlockScalar(const FlatTriangleBlock<W>& block, const WatertightRay& wray,
+    float t_min, float t_max, float& t, float& u, float& v)
+{
+    int lane = -1;
+#pragma unroll
+    for (int i = 0; i < W; i++) {
+        if (block.primitive[i] < 0) break;
+        float ti, ui, vi;
+        if (IntersectTriangle(wray, BlockVertex(block, 0, i), BlockVertex(block, 1, i), BlockVertex(block, 2, i),
+            t_min, t_max, false, ti, ui, vi)) {
+            t_max = ti;
+            t = ti;
+            u = ui;
+            v = vi;
+            lane = i;
+        }
+    }
+    return lane;
+}
+
+#ifdef WIDE_AABB_SSE
+// SIMDで求めた要素ごとの結果から最も近い交差を選ぶ
+// 辺関数が0になった要素（辺の上）はIntersectTriangleでdoubleを使って判定し直す
+template<int W>
+inline int ClosestBlockHit(const FlatTriangleBlock<W>& block, const WatertightRay& wray, unsigned mask, unsigned edgeMask,
+    const float* ts, const float* us, const float* vs, float t_min, float t_max, float& t, float& u, float& v)
+{
+    int lane = -1;
+    for (int i = 0; i < W; i++) {
+        if (block.primitive[i] < 0) break;
+        float ti = ts[i], ui = us[i], vi = vs[i];
+        if ((edgeMask >> i) & 1) {
+            if (!IntersectTriangle(wray, BlockVertex(block, 0, i), BlockVertex(block, 1, i), BlockVertex(block, 2, i),
+                t_min, t_max, false, ti, ui, vi)) continue;
+        }
+        else if (!((mask >> i) & 1)) {
+            continue;
+        }
+        if (ti < t_max) {
+            t_max = ti;
+            t = ti;
+            u = ui;
+            v = vi;
+            lane = i;
+        }
+    }
+    return lane;
+}
+
+// first番目からの4個の三角形の判定。IntersectTriangleと同じ計算を要素ごとに行う
+// 交差した要素のビットを返し、辺関数が0になった要素はedgeMaskに入れる
+template<int W>
+inline unsigned IntersectTriangles4SSE(const FlatTriangleBlock<W>& block, int first, const WatertightRay& ray,
+    float t_min, float t_max, float* ts, float* us, float* vs, unsigned& edgeMask)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+    const __m128 Sx = _mm_set1_ps(ray.Sx), Sy = _mm_set1_ps(ray.Sy), Sz = _mm_set1_ps(ray.Sz);
+    __m128 px[3], py[3], pz[3];
+    for (int k = 0; k < 3; k++) {
+        __m128 ax = _mm_sub_ps(_mm_loadu_ps(block.v[k][ray.kx] + first), _mm_set1_ps(ray.org[ray.kx]));
+        __m128 ay = _mm_sub_ps(_mm_loadu_ps(block.v[k][ray.ky] + first), _mm_set1_ps(ray.org[ray.ky]));
+        __m128 az = _mm_sub_ps(_mm_loadu_ps(block.v[k][ray.kz] + first), _mm_set1_ps(ray.org[ray.kz]));
+        px[k] = _mm_sub_ps(ax, _mm_mul_ps(Sx, az));
+        py[k] = _mm_sub_ps(ay, _mm_mul_ps(Sy, az));
+        pz[k] = _mm_mul_ps(Sz, az);
+    }
+    __m128 U = _mm_sub_ps(_mm_mul_ps(px[2], py[1]), _mm_mul_ps(py[2], px[1]));
+    __m128 V = _mm_sub_ps(_mm_mul_ps(px[0], py[2]), _mm_mul_ps(py[0], px[2]));
+    __m128 Wv = _mm_sub_ps(_mm_mul_ps(px[1], py[0]), _mm_mul_ps(py[1], px[0]));
+    __m128 edge = _mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(U, zero), _mm_cmpeq_ps(V, zero)), _mm_cmpeq_ps(Wv, zero));
+    __m128 negative = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(U, zero), _mm_cmplt_ps(V, zero)), _mm_cmplt_ps(Wv, zero));
+    __m128 positive = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(U, zero), _mm_cmpgt_ps(V, zero)), _mm_cmpgt_ps(Wv, zero));
+    __m128 det = _mm_add_ps(_mm_add_ps(U, V), Wv);
+    __m128 valid = _mm_andnot_ps(_mm_and_ps(negative, positive), _mm_cmpneq_ps(det, zero));
+
+    __m128 T = _mm_add_ps(_mm_add_ps(_mm_mul_ps(U, pz[0]), _mm_mul_ps(V, pz[1])), _mm_mul_ps(Wv, pz[2]));
+    __m128 signedT = _mm_xor_ps(T, _mm_and_ps(det, signBit));
+    __m128 absDet = _mm_andnot_ps(signBit, det);
+    valid = _mm_and_ps(valid, _mm_cmpgt_ps(signedT, _mm_mul_ps(_mm_set1_ps(t_min), absDet)));
+    valid = _mm_and_ps(valid, _mm_cmplt_ps(signedT, _mm_mul_ps(_mm_set1_ps(t_max), absDet)));
+
+    __m128 rcpDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+    _mm_storeu_ps(ts, _mm_mul_ps(T, rcpDet));
+    _mm_storeu_ps(us, _mm_mul_ps(V, rcpDet));
+    _mm_storeu_ps(vs, _mm_mul_ps(Wv, rcpDet));
+    edgeMask = (unsigned)_mm_movemask_ps(edge);
+    return (unsigned)_mm_movemask_ps(valid);
+}
+
+template<int W>
+struct TriangleBlockHost {
+    static int Intersect(const FlatTriangleBlock<W>& block, const WatertightRay& wray, float t_min, float t_max,
+        float& t, float& u, float& v)
+    {
+        return IntersectTriangleBlockScalar<W>(block, wray, t_min, t_max, t, u, v);
+    }
+};
+
+template<>
+struct TriangleBlockHost<4> {
+    static int Intersect(const FlatTriangleBlock<4>& block, const WatertightRay& wray, float t_min, float t_max,
+        float& t, float& u, float& v)
+    {
+        float ts[4], us[4], vs[4];
+        unsigned edgeMask;
+        unsigned mask = IntersectTriangles4SSE<4>(block, 0, wray, t_min, t_max, ts, us, vs, edgeMask);
+        if (!(mask | edgeMask)) return -1;
+        return ClosestBlockHit<4>(block, wray, mask, edgeMask, ts, us, vs, t_min, t_max, t, u, v);
+    }
+};
+
+template<>
+struct TriangleBlockHost<8> {
+    static int Intersect(const FlatTriangleBlock<8>& block, const WatertightRay& wray, float t_min, float t_max,
+        float& t, float& u, float& v)
+    {
+        float ts[8], us[8], vs[8];
+        unsigned mask, edgeMask;
+#ifdef WIDE_AABB_AVX
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 signBit = _mm256_set1_ps(-0.0f);
+        const __m256 Sx = _mm256_set1_ps(wray.Sx), Sy = _mm256_set1_ps(wray.Sy), Sz = _mm256_set1_ps(wray.Sz);
+        __m256 px[3], py[3], pz[3];
+        for (int k = 0; k < 3; k++) {
+            __m256 ax = _mm256_sub_ps(_mm256_loadu_ps(block.v[k][wray.kx]), _mm256_set1_ps(wray.org[wray.kx]));
+            __m256 ay = _mm256_sub_ps(_mm256_loadu_ps(block.v[k][wray.ky]), _mm256_set1_ps(wray.org[wray.ky]));
+            __m256 az = _mm256_sub_ps(_mm256_loadu_ps(block.v[k][wray.kz]), _mm256_set1_ps(wray.org[wray.kz]));
+            px[k] = _mm256_sub_ps(ax, _mm256_mul_ps(Sx, az));
+            py[k] = _mm256_sub_ps(ay, _mm256_mul_ps(Sy, az));
+            pz[k] = _mm256_mul_ps(Sz, az);
+        }
+        __m256 U = _mm256_sub_ps(_mm256_mul_ps(px[2], py[1]), _mm256_mul_ps(py[2], px[1]));
+        __m256 V = _mm256_sub_ps(_mm256_mul_ps(px[0], py[2]), _mm256_mul_ps(py[0], px[2]));
+        __m256 Wv = _mm256_sub_ps(_mm256_mul_ps(px[1], py[0]), _mm256_mul_ps(py[1], px[0]));
+        __m256 edge = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(U, zero, _CMP_EQ_OQ), _mm256_cmp_ps(V, zero, _CMP_EQ_OQ)),
+            _mm256_cmp_ps(Wv, zero, _CMP_EQ_OQ));
+        __m256 negative = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(U, zero, _CMP_LT_OQ), _mm256_cmp_ps(V, zero, _CMP_LT_OQ)),
+            _mm256_cmp_ps(Wv, zero, _CMP_LT_OQ));
+        __m256 positive = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(U, zero, _CMP_GT_OQ), _mm256_cmp_ps(V, zero, _CMP_GT_OQ)),
+            _mm256_cmp_ps(Wv, zero, _CMP_GT_OQ));
+        __m256 det = _mm256_add_ps(_mm256_add_ps(U, V), Wv);
+        __m256 valid = _mm256_andnot_ps(_mm256_and_ps(negative, positive), _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ));
+
+        __m256 T = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(U, pz[0]), _mm256_mul_ps(V, pz[1])), _mm256_mul_ps(Wv, pz[2]));
+        __m256 signedT = _mm256_xor_ps(T, _mm256_and_ps(det, signBit));
+        __m256 absDet = _mm256_andnot_ps(signBit, det);
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(signedT, _mm256_mul_ps(_mm256_set1_ps(t_min), absDet), _CMP_GT_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(signedT, _mm256_mul_ps(_mm256_set1_ps(t_max), absDet), _CMP_LT_OQ));
+
+        __m256 rcpDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+        _mm256_storeu_ps(ts, _mm256_mul_ps(T, rcpDet));
+        _mm256_storeu_ps(us, _mm256_mul_ps(V, rcpDet));
+        _mm256_storeu_ps(vs, _mm256_mul_ps(Wv, rcpDet));
+        edgeMask = (unsigned)_mm256_movemask_ps(edge);
+        mask = (unsigned)_mm256_movemask_ps(valid);
+#else
+        // AVXがないときは4個ずつ2回に分ける
+        unsigned edgeHigh;
+        mask = IntersectTriangles4SSE<8>(block, 0, wray, t_min, t_max, ts, us, vs, edgeMask);
+        mask |= IntersectTriangles4SSE<8>(block, 4, wray, t_min, t_max, ts + 4, us + 4, vs + 4, edgeHigh) << 4;
+        edgeMask |= edgeHigh << 4;
+#endif
+        if (!(mask | edgeMask)) return -1;
+        return ClosestBlockHit<8>(block, wray, mask, edgeMask, ts, us, vs, t_min, t_max, t, u, v);
+    }
+};
+#endif
+
+// ブロックのW個の三角形と1本の光線の判定。最も近い交差の要素の番号を返す（なければ-1）
+template<int W>
+__host__ __device__ inline int IntersectTriangleBlock(const FlatTriangleBlock<W>& block, const WatertightRay& wray,
+    float t_min, float t_max, float& t, float& u, float& v)
+{
+#if !defined(__CUDA_ARCH__) && defined(WIDE_AABB_SSE)
+    return TriangleBlockHost<W>::Intersect(block, wray, t_min, t_max, t, u, v);
+#else
+    return IntersectTriangleBlockScalar<W>(block, wray, t_min, t_max, t, u, v);
+#endif
+}
+
+// 三角形の葉をブロックで判定する（TraverseFlatWideMeshのLeaf）。三角形以外の葉は1つずつ判定する
+template<int W>
+struct FlatTriangleLeaf {
+    FlatTriangleBlockView<W> view;
+
+    __host__ __device__ bool operator()(const FlatSceneView& scene, int first, int count, const Ray& r, const WatertightRay& wray,
+        float t_min, float& t_max, FlatHit& hit, bool anyHit) const
+    {
+        int block = view.firstBlock[first];
+        if (block < 0) return FlatPrimitiveLeaf()(scene, first, count, r, wray, t_min, t_max, hit, anyHit);
+
+        bool hit_anything = false;
+        for (int end = block + (count + W - 1) / W; block < end; block++) {
+            float t, u, v;
+            int lane = IntersectTriangleBlock<W>(view.blocks[block], wray, t_min, t_max, t, u, v);
+            if (lane < 0) continue;
+            hit_anything = true;
+            if (anyHit) return true;
+            t_max = t;
+            hit.t = t;
+            hit.u = u;
+            hit.v = v;
+            hit.primitive = view.blocks[block].primitive[lane];
+        }
+        return hit_anything;
+    }
+};
+
+
+// FlatSceneの葉ごとに三角形をW個ずつブロックに詰める
+// 葉の大きさはFlatSceneのmaxLeafSizeとleafWidth（= W）のコストの見積もりで決まる
+// UpdateTriangleMeshの後はもう一度Buildする
+template<int W>
+class FlatTriangleBlocks {
+public:
+    void Build(const FlatScene& scene)
+    {
+        blocks.clear();
+        firstBlock.assign(scene.primitives.size(), -1);
+        for (const FlatBVHNode& node : scene.nodes)
+        {
+            if (!node.IsLeaf()) continue;
+            bool triangles = true;
+            for (int p = node.leftFirst; p < node.leftFirst + node.count; p++)
+            {
+                if (scene.primitives[p].type != FLAT_TRIANGLE) triangles = false;
+            }
+            if (!triangles) continue;
+
+            firstBlock[node.leftFirst] = (int)blocks.size();
+            for (int i = 0; i < node.count; i += W)
+            {
+                FlatTriangleBlock<W> block;
+                for (int k = 0; k < W; k++)
+                {
+                    int p = node.leftFirst + i + k;
+                    bool used = i + k < node.count;
+                    block.primitive[k] = used ? p : -1;
+                    for (int a = 0; a < 3; a++)
+                    {
+                        block.v[0][a][k] = used ? scene.primitives[p].triangle.v0[a] : 0.0f;
+                        block.v[1][a][k] = used ? scene.primitives[p].triangle.v1[a] : 0.0f;
+                        block.v[2][a][k] = used ? scene.primitives[p].triangle.v2[a] : 0.0f;
+                    }
+                }
+                blocks.push_back(block);
+            }
+        }
+    }
+
+    FlatTriangleBlockView<W> HostView() const
+    {
+        FlatTriangleBlockView<W> view;
+        view.blocks = blocks.data();
+        view.firstBlock = firstBlock.data();
+        return view;
+    }
+
+    FlatTriangleBlockView<W> Upload()
+    {
+        d_blocks.Upload(blocks.data(), blocks.size());
+        d_firstBlock.Upload(firstBlock.data(), firstBlock.size());
+        FlatTriangleBlockView<W> view;
+        view.blocks = d_blocks.get();
+        view.firstBlock = d_firstBlock.get();
+        return view;
+    }
+
+    // Leafとして渡すときに使う
+    FlatTriangleLeaf<W> HostLeaf() const
+    {
+        FlatTriangleLeaf<W> leaf;
+        leaf.view = HostView();
+        return leaf;
+    }
+
+    std::vector<FlatTriangleBlock<W>> blocks;
+    std::vector<int> firstBlock;
+
+private:
+    DeviceBuffer<FlatTriangleBlock<W>> d_blocks;
+    DeviceBuffer<int> d_firstBlock;
+};
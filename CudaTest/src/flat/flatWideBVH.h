@@ -0,0 +1,286 @@
+#pragma once
+
+#include <vector>
+#include "flatSceneBuilder.h"
+#include "../core/wideAABB.h"
+
+// 2分木のBVHをまとめたN分木（N = 4, 8）のBVH
+// 子の箱はSoAで持ち、1本の光線とN個の箱をまとめて判定する（CPUではSIMD）
+
+// ノード。子の箱と、子ごとの番号・プリミティブ数
+template<int N>
+struct FlatWideNode {
+    AABBxN<N> bounds;
+    int child[N];   // 内部ノードなら子のノードの番号、葉なら最初のプリミティブの番号
+    int count[N];   // 葉のプリミティブ数。0なら内部ノード、-1なら空き
+};
+
+template<int N>
+struct FlatWideView {
+    const FlatWideNode<N>* nodes;
+    const int* meshRoots;   // メッシュごとの根のノードの番号
+};
+
+// 葉のプリミティブを1つずつ判定する
+struct FlatPrimitiveLeaf {
+    __host__ __device__ bool operator()(const FlatSceneView& scene, int first, int count, const Ray& r, const WatertightRay& wray,
+        float t_min, float& t_max, FlatHit& hit, bool anyHit) const
+    {
+        bool hit_anything = false;
+        for (int i = first; i < first + count; i++) {
+            float t, u, v;
+            if (IntersectPrimitive(scene.primitives[i], r, wray, t_min, t_max, t, u, v)) {
+                hit_anything = true;
+                if (anyHit) return true;
+                t_max = t;
+                hit.t = t;
+                hit.u = u;
+                hit.v = v;
+                hit.primitive = i;
+            }
+        }
+        return hit_anything;
+    }
+};
+
+// 1つのメッシュのN分木を辿る
+// 当たった子を近い順に並べて積むので、近い子から調べてt_maxで遠い子を枝刈りできる
+// 葉の判定はLeafで差し替えられる（FlatTriangleLeafなど）
+template<int N, class Leaf = FlatPrimitiveLeaf>
+__host__ __device__ inline bool TraverseFlatWideMesh(const FlatSceneView& scene, const FlatWideView<N>& wide, int mesh,
+    const Ray& r, float t_min, float& t_max, FlatHit& hit, bool anyHit, const Leaf& leaf = Leaf())
+{
+    // 深さFLAT_MAX_DEPTHまでの段ごとに、まだ辿っていない子を最大N-1個ずつ積む
+    const int STACK_SIZE = FLAT_MAX_DEPTH * (N - 1) + 1;
+    int stackChild[STACK_SIZE];
+    int stackCount[STACK_SIZE];
+    float stackT[STACK_SIZE];
+    int sp = 0;
+
+    const InvRay inv_r(r);
+    const WatertightRay wray(r.origin(), r.direction());
+
+    stackChild[sp] = wide.meshRoots[mesh];
+    stackCount[sp] = 0;
+    stackT[sp] = t_min;
+    sp++;
+
+    bool hit_anything = false;
+    while (sp > 0) {
+        sp--;
+        // 今の最も近い交差より遠いものは飛ばす
+        if (stackT[sp] > t_max) continue;
+        const int child = stackChild[sp];
+        const int count = stackCount[sp];
+
+        if (count > 0) {
+            if (leaf(scene, child, count, r, wray, t_min, t_max, hit, anyHit)) {
+                hit_anything = true;
+                if (anyHit) return true;
+            }
+            continue;
+        }
+
+        const FlatWideNode<N>& node = wide.nodes[child];
+        float t_enter[N];
+        unsigned mask = IntersectAABBxN<N>(node.bounds, inv_r, t_min, t_max, t_enter);
+
+        // 当たった子を遠い順に並べる（挿入ソート）
+        int order[N];
+        int hitCount = 0;
+        for (int i = 0; i < N; i++) {
+            if (!((mask >> i) & 1) || node.count[i] < 0) continue;
+            int k = hitCount++;
+            while (k > 0 && t_enter[order[k - 1]] < t_enter[i]) {
+                order[k] = order[k - 1];
+                k--;
+            }
+            order[k] = i;
+        }
+        // 遠い子から積むので、近い子が先に取り出される
+        if (sp + hitCount > STACK_SIZE) return hit_anything;
+        for (int k = 0; k < hitCount; k++) {
+            int i = order[k];
+            stackChild[sp] = node.child[i];
+            stackCount[sp] = node.count[i];
+            stackT[sp] = t_enter[i];
+            sp++;
+        }
+    }
+    return hit_anything;
+}
+
+template<int N, class Leaf = FlatPrimitiveLeaf>
+__host__ __device__ inline bool FlatWideIntersect(const FlatSceneView& scene, const FlatWideView<N>& wide,
+    const Ray& r, float t_min, float t_max, FlatHit& hit, const Leaf& leaf = Leaf())
+{
+    bool hit_anything = false;
+    for (int i = 0; i < scene.instanceCount; i++) {
+        const FlatInstance& instance = scene.instances[i];
+        Ray local = FlatInstanceRay(scene, instance, r);
+        if (TraverseFlatWideMesh<N, Leaf>(scene, wide, instance.mesh, local, t_min, t_max, hit, false, leaf)) {
+            hit_anything = true;
+            hit.instance = i;
+        }
+    }
+    return hit_anything;
+}
+
+template<int N, class Leaf = FlatPrimitiveLeaf>
+__host__ __device__ inline bool FlatWideOccluded(const FlatSceneView& scene, const FlatWideView<N>& wide,
+    const Ray& r, float t_min, float t_max, const Leaf& leaf = Leaf())
+{
+    FlatHit hit;
+    for (int i = 0; i < scene.instanceCount; i++) {
+        const FlatInstance& instance = scene.instances[i];
+        Ray local = FlatInstanceRay(scene, instance, r);
+        if (TraverseFlatWideMesh<N, Leaf>(scene, wide, instance.mesh, local, t_min, t_max, hit, true, leaf)) return true;
+    }
+    return false;
+}
+
+
+// FlatSceneの2分木のBVHを畳んでN分木を作る
+// 子がN個になるまで、表面積が最大の内部ノードの子をその2つの子で置き換える
+template<int N>
+class FlatWideBVH {
+public:
+    void Build(const FlatScene& scene)
+    {
+        nodes.clear();
+        sourceNodes.clear();
+        meshRoots.clear();
+        for (const FlatMesh& mesh : scene.meshes)
+        {
+            meshRoots.push_back(mesh.primitiveCount > 0 ? Collapse(scene, mesh.rootNode) : EmptyNode());
+        }
+    }
+
+    // FlatScene::Refitの後に呼ぶ。子の箱を元の2分木のノードの箱で置き換える
+    void Refit(const FlatScene& scene)
+    {
+        for (size_t n = 0; n < nodes.size(); n++)
+        {
+            for (int i = 0; i < N; i++)
+            {
+                int source = sourceNodes[n * N + i];
+                if (source >= 0) SetChildBounds(nodes[n], i, scene.nodes[source]);
+            }
+        }
+    }
+
+    FlatWideView<N> HostView() const
+    {
+        FlatWideView<N> view;
+        view.nodes = nodes.data();
+        view.meshRoots = meshRoots.data();
+        return view;
+    }
+
+    // デバイスに転送する。リフィットした後はもう一度呼ぶ
+    FlatWideView<N> Upload()
+    {
+        d_nodes.Upload(nodes.data(), nodes.size());
+        d_meshRoots.Upload(meshRoots.data(), meshRoots.size());
+        FlatWideView<N> view;
+        view.nodes = d_nodes.get();
+        view.meshRoots = d_meshRoots.get();
+        return view;
+    }
+
+    std::vector<FlatWideNode<N>> nodes;
+    std::vector<int> meshRoots;
+
+private:
+    static float SurfaceArea(const FlatBVHNode& node)
+    {
+        float dx = node.bmax[0] - node.bmin[0];
+        float dy = node.bmax[1] - node.bmin[1];
+        float dz = node.bmax[2] - node.bmin[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    static void SetChildBounds(FlatWideNode<N>& node, int i, const FlatBVHNode& source)
+    {
+        for (int a = 0; a < 3; a++) {
+            node.bounds.bmin[a][i] = source.bmin[a];
+            node.bounds.bmax[a][i] = source.bmax[a];
+        }
+    }
+
+    // 空のメッシュの根。プリミティブ数0の葉は2分木では内部ノードと区別できず、
+    // N分木でもcount 0は内部ノードなので、全ての子を空き（-1）にする
+    int EmptyNode()
+    {
+        int wideIndex = (int)nodes.size();
+        nodes.push_back(FlatWideNode<N>());
+        sourceNodes.resize(nodes.size() * N, -1);
+        for (int i = 0; i < N; i++) {
+            nodes[wideIndex].bounds.SetEmpty(i);
+            nodes[wideIndex].child[i] = -1;
+            nodes[wideIndex].count[i] = -1;
+        }
+        return wideIndex;
+    }
+
+    // 2分木のノードbinaryIndexを根とする部分木をN分木のノードにし、その番号を返す
+    int Collapse(const FlatScene& scene, int binaryIndex)
+    {
+        int slots[N];
+        int slotCount = 0;
+        const FlatBVHNode& root = scene.nodes[binaryIndex];
+        if (root.IsLeaf()) {
+            slots[slotCount++] = binaryIndex;
+        }
+        else {
+            slots[slotCount++] = root.leftFirst;
+            slots[slotCount++] = root.leftFirst + 1;
+        }
+        while (slotCount < N) {
+            int best = -1;
+            float bestArea = -1.0f;
+            for (int i = 0; i < slotCount; i++) {
+                const FlatBVHNode& node = scene.nodes[slots[i]];
+                if (!node.IsLeaf() && SurfaceArea(node) > bestArea) {
+                    best = i;
+                    bestArea = SurfaceArea(node);
+                }
+            }
+            if (best < 0) break;
+            int expanded = scene.nodes[slots[best]].leftFirst;
+            slots[best] = expanded;
+            slots[slotCount++] = expanded + 1;
+        }
+
+        int wideIndex = (int)nodes.size();
+        nodes.push_back(FlatWideNode<N>());
+        sourceNodes.resize(nodes.size() * N, -1);
+        for (int i = 0; i < N; i++) {
+            FlatWideNode<N>& node = nodes[wideIndex];
+            if (i >= slotCount) {
+                node.bounds.SetEmpty(i);
+                node.child[i] = -1;
+                node.count[i] = -1;
+                continue;
+            }
+            const FlatBVHNode& source = scene.nodes[slots[i]];
+            SetChildBounds(node, i, source);
+            sourceNodes[wideIndex * N + i] = slots[i];
+            if (source.IsLeaf()) {
+                node.child[i] = source.leftFirst;
+                node.count[i] = source.count;
+            }
+            else {
+                // 子を作るとnodesが伸びるので、番号で書き込む
+                int child = Collapse(scene, slots[i]);
+                nodes[wideIndex].child[i] = child;
+                nodes[wideIndex].count[i] = 0;
+            }
+        }
+        return wideIndex;
+    }
+
+    std::vector<int> sourceNodes;   // 子ごとの元の2分木のノードの番号（空きは-1）
+    DeviceBuffer<FlatWideNode<N>> d_nodes;
+    DeviceBuffer<int> d_meshRoots;
+};
@@ -5,7 +5,7 @@
 class BoneBVHNode : public Hitable {
 public:
     __device__ BoneBVHNode() {}
-    __device__ BoneBVHNode(bool empty) { isEmpty = true; }
+    __device__ BoneBVHNode(bool empty) { isEmpty = true; childIsNode = false; }
     __device__ BoneBVHNode(Hitable** l,
         int n,
         float time0,
@@ -14,12 +14,24 @@ public:
         vec3 dT,
         vec3 nowT,
         bool root);
+    // 子ノードを破棄する。葉の三角形はメッシュ側が所有している
+    __device__ virtual ~BoneBVHNode()
+    {
+        if (childIsNode) {
+            delete left;
+            delete right;
+        }
+    }
 
     __device__ virtual bool collision_detection(const Ray& r,
         float t_min,
         float t_max,
         HitRecord& rec, int frameIndex) const;
 
+    __device__ virtual bool occlusion_detection(const Ray& r,
+        float t_min,
+        float t_max, int frameIndex) const;
+
     __device__ virtual bool bounding_box(float t0,
         float t1,
         AABB& b) const;
@@ -37,7 +49,7 @@ public:
 };
 
 
-// ^ꂽ{[AOp`̃XgBVH쐬
+// 与えられたボーン情報、三角形のリストからBVHを作成する
 __device__ BoneBVHNode::BoneBVHNode(Hitable** l,
     int n,
     float time0,
@@ -88,7 +100,7 @@ __device__ BoneBVHNode::BoneBVHNode(Hitable** l,
 
     if (!childIsNode)
     {
-        // bvړor]
+        // bvを移動or回転
         box = moveAABB(box, -defaultTransform);
     }
 }
@@ -118,56 +130,151 @@ __device__ void BoneBVHNode::UpdateBVH(vec3 nowT)
         // std::cerr << "no bounding box in BVHNode constructor \n";
     }
 
-    //g
+    //拡大
     //box = surrounding_box(box_left, box);
     //box = surrounding_box(box_right, box);
 
-    // ătBbg
+    // 再フィット
     box = surrounding_box(box_right, box_left);
     if (!childIsNode)
     {
-        // bvړor]
+        // bvを移動or回転
         box = moveAABB(box, -nowTransform);
     }
 
 }
 
-// {[Ɠ]ďՓ
+// 光線をボーンと同じだけ回転させて衝突
+// 近い子から先に調べ、見つかった交差のtをt_maxとして遠い子を枝刈りする
 __device__ bool BoneBVHNode::collision_detection(const Ray& r,
     float t_min,
     float t_max,
     HitRecord& rec, int frameIndex) const {
     if (isEmpty)return false;
 
-    Ray moved_r(r.origin(), r.direction(), r.time());
-    //{[̍Wό`
-    moved_r = isRoot ? Ray(r.origin() - nowTransform, r.direction(), r.time()) : moved_r;
+    //ボーンの座標分光線を変形
+    Ray moved_r = isRoot ? Ray(r.origin() - nowTransform, r.direction(), r.time()) : r;
+    //葉と衝突判定時は光線の変形を戻す
+    Ray leaf_r(moved_r.origin() + nowTransform, moved_r.direction(), moved_r.time());
 
-    if (!box.hit(moved_r, t_min, t_max)) return false;
+    const int STACK_SIZE = BVH_STACK_SIZE;
+    const BoneBVHNode* stack[STACK_SIZE];
+    float stackT[STACK_SIZE];   // スタックに積んだノードに入る距離
+    int sp = 0;
 
-    //tƏՓ˔莞͌̕ό`߂
-    moved_r = childIsNode ? moved_r : Ray(r.origin() + nowTransform, r.direction(), r.time());
+    // 方向の逆数は走査の間ずっと同じ
+    const InvRay inv_r(moved_r);
+    float t_enter;
+    if (!box.hit(inv_r, t_min, t_max, t_enter)) return false;
 
-    HitRecord left_rec, right_rec;
-    bool hit_left = left->hit(moved_r, t_min, t_max, left_rec, frameIndex);
-    bool hit_right = right->hit(moved_r, t_min, t_max, right_rec, frameIndex);
-    if (hit_left && hit_right) {
-        if (left_rec.t < right_rec.t) {
-            rec = left_rec;
+    // 以前の走査と比べるときは枝刈りに元のt_maxを使う
+    const float original_t_max = t_max;
+    bool hit_anything = false;
+    const BoneBVHNode* node = this;
+    while (true) {
+        COUNT_NODE_VISIT();
+        const float cull_t = orderedTraversal ? t_max : original_t_max;
+        if (!node->childIsNode) {
+            HitRecord tmp_rec;
+            if (node->left->hit(leaf_r, t_min, cull_t, tmp_rec, frameIndex) && tmp_rec.t < t_max) {
+                hit_anything = true;
+                t_max = tmp_rec.t;
+                rec = tmp_rec;
+            }
+            // 三角形が1つの葉はleftとrightが同じ
+            if (node->right != node->left
+                && node->right->hit(leaf_r, t_min, orderedTraversal ? t_max : original_t_max, tmp_rec, frameIndex) && tmp_rec.t < t_max) {
+                hit_anything = true;
+                t_max = tmp_rec.t;
+                rec = tmp_rec;
+            }
         }
         else {
-            rec = right_rec;
+            const BoneBVHNode* left_node = (const BoneBVHNode*)node->left;
+            const BoneBVHNode* right_node = (const BoneBVHNode*)node->right;
+            float t_left, t_right;
+            bool hit_left = !left_node->isEmpty && left_node->box.hit(inv_r, t_min, cull_t, t_left);
+            bool hit_right = !right_node->isEmpty && right_node->box.hit(inv_r, t_min, cull_t, t_right);
+            if (hit_left && hit_right) {
+                const BoneBVHNode* nearNode = left_node;
+                const BoneBVHNode* farNode = right_node;
+                float t_far = t_right;
+                if (orderedTraversal && t_right < t_left) {
+                    nearNode = right_node;
+                    farNode = left_node;
+                    t_far = t_left;
+                }
+                if (sp == STACK_SIZE) return hit_anything;
+                stack[sp] = farNode;
+                stackT[sp] = t_far;
+                sp++;
+                node = nearNode;
+                continue;
+            }
+            else if (hit_left) {
+                node = left_node;
+                continue;
+            }
+            else if (hit_right) {
+                node = right_node;
+                continue;
+            }
         }
-        return true;
-    }
-    else if (hit_left) {
-        rec = left_rec;
-        return true;
-    }
-    else if (hit_right) {
-        rec = right_rec;
-        return true;
+
+        // 今の最も近い交差より遠いノードは飛ばす
+        do {
+            if (sp == 0) return hit_anything;
+            sp--;
+        } while (orderedTraversal && stackT[sp] >= t_max);
+        node = stack[sp];
     }
+}
+
+// 最初に見つかった交差で打ち切る。光線の変形はcollision_detectionと同じ
+__device__ bool BoneBVHNode::occlusion_detection(const Ray& r,
+    float t_min,
+    float t_max, int frameIndex) const {
+    if (isEmpty)return false;
+
+    Ray moved_r = isRoot ? Ray(r.origin() - nowTransform, r.direction(), r.time()) : r;
+    Ray leaf_r(moved_r.origin() + nowTransform, moved_r.direction(), moved_r.time());
+
+    const int STACK_SIZE = BVH_STACK_SIZE;
+    const BoneBVHNode* stack[STACK_SIZE];
+    int sp = 0;
+
+    const InvRay inv_r(moved_r);
+    if (!box.hit(inv_r, t_min, t_max)) return false;
 
-    return false;
+    const BoneBVHNode* node = this;
+    while (true) {
+        COUNT_NODE_VISIT();
+        if (!node->childIsNode) {
+            if (node->left->occluded(leaf_r, t_min, t_max, frameIndex)) return true;
+            if (node->right != node->left && node->right->occluded(leaf_r, t_min, t_max, frameIndex)) return true;
+        }
+        else {
+            const BoneBVHNode* left_node = (const BoneBVHNode*)node->left;
+            const BoneBVHNode* right_node = (const BoneBVHNode*)node->right;
+            bool hit_left = !left_node->isEmpty && left_node->box.hit(inv_r, t_min, t_max);
+            bool hit_right = !right_node->isEmpty && right_node->box.hit(inv_r, t_min, t_max);
+            if (hit_left && hit_right) {
+                if (sp == STACK_SIZE) return false;
+                stack[sp++] = right_node;
+                node = left_node;
+                continue;
+            }
+            else if (hit_left) {
+                node = left_node;
+                continue;
+            }
+            else if (hit_right) {
+                node = right_node;
+                continue;
+            }
+        }
+
+        if (sp == 0) return false;
+        node = stack[--sp];
+    }
 }
@@ -15,41 +15,10 @@ public:
     }
 };
 
-class KeyFrameList {
+class KeyFrameList : public GrowableArray<KeyFrame*> {
 public:
-    __host__ __device__ KeyFrameList() { list = new KeyFrame * (); list_size = 0; }
-    __host__ __device__ KeyFrameList(KeyFrame** l, int n) { list = l; list_size = n; }
-    __host__ __device__ void append(KeyFrame* data)
-    {
-        KeyFrame** tmp = (KeyFrame**)malloc(sizeof(KeyFrame*) * list_size);
-
-        for (int i = 0; i < list_size; i++)
-        {
-            tmp[i] = list[i];
-        }
-
-        free(list);
-
-        list_size++;
-
-        list = (KeyFrame**)malloc(sizeof(KeyFrame*) * list_size);
-
-        for (int i = 0; i < list_size - 1; i++)
-        {
-            list[i] = tmp[i];
-        }
-        list[list_size - 1] = data;
-
-        free(tmp);
-    }
-    __host__ __device__  void freeMemory()
-    {
-        free(list);
-        list_size = 0;
-    }
-
-    KeyFrame** list;
-    int list_size;
+    __host__ __device__ KeyFrameList() {}
+    __host__ __device__ KeyFrameList(KeyFrame** l, int n) : GrowableArray<KeyFrame*>(l, n) {}
 };
 
 
@@ -73,18 +42,18 @@ public:
             return *keyframs->list[currentFrameIndex]->transform;
         }
 
-        //⊮TransformԂ
+        //補完したTransformを返す
         Transform* begin = keyframs->list[currentFrameIndex]->transform;
         Transform* end = keyframs->list[currentFrameIndex+1]->transform;
         float t = ((float)(nextFrame - keyframs->list[currentFrameIndex]->frame)) / (keyframs->list[currentFrameIndex+1]->frame - keyframs->list[currentFrameIndex]->frame);
         //printf("t:%f\n", t);
         
         //vec3 position = SLerp(begin.position, end.position, t);
-        vec3 position = lerp(t, begin->position, end->position);
+        vec3 position = lerp(t, begin->Position(), end->Position());
         //vec3 rotation = SLerp(begin.rotation, end.rotation, t);
-        vec3 rotation = lerp(t, begin->rotation, end->rotation);
+        vec3 rotation = lerp(t, begin->Rotation(), end->Rotation());
         //vec3 scale = SLerp(begin.scale, end.scale, t);
-        vec3 scale = lerp(t, begin->scale, end->scale);
+        vec3 scale = lerp(t, begin->Scale(), end->Scale());
         //printf("%f\n", scale.y());
         return  Transform(position, rotation, scale);
     }
@@ -96,39 +65,8 @@ public:
 };
 
 
-class AnimationDataList {
+class AnimationDataList : public GrowableArray<AnimationData*> {
 public:
-    __host__ __device__ AnimationDataList() { list = new AnimationData * (); list_size = 0; }
-    __host__ __device__ AnimationDataList(AnimationData** l, int n) { list = l; list_size = n; }
-    __host__ __device__ void append(AnimationData* data)
-    {
-        AnimationData** tmp = (AnimationData**)malloc(sizeof(AnimationData*) * list_size);
-
-        for (int i = 0; i < list_size; i++)
-        {
-            tmp[i] = list[i];
-        }
-
-        free(list);
-
-        list_size++;
-
-        list = (AnimationData**)malloc(sizeof(AnimationData*) * list_size);
-
-        for (int i = 0; i < list_size - 1; i++)
-        {
-            list[i] = tmp[i];
-        }
-        list[list_size - 1] = data;
-
-        free(tmp);
-    }
-    __host__ __device__  void freeMemory()
-    {
-        free(list);
-        list_size = 0;
-    }
-
-    AnimationData** list;
-    int list_size;
+    __host__ __device__ AnimationDataList() {}
+    __host__ __device__ AnimationDataList(AnimationData** l, int n) : GrowableArray<AnimationData*>(l, n) {}
 };
\ No newline at end of file
@@ -45,6 +45,11 @@ struct BoxCompare {
 };
 
 
+// 走査のスタックの大きさ。回転では木の高さをBVH_MAX_DEPTH以下に保つ
+// 走査では遠い子だけを積むので、積む数は深さを超えない
+const int BVH_STACK_SIZE = 64;
+const int BVH_MAX_DEPTH = 60;
+
 class BVHNode : public Hitable {
 public:
     __device__ BVHNode() {}
@@ -53,23 +58,57 @@ public:
         float time0,
         float time1,
         curandState* state) ;
+    // 子ノードと葉のリストを破棄する。葉の要素はメッシュ側が所有している
+    __device__ virtual ~BVHNode()
+    {
+        if (isLeaf) {
+            delete childList;
+        }
+        else {
+            delete left;
+            delete right;
+        }
+    }
 
     __device__ virtual bool collision_detection(const Ray& r,
         float t_min,
         float t_max,
         HitRecord& rec, int frameIndex) const;
 
+    __device__ virtual bool occlusion_detection(const Ray& r,
+        float t_min,
+        float t_max, int frameIndex) const;
+
     __device__ virtual bool bounding_box(float t0,
         float t1,
         AABB& b) const;
 
-    __device__ void UpdateBVH();
+    // rotationBudgetを渡すと、リフィットしながら子と孫を入れ替えて表面積が減る場合は入れ替える（最大*rotationBudget回）
+    // depthはこのノードの根からの深さ。入れ替えで葉の深さがBVH_MAX_DEPTHを超える場合は入れ替えない
+    __device__ void UpdateBVH(int* rotationBudget = nullptr, int depth = 0);
+
+    // 三角形のシャッターが開くときと閉じるときの頂点から、両端の箱をリフィットする（モーションブラー用）
+    // 走査では光線の時刻で2つの箱を線形補間する。UpdateBVHでリフィットすると1つの箱に戻る
+    __device__ void UpdateMotionBVH();
+
+    // 時刻timeの箱
+    __device__ AABB BoxAt(float time) const { return motion ? lerpAABB(time, box, closeBox) : box; }
+
+    // 根の表面積に対するSAHコスト（内部ノードの判定と葉の三角形1つの判定をそれぞれ1とする）
+    __device__ float SAHCost() const { return box.area() > 0.0f ? AreaCost() / box.area() : 0.0f; }
 
     BVHNode* left;
     BVHNode* right;
     HitableList* childList;
     AABB box;
+    AABB closeBox;  //motionのときのシャッターが閉じるときの箱
     bool isLeaf;
+    bool motion;
+    int height;     // このノードを根とする部分木の高さ（葉は0）
+
+private:
+    __device__ bool Rotate(int depth);
+    __device__ float AreaCost() const;
 };
 
 
@@ -79,7 +118,8 @@ __device__ BVHNode::BVHNode(Hitable** l,
     float time1,
     curandState* state) {
     transform->ResetTransform();
-    
+    motion = false;
+
 
     int axis = int(3 * curand_uniform(state));
     if (axis == 0) {
@@ -97,6 +137,7 @@ __device__ BVHNode::BVHNode(Hitable** l,
         childList->transform->ResetTransform();
         childList->list[0] = l[0];
         isLeaf = true;
+        height = 0;
         childList->GetBV(0,1,box);
     }
     else if (n == 2) {
@@ -105,12 +146,14 @@ __device__ BVHNode::BVHNode(Hitable** l,
         childList->list[0] = l[0];
         childList->list[1] = l[1];
         isLeaf = true;
+        height = 0;
         childList->GetBV(0, 1, box);
     }
     else {
         left = new BVHNode(l, n / 2, time0, time1, state);
         right = new BVHNode(l + n / 2, n - n / 2, time0, time1, state);
         isLeaf = false;
+        height = 1 + max(left->height, right->height);
 
         AABB box_left, box_right;
         if (!left->GetBV(time0, time1, box_left) ||
@@ -128,63 +171,214 @@ __device__ BVHNode::BVHNode(Hitable** l,
 __device__ bool BVHNode::bounding_box(float t0,
     float t1,
     AABB& b) const {
-    b = box;
+    b = motion ? surrounding_box(BoxAt(t0), BoxAt(t1)) : box;
     return true;
 }
 
-__device__ void BVHNode::UpdateBVH()
+__device__ void BVHNode::UpdateBVH(int* rotationBudget, int depth)
 {
+    motion = false;
     if (isLeaf) 
     {
         childList->bounding_box(0, 1, box);
     }
     else {
-        left->UpdateBVH();
-        right->UpdateBVH();
+        left->UpdateBVH(rotationBudget, depth + 1);
+        right->UpdateBVH(rotationBudget, depth + 1);
+        // 子の箱が更新されてから回転する（Kopta et al. 2012 "Fast, Effective BVH Updates for Animated Scenes"）
+        if (rotationBudget && *rotationBudget > 0 && Rotate(depth)) (*rotationBudget)--;
+        height = 1 + max(left->height, right->height);
 
         AABB box_left, box_right;
         if (!left->GetBV(0, 1, box_left) ||
             !right->GetBV(0, 1, box_right)) {
             return;
         }
-        //g
+        //拡大
         //box = surrounding_box(box_left, box);
         //box = surrounding_box(box_right, box);
 
-        // ătBbg
+        // 再フィット
         box = surrounding_box(box_right, box_left);
     }
     
 }
 
+__device__ void BVHNode::UpdateMotionBVH()
+{
+    motion = true;
+    if (isLeaf)
+    {
+        childList->bounding_box(0, 0, box);
+        childList->bounding_box(1, 1, closeBox);
+    }
+    else {
+        left->UpdateMotionBVH();
+        right->UpdateMotionBVH();
+        box = surrounding_box(left->box, right->box);
+        closeBox = surrounding_box(left->closeBox, right->closeBox);
+    }
+}
+
+// 子の一方と、もう一方の子の子（孫）を入れ替える4通りのうち、孫の親の表面積が最も減るものを行う
+// このノードの箱は変わらない。入れ替えた子は1段深くなるので、深さdepth + 高さがBVH_MAX_DEPTHを超えるものは選ばない
+__device__ bool BVHNode::Rotate(int depth)
+{
+    float bestArea = 0.0f;
+    BVHNode** bestChild = nullptr;
+    BVHNode** bestGrandchild = nullptr;
+    BVHNode* bestParent = nullptr;
+    BVHNode* children[2] = { left, right };
+    for (int c = 0; c < 2; c++)
+    {
+        BVHNode* child = children[c];
+        BVHNode* other = children[1 - c];
+        if (other->isLeaf) continue;
+        // childをotherの子と入れ替えると、otherの箱はchildと残った孫を囲む箱になる
+        float area = other->box.area();
+        float toLeft = surrounding_box(child->box, other->right->box).area();
+        float toRight = surrounding_box(child->box, other->left->box).area();
+        // 入れ替えた後のこのノードの高さ
+        int heightLeft = 1 + max(other->left->height, 1 + max(child->height, other->right->height));
+        int heightRight = 1 + max(other->right->height, 1 + max(child->height, other->left->height));
+        if (depth + heightLeft <= BVH_MAX_DEPTH && area - toLeft > bestArea) {
+            bestArea = area - toLeft;
+            bestChild = c == 0 ? &left : &right;
+            bestGrandchild = &other->left;
+            bestParent = other;
+        }
+        if (depth + heightRight <= BVH_MAX_DEPTH && area - toRight > bestArea) {
+            bestArea = area - toRight;
+            bestChild = c == 0 ? &left : &right;
+            bestGrandchild = &other->right;
+            bestParent = other;
+        }
+    }
+    if (!bestChild) return false;
+    BVHNode* child = *bestChild;
+    *bestChild = *bestGrandchild;
+    *bestGrandchild = child;
+    bestParent->box = surrounding_box(bestParent->left->box, bestParent->right->box);
+    bestParent->height = 1 + max(bestParent->left->height, bestParent->right->height);
+    return true;
+}
+
+__device__ float BVHNode::AreaCost() const
+{
+    if (isLeaf) return box.area() * childList->list_size;
+    return box.area() + left->AreaCost() + right->AreaCost();
+}
+
+// 近い子から先に調べ、見つかった交差のtをt_maxとして遠い子を枝刈りする
+// 内部ノードのtransformは単位変換なので、子ノードは変換せずにスタックで辿る
 __device__ bool BVHNode::collision_detection(const Ray& r,
     float t_min,
     float t_max,
     HitRecord& rec, int frameIndex) const {
-   
-    if (!box.hit(r, t_min, t_max)) return false;
-    if (isLeaf)return childList->hit(r, t_min, t_max, rec, frameIndex);
-    
-    HitRecord left_rec, right_rec;
-    bool hit_left = left->hit(r, t_min, t_max, left_rec, frameIndex);
-    bool hit_right = right->hit(r, t_min, t_max, right_rec, frameIndex);
-    if (hit_left && hit_right) {
-        if (left_rec.t < right_rec.t) {
-            rec = left_rec;
+    const int STACK_SIZE = BVH_STACK_SIZE;
+    const BVHNode* stack[STACK_SIZE];
+    float stackT[STACK_SIZE];   // スタックに積んだノードに入る距離
+    int sp = 0;
+
+    // 方向の逆数と時刻は走査の間ずっと同じ
+    const InvRay inv_r(r);
+    const float time = r.time();
+    float t_enter;
+    if (!BoxAt(time).hit(inv_r, t_min, t_max, t_enter)) return false;
+
+    // 以前の走査と比べるときは枝刈りに元のt_maxを使う
+    const float original_t_max = t_max;
+    bool hit_anything = false;
+    const BVHNode* node = this;
+    while (true) {
+        COUNT_NODE_VISIT();
+        const float cull_t = orderedTraversal ? t_max : original_t_max;
+        if (node->isLeaf) {
+            HitRecord tmp_rec;
+            if (node->childList->hit(r, t_min, cull_t, tmp_rec, frameIndex) && tmp_rec.t < t_max) {
+                hit_anything = true;
+                t_max = tmp_rec.t;
+                rec = tmp_rec;
+            }
         }
         else {
-            rec = right_rec;
+            float t_left, t_right;
+            bool hit_left = node->left->BoxAt(time).hit(inv_r, t_min, cull_t, t_left);
+            bool hit_right = node->right->BoxAt(time).hit(inv_r, t_min, cull_t, t_right);
+            if (hit_left && hit_right) {
+                const BVHNode* nearNode = node->left;
+                const BVHNode* farNode = node->right;
+                float t_far = t_right;
+                if (orderedTraversal && t_right < t_left) {
+                    nearNode = node->right;
+                    farNode = node->left;
+                    t_far = t_left;
+                }
+                // 深さの制限を超える木では、配列の外に書かずに打ち切る
+                if (sp == STACK_SIZE) return hit_anything;
+                stack[sp] = farNode;
+                stackT[sp] = t_far;
+                sp++;
+                node = nearNode;
+                continue;
+            }
+            else if (hit_left) {
+                node = node->left;
+                continue;
+            }
+            else if (hit_right) {
+                node = node->right;
+                continue;
+            }
         }
-        return true;
-    }
-    else if (hit_left) {
-        rec = left_rec;
-        return true;
+
+        // 今の最も近い交差より遠いノードは飛ばす
+        do {
+            if (sp == 0) return hit_anything;
+            sp--;
+        } while (orderedTraversal && stackT[sp] >= t_max);
+        node = stack[sp];
     }
-    else if (hit_right) {
-        rec = right_rec;
-        return true;
+}
+
+// 最初に見つかった交差で打ち切る。順番は関係ないので子の距離は比べない
+__device__ bool BVHNode::occlusion_detection(const Ray& r,
+    float t_min,
+    float t_max, int frameIndex) const {
+    const int STACK_SIZE = BVH_STACK_SIZE;
+    const BVHNode* stack[STACK_SIZE];
+    int sp = 0;
+
+    const InvRay inv_r(r);
+    const float time = r.time();
+    if (!BoxAt(time).hit(inv_r, t_min, t_max)) return false;
+
+    const BVHNode* node = this;
+    while (true) {
+        COUNT_NODE_VISIT();
+        if (node->isLeaf) {
+            if (node->childList->occluded(r, t_min, t_max, frameIndex)) return true;
+        }
+        else {
+            bool hit_left = node->left->BoxAt(time).hit(inv_r, t_min, t_max);
+            bool hit_right = node->right->BoxAt(time).hit(inv_r, t_min, t_max);
+            if (hit_left && hit_right) {
+                if (sp == STACK_SIZE) return false;
+                stack[sp++] = node->right;
+                node = node->left;
+                continue;
+            }
+            else if (hit_left) {
+                node = node->left;
+                continue;
+            }
+            else if (hit_right) {
+                node = node->right;
+                continue;
+            }
+        }
+
+        if (sp == 0) return false;
+        node = stack[--sp];
     }
-        
-    return false;
 }
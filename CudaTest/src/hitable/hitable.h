@@ -3,11 +3,12 @@
 #include "../core/ray.h"
 #include "../core/aabb.h"
 #include "transform.h"
+#include "traversalStats.h"
 
 
 class Material;
 
-// Փˌʂ̃f[^i[
+// 衝突結果のデータを格納する
 struct HitRecord {
     float t;
     float u;
@@ -18,22 +19,31 @@ struct HitRecord {
 };
 
 
-// _OŎgpIuWFNg
-// XgBVHȂǂlɈ
+// レンダリングで使用されるオブジェクト
+// リストやBVHなども同様に扱う
+
+// デバイスヒープ上で生存しているHitableの数（解放漏れの確認用）
+__device__ int liveHitableCount = 0;
 
 class Hitable {
 public:
-    __device__ Hitable(Transform* t) : transform(t) {}
-    __device__ Hitable() { transform = new Transform(); }
+    __device__ Hitable(Transform* t) : transform(t) { atomicAdd(&liveHitableCount, 1); }
+    __device__ Hitable() { transform = new Transform(); atomicAdd(&liveHitableCount, 1); }
+    // transformはHitableが所有する
+    __device__ virtual ~Hitable() { delete transform; atomicAdd(&liveHitableCount, -1); }
 
     __device__ bool hit(const Ray& r,
         float t_min,
         float t_max,
         HitRecord& rec,int frameIndex) 
         {
+            if (transform->IsIdentity()) return collision_detection(r, t_min, t_max, rec, frameIndex);
             Ray transformedRay = transform->TransformRay(r);
             bool flag = collision_detection(transformedRay, t_min, t_max, rec,frameIndex);
-            rec.normal = rotate(rec.normal, transform->rotation);
+            if (flag) {
+                rec.p = transform->TransformPoint(rec.p);
+                rec.normal = transform->TransformNormal(rec.normal);
+            }
             return flag;
         }
 
@@ -42,6 +52,26 @@ public:
         float t_max,
         HitRecord& rec, int frameIndex) const = 0;
 
+    // t_minからt_maxの間に何かがあるかだけを調べる（影やAO用）
+    // 最初に見つかった交差で打ち切り、HitRecordは書かない
+    __device__ bool occluded(const Ray& r,
+        float t_min,
+        float t_max, int frameIndex)
+    {
+        if (transform->IsIdentity()) return occlusion_detection(r, t_min, t_max, frameIndex);
+        Ray transformedRay = transform->TransformRay(r);
+        return occlusion_detection(transformedRay, t_min, t_max, frameIndex);
+    }
+
+    // 専用の判定がないものは最も近い交差で代用する
+    __device__ virtual bool occlusion_detection(const Ray& r,
+        float t_min,
+        float t_max, int frameIndex) const
+    {
+        HitRecord rec;
+        return collision_detection(r, t_min, t_max, rec, frameIndex);
+    }
+
     __device__ bool GetBV(float t0,float t1,AABB& box) 
     {
         bool flag = bounding_box(t0, t1, box);
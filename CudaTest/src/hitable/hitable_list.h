@@ -1,75 +1,30 @@
 #pragma once
 #include "hitable.h"
+#include "../core/growableArray.h"
 
 
-// ̃IuWFNgi[郊Xg
-class HitableList : public Hitable {
+// 複数のオブジェクトを格納するリスト
+class HitableList : public Hitable, public GrowableArray<Hitable*> {
 public:
-    __device__ HitableList() { list = new Hitable * (); list_size = 0; }
-    __device__ HitableList(Hitable** l, int n) { list = l; list_size = n; }
-    __device__ HitableList(int n){ list_size = n; list = (Hitable**)malloc(sizeof(Hitable*) * list_size);}
-    __device__ HitableList(Hitable** l, int n, Transform* t) : Hitable(t) { list = l; list_size = n; }
+    __device__ HitableList() {}
+    __device__ HitableList(Hitable** l, int n) : GrowableArray<Hitable*>(l, n) {}
+    __device__ HitableList(int n) : GrowableArray<Hitable*>(n) {}
+    __device__ HitableList(Hitable** l, int n, Transform* t) : Hitable(t), GrowableArray<Hitable*>(l, n) {}
+    // 要素の配列のみ解放する。要素の所有者は別で破棄する
+    __device__ virtual ~HitableList() { freeMemory(); }
     __device__ virtual bool collision_detection(const Ray& r,
         float t_min,
         float t_max,
         HitRecord& rec, int frameIndex) const;
+    __device__ virtual bool occlusion_detection(const Ray& r,
+        float t_min,
+        float t_max, int frameIndex) const;
     __device__ virtual bool bounding_box(float t0, float t1, AABB& box) const;
-    __device__ void append(Hitable* data)
-    {
-        Hitable** tmp = (Hitable**)malloc(sizeof(Hitable*) * list_size);
-
-        for (int i = 0; i < list_size; i++)
-        {
-            tmp[i] = list[i];
-        }
-
-        free(list);
-
-        list_size++;
-
-        list = (Hitable**)malloc(sizeof(Hitable*) * list_size);
-
-        for (int i = 0; i < list_size - 1; i++)
-        {
-            list[i] = tmp[i];
-        }
-        list[list_size - 1] = data;
-
-        free(tmp); 
-    }
 
     __device__ void Reseize(int n)
     {
-        Hitable** tmp = (Hitable**)malloc(sizeof(Hitable*) * list_size);
-
-        for (int i = 0; i < list_size; i++)
-        {
-            tmp[i] = list[i];
-        }
-
-        free(list);
-
-        
-
-        list = (Hitable**)malloc(sizeof(Hitable*) * n);
-
-        for (int i = 0; i < list_size - 1; i++)
-        {
-            list[i] = tmp[i];
-        }
-        
-        list_size = n;
-        free(tmp);
-    }
-    __device__  void freeMemory()
-    {
-        free(list);
-
-        list_size = 0;
+        resize(n);
     }
-
-    Hitable** list;
-    int list_size;
 };
 
 
@@ -91,6 +46,15 @@ __device__ bool HitableList::collision_detection(const Ray& r,
 }
 
 
+__device__ bool HitableList::occlusion_detection(const Ray& r,
+    float t_min,
+    float t_max, int frameIndex) const {
+    for (int i = 0; i < list_size; i++) {
+        if (list[i]->occluded(r, t_min, t_max, frameIndex)) return true;
+    }
+    return false;
+}
+
 __device__ bool HitableList::bounding_box(float t0,
     float t1,
     AABB& box) const {
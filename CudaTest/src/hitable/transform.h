@@ -1,94 +1,94 @@
 #pragma once
 
 #include <float.h>
+#include "../core/growableArray.h"
+#include "../core/mat34.h"
 
 
+// 位置・回転（度）・拡大縮小と、それから作った変換行列を持つ
+// 行列は値を変えたときだけ作り直し、光線や法線、AABBの変換では作った行列を使う
 class Transform {
 public:
-    __host__ __device__ Transform() { position = vec3(); rotation = vec3(); scale = vec3(1); }
-    __host__ __device__ Transform(vec3 p, vec3 r, vec3 s) : position(p), rotation(r), scale(s)
-    {}
-     __device__ Ray TransformRay(const Ray& r)
+    __host__ __device__ Transform() { Set(vec3(0), vec3(0), vec3(1)); }
+    __host__ __device__ Transform(vec3 p, vec3 r, vec3 s) { Set(p, r, s); }
+
+    __host__ __device__ void Set(const vec3& p, const vec3& r, const vec3& s)
     {
-        return  TranslateRay(RotateRay(ScaleRay(r)));
+        position = p;
+        rotation = r;
+        scale = s;
+        UpdateMatrix();
     }
 
-     __device__ void ResetTransform() {
-         position = vec3(0);
-         rotation = vec3(0);
-         scale = vec3(1);
-     }
-
-     __device__ void TransformAABB(AABB& aabb) {
-         //]?ԈĂH
-         vec3 rotetedMin = rotate(aabb.min(), rotation);
-         vec3 rotetedMax = rotate(aabb.max(), rotation);
-         vec3 min = minVec3(rotetedMin, rotetedMax);
-         vec3 max = maxVec3(rotetedMin,rotetedMax);
+    __host__ __device__ void SetPosition(const vec3& p) { Set(p, rotation, scale); }
+    __host__ __device__ void SetRotation(const vec3& r) { Set(position, r, scale); }
+    __host__ __device__ void SetScale(const vec3& s) { Set(position, rotation, s); }
 
-         //ʒuړ
-         aabb =  AABB(min + position, max + position);
-     }
+    __host__ __device__ void ResetTransform() { Set(vec3(0), vec3(0), vec3(1)); }
 
-    vec3 position;
-    vec3 rotation;
-    vec3 scale;
+    __host__ __device__ const vec3& Position() const { return position; }
+    __host__ __device__ const vec3& Rotation() const { return rotation; }
+    __host__ __device__ const vec3& Scale() const { return scale; }
+    __host__ __device__ bool IsIdentity() const { return identity; }
+    __host__ __device__ const Mat34& ObjectToWorld() const { return objectToWorld; }
+    __host__ __device__ const Mat34& WorldToObject() const { return worldToObject; }
 
-private:
-    __device__ Ray TranslateRay(const Ray& r) const {
-        Ray moved_r(r.origin() - position, r.direction(), r.time());
-        return moved_r;
+    // ワールド空間の光線を物体の空間に変換する
+    // 方向は正規化しないので、tはワールド空間と同じ値になる
+    __host__ __device__ Ray TransformRay(const Ray& r) const
+    {
+        if (identity) return r;
+        return Ray(worldToObject.TransformPoint(r.origin()), worldToObject.TransformVector(r.direction()), r.time());
     }
 
-    __device__ Ray RotateRay(const Ray& r) const {
-        
-        Ray rotate_r(rotate(r.origin(),rotation), rotate(r.direction(),rotation), r.time());
-
-        return rotate_r;
+    // 物体の空間の点をワールド空間に変換する
+    __host__ __device__ vec3 TransformPoint(const vec3& p) const
+    {
+        if (identity) return p;
+        return objectToWorld.TransformPoint(p);
     }
 
-    __device__ Ray ScaleRay(const Ray& r) const {
-        vec3 dir = r.direction() / scale;
-        Ray scaled_r(r.origin(), unit_vector(dir), r.time()*dir.length());
-        return scaled_r;
+    // 物体の空間の法線をワールド空間に変換する（逆行列の転置をかけて正規化）
+    __host__ __device__ vec3 TransformNormal(const vec3& n) const
+    {
+        if (identity) return n;
+        return unit_vector(worldToObject.TransposeTransformVector(n));
     }
 
-
-};
-
-class TransformList {
-public:
-     __device__ TransformList() { list = new Transform * (); list_size = 0; }
-     __device__ TransformList(Transform** l, int n) { list = l; list_size = n; }
-     __device__ void append(Transform* data)
+    // 物体の空間のAABBの8つの角を変換し、それを囲むAABBにする
+    __device__ void TransformAABB(AABB& aabb) const
     {
-        Transform** tmp = (Transform**)malloc(sizeof(Transform*) * list_size);
-
-        for (int i = 0; i < list_size; i++)
-        {
-            tmp[i] = list[i];
+        if (identity) return;
+        vec3 bmin = aabb.min();
+        vec3 bmax = aabb.max();
+        vec3 newMin(FLT_MAX), newMax(-FLT_MAX);
+        for (int i = 0; i < 8; i++) {
+            vec3 corner((i & 1) ? bmax.x() : bmin.x(), (i & 2) ? bmax.y() : bmin.y(), (i & 4) ? bmax.z() : bmin.z());
+            vec3 p = objectToWorld.TransformPoint(corner);
+            newMin = minVec3(newMin, p);
+            newMax = maxVec3(newMax, p);
         }
-
-        free(list);
-
-        list_size++;
-
-        list = (Transform**)malloc(sizeof(Transform*) * list_size);
-
-        for (int i = 0; i < list_size - 1; i++)
-        {
-            list[i] = tmp[i];
-        }
-        list[list_size - 1] = data;
-
-        free(tmp);
+        aabb = AABB(newMin, newMax);
     }
-     __device__  void freeMemory()
+
+private:
+    __host__ __device__ void UpdateMatrix()
     {
-        free(list);
-        list_size = 0;
+        objectToWorld = Mat34::FromTRS(position, rotation, scale);
+        worldToObject = objectToWorld.Inverse();
+        identity = objectToWorld.IsIdentity();
     }
 
-    Transform** list;
-    int list_size;
+    vec3 position;
+    vec3 rotation;
+    vec3 scale;
+    Mat34 objectToWorld;
+    Mat34 worldToObject;
+    bool identity;
+};
+
+class TransformList : public GrowableArray<Transform*> {
+public:
+    __device__ TransformList() {}
+    __device__ TransformList(Transform** l, int n) : GrowableArray<Transform*>(l, n) {}
 };
\ No newline at end of file
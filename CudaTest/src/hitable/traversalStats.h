@@ -0,0 +1,47 @@
+#pragma once
+
+#include "../core/deviceResource.h"
+
+// 走査の計測
+// TRAVERSAL_STATSを定義するとノードの訪問数・三角形の判定数・光線の数をatomicAddで数える
+// 計測のためのビルドでだけ有効にする
+//#define TRAVERSAL_STATS
+
+struct TraversalStats {
+    unsigned long long rays;
+    unsigned long long nodeVisits;
+    unsigned long long triangleTests;
+};
+
+__device__ TraversalStats traversalStats;
+
+// falseにすると以前の走査（両方の子を元のt_maxで調べる）になる。削減量の比較用
+__device__ bool orderedTraversal = true;
+
+#ifdef TRAVERSAL_STATS
+#define COUNT_RAY() atomicAdd(&traversalStats.rays, 1ULL)
+#define COUNT_NODE_VISIT() atomicAdd(&traversalStats.nodeVisits, 1ULL)
+#define COUNT_TRIANGLE_TEST() atomicAdd(&traversalStats.triangleTests, 1ULL)
+#else
+#define COUNT_RAY()
+#define COUNT_NODE_VISIT()
+#define COUNT_TRIANGLE_TEST()
+#endif
+
+void ResetTraversalStats()
+{
+    TraversalStats zero = { 0, 0, 0 };
+    checkCudaErrors(cudaMemcpyToSymbol(traversalStats, &zero, sizeof(TraversalStats)));
+}
+
+TraversalStats GetTraversalStats()
+{
+    TraversalStats stats;
+    checkCudaErrors(cudaMemcpyFromSymbol(&stats, traversalStats, sizeof(TraversalStats)));
+    return stats;
+}
+
+void SetOrderedTraversal(bool ordered)
+{
+    checkCudaErrors(cudaMemcpyToSymbol(orderedTraversal, &ordered, sizeof(bool)));
+}
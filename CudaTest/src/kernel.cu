@@ -1,21 +1,39 @@
 #include "Loader/CSVWriter.h"
 #include "core/render.h"
+#include "benchmark/appendBenchmark.h"
+#include "benchmark/leakCheck.h"
+#include "benchmark/triangleBenchmark.h"
+#include "benchmark/occlusionBenchmark.h"
+#include "benchmark/flatSceneBenchmark.h"
+#include "benchmark/transformBenchmark.h"
+#include "benchmark/boxBenchmark.h"
+#include "benchmark/wideBVHBenchmark.h"
+#include "benchmark/packetBenchmark.h"
+#include "benchmark/quantizedBVHBenchmark.h"
+#include "benchmark/triangleLeafBenchmark.h"
+#include "benchmark/splitBuilderBenchmark.h"
+#include "benchmark/parallelBuildBenchmark.h"
+#include "benchmark/treeletBenchmark.h"
+#include "benchmark/rotationBenchmark.h"
+#include "benchmark/clipBVHBenchmark.h"
+#include "benchmark/motionBlurBenchmark.h"
+#include "benchmark/crowdBenchmark.h"
+#include "benchmark/blasCacheBenchmark.h"
+#include "benchmark/multiMeshBenchmark.h"
+#include "benchmark/normalSkinningBenchmark.h"
+#include "batchRender.h"
 
 
 void renderBoneBVH(int nx, int ny, int samples, int max_depth, int beginFrame, int endFrame,
     Camera** camera, 
     dim3 blocks, dim3 threads, curandState* curand_state, std::vector<std::vector<std::string>>& data,
-    CudaPointerList* pointerList, FBXObject* fbxData)
+    ResourceList* resources, FBXObject* fbxData)
 {
-    StopWatch sw;
-    sw.Reset();
-    sw.Start();
     HitableList** boneBVHList;
     cudaMalloc(&boneBVHList, sizeof(HitableList*));
-    createBoneBVH(boneBVHList, fbxData, curand_state, pointerList);
-    sw.Stop();
-    printf("BVH쐬\n");
-    data.push_back({ "", "", "",std::to_string(sw.GetTime()) });
+    createBoneBVH(boneBVHList, fbxData, curand_state, resources);
+    printf("BVH作成完了\n");
+    data.push_back({ "", "", "",std::to_string(Profiler::Get().GetLastTime("build")) });
     renderBoneBVHAnimation(nx, ny, samples, max_depth, beginFrame, endFrame, (Hitable**)boneBVHList, camera, fbxData, blocks, threads, curand_state, data);
 
 }
@@ -24,23 +42,23 @@ void renderBoneBVH(int nx, int ny, int samples, int max_depth, int beginFrame, i
 void renderBVH(int nx, int ny, int samples, int max_depth, int beginFrame, int endFrame,
     HitableList** fbxList, Camera** camera,
     dim3 blocks, dim3 threads, curandState* curand_state, std::vector<std::vector<std::string>>& data,
-    CudaPointerList* pointerList, FBXObject* fbxData)
+    ResourceList* resources, FBXObject* fbxData)
 {
-    StopWatch sw;
-    sw.Reset();
-    sw.Start();
     BVHNode** bvhNode;
     cudaMalloc(&bvhNode, sizeof(BVHNode*));
-    create_BVHfromList(bvhNode, fbxList, curand_state, pointerList);
-    sw.Stop();
-    printf("BVH쐬\n");
-    data.push_back({ "", "", "",std::to_string(sw.GetTime()) });
+    create_BVHfromList(bvhNode, fbxList, curand_state, resources);
+    printf("BVH作成完了\n");
+    //遮蔽の判定(occluded)と最も近い交差(hit)の光線数/秒の比較
+    //RunOcclusionBenchmark("occlusion_benchmark.csv", (Hitable**)bvhNode, camera, curand_state, nx, ny, blocks, threads);
+    //仮想関数のBVHとフラットなシーン(GPU/CPU)の光線数/秒の比較
+    //RunFlatSceneBenchmark("flat_scene_benchmark.csv", (Hitable**)bvhNode, fbxData, nx, ny, blocks, threads);
+    data.push_back({ "", "", "",std::to_string(Profiler::Get().GetLastTime("build")) });
     renderBVHAnimation(nx, ny, samples, max_depth, beginFrame, endFrame, (Hitable**)bvhNode, camera, fbxData, blocks, threads, curand_state, data);
 }
 
-int main()
+int main(int argc, char** argv)
 {
-    // p[^[ݒ
+    // パラメーター設定
     const int nx = 1024 * RESOLUTION;
     const int ny = 512 * RESOLUTION;  
     const int threadX = 16;
@@ -53,57 +71,111 @@ int main()
     const int num_pixel = nx * ny;
     dim3 blocks(nx / threadX + 1, ny / threadY + 1);
     dim3 threads(threadX, threadY);
-    CudaPointerList* pointerList = new CudaPointerList();//ƂŔjfoCXp|C^[̃Xg
+    ResourceList* resources = new ResourceList();//あとでまとめて破棄するデバイス用のリソース
 
-    //vpf[^
+    //計測用データ
     StopWatch sw;
     std::vector<std::vector<std::string>> data;
     data.push_back({ "frame", "rendering", "update","build"});
-
-    //q[vTCYEX^bNTCYw
+    //リストのappendの計測
+    //RunAppendBenchmark("append_benchmark.csv");
+    //描画方法の切り替え（直接光とAO）
+    //SetShadeMode(SHADE_AO);
+    //BVHの走査を以前の方法（両方の子を元のt_maxで調べる）に戻す。traversalStats.hのTRAVERSAL_STATSと合わせて削減量を比較する
+    //SetOrderedTraversal(false);
+    //三角形の交差判定の計測
+    //RunTriangleBenchmark("triangle_benchmark.csv");
+    //光線の変換の計測
+    //RunTransformBenchmark("transform_benchmark.csv");
+    //AABBの判定の計測
+    //RunBoxBenchmark("box_benchmark.csv");
+    //2分木と4分木・8分木のBVHのCPUでの光線数/秒の比較（objects内の全モデル）
+    //RunWideBVHBenchmark("wide_bvh_benchmark.csv");
+    //CPUでの1本ずつの走査とパケットの走査の比較（1024x512）
+    //RunPacketBenchmark("packet_benchmark.csv");
+    //量子化したBVHのノードと元のノードの大きさ・光線数/秒の比較（高ポリゴンのモデル）
+    //RunQuantizedBVHBenchmark("quantized_bvh_benchmark.csv");
+    //葉の三角形を1つずつ判定する場合と4個・8個まとめて判定する場合の比較
+    //RunTriangleLeafBenchmark("triangle_leaf_benchmark.csv");
+    //中央値分割・SAH・空間分割あり（SBVH）のBVHの構築時間・SAHコスト・光線数/秒の比較
+    //RunSplitBuilderBenchmark("split_builder_benchmark.csv");
+    //ホストでのBVHの構築時間のスレッド数ごとの比較
+    //RunParallelBuildBenchmark("parallel_build_benchmark.csv");
+    //アニメーションでリフィットだけする場合とtreeletを組み替える場合のSAHコスト・描画時間の比較
+    //RunTreeletBenchmark("treelet_benchmark.csv");
+    //アニメーションでBVHNodeをリフィットだけする場合と回転もする場合のSAHコストの推移
+    //RunRotationBenchmark("rotation_benchmark.csv");
+    //クリップの全フレームの姿勢で構築したBVHと0フレーム目で構築してリフィットするBVHの比較
+    //RunClipBVHBenchmark("clip_bvh_benchmark.csv");
+    //変形によるモーションブラーとサブフレームを平均する場合の時間と画像の差の比較
+    //RunMotionBlurBenchmark("motion_blur_benchmark.csv");
+    //1000体の群衆をインスタンスで並べたときのメモリ・更新時間・CPUでの描画時間
+    //RunCrowdBenchmark("crowd_benchmark.csv");
+    //群衆のフレームごとのメッシュをキャッシュした場合の更新時間とヒット率
+    //RunBLASCacheBenchmark("blas_cache_benchmark.csv");
+    //全てのメッシュをまとめて読み込んだときの読み込み・構築時間と三角形あたりのメモリ
+    //RunMultiMeshBenchmark("multi_mesh_benchmark.csv");
+    //頂点の法線もスキニングする場合に増える1フレームあたりの時間
+    //RunNormalSkinningBenchmark("normal_skinning_benchmark.csv");
+
+    //ヒープサイズ・スタックサイズ指定
     //ChangeHeapSize(1024 * 1024 * 1024*4);
     cudaError_t err = cudaDeviceSetLimit(cudaLimitMallocHeapSize, 1048576ULL * 2048);
 
     ChangeStackSize(1024 * 16);
-    // 񐶐p̃m
+    //ジョブファイルが指定されたらその内容でまとめてレンダリングする
+    if (argc > 1) {
+        int result = RunJobFile(argv[1]);
+        delete resources;
+        ResourceTracker::Get().Report();
+        cudaDeviceReset();
+        return result;
+    }
+    //シーンの読み込みと解放を繰り返してリークを確認
+    //RunSceneLeakCheck("./objects/low_walking.fbx", 100);
+    // 乱数列生成用のメモリ確保
     curandState* curand_state;
     checkCudaErrors(cudaMallocManaged((void**)&curand_state, nx * ny * sizeof(curandState)));
-    SetCurandState(curand_state, nx, ny, blocks, threads,pointerList);
+    SetCurandState(curand_state, nx, ny, blocks, threads, resources);
 
-    //J쐬
+    //カメラ作成
     Camera** camera;
     checkCudaErrors(cudaMallocManaged((void**)&camera, sizeof(Camera*)));
-    init_camera(camera, nx, ny, pointerList);
+    init_camera(camera, nx, ny, resources);
 
-    //FBXIuWFNg쐬
+    //FBXオブジェクト作成
     HitableList** fbxList;
     checkCudaErrors(cudaMallocManaged((void**)&fbxList, sizeof(HitableList*)));
-    init_List(fbxList, pointerList);
-    //FBXt@Cǂݍ
-    FBXObject* fbxData = new FBXObject();//ff[^
+    init_MeshList(fbxList, resources);
+    //FBXファイル読み込み
+    FBXObject* fbxData = new FBXObject();//モデルデータ
     CreateFBXData("./objects/low_walking.fbx", fbxData, endFrame);
     //CreateFBXData("./objects/low_standUp.fbx", fbxData, endFrame);
     //CreateFBXData("./objects/high_Walking5.fbx", fbxData, endFrame);
     //CreateFBXData("./objects/high_StandUp2.fbx", fbxData, endFrame);
     //CreateFBXData("./objects/Land2.fbx", fbxData, endFrame);
-    // bV̐
+    // メッシュの生成
     create_FBXMesh(fbxList, fbxData);
-    printf("V[쐬\n");
-    //̃Xg
+    printf("シーン作成完了\n");
+    //ただのリスト
     //renderListAnimation(nx, ny, samples, max_depth, beginFrame, endFrame, (Hitable**)fbxList, camera, fbxAnimationData, blocks, threads, curand_state);
-    //{[ɂBVH
-    //renderBoneBVH(nx, ny, samples, max_depth, beginFrame, endFrame, camera, blocks, threads, curand_state, data, pointerList, fbxData);
+    //ボーンによるBVH
+    //renderBoneBVH(nx, ny, samples, max_depth, beginFrame, endFrame, camera, blocks, threads, curand_state, data, resources, fbxData);
     //BVH
-    renderBVH(nx, ny, samples, max_depth, beginFrame, endFrame, fbxList, camera, blocks, threads, curand_state, data, pointerList,fbxData);
+    renderBVH(nx, ny, samples, max_depth, beginFrame, endFrame, fbxList, camera, blocks, threads, curand_state, data, resources, fbxData);
 
 
-    // CSVt@Cɏo
+    // CSVファイルに書き出す
     writeCSV("output.csv", data);
-    printf("csvo\n");
+    Profiler::Get().WriteCSV("profile.csv");
+    Profiler::Get().WriteChromeTrace("trace.json");
+    printf("csv書き出し完了\n");
 
-    //
+    //メモリ解放
     checkCudaErrors(cudaDeviceSynchronize());
-    pointerList->freeMemory();
+    delete resources;
+    delete fbxData;
+    ResourceTracker::Get().Report();
     cudaDeviceReset();
     checkCudaErrors(cudaGetLastError());
 
@@ -41,6 +41,7 @@ __device__ bool refract(const vec3& v, const vec3& n, float ni_over_nt, vec3& re
 
 class Material {
 public:
+    __device__ virtual ~Material() {}
     __device__ virtual bool scatter(const Ray& r_in,
         const HitRecord& rec,
         vec3& attenuation,
@@ -57,6 +58,7 @@ public:
 class Lambertian : public Material {
 public:
     __device__ Lambertian(Texture* a) : albedo(a) {}
+    __device__ virtual ~Lambertian() { delete albedo; }
 
     __device__ virtual bool scatter(const Ray& r_in,
         const HitRecord& rec,
@@ -146,6 +148,7 @@ public:
 class DiffuseLight : public Material {
 public:
     __device__ DiffuseLight(Texture* texture) : emit(texture) {}
+    __device__ virtual ~DiffuseLight() { delete emit; }
     __device__ virtual bool scatter(const Ray& r_in,
         const HitRecord& rec,
         vec3& attenuation,
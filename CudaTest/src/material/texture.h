@@ -5,6 +5,7 @@
 
 class Texture {
 public:
+    __device__ virtual ~Texture() {}
     __device__ virtual vec3 value(float u, float v, const vec3& p) const = 0;
 };
 
@@ -26,6 +27,7 @@ class CheckerTexture : public Texture {
 public:
     __device__ CheckerTexture() {}
     __device__ CheckerTexture(Texture* t0, Texture* t1) : even(t0), odd(t1) {}
+    __device__ virtual ~CheckerTexture() { delete odd; delete even; }
 
     __device__ virtual vec3 value(float u, float v, const vec3& p) const {
         float sines = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
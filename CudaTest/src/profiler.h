@@ -0,0 +1,286 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include "Loader/CSVWriter.h"
+
+// 名前付きの区間を入れ子で計測するプロファイラ
+// ホスト側はsteady_clock、デバイス側はCUDAイベントで計測し、
+// フレームごとの集計をCSVに、全区間をChromeのトレース形式(chrome://tracing)のJSONに書き出す
+// 区間の名前は文字列リテラルなど、プロファイラより長く生存する文字列を渡す
+class Profiler
+{
+public:
+    struct Zone {
+        const char* name;
+        int depth;
+        int frame;
+        double start;   // 計測開始からの秒数
+        double duration;// 秒
+        bool gpu;
+    };
+
+    static Profiler& Get()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    // フレームの区切り。BeginFrameからEndFrameまでの区間はそのフレームに集計される
+    void BeginFrame(int frameIndex)
+    {
+        currentFrame = frameIndex;
+    }
+
+    void EndFrame()
+    {
+#ifdef __CUDACC__
+        ResolveGpuZones();
+#endif
+        frameTotals.push_back(FrameTotals(currentFrame, std::map<std::string, double>()));
+        std::map<std::string, double>& totals = frameTotals.back().second;
+        for (size_t i = frameBegin; i < zones.size(); i++)
+        {
+            totals[zones[i].name] += zones[i].duration;
+        }
+        for (const auto& value : frameValues)
+        {
+            totals[value.first] += value.second;
+        }
+        frameValues.clear();
+        frameBegin = zones.size();
+        currentFrame = -1;
+    }
+
+    void Begin(const char* name)
+    {
+        Zone zone = { name, (int)openZones.size(), currentFrame, Now(), 0.0, false };
+        openZones.push_back(zones.size());
+        zones.push_back(zone);
+        AddZoneName(name);
+    }
+
+    void End()
+    {
+        if (openZones.empty()) return;
+        Zone& zone = zones[openZones.back()];
+        zone.duration = Now() - zone.start;
+        openZones.pop_back();
+        if (currentFrame < 0) frameBegin = zones.size();
+    }
+
+    // 時間以外の値（走査の統計など）を今のフレームに加える。CSVには区間と同じく列として出力される
+    void AddValue(const char* name, double value)
+    {
+        frameValues[name] += value;
+        AddZoneName(name);
+    }
+
+#ifdef __CUDACC__
+    // streamに積まれた処理をCUDAイベントで計測する。結果はEndFrameで回収する
+    void BeginGpu(const char* name, cudaStream_t stream = 0)
+    {
+        GpuZone gpuZone;
+        gpuZone.zoneIndex = zones.size();
+        gpuZone.start = AcquireEvent();
+        gpuZone.stop = nullptr;
+        cudaEventRecord(gpuZone.start, stream);
+        gpuZones.push_back(gpuZone);
+
+        Zone zone = { name, (int)openZones.size(), currentFrame, Now(), 0.0, true };
+        zones.push_back(zone);
+        AddZoneName(name);
+    }
+
+    void EndGpu(cudaStream_t stream = 0)
+    {
+        for (size_t i = gpuZones.size(); i > 0; i--)
+        {
+            if (gpuZones[i - 1].stop == nullptr) {
+                gpuZones[i - 1].stop = AcquireEvent();
+                cudaEventRecord(gpuZones[i - 1].stop, stream);
+                return;
+            }
+        }
+    }
+#endif
+
+    // 指定したフレームでの区間の合計時間（秒）
+    // 同じフレーム番号を複数回計測した場合（バッチレンダリングのジョブごとなど）は最後のもの
+    double GetFrameTime(int frameIndex, const std::string& name) const
+    {
+        for (size_t i = frameTotals.size(); i > 0; i--)
+        {
+            const FrameTotals& frame = frameTotals[i - 1];
+            if (frame.first != frameIndex) continue;
+            auto total = frame.second.find(name);
+            return total == frame.second.end() ? 0.0 : total->second;
+        }
+        return 0.0;
+    }
+
+    // フレームの外で計測した区間（読み込みや構築など）の最後の時間（秒）
+    double GetLastTime(const std::string& name) const
+    {
+        for (size_t i = zones.size(); i > 0; i--)
+        {
+            if (name == zones[i - 1].name) return zones[i - 1].duration;
+        }
+        return 0.0;
+    }
+
+    // フレームごと・区間ごとの合計時間をCSVに書き出す
+    void WriteCSV(const std::string& filename) const
+    {
+        // フレームの中で計測された区間だけを列にする
+        std::vector<std::string> columns;
+        for (const std::string& name : zoneNames)
+        {
+            for (const auto& frame : frameTotals)
+            {
+                if (frame.second.count(name) > 0) {
+                    columns.push_back(name);
+                    break;
+                }
+            }
+        }
+
+        std::vector<std::vector<std::string>> data;
+        std::vector<std::string> header = { "frame" };
+        header.insert(header.end(), columns.begin(), columns.end());
+        data.push_back(header);
+
+        for (const auto& frame : frameTotals)
+        {
+            std::vector<std::string> row = { std::to_string(frame.first) };
+            for (const std::string& name : columns)
+            {
+                auto total = frame.second.find(name);
+                row.push_back(total == frame.second.end() ? "" : std::to_string(total->second));
+            }
+            data.push_back(row);
+        }
+        writeCSV(filename, data);
+    }
+
+    // Chromeのトレース形式で書き出す。GPUの区間は別のスレッドとして表示される
+    void WriteChromeTrace(const std::string& filename) const
+    {
+        FILE* fp = fopen(filename.c_str(), "w");
+        if (fp == nullptr) {
+            printf("cannot open %s\n", filename.c_str());
+            return;
+        }
+        fprintf(fp, "{\"traceEvents\":[\n");
+        for (size_t i = 0; i < zones.size(); i++)
+        {
+            const Zone& zone = zones[i];
+            fprintf(fp, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d,\"args\":{\"frame\":%d,\"depth\":%d}}%s\n",
+                zone.name, zone.gpu ? "gpu" : "cpu", zone.start * 1e6, zone.duration * 1e6, zone.gpu ? 1 : 0,
+                zone.frame, zone.depth, i + 1 < zones.size() ? "," : "");
+        }
+        fprintf(fp, "]}\n");
+        fclose(fp);
+    }
+
+    void Clear()
+    {
+        zones.clear();
+        openZones.clear();
+        frameTotals.clear();
+        frameValues.clear();
+        zoneNames.clear();
+        frameBegin = 0;
+        currentFrame = -1;
+    }
+
+private:
+    Profiler() : epoch(std::chrono::steady_clock::now()), currentFrame(-1), frameBegin(0) {}
+    ~Profiler()
+    {
+#ifdef __CUDACC__
+        // プロセス終了時にはデバイスがリセット済みのことがあるので、イベントは破棄しない
+        eventPool.clear();
+#endif
+    }
+
+    double Now() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    void AddZoneName(const char* name)
+    {
+        for (const std::string& n : zoneNames)
+        {
+            if (n == name) return;
+        }
+        zoneNames.push_back(name);
+    }
+
+#ifdef __CUDACC__
+    struct GpuZone {
+        size_t zoneIndex;
+        cudaEvent_t start;
+        cudaEvent_t stop;
+    };
+
+    // イベントは使い回す
+    cudaEvent_t AcquireEvent()
+    {
+        if (!eventPool.empty()) {
+            cudaEvent_t event = eventPool.back();
+            eventPool.pop_back();
+            return event;
+        }
+        cudaEvent_t event;
+        cudaEventCreate(&event);
+        return event;
+    }
+
+    void ResolveGpuZones()
+    {
+        for (GpuZone& gpuZone : gpuZones)
+        {
+            float ms = 0.0f;
+            if (gpuZone.stop != nullptr) {
+                cudaEventSynchronize(gpuZone.stop);
+                cudaEventElapsedTime(&ms, gpuZone.start, gpuZone.stop);
+                eventPool.push_back(gpuZone.stop);
+            }
+            eventPool.push_back(gpuZone.start);
+            zones[gpuZone.zoneIndex].duration = ms / 1000.0;
+        }
+        gpuZones.clear();
+    }
+
+    std::vector<GpuZone> gpuZones;
+    std::vector<cudaEvent_t> eventPool;
+#endif
+
+    std::chrono::steady_clock::time_point epoch;
+    std::vector<Zone> zones;
+    std::vector<size_t> openZones;
+    // 計測した順の（フレーム番号, 区間ごとの合計）
+    typedef std::pair<int, std::map<std::string, double>> FrameTotals;
+    std::vector<FrameTotals> frameTotals;
+    std::map<std::string, double> frameValues;
+    std::vector<std::string> zoneNames;
+    int currentFrame;
+    size_t frameBegin;
+};
+
+
+// スコープを抜けるまでを計測する
+class ProfileScope
+{
+public:
+    ProfileScope(const char* name) { Profiler::Get().Begin(name); }
+    ~ProfileScope() { Profiler::Get().End(); }
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
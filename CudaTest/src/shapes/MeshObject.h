@@ -1,17 +1,38 @@
 #pragma once
 #include "../core/vec3.h"
+#include "../core/deviceResource.h"
 #include <fbxsdk.h>
 #pragma comment(lib, "libfbxsdk-md.lib")
 #pragma comment(lib, "libxml2-md.lib")
 #pragma comment(lib, "zlib-md.lib")
 #pragma comment(lib, "zlib-md.lib")
+// シーンの全てのメッシュを1つにまとめた頂点と三角形
+// 三角形の頂点番号は結合した頂点配列での番号、マテリアルの番号はmaterialColorsの番号
 class MeshData {
 public:
+    MeshData() : nPoints(0), nTriangles(0), nMeshes(0), nMaterials(0), points(nullptr), idxVertex(nullptr), normals(nullptr),
+        cornerNormals(nullptr), materialIds(nullptr), uvs(nullptr), materialColors(nullptr) {}
+    ~MeshData()
+    {
+        free(points);
+        free(idxVertex);
+        free(normals);
+        free(cornerNormals);
+        free(materialIds);
+        free(uvs);
+        free(materialColors);
+    }
     int nPoints;
     int nTriangles;
+    int nMeshes;    // 結合したメッシュの数
+    int nMaterials;
     vec3* points;
     vec3* idxVertex;
     vec3* normals;
+    vec3* cornerNormals;    // 三角形ごとに3頂点分の法線（idxVertexと同じ順）。同じ頂点でも角ごとに違えば折れ目が残る
+    int* materialIds;   // 三角形ごとのマテリアルの番号
+    vec3* uvs;  // 三角形ごとに3頂点分のUV（idxVertexと同じ順。zは0）。UVがなければnullptr
+    vec3* materialColors;   // マテリアルごとの拡散反射の色（どれかの三角形が使うマテリアルだけ）
 };
 
 class Bone {
@@ -65,7 +86,7 @@ public:
 class FBXObject {
 public:
     MeshData* mesh;
-    Triangle** d_triangleData;
+    DeviceBuffer<Triangle*> d_triangleData;//デバイス上の三角形へのポインタ（三角形自体はメッシュのリストが所有する）
     Bone* boneList;
     int boneCount;
     FBXAnimationData* fbxAnimationData;
@@ -73,6 +94,32 @@ public:
     {
         mesh = new MeshData();
         fbxAnimationData = new FBXAnimationData();
+        fbxAnimationData->frameCount = 0;
+        fbxAnimationData->animation = nullptr;
+        boneList = nullptr;
+        boneCount = 0;
+        ResourceTracker::Get().Add("FBXObject", sizeof(FBXObject));
     }
-};
+    FBXObject(const FBXObject&) = delete;
+    FBXObject& operator=(const FBXObject&) = delete;
+    ~FBXObject()
+    {
+        for (int i = 0; i < fbxAnimationData->frameCount; i++)
+        {
+            free(fbxAnimationData->animation[i].nowTransforom);
+            free(fbxAnimationData->animation[i].nowRatation);
+            delete[] fbxAnimationData->animation[i].clusterDeformation;
+        }
+        free(fbxAnimationData->animation);
+        delete fbxAnimationData;
 
+        for (int i = 0; i < boneCount; i++)
+        {
+            free(boneList[i].weightIndices);
+            free(boneList[i].weights);
+        }
+        free(boneList);
+        delete mesh;
+        ResourceTracker::Get().Remove("FBXObject", sizeof(FBXObject));
+    }
+};
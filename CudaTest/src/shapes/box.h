@@ -8,6 +8,7 @@ class Box : public Hitable {
 public:
     __device__ Box(Transform* t) :Hitable(t) {}
     __device__ Box(const vec3& p0, const vec3& p1, Material* mat, Transform* t);
+    __device__ virtual ~Box() { delete list_ptr; }
 
     __device__ virtual bool collision_detection(const Ray& r,
         float t_min,
@@ -29,7 +30,7 @@ __device__ Box::Box(const vec3& p0, const vec3& p1, Material* mat, Transform* t)
     p_min = p0;
     p_max = p1;
 
-    Hitable** list = new Hitable * [6];
+    Hitable** list = (Hitable**)malloc(sizeof(Hitable*) * 6);
     /*list[0] = (new RectangleXY(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), mat));
     list[1] = new FlipNormals(new RectangleXY(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), mat));
     list[2] = (new RectangleXZ(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), mat));
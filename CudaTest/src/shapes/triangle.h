@@ -1,12 +1,13 @@
 #pragma once
 
 #include "../hitable/hitable.h"
+#include "triangleIntersect.h"
 
 class Triangle : public Hitable {
 public:
-    __device__ Triangle() : EPSILON(0.00001) {}
+    __device__ Triangle() {}
     __device__ Triangle(vec3 vs[3], Material* mat, bool flip, Transform* t, const bool cull = false) :
-        Hitable(t), flipNormal(flip) ,EPSILON(0.000001) {
+        Hitable(t), flipNormal(flip) {
         for (int i = 0; i < 3; i++) {
             vertices[i] = vs[i];
         }
@@ -16,16 +17,22 @@ public:
         edge2 = vertices[2] - vertices[0];
         normal = unit_vector(cross(edge1, edge2));
         backCulling = cull;
+        moving = false;
+        smooth = false;
+        hasUV = false;
     };
 
     __device__ Triangle(vec3 vs[3], vec3 triNormal,  Material* mat, bool flip, Transform* t, const bool cull = false) :
-        Hitable(t), flipNormal(flip), EPSILON(0.000001) {
+        Hitable(t), flipNormal(flip) {
         for (int i = 0; i < 3; i++) {
             vertices[i] = vs[i];
         }
         normal = triNormal;
         material = mat;
         backCulling = cull;
+        moving = false;
+        smooth = false;
+        hasUV = false;
     };
 
     __device__ virtual bool collision_detection(const Ray& r,
@@ -33,20 +40,66 @@ public:
         float t_max,
         HitRecord& rec, int frameIndex) const;
 
+    __device__ virtual bool occlusion_detection(const Ray& r,
+        float t_min,
+        float t_max, int frameIndex) const;
+
     __device__ virtual bool bounding_box(float t0,
         float t1,
         AABB& box) const;
 
+    // 交差判定は頂点をそのまま使うので、リフィットでは頂点を書き換えるだけでよい
     __device__ void SetVertices(vec3 vs[3]) {
         for (int vi = 0; vi < 3; vi++) 
         {
             vertices[vi] = vs[vi];
         }
+        moving = false;
+    }
+
+    // 変形によるモーションブラー用に、シャッターが開くときと閉じるときの頂点を設定する
+    // 光線の時刻（0で開く、1で閉じる）で頂点を線形補間して判定する
+    __device__ void SetMotionVertices(vec3 open[3], vec3 close[3]) {
+        for (int vi = 0; vi < 3; vi++)
+        {
+            vertices[vi] = open[vi];
+            closeVertices[vi] = close[vi];
+        }
+        moving = true;
+    }
+
+    // 頂点ごとの法線を設定すると、交差した点の法線を重心座標で補間する（スキニングで毎フレーム更新する）
+    __device__ void SetVertexNormals(vec3 ns[3]) {
+        for (int vi = 0; vi < 3; vi++)
+        {
+            vertexNormals[vi] = ns[vi];
+        }
+        smooth = true;
     }
 
-    const float EPSILON;
+    // 頂点ごとのUVを設定すると、HitRecordのu, vに補間したUVを入れる（設定しなければ重心座標）
+    __device__ void SetUVs(vec3 uv[3]) {
+        for (int vi = 0; vi < 3; vi++)
+        {
+            uvs[vi] = uv[vi];
+        }
+        hasUV = true;
+    }
+
+    __device__ void VerticesAt(float time, vec3 v[3]) const {
+        for (int vi = 0; vi < 3; vi++)
+        {
+            v[vi] = moving ? lerp(time, vertices[vi], closeVertices[vi]) : vertices[vi];
+        }
+    }
 
     vec3 vertices[3];
+    vec3 closeVertices[3];  //movingのときのシャッターが閉じるときの頂点
+    bool moving;
+    vec3 vertexNormals[3];  //smoothのときの頂点ごとの法線
+    vec3 uvs[3];    //hasUVのときの頂点ごとのUV（zは使わない）
+    bool smooth;
+    bool hasUV;
     vec3 normal;
     bool flipNormal;
     bool backCulling;
@@ -58,58 +111,58 @@ __device__ bool Triangle::collision_detection(const Ray& r,
     float t_min,
     float t_max,
     HitRecord& rec, int frameIndex) const {
-    if (dot(r.direction(), normal) < 0)return false;
-    vec3 vertex0 = vertices[0];
-    vec3 vertex1 = vertices[1];
-    vec3 vertex2 = vertices[2];
-
-    vec3 edge1, edge2, h, s, q;
-    float a, f, u, v;
-
-    edge1 = vertex1 - vertex0;
-    edge2 = vertex2 - vertex0;
-    h = cross(r.direction(), edge2);
-    a = dot(edge1, h);
-
-    if (a < EPSILON && backCulling)
-        return false;
-
-    if (a > -EPSILON && a < EPSILON)
-        return false;
-
-    f = 1.0 / a;
-    s = r.origin() - vertex0;
-    u = f * dot(s, h);
-
-    if (u < 0.0 || u > 1.0)
-        return false;
-
-    q = cross(s, edge1);
-    v = f * dot(r.direction(), q);
-    if (v < 0.0 || u + v > 1.0)
+    COUNT_TRIANGLE_TEST();
+    vec3 vs[3];
+    VerticesAt(r.time(), vs);
+    float t, u, v;
+    if (!IntersectTriangle(WatertightRay(r.origin(), r.direction()), vs[0], vs[1], vs[2],
+        t_min, t_max, backCulling, t, u, v))
         return false;
 
-    float t = f * dot(edge2, q);
-
     rec.t = t;
+    const float w = 1.0f - u - v;
+    if (hasUV) {
+        vec3 uv = w * uvs[0] + u * uvs[1] + v * uvs[2];
+        rec.u = uv.x();
+        rec.v = uv.y();
+    }
+    else {
+        rec.u = u;
+        rec.v = v;
+    }
     rec.p = r.point_at_t(rec.t);
-    rec.normal = normal;
+    const vec3 n = smooth ? unit_vector(w * vertexNormals[0] + u * vertexNormals[1] + v * vertexNormals[2]) : normal;
+    rec.normal = flipNormal ? -n : n;
     rec.mat_ptr = material;
 
     return true;
 }
 
+__device__ bool Triangle::occlusion_detection(const Ray& r,
+    float t_min,
+    float t_max, int frameIndex) const {
+    COUNT_TRIANGLE_TEST();
+    vec3 vs[3];
+    VerticesAt(r.time(), vs);
+    float t, u, v;
+    return IntersectTriangle(WatertightRay(r.origin(), r.direction()), vs[0], vs[1], vs[2],
+        t_min, t_max, backCulling, t, u, v);
+}
+
+// 時刻t0からt1の間の箱。頂点は線形に動くので、両端の頂点を囲めばよい
 __device__ bool Triangle::bounding_box(float t0,
     float t1,
     AABB& bbox) const {
-    float minX = min(vertices[0][0], min(vertices[1][0], vertices[2][0]));
-    float minY = min(vertices[0][1], min(vertices[1][1], vertices[2][1]));
-    float minZ = min(vertices[0][2], min(vertices[1][2], vertices[2][2]));
-
-    float maxX = max(vertices[0][0], max(vertices[1][0], vertices[2][0]));
-    float maxY = max(vertices[0][1], max(vertices[1][1], vertices[2][1]));
-    float maxZ = max(vertices[0][2], max(vertices[1][2], vertices[2][2]));
+    vec3 v0[3], v1[3];
+    VerticesAt(t0, v0);
+    VerticesAt(t1, v1);
+    vec3 small = v0[0], big = v0[0];
+    for (int vi = 0; vi < 3; vi++)
+    {
+        small = minVec3(small, minVec3(v0[vi], v1[vi]));
+        big = maxVec3(big, maxVec3(v0[vi], v1[vi]));
+    }
 
-    bbox = AABB(vec3(minX, minY, minZ), vec3(maxX, maxY, maxZ));
+    bbox = AABB(small, big);
     return true;
 }
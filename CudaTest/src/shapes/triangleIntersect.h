@@ -0,0 +1,87 @@
+#pragma once
+
+#include <math.h>
+#include "../core/vec3.h"
+
+// 水密な交差判定用に前計算したレイ
+// レイの方向の絶対値が最大の軸がzになるように軸を並べ替え、zの方向に揃えるせん断の係数を持つ
+struct WatertightRay {
+    __host__ __device__ WatertightRay() {}
+    __host__ __device__ WatertightRay(const vec3& o, const vec3& dir) : org(o)
+    {
+        float dx = fabsf(dir[0]), dy = fabsf(dir[1]), dz = fabsf(dir[2]);
+        kz = dx > dy ? (dx > dz ? 0 : 2) : (dy > dz ? 1 : 2);
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+        // 裏表が入れ替わらないように
+        if (dir[kz] < 0.0f) {
+            int tmp = kx;
+            kx = ky;
+            ky = tmp;
+        }
+        Sz = 1.0f / dir[kz];
+        Sx = dir[kx] * Sz;
+        Sy = dir[ky] * Sz;
+    }
+
+    vec3 org;
+    int kx, ky, kz;
+    float Sx, Sy, Sz;
+};
+
+// レイと三角形の水密な交差判定（Woop, Benthin, Wald 2013 "Watertight Ray/Triangle Intersection"）
+// 頂点をレイを原点とする空間に移して2次元の辺関数で判定する
+// 隣り合う三角形の共有辺は同じ2頂点から同じ値が計算されるので、辺の上を通るレイが両方の三角形をすり抜けることがない
+// t_min < t < t_max の交差だけを返す。u, vはv1, v2の重心座標
+__host__ __device__ inline bool IntersectTriangle(const WatertightRay& ray,
+    const vec3& v0, const vec3& v1, const vec3& v2,
+    float t_min, float t_max, bool backCulling,
+    float& t, float& u, float& v)
+{
+    const int kx = ray.kx, ky = ray.ky, kz = ray.kz;
+    vec3 A = v0 - ray.org;
+    vec3 B = v1 - ray.org;
+    vec3 C = v2 - ray.org;
+    float Ax = A[kx] - ray.Sx * A[kz];
+    float Ay = A[ky] - ray.Sy * A[kz];
+    float Bx = B[kx] - ray.Sx * B[kz];
+    float By = B[ky] - ray.Sy * B[kz];
+    float Cx = C[kx] - ray.Sx * C[kz];
+    float Cy = C[ky] - ray.Sy * C[kz];
+
+    float U = Cx * By - Cy * Bx;
+    float V = Ax * Cy - Ay * Cx;
+    float W = Bx * Ay - By * Ax;
+    // 辺の上ではfloatの誤差で符号が決まらないのでdoubleで計算し直す
+    if (U == 0.0f || V == 0.0f || W == 0.0f) {
+        U = (float)((double)Cx * (double)By - (double)Cy * (double)Bx);
+        V = (float)((double)Ax * (double)Cy - (double)Ay * (double)Cx);
+        W = (float)((double)Bx * (double)Ay - (double)By * (double)Ax);
+    }
+
+    // 正ならレイがcross(v1-v0, v2-v0)と向かい合う面（表）に当たっている
+    if (backCulling) {
+        if (U < 0.0f || V < 0.0f || W < 0.0f) return false;
+    }
+    else if ((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f)) {
+        return false;
+    }
+    float det = U + V + W;
+    if (det == 0.0f) return false;
+
+    float Az = ray.Sz * A[kz];
+    float Bz = ray.Sz * B[kz];
+    float Cz = ray.Sz * C[kz];
+    float T = U * Az + V * Bz + W * Cz;
+
+    // 除算の前にdetの符号をそろえて区間の判定をする
+    float signedT = det < 0.0f ? -T : T;
+    float absDet = fabsf(det);
+    if (signedT <= t_min * absDet || signedT >= t_max * absDet) return false;
+
+    float rcpDet = 1.0f / det;
+    t = T * rcpDet;
+    u = V * rcpDet;
+    v = W * rcpDet;
+    return true;
+}
@@ -2,10 +2,9 @@
 
 StopWatch::StopWatch(void)
 {
-    LARGE_INTEGER LFreq;
-
-    QueryPerformanceFrequency(&LFreq);
-    FFreq = LFreq.HighPart * 4294967296.0 + LFreq.LowPart;
+    typedef std::chrono::steady_clock::period Period;
+    FFreq = double(Period::den) / double(Period::num);
+    FTime = 0;
 }
 
 void StopWatch::Reset(void)
@@ -15,15 +14,11 @@ void StopWatch::Reset(void)
 
 void StopWatch::Start(void)
 {
-    QueryPerformanceCounter(&StartTime);
+    StartTime = std::chrono::steady_clock::now();
 }
 
 void StopWatch::Stop(void)
 {
-    double start, end;
-
-    QueryPerformanceCounter(&EndTime);
-    end   = EndTime.  HighPart * 4294967296.0 + EndTime.  LowPart;
-    start = StartTime.HighPart * 4294967296.0 + StartTime.LowPart;
-    FTime += (end - start) / FFreq;
+    EndTime = std::chrono::steady_clock::now();
+    FTime += std::chrono::duration<double>(EndTime - StartTime).count();
 }
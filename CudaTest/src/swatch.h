@@ -1,10 +1,10 @@
 #pragma once
-#include <windows.h>
+#include <chrono>
 
 class StopWatch
 {
 private:
-        LARGE_INTEGER StartTime, EndTime;
+        std::chrono::steady_clock::time_point StartTime, EndTime;
         double FFreq;
         double FTime;
 public: